@@ -2,8 +2,11 @@
 #include <vector>
 #include <algorithm>
 #include <set>
-#include <mpi.h> 
-#include <unistd.h>
+#include <string>
+#include "codec.h"
+#include "comm.h"
+#include "tree_io.h"
+#include "event_log.h"
 
 using namespace std;
 
@@ -16,7 +19,35 @@ const int PROCEED_TAG = 14;
 const int TERMINATE_TAG = 15;
 
 const int ROOT_RANK = 0;
-const int MAX_CHILDREN = 100;
+
+enum {
+    EV_STARTED, EV_ROOT_START, EV_SENT_LEVEL_COMPLETE, EV_LEVEL_DONE, EV_TREE_DONE, EV_SENT_EXPLORE,
+    EV_NO_NEIGHBORS, EV_FORWARD_PROCEED, EV_EXPLORE, EV_PARENT, EV_SENT_ACCEPT, EV_REJECT, EV_ACCEPT,
+    EV_RECV_REJECT, EV_PROCEED, EV_LEVEL_COMPLETE, EV_TERMINATE
+};
+const EventKind ASYNC_BFS_EVENTS[] = {
+    {"started", "Starting BFS tree algorithm with {} neighbors."},
+    {"root_start", "ROOT: Initiating BFS construction."},
+    {"sent_level_complete", "Sent LEVEL_COMPLETE({}, {} discovered) to parent {}"},
+    {"level_done", "ROOT: Level {} COMPLETE! {} nodes at level {}"},
+    {"tree_done", "ROOT: BFS TREE CONSTRUCTION COMPLETE!"},
+    {"sent_explore", "Sent EXPLORE({}) to neighbor {}"},
+    {"no_neighbors", "No neighbors to explore"},
+    {"forward_proceed", "Forwarded PROCEED({}) to child {}"},
+    {"explore", "Received EXPLORE({}, {})"},
+    {"parent", "Set parent to {}, level to {}"},
+    {"sent_accept", "Sent ACCEPT({}) to parent {}"},
+    {"reject", "Rejected EXPLORE from {} (already have parent)"},
+    {"accept", "Received ACCEPT({}, {})"},
+    {"recv_reject", "Received REJECT from {}"},
+    {"proceed", "Received PROCEED_NEXT_LEVEL({})"},
+    {"level_complete", "Received LEVEL_COMPLETE({}, {}, {} discovered)"},
+    {"terminate", "Received TERMINATE"},
+};
+
+// Size of the old fixed LevelCompleteMessage (3 ints + int children[100]),
+// kept to report how much the compact encoding saves.
+const int FIXED_LEVEL_COMPLETE_BYTES = (3 + 100) * sizeof(int);
 
 // Message structures
 struct ExploreMessage {
@@ -33,380 +64,406 @@ struct RejectMessage {
     int sender_id;
 };
 
+// Convergecast report for round sender_level: children lists the ranks the
+// sender's subtree discovered at level sender_level + 1. Sent with the codec.h
+// encoding (varint fields, delta-encoded rank list), so its size grows with
+// the list instead of being fixed.
 struct LevelCompleteMessage {
     int sender_id;
     int sender_level;
-    int num_children;
-    int children[MAX_CHILDREN];
+    vector<int> children;
 };
 
+void encode_level_complete(const LevelCompleteMessage& msg, vector<uint8_t>& out) {
+    WireWriter writer(out);
+    writer.put_int(msg.sender_id);
+    writer.put_int(msg.sender_level);
+    writer.put_id_list(msg.children);
+}
+
+bool decode_level_complete(const vector<uint8_t>& buf, LevelCompleteMessage& msg) {
+    WireReader reader(buf);
+    msg.sender_id = reader.get_int();
+    msg.sender_level = reader.get_int();
+    msg.children = reader.get_id_list<int>();
+    return reader.ok() && reader.at_end();
+}
+
 struct ProceedMessage {
     int level;
 };
 
-// Graph topology
-vector<vector<int>> get_graph_topology(int world_size) {
+// Graph topology: a fixed graph for 4 ranks, otherwise a line. Only this
+// rank's neighbours are built, so a virtual run (comm.h) stays linear in
+// memory however many ranks it has.
+vector<int> get_graph_neighbors(int world_size, int rank) {
     if (world_size == 4) {
-        return {
+        const vector<vector<int>> square = {
             {1, 3},
             {0, 2},
             {3, 1},
             {0, 2}
             
         };
+        return square[rank];
     }
-    if (world_size > 1) {
-        vector<vector<int>> adj(world_size);
-        for (int i = 0; i < world_size; ++i) {
-            if (i > 0) adj[i].push_back(i - 1);
-            if (i < world_size - 1) adj[i].push_back(i + 1);
-        }
-        return adj;
+    vector<int> neighbors;
+    if (rank > 0) neighbors.push_back(rank - 1);
+    if (rank < world_size - 1) neighbors.push_back(rank + 1);
+    return neighbors;
+}
+
+// Rank 1 is a hub adjacent to every other rank, for exercising reports with
+// far more children than the old fixed message could hold.
+vector<int> get_hub_neighbors(int world_size, int rank) {
+    vector<int> neighbors;
+    if (rank != 1) {
+        neighbors.push_back(1);
+        return neighbors;
     }
-    return vector<vector<int>>(world_size);
+    for (int i = 0; i < world_size; ++i) {
+        if (i != 1) neighbors.push_back(i);
+    }
+    return neighbors;
 }
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+// Node state. Level synchronisation is a convergecast over the tree being
+// built: PROCEED(L) travels down the tree to the level-L frontier, every node
+// waits for the LEVEL_COMPLETE of the children it forwarded to and sends a
+// single aggregated report to its parent, so no rank handles more messages
+// than its degree.
+struct BfsNode {
+    Comm* comm;
+    EventLog* events;
+    int rank;
+    vector<int> neighbors;
+    int parent = -2;                 // -1 for root, -2 for unassigned
+    int level = -1;                  // -1 for unassigned
+    vector<int> children;
+    set<int> pending_neighbors;
+
+    int round_level = -1;            // level explored in the current round
+    int reports_pending = 0;         // children that still owe a LEVEL_COMPLETE
+    vector<int> round_discovered;    // ranks found at round_level + 1 in this subtree
+    set<int> active_children;        // children whose subtree still has a frontier
+
+    // Root only
+    vector<set<int>> nodes_at_level;
+    bool running = true;
+
+    vector<uint8_t> send_buf;
+    BufferPool recv_pool;
+    long long level_complete_sent = 0;
+    long long level_complete_bytes = 0;
+};
+
+void start_round(BfsNode& node, int round);
+
+void send_terminate(BfsNode& node) {
+    for (int child : node.children) {
+        node.comm->send(NULL, 0, child, TERMINATE_TAG);
+    }
+    node.running = false;
+}
+
+// Called once this node's whole subtree has finished the current round.
+void report_round(BfsNode& node) {
+    int round = node.round_level;
+
+    if (node.rank != ROOT_RANK) {
+        LevelCompleteMessage lc_msg = {node.rank, round, node.round_discovered};
+        node.send_buf.clear();
+        encode_level_complete(lc_msg, node.send_buf);
+
+        send_encoded(node.send_buf, node.parent, LEVEL_COMPLETE_TAG, *node.comm);
+        node.level_complete_sent++;
+        node.level_complete_bytes += node.send_buf.size();
+        LOG_EVENT(*node.events, LOG_INFO, EV_SENT_LEVEL_COMPLETE, round, node.round_discovered.size(),
+                  node.parent);
+        return;
+    }
+
+    // Root: the whole tree has reported for this round.
+    for (int rank : node.round_discovered) {
+        node.nodes_at_level[round + 1].insert(rank);
+    }
+    LOG_EVENT(*node.events, LOG_INFO, EV_LEVEL_DONE, round, node.round_discovered.size(), round + 1);
+
+    if (!node.round_discovered.empty()) {
+        start_round(node, round + 1);
+    } else {
+        LOG_EVENT(*node.events, LOG_INFO, EV_TREE_DONE);
+        send_terminate(node);
+    }
+}
+
+// This node is on the frontier and all its EXPLOREs have been answered.
+void finish_exploration(BfsNode& node) {
+    node.round_discovered = node.children;
+    node.active_children.insert(node.children.begin(), node.children.end());
+    report_round(node);
+}
+
+// PROCEED(round) reached this node (the root starts every round itself).
+void start_round(BfsNode& node, int round) {
+    node.round_level = round;
+    node.round_discovered.clear();
+
+    if (node.level == round) {
+        // Frontier: EXPLORE all neighbours except the parent.
+        ExploreMessage explore_msg = {node.rank, node.level};
+        for (int neighbor : node.neighbors) {
+            if (neighbor != node.parent) {
+                node.comm->send(&explore_msg, sizeof(ExploreMessage), neighbor, EXPLORE_TAG);
+                node.pending_neighbors.insert(neighbor);
+                LOG_EVENT(*node.events, LOG_INFO, EV_SENT_EXPLORE, node.level, neighbor);
+            }
+        }
+        if (node.pending_neighbors.empty()) {
+            LOG_EVENT(*node.events, LOG_INFO, EV_NO_NEIGHBORS);
+            finish_exploration(node);
+        }
+        return;
+    }
+
+    // Interior: pass PROCEED on to the children that still have a frontier
+    // below them and wait for their reports.
+    ProceedMessage proceed_msg = {round};
+    node.reports_pending = node.active_children.size();
+    for (int child : node.active_children) {
+        node.comm->send(&proceed_msg, sizeof(ProceedMessage), child, PROCEED_TAG);
+        LOG_EVENT(*node.events, LOG_INFO, EV_FORWARD_PROCEED, round, child);
+    }
+    if (node.reports_pending == 0) {
+        report_round(node);
+    }
+}
 
-    int world_rank, world_size;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+int run(Comm& comm, int argc, char** argv) {
+    int world_rank = comm.rank();
+    int world_size = comm.size();
 
     if (world_size < 2) {
         if (world_rank == 0) {
             cerr << "Need at least 2 processes for this simulation." << endl;
         }
-        MPI_Finalize();
         return 0;
     }
+    EventLog events(comm, argc, argv, ASYNC_BFS_EVENTS);
 
-    // Get topology
-    const vector<vector<int>> adjacency_list = get_graph_topology(world_size);
-    const vector<int>& neighbors = adjacency_list[world_rank];
-
-    // Node state
-    int parent = -2; // -1 for root, -2 for unassigned
-    int level = -1;  // -1 for unassigned
-    vector<int> children;
-    set<int> pending_neighbors;
-    bool explored = false;
-    bool received_proceed = false;
+    // Get topology ("hub" selects the high-degree test topology)
+    bool hub = (argc > 1 && string(argv[1]) == "hub");
 
-    // Root-specific state
-    vector<set<int>> nodes_at_level;
-    vector<int> completed_at_level;
+    BfsNode node;
+    node.comm = &comm;
+    node.events = &events;
+    node.rank = world_rank;
+    node.neighbors = hub ? get_hub_neighbors(world_size, world_rank) : get_graph_neighbors(world_size, world_rank);
     if (world_rank == ROOT_RANK) {
-        nodes_at_level.resize(world_size);
-        completed_at_level.resize(world_size, 0);
-        nodes_at_level[0].insert(ROOT_RANK);
-        parent = -1;
-        level = 0;
+        node.nodes_at_level.resize(world_size + 1);
+        node.nodes_at_level[0].insert(ROOT_RANK);
+        node.parent = -1;
+        node.level = 0;
     }
 
-    cout << "Rank " << world_rank << ": Starting BFS tree algorithm with " 
-         << neighbors.size() << " neighbors." << endl;
+    LOG_EVENT(events, LOG_INFO, EV_STARTED, node.neighbors.size());
 
     // ==================== ROOT INITIALIZATION ====================
     if (world_rank == ROOT_RANK) {
-        cout << "\n=== ROOT " << world_rank << ": Initiating BFS construction ===" << endl;
-        
-        // Send EXPLORE to all neighbors
-        ExploreMessage explore_msg = {ROOT_RANK, 0};
-        for (int neighbor : neighbors) {
-            MPI_Send(&explore_msg, sizeof(ExploreMessage), MPI_BYTE, 
-                    neighbor, EXPLORE_TAG, MPI_COMM_WORLD);
-            pending_neighbors.insert(neighbor);
-            cout << "ROOT: Sent EXPLORE(0, 0) to neighbor " << neighbor << endl;
-        }
-
-        if (pending_neighbors.empty()) {
-            explored = true;
-            cout << "ROOT: No neighbors, sending LEVEL_COMPLETE to self" << endl;
-        }
+        LOG_EVENT(events, LOG_INFO, EV_ROOT_START);
+        start_round(node, 0);
     }
 
     //  MAIN MESSAGE LOOP
-    bool algorithm_running = true;
-    MPI_Status status;
+    CommStatus status;
 
-    while (algorithm_running) {
-        usleep(50000); // 50ms polling interval
+    while (node.running) {
+        comm.probe(COMM_ANY_SOURCE, COMM_ANY_TAG, &status);
 
-        int flag;
-        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        int tag = status.tag;
+        int source = status.source;
 
-        if (!flag) continue;
-
-        int tag = status.MPI_TAG;
-        int source = status.MPI_SOURCE;
-
-        // HANDLE EXPLORE 
+        // HANDLE EXPLORE
         if (tag == EXPLORE_TAG) {
             ExploreMessage msg;
-            MPI_Recv(&msg, sizeof(ExploreMessage), MPI_BYTE, source, 
-                    EXPLORE_TAG, MPI_COMM_WORLD, &status);
-            
-            cout << "Rank " << world_rank << ": Received EXPLORE(" 
-                 << msg.sender_id << ", " << msg.sender_level << ")" << endl;
+            comm.recv(&msg, sizeof(ExploreMessage), source, EXPLORE_TAG);
 
-            if (world_rank == ROOT_RANK) {
-                // Root rejects all EXPLORE
-                RejectMessage reject_msg = {world_rank};
-                MPI_Send(&reject_msg, sizeof(RejectMessage), MPI_BYTE, 
-                        source, REJECT_TAG, MPI_COMM_WORLD);
-                cout << "ROOT: Rejected EXPLORE from " << source << endl;
-            }
-            else if (parent == -2) {
+            LOG_EVENT(events, LOG_INFO, EV_EXPLORE, msg.sender_id, msg.sender_level);
+
+            if (node.parent == -2) {
                 // First EXPLORE - set parent
-                parent = msg.sender_id;
-                level = msg.sender_level + 1;
-                
-                cout << "Rank " << world_rank << ": **Set parent to " << parent 
-                     << ", level to " << level << "**" << endl;
+                node.parent = msg.sender_id;
+                node.level = msg.sender_level + 1;
+
+                LOG_EVENT(events, LOG_INFO, EV_PARENT, node.parent, node.level);
 
                 // Send ACCEPT to parent
-                AcceptMessage accept_msg = {world_rank, level};
-                MPI_Send(&accept_msg, sizeof(AcceptMessage), MPI_BYTE, 
-                        parent, ACCEPT_TAG, MPI_COMM_WORLD);
-                cout << "Rank " << world_rank << ": Sent ACCEPT(" << world_rank 
-                     << ", " << level << ") to parent " << parent << endl;
+                AcceptMessage accept_msg = {world_rank, node.level};
+                comm.send(&accept_msg, sizeof(AcceptMessage), node.parent, ACCEPT_TAG);
+                LOG_EVENT(events, LOG_INFO, EV_SENT_ACCEPT, node.level, node.parent);
             }
             else {
-                // Already have parent - reject
+                // Root or already have parent - reject
                 RejectMessage reject_msg = {world_rank};
-                MPI_Send(&reject_msg, sizeof(RejectMessage), MPI_BYTE, 
-                        source, REJECT_TAG, MPI_COMM_WORLD);
-                cout << "Rank " << world_rank << ": Rejected EXPLORE from " 
-                     << source << " (already have parent)" << endl;
+                comm.send(&reject_msg, sizeof(RejectMessage), source, REJECT_TAG);
+                LOG_EVENT(events, LOG_INFO, EV_REJECT, source);
             }
         }
 
-        // HANDLE ACCEPT 
+        // HANDLE ACCEPT
         else if (tag == ACCEPT_TAG) {
             AcceptMessage msg;
-            MPI_Recv(&msg, sizeof(AcceptMessage), MPI_BYTE, source, 
-                    ACCEPT_TAG, MPI_COMM_WORLD, &status);
-            
-            cout << "Rank " << world_rank << ": Received ACCEPT(" 
-                 << msg.sender_id << ", " << msg.sender_level << ")" << endl;
+            comm.recv(&msg, sizeof(AcceptMessage), source, ACCEPT_TAG);
 
-            children.push_back(msg.sender_id);
-            pending_neighbors.erase(msg.sender_id);
+            LOG_EVENT(events, LOG_INFO, EV_ACCEPT, msg.sender_id, msg.sender_level);
 
-            // Root updates nodes_at_level
-            if (world_rank == ROOT_RANK) {
-                nodes_at_level[msg.sender_level].insert(msg.sender_id);
-                cout << "ROOT: Added node " << msg.sender_id << " to level " 
-                     << msg.sender_level << endl;
-            }
+            node.children.push_back(msg.sender_id);
+            node.pending_neighbors.erase(msg.sender_id);
 
-            // Check if exploration complete
-            if (pending_neighbors.empty() ) {
-                explored = true;
-                
-                // Send LEVEL_COMPLETE
-                LevelCompleteMessage lc_msg;
-                lc_msg.sender_id = world_rank;
-                lc_msg.sender_level = level;
-                lc_msg.num_children = children.size();
-                for (size_t i = 0; i < children.size(); ++i) {
-                    lc_msg.children[i] = children[i];
-                }
-                
-                MPI_Send(&lc_msg, sizeof(LevelCompleteMessage), MPI_BYTE, 
-                        ROOT_RANK, LEVEL_COMPLETE_TAG, MPI_COMM_WORLD);
-                cout << "Rank " << world_rank << ": Sent LEVEL_COMPLETE(" 
-                     << world_rank << ", " << level << ", " << children.size() 
-                     << " children) to ROOT" << endl;
+            if (node.pending_neighbors.empty()) {
+                finish_exploration(node);
             }
         }
 
-        //  HANDLE REJECT 
+        //  HANDLE REJECT
         else if (tag == REJECT_TAG) {
             RejectMessage msg;
-            MPI_Recv(&msg, sizeof(RejectMessage), MPI_BYTE, source, 
-                    REJECT_TAG, MPI_COMM_WORLD, &status);
-            
-            cout << "Rank " << world_rank << ": Received REJECT from " 
-                 << msg.sender_id << endl;
-
-            pending_neighbors.erase(msg.sender_id);
-
-            // Check if exploration complete
-            if (pending_neighbors.empty() ) {
-                explored = true;
-                
-                // Send LEVEL_COMPLETE
-                LevelCompleteMessage lc_msg;
-                lc_msg.sender_id = world_rank;
-                lc_msg.sender_level = level;
-                lc_msg.num_children = children.size();
-                for (size_t i = 0; i < children.size(); ++i) {
-                    lc_msg.children[i] = children[i];
-                }
-                
-                MPI_Send(&lc_msg, sizeof(LevelCompleteMessage), MPI_BYTE, 
-                        ROOT_RANK, LEVEL_COMPLETE_TAG, MPI_COMM_WORLD);
-                cout << "Rank " << world_rank << ": Sent LEVEL_COMPLETE(" 
-                     << world_rank << ", " << level << ", " << children.size() 
-                     << " children) to ROOT" << endl;
+            comm.recv(&msg, sizeof(RejectMessage), source, REJECT_TAG);
+
+            LOG_EVENT(events, LOG_INFO, EV_RECV_REJECT, msg.sender_id);
+
+            node.pending_neighbors.erase(msg.sender_id);
+
+            if (node.pending_neighbors.empty()) {
+                finish_exploration(node);
             }
         }
 
-        //  HANDLE PROCEED 
+        //  HANDLE PROCEED (from parent)
         else if (tag == PROCEED_TAG) {
             ProceedMessage msg;
-            MPI_Recv(&msg, sizeof(ProceedMessage), MPI_BYTE, source, 
-                    PROCEED_TAG, MPI_COMM_WORLD, &status);
-            
-            cout << "Rank " << world_rank << ": Received PROCEED_NEXT_LEVEL(" 
-                 << msg.level << ")" << endl;
-
-            received_proceed = true;
-
-            // Send EXPLORE to all neighbors except parent
-            ExploreMessage explore_msg = {world_rank, level};
-            for (int neighbor : neighbors) {
-                if (neighbor != parent) {
-                    MPI_Send(&explore_msg, sizeof(ExploreMessage), MPI_BYTE, 
-                            neighbor, EXPLORE_TAG, MPI_COMM_WORLD);
-                    pending_neighbors.insert(neighbor);
-                    cout << "Rank " << world_rank << ": Sent EXPLORE(" 
-                         << world_rank << ", " << level << ") to neighbor " 
-                         << neighbor << endl;
-                }
-            }
+            comm.recv(&msg, sizeof(ProceedMessage), source, PROCEED_TAG);
 
-            // Check if no neighbors to explore
-            if (pending_neighbors.empty()) {
-                explored = true;
-                
-                // Send LEVEL_COMPLETE
-                LevelCompleteMessage lc_msg;
-                lc_msg.sender_id = world_rank;
-                lc_msg.sender_level = level;
-                lc_msg.num_children = 0;
-                
-                MPI_Send(&lc_msg, sizeof(LevelCompleteMessage), MPI_BYTE, 
-                        ROOT_RANK, LEVEL_COMPLETE_TAG, MPI_COMM_WORLD);
-                cout << "Rank " << world_rank 
-                     << ": No neighbors to explore, sent LEVEL_COMPLETE to ROOT" 
-                     << endl;
-            }
+            LOG_EVENT(events, LOG_INFO, EV_PROCEED, msg.level);
+
+            start_round(node, msg.level);
         }
 
-        //  HANDLE LEVEL_COMPLETE (ROOT ONLY) 
-        else if (tag == LEVEL_COMPLETE_TAG && world_rank == ROOT_RANK) {
+        //  HANDLE LEVEL_COMPLETE (from a child)
+        else if (tag == LEVEL_COMPLETE_TAG) {
+            vector<uint8_t> buf = recv_encoded(node.recv_pool, source,
+                    LEVEL_COMPLETE_TAG, comm, &status);
             LevelCompleteMessage msg;
-            MPI_Recv(&msg, sizeof(LevelCompleteMessage), MPI_BYTE, source, 
-                    LEVEL_COMPLETE_TAG, MPI_COMM_WORLD, &status);
-            
-            cout << "\nROOT: Received LEVEL_COMPLETE(" << msg.sender_id 
-                 << ", " << msg.sender_level << ", " << msg.num_children 
-                 << " children)" << endl;
-
-            // Add children to next level
-            for (int i = 0; i < msg.num_children; ++i) {
-                int child = msg.children[i];
-                nodes_at_level[msg.sender_level + 1].insert(child);
-                cout << "ROOT: Added node " << child << " to level " 
-                     << (msg.sender_level + 1) << endl;
+            bool decoded = decode_level_complete(buf, msg);
+            node.recv_pool.release(move(buf));
+            if (!decoded) {
+                cerr << "Rank " << world_rank << ": Malformed LEVEL_COMPLETE from "
+                     << source << endl;
+                comm.abort(1);
             }
 
-            // Increment completion count
-            completed_at_level[msg.sender_level]++;
-            
-            cout << "ROOT: Level " << msg.sender_level << " completion: " 
-                 << completed_at_level[msg.sender_level] << "/" 
-                 << nodes_at_level[msg.sender_level].size() << endl;
-
-            // check if level complete
-            if (completed_at_level[msg.sender_level] == 
-                (int)nodes_at_level[msg.sender_level].size()) {
-                
-                cout << "\n ROOT: Level " << msg.sender_level 
-                     << " COMPLETE! " << endl;
-
-                int next_level = msg.sender_level + 1;
-                
-                if (!nodes_at_level[next_level].empty()) {
-                    //  send proced to nect level
-                    cout << "ROOT: Sending PROCEED(" << next_level 
-                         << ") to " << nodes_at_level[next_level].size() 
-                         << " nodes" << endl;
-                    
-                    ProceedMessage proceed_msg = {next_level};
-                    for (int node : nodes_at_level[next_level]) {
-                        MPI_Send(&proceed_msg, sizeof(ProceedMessage), MPI_BYTE, 
-                                node, PROCEED_TAG, MPI_COMM_WORLD);
-                        cout << "ROOT: Sent PROCEED to node " << node << endl;
-                    }
-                } else {
-                    
-                    cout << "\n*** ROOT: BFS TREE CONSTRUCTION COMPLETE! ***\n" 
-                         << endl;
-                    
-                    // sending termination to all
-                    for (int i = 1; i < world_size; ++i) {
-                        MPI_Send(NULL, 0, MPI_BYTE, i, TERMINATE_TAG, 
-                                MPI_COMM_WORLD);
-                    }
-                    algorithm_running = false;
-                }
+            LOG_EVENT(events, LOG_INFO, EV_LEVEL_COMPLETE, msg.sender_id, msg.sender_level,
+                      msg.children.size());
+
+            // A subtree that found nothing this round has no frontier left.
+            if (msg.children.empty()) {
+                node.active_children.erase(msg.sender_id);
+            }
+            node.round_discovered.insert(node.round_discovered.end(),
+                                         msg.children.begin(), msg.children.end());
+
+            if (--node.reports_pending == 0) {
+                report_round(node);
             }
         }
 
-     
         else if (tag == TERMINATE_TAG) {
-            MPI_Recv(NULL, 0, MPI_BYTE, ROOT_RANK, TERMINATE_TAG, 
-                    MPI_COMM_WORLD, &status);
-            cout << "Rank " << world_rank << ": Received TERMINATE" << endl;
-            algorithm_running = false;
+            comm.recv(NULL, 0, source, TERMINATE_TAG);
+            LOG_EVENT(events, LOG_INFO, EV_TERMINATE);
+            send_terminate(node);
         }
     }
 
+    comm.barrier();
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    long long totals[2] = {0, 0};
+    long long local_totals[2] = {node.level_complete_sent, node.level_complete_bytes};
+    comm.reduce(local_totals, totals, 2, COMM_SUM, ROOT_RANK);
 
   
-    cout << "\n========================================" << endl;
-    cout << "Rank " << world_rank << " - FINAL BFS TREE RESULT" << endl;
-    cout << "========================================" << endl;
-    cout << "Level: " << level << endl;
-    cout << "Parent: " << (parent == -1 ? "ROOT" : to_string(parent)) << endl;
-    cout << "Children (" << children.size() << "): ";
-    if (children.empty()) {
-        cout << "None";
-    } else {
-        for (size_t i = 0; i < children.size(); ++i) {
-            cout << children[i];
-            if (i < children.size() - 1) cout << ", ";
+    // With --out the tree goes to a binary file (tree_io.h) instead of stdout.
+    const char* out_path = tree_output_path(argc, argv);
+    if (out_path == NULL) {
+        cout << "\n========================================" << endl;
+        cout << "Rank " << world_rank << " - FINAL BFS TREE RESULT" << endl;
+        cout << "========================================" << endl;
+        cout << "Level: " << node.level << endl;
+        cout << "Parent: " << (node.parent == -1 ? "ROOT" : to_string(node.parent)) << endl;
+        cout << "Children (" << node.children.size() << "): ";
+        if (node.children.empty()) {
+            cout << "None";
+        } else {
+            for (size_t i = 0; i < node.children.size(); ++i) {
+                cout << node.children[i];
+                if (i < node.children.size() - 1) cout << ", ";
+            }
         }
+        cout << endl;
+        cout << "========================================\n" << endl;
     }
-    cout << endl;
-    cout << "========================================\n" << endl;
 
-    // Root prints complete tree structure
+    // Root prints complete tree structure and the LEVEL_COMPLETE traffic
     if (world_rank == ROOT_RANK) {
-        cout << "\n=======================================" << endl;
-        cout << "ROOT: COMPLETE BFS TREE STRUCTURE" << endl;
-        cout << "=======================================" << endl;
-        for (size_t l = 0; l < nodes_at_level.size(); ++l) {
-            if (!nodes_at_level[l].empty()) {
-                cout << "Level " << l << ": { ";
-                bool first = true;
-                for (int node : nodes_at_level[l]) {
-                    if (!first) cout << ", ";
-                    cout << node;
-                    first = false;
+        if (out_path == NULL) {
+            cout << "\n=======================================" << endl;
+            cout << "ROOT: COMPLETE BFS TREE STRUCTURE" << endl;
+            cout << "=======================================" << endl;
+            for (size_t l = 0; l < node.nodes_at_level.size(); ++l) {
+                if (!node.nodes_at_level[l].empty()) {
+                    cout << "Level " << l << ": { ";
+                    bool first = true;
+                    for (int rank : node.nodes_at_level[l]) {
+                        if (!first) cout << ", ";
+                        cout << rank;
+                        first = false;
+                    }
+                    cout << " }" << endl;
                 }
-                cout << " }" << endl;
+            }
+            cout << "=======================================" << endl;
+        }
+
+        long long fixed_bytes = totals[0] * FIXED_LEVEL_COMPLETE_BYTES;
+        cout << "LEVEL_COMPLETE traffic: " << totals[0] << " messages, " << totals[1]
+             << " bytes (fixed struct: " << fixed_bytes << " bytes";
+        if (totals[1] > 0) cout << ", " << (double)fixed_bytes / totals[1] << "x smaller";
+        cout << ")" << endl;
+    }
+
+    // Export the BFS tree as a TreeComm; a reduce over it reports the tree
+    // size and height at the root.
+    // TreeComm and the MPI-IO writer need real MPI ranks.
+    if (comm.mpi_comm() != MPI_COMM_NULL) {
+        TreeComm tree(comm.mpi_comm(), node.parent, node.children);
+        int counts[2] = {1, tree.depth()}, tree_totals[2];
+        tree.reduce(&counts[0], &tree_totals[0], 1, MPI_INT, MPI_SUM);
+        tree.reduce(&counts[1], &tree_totals[1], 1, MPI_INT, MPI_MAX);
+        if (world_rank == ROOT_RANK) {
+            cout << "Tree communicator: " << tree_totals[0] << " ranks, height " << tree_totals[1] << endl;
+        }
+        if (out_path != NULL) {
+            double start = comm.now();
+            bool written = write_rank_tree_file(out_path, tree, comm.mpi_comm());
+            if (world_rank == ROOT_RANK) {
+                cout << (written ? "Tree written to " : "Could not write ") << out_path << " in "
+                     << comm.now() - start << " s" << endl;
             }
         }
-        cout << "=======================================" << endl;
     }
 
-    MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
@@ -1,30 +1,29 @@
 #include <iostream>
 #include <vector>
-#include <mpi.h>
-#include <unistd.h> 
+#include "comm.h"
+#include "event_log.h"
 
 using namespace std;
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+enum { EV_STARTED, EV_RECEIVED };
+const EventKind BCAST_EVENTS[] = {
+    {"started", "started."},
+    {"received", "Received ID {} from Rank {}"},
+};
 
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+int run(Comm& comm, int argc, char** argv) {
+    int world_rank = comm.rank();
+    int world_size = comm.size();
 
     if (world_size == 1) {
         cout << "Need more than one process for broadcast simulation." << endl;
-        MPI_Finalize();
         return 0;
     }
-
-    int received_id;
-    
+    EventLog events(comm, argc, argv, BCAST_EVENTS);
 
     vector<int> all_ids(world_size);
 
-    cout << "Rank " << world_rank << " started." << endl;
+    LOG_EVENT(events, LOG_INFO, EV_STARTED);
 
   
     for (int root_rank = 0; root_rank < world_size; ++root_rank) {
@@ -37,13 +36,13 @@ int main(int argc, char** argv) {
             broadcast_data = world_rank;
         }
         
-        MPI_Bcast(&broadcast_data, 1,MPI_INT,root_rank, MPI_COMM_WORLD  );
+        comm.bcast(&broadcast_data, sizeof(int), root_rank);
         
       
         all_ids[root_rank] = broadcast_data;
 
-        cout << "Rank " << world_rank << ": Received ID " << broadcast_data << " from Rank " << root_rank << endl;
-        usleep(50000); 
+        LOG_EVENT(events, LOG_INFO, EV_RECEIVED, broadcast_data, root_rank);
+        comm.sleep_us(50000); 
     }
 
 
@@ -56,6 +55,9 @@ int main(int argc, char** argv) {
     }
     cout << "]" << endl;
 
-    MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
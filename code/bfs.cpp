@@ -1,8 +1,10 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
-#include <mpi.h>
-#include <unistd.h> 
+#include "comm.h"
+#include "coro.h"
+#include "tree_io.h"
+#include "event_log.h"
 
 using namespace std;
 
@@ -10,231 +12,247 @@ using namespace std;
 const int MC_PROPOSE_TAG = 10;
 const int MP_ACCEPT_TAG = 11;
 const int MR_REJECT_TAG = 12;
-const int MS_SYNC_TAG    = 13; 
-const int ROOT_RANK = 0; 
+const int MS_SYNC_TAG    = 13;
+const int ROOT_NODE = 0;
+
+enum {
+    EV_ROOT_START, EV_WAIT_PARENT, EV_PARENT, EV_ACCEPTED, EV_REJECTED, EV_SYNC, EV_REJECT_LATE, EV_PROPOSE,
+    EV_PROPOSALS_DONE, EV_COMPLETION, EV_START_CHILD, EV_CHILD_DONE, EV_FINISH
+};
+const EventKind BFS_EVENTS[] = {
+    {"root_start", "Node {}: (ROOT) initiating Level 0 proposals."},
+    {"wait_parent", "Node {}: waiting for first MC message to select parent."},
+    {"parent", "Node {}: first MC received from {}. Parent set to {}."},
+    {"accepted", "Node {}: accepted as parent by {} (MP). Resp left: {}"},
+    {"rejected", "Node {}: rejected by {} (MR). Resp left: {}"},
+    {"sync", "Node {}: received MS from parent {}. STARTING PROPOSALS."},
+    {"reject_late", "Node {}: rejected late MC proposal from {} (sent MR)."},
+    {"propose", "Node {}: sent MC to neighbor {}"},
+    {"proposals_done", "Node {}: finished proposals (Resp left: 0). Waiting for children to finish."},
+    {"completion", "Node {}: sent completion MP back to parent {}"},
+    {"start_child", "Node {}: sent MS to child {} to start its proposals."},
+    {"child_done", "Node {}: child {} finished. Children left: {}"},
+    {"finish", "Node {}: received final MS from parent {}."},
+};
 
 struct RSTMessage {
-    int sender_rank;
+    int sender;
+    int level;   // of the sender
+};
+
+// Where one node ended up in the tree; parent -1 for the root, -2 while
+// unreached.
+struct NodeResult {
+    int parent = -2;
+    int level = 0;
+    vector<int> children;
 };
 
-vector<vector<int>> get_graph_topology(int world_size) {
-    if (world_size == 4) {
-        return {
-            {1, 3},       
-            {0, 2},       
-            {1, 3},       
-            {0, 2}        
+// Neighbours of node: fixed graphs for 2 and 4 nodes, otherwise a line.
+// Only this node's list is built, so a run stays linear in memory however
+// many nodes it has.
+vector<int> get_neighbors(int num_nodes, int node) {
+    if (num_nodes == 4) {
+        const vector<vector<int>> square = {
+            {1, 3},
+            {0, 2},
+            {1, 3},
+            {0, 2}
         };
-    } 
-     if (world_size == 2) {
-       return {
-        {1},
-        {0}
-       };
+        return square[node];
     }
-    if (world_size > 1) {
-        vector<vector<int>> adj(world_size);
-        for (int i = 0; i < world_size; ++i) {
-            if (i > 0) adj[i].push_back(i - 1); 
-            if (i < world_size - 1) adj[i].push_back(i + 1); 
-        }
-        return adj;
+    if (num_nodes == 2) {
+        return {1 - node};
     }
-    return vector<vector<int>>(world_size); 
+    vector<int> neighbors;
+    if (node > 0) neighbors.push_back(node - 1);
+    if (node < num_nodes - 1) neighbors.push_back(node + 1);
+    return neighbors;
 }
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+// One node of the tree (coro.h). A node joins under the first proposal (MC)
+// it gets and accepts it (MP), waits for its parent's MS, proposes to its
+// other neighbours and collects their MP/MR answers, then starts its
+// children with MS. Completion MPs flow back up to the root, and a final MS
+// wave from the root ends the run; until then a node answers every late
+// proposal with MR, so no proposal is left waiting on a node that has
+// returned.
+NodeTask bfs_node(CoroNode& node, EventLog& events, NodeResult& result) {
+    const int self = node.id();
+    const vector<int> neighbors = get_neighbors(node.count(), self);
+    RSTMessage mine = {self, 0};
+    NodeMessage msg;
 
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    if (self == ROOT_NODE) {
+        LOG_EVENT(events, LOG_INFO, EV_ROOT_START, self);
+        result.parent = -1;
+    } else {
+        LOG_EVENT(events, LOG_INFO, EV_WAIT_PARENT, self);
+        msg = co_await node.recv(MC_PROPOSE_TAG);
+        result.parent = msg.source;
+        result.level = msg.as<RSTMessage>().level + 1;
+        mine.level = result.level;
+        LOG_EVENT(events, LOG_INFO, EV_PARENT, self, result.parent, result.parent);
+        co_await node.send(result.parent, MP_ACCEPT_TAG, mine);
 
-    if (world_size < 2) {
-        cerr << "at least 2 processes required" << endl;
-        MPI_Finalize();
-        return 0;
+        while (true) {
+            msg = co_await node.recv(COMM_ANY_TAG);
+            if (msg.tag == MS_SYNC_TAG && msg.source == result.parent) break;
+            if (msg.tag == MC_PROPOSE_TAG) {
+                co_await node.send(msg.source, MR_REJECT_TAG, mine);
+                LOG_EVENT(events, LOG_INFO, EV_REJECT_LATE, self, msg.source);
+            }
+        }
+        LOG_EVENT(events, LOG_INFO, EV_SYNC, self, result.parent);
     }
 
-    const vector<vector<int>> adjacency_list = get_graph_topology(world_size);
-    const vector<int>& neighbors = adjacency_list[world_rank];
-    const size_t num_neighbors = neighbors.size();
-
-    int parent_rank = (world_rank == ROOT_RANK) ? -1 : -2; 
-    vector<int> children;
-    
-    // flag: 
-    // 0 - not started
-    // 1- has parent
-    // 2- can send Ms
-    // 3- recived Ms
-    
-    int level_status = 0; 
-    
-    
-    size_t no_response_remaining = 0; 
-
-    
-    size_t child_response_count = 0;
-
-    RSTMessage received_msg;
-    MPI_Request recv_request;
-    MPI_Status recv_status;
-
-    
-    if (world_rank == ROOT_RANK) {
-        cout << "\nRank " << world_rank << " (ROOT) initiating Level 0 proposals." << endl;
-        RSTMessage send_mc_msg = {world_rank};
-        
-        for (int dest_rank : neighbors) {
-            MPI_Request send_request;
-            MPI_Isend(&send_mc_msg, sizeof(RSTMessage), MPI_BYTE, dest_rank, MC_PROPOSE_TAG, MPI_COMM_WORLD, &send_request);
-            MPI_Request_free(&send_request); 
+    size_t no_response_remaining = 0;
+    for (int dest : neighbors) {
+        if (dest == result.parent) continue;
+        co_await node.send(dest, MC_PROPOSE_TAG, mine);
+        LOG_EVENT(events, LOG_INFO, EV_PROPOSE, self, dest);
+        no_response_remaining++;
+    }
+    while (no_response_remaining > 0) {
+        msg = co_await node.recv(COMM_ANY_TAG);
+        if (msg.tag == MP_ACCEPT_TAG) {
+            result.children.push_back(msg.source);
+            no_response_remaining--;
+            LOG_EVENT(events, LOG_INFO, EV_ACCEPTED, self, msg.source, no_response_remaining);
+        } else if (msg.tag == MR_REJECT_TAG) {
+            no_response_remaining--;
+            LOG_EVENT(events, LOG_INFO, EV_REJECTED, self, msg.source, no_response_remaining);
+        } else if (msg.tag == MC_PROPOSE_TAG) {
+            co_await node.send(msg.source, MR_REJECT_TAG, mine);
+            LOG_EVENT(events, LOG_INFO, EV_REJECT_LATE, self, msg.source);
         }
-        no_response_remaining = num_neighbors;
-        level_status = 1; 
-        
-    } else {
-        cout << "Rank " << world_rank << ": Waiting for first MC message to select parent." << endl;
-        
-      
-        MPI_Recv(&received_msg, sizeof(RSTMessage), MPI_BYTE, MPI_ANY_SOURCE, MC_PROPOSE_TAG, MPI_COMM_WORLD, &recv_status);
-        
-        parent_rank = received_msg.sender_rank;
-        cout << "Rank " << world_rank << ": First MC received from " << parent_rank << ". Parent set to " << parent_rank << "." << endl;
-
-       
-        RSTMessage send_mp_msg = {world_rank};
-        MPI_Request send_request_mp;
-        MPI_Isend(&send_mp_msg, sizeof(RSTMessage), MPI_BYTE, parent_rank, MP_ACCEPT_TAG, MPI_COMM_WORLD, &send_request_mp);
-        MPI_Request_free(&send_request_mp);
-        
-        level_status = 0;
     }
+    LOG_EVENT(events, LOG_INFO, EV_PROPOSALS_DONE, self);
 
-
-    MPI_Irecv(&received_msg, sizeof(RSTMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &recv_request);
-
-
-    bool all_done = false;
-    while (!all_done) {
-        usleep(100000); 
-
-        int flag = 0;
-        MPI_Test(&recv_request, &flag, &recv_status);
-
-        if (flag) { 
-            int sender_rank = received_msg.sender_rank;
-            int received_tag = recv_status.MPI_TAG;
-        
-            
-            MPI_Irecv(&received_msg, sizeof(RSTMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &recv_request);
-            
-            
-            if (received_tag == MP_ACCEPT_TAG) {
-                if (level_status == 1) {
-                    children.push_back(sender_rank);
-                    no_response_remaining--;
-                    cout << "Rank " << world_rank << ": Accepted as parent by " << sender_rank << " (MP). Resp left: " << no_response_remaining << endl;
-                }
-            } 
-            else if (received_tag == MR_REJECT_TAG) {
-                if (level_status == 1) {
-                    no_response_remaining--;
-                    cout << "Rank " << world_rank << ": Rejected by " << sender_rank << " (MR). Resp left: " << no_response_remaining << endl;
-                }
-            }
-           
-            else if (received_tag == MS_SYNC_TAG) {
-                if (world_rank != ROOT_RANK && sender_rank == parent_rank) {
-                    level_status = 3; 
-                    cout << "Rank " << world_rank << ": Received MS from parent " << parent_rank << ". STARTING PROPOSALS." << endl;
-                }
-            }
-            
-            else if (received_tag == MC_PROPOSE_TAG) {
-                RSTMessage send_mr_msg = {world_rank};
-                
-                
-                if (parent_rank != -2) { 
-                    MPI_Request send_request;
-                    MPI_Isend(&send_mr_msg, sizeof(RSTMessage), MPI_BYTE, sender_rank, MR_REJECT_TAG, MPI_COMM_WORLD, &send_request);
-                    MPI_Request_free(&send_request);
-                    cout << "Rank " << world_rank << ": Rejected late MC proposal from " << sender_rank << " (sent MR)." << endl;
-                } 
-            }
+    for (int child : result.children) {
+        co_await node.send(child, MS_SYNC_TAG, mine);
+        LOG_EVENT(events, LOG_INFO, EV_START_CHILD, self, child);
+    }
+    size_t children_running = result.children.size();
+    while (children_running > 0) {
+        msg = co_await node.recv(COMM_ANY_TAG);
+        if (msg.tag == MP_ACCEPT_TAG) {
+            children_running--;
+            LOG_EVENT(events, LOG_INFO, EV_CHILD_DONE, self, msg.source, children_running);
+        } else if (msg.tag == MC_PROPOSE_TAG) {
+            co_await node.send(msg.source, MR_REJECT_TAG, mine);
+            LOG_EVENT(events, LOG_INFO, EV_REJECT_LATE, self, msg.source);
         }
-        
-     
-
-        // non root
-        if (level_status == 3) {
-            
-            RSTMessage send_mc_msg = {world_rank};
-            for (int dest_rank : neighbors) {
-                if (dest_rank != parent_rank) {
-                    MPI_Request send_request;
-                    MPI_Isend(&send_mc_msg, sizeof(RSTMessage), MPI_BYTE, dest_rank, MC_PROPOSE_TAG, MPI_COMM_WORLD, &send_request);
-                    MPI_Request_free(&send_request); 
-                    cout << "Rank " << world_rank << ": Sent MC to neighbor " << dest_rank << endl;
-                }
+    }
+
+    if (self != ROOT_NODE) {
+        co_await node.send(result.parent, MP_ACCEPT_TAG, mine);
+        LOG_EVENT(events, LOG_INFO, EV_COMPLETION, self, result.parent);
+        while (true) {
+            msg = co_await node.recv(COMM_ANY_TAG);
+            if (msg.tag == MS_SYNC_TAG && msg.source == result.parent) break;
+            if (msg.tag == MC_PROPOSE_TAG) {
+                co_await node.send(msg.source, MR_REJECT_TAG, mine);
+                LOG_EVENT(events, LOG_INFO, EV_REJECT_LATE, self, msg.source);
             }
-            no_response_remaining = num_neighbors - 1; 
-            child_response_count = children.size(); 
-            level_status = 1; 
-        }
-        
-        
-        if (level_status == 1 && no_response_remaining == 0) {
-            level_status = 2;
-            cout << "Rank " << world_rank << ": Finished proposals (Resp left: 0). Waiting for children to finish." << endl;
         }
+        LOG_EVENT(events, LOG_INFO, EV_FINISH, self, result.parent);
+    }
+    for (int child : result.children) co_await node.send(child, MS_SYNC_TAG, mine);
+}
 
-        
-        if (level_status == 2) {
-          
-            if (world_rank != ROOT_RANK) {
-                RSTMessage send_mp_msg = {world_rank};
-                MPI_Request send_request_mp;
-                MPI_Isend(&send_mp_msg, sizeof(RSTMessage), MPI_BYTE, parent_rank, MP_ACCEPT_TAG, MPI_COMM_WORLD, &send_request_mp);
-                MPI_Request_free(&send_request_mp);
-                cout << "Rank " << world_rank << ": Sent completion MP back to parent " << parent_rank << endl;
-            }
-            
-            
-            RSTMessage send_ms_msg = {world_rank};
-            for(int child_rank : children) {
-                MPI_Request send_request;
-                MPI_Isend(&send_ms_msg, sizeof(RSTMessage), MPI_BYTE, child_rank, MS_SYNC_TAG, MPI_COMM_WORLD, &send_request);
-                MPI_Request_free(&send_request);
-                cout << "Rank " << world_rank << ": Sent MS to child " << child_rank << " to start its proposals." << endl;
-            }
+// --nodes N spreads N tree nodes over the ranks (default one per rank).
+int run(Comm& comm, int argc, char** argv) {
+    int world_rank = comm.rank();
+    int num_nodes = coro_node_count(argc, argv, comm.size());
 
-            all_done = true;
-        }
+    if (num_nodes < 2) {
+        cerr << "at least 2 nodes required" << endl;
+        return 0;
+    }
+    EventLog events(comm, argc, argv, BFS_EVENTS);
 
-    } 
+    CoroExecutor executor(comm, num_nodes);
+    vector<CoroNode>& nodes = executor.local_nodes();
+    vector<NodeResult> results(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) executor.spawn(bfs_node(nodes[i], events, results[i]));
+    double start = comm.now();
+    executor.run();
+    double elapsed = comm.now() - start;
 
-    MPI_Cancel(&recv_request);
-    MPI_Status status;
-    MPI_Wait(&recv_request, &status);
-    MPI_Request_free(&recv_request);
+    comm.barrier();
 
-   
-    MPI_Barrier(MPI_COMM_WORLD); 
+    // With --out the tree goes to a binary file (tree_io.h) instead of stdout.
+    const char* out_path = tree_output_path(argc, argv);
+    if (out_path == NULL) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const NodeResult& r = results[i];
+            cout << "\n--- Node " << nodes[i].id() << " BFS Result ---" << endl;
+            cout << "Parent: " << ((r.parent == -1) ? "ROOT" : to_string(r.parent)) << endl;
+            cout << "Children (" << r.children.size() << "): ";
+            if (r.children.empty()) {
+                cout << "None" << endl;
+            } else {
+                for (int c : r.children) cout << c << " ";
+                cout << endl;
+            }
+            cout << "--------------------------------" << endl;
+        }
+    }
 
-    cout << "\n--- Rank " << world_rank << " BFS Result ---" << endl;
-    cout << "Parent: " << ((world_rank == ROOT_RANK) ? "ROOT" : to_string(parent_rank)) << endl;
-    cout << "Children (" << children.size() << "): ";
-    if (children.empty()) {
-        cout << "None" << endl;
-    } else {
-        for (int c : children) cout << c << " ";
-        cout << endl;
+    long long sums[5] = {0, executor.local_messages(), executor.remote_messages(), executor.frames_sent(),
+                         executor.rounds()};
+    long long height = 0, totals[5], max_height;
+    for (const NodeResult& r : results) {
+        if (r.parent == -2) continue;
+        sums[0]++;
+        height = max(height, (long long)r.level);
+    }
+    comm.allreduce(sums, totals, 5, COMM_SUM);
+    comm.allreduce(&height, &max_height, 1, COMM_MAX);
+    if (world_rank == 0) {
+        cout << "BFS tree: " << totals[0] << " of " << num_nodes << " nodes on " << comm.size()
+             << " ranks, height " << max_height << ", " << elapsed << " s" << endl;
+        cout << "Messages: " << totals[1] << " in memory, " << totals[2] << " between ranks in " << totals[3]
+             << " frames, " << totals[4] << " waits" << endl;
     }
-    cout << "--------------------------------" << endl;
-    
-    MPI_Finalize();
+
+    // TreeComm and the MPI-IO writer need real MPI ranks.
+    if (comm.mpi_comm() != MPI_COMM_NULL) {
+        // With one node per rank, hand the tree to TreeComm so later phases
+        // can run collectives over its edges; as a check, count its ranks
+        // and height.
+        if (num_nodes == comm.size()) {
+            TreeComm tree(comm.mpi_comm(), results[0].parent, results[0].children);
+            int counts[2] = {1, tree.depth()}, tree_totals[2];
+            tree.reduce(&counts[0], &tree_totals[0], 1, MPI_INT, MPI_SUM);
+            tree.reduce(&counts[1], &tree_totals[1], 1, MPI_INT, MPI_MAX);
+            if (world_rank == 0) {
+                cout << "Tree communicator: " << tree_totals[0] << " ranks, height " << tree_totals[1] << endl;
+            }
+        }
+        if (out_path != NULL) {
+            vector<int64_t> parents, levels;
+            vector<vector<int64_t>> children;
+            for (const NodeResult& r : results) {
+                bool reached = r.parent != -2;
+                parents.push_back(reached ? r.parent : -1);
+                levels.push_back(reached ? r.level : -1);
+                children.emplace_back(r.children.begin(), r.children.end());
+            }
+            double write_start = comm.now();
+            bool written = write_tree_file(out_path, num_nodes, executor.first_node(world_rank), parents, levels,
+                                           children, comm.mpi_comm());
+            if (world_rank == 0) {
+                cout << (written ? "Tree written to " : "Could not write ") << out_path << " in "
+                     << comm.now() - write_start << " s" << endl;
+            }
+        }
+    }
+
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
@@ -0,0 +1,1074 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <unordered_map>
+#include <queue>
+#include <list>
+#include <cmath>
+#include <climits>
+#include <mpi.h>
+#include "graph500.h"
+#include "codec.h"
+#include "work_pool.h"
+#include "tree_io.h"
+
+using namespace std;
+
+// Graph500-style benchmark for the BFS traversal.
+//
+// The graph is a Kronecker (R-MAT) graph with 2^scale vertices and
+// edge_factor * 2^scale edges, block-distributed over the ranks. Each search
+// is the same EXPLORE/ACCEPT scheme as bfs.cpp and async_bfs.cpp, batched per
+// level: every frontier vertex EXPLOREs its neighbours, and the owner of a
+// neighbour accepts the first proposal (it becomes the parent) and rejects the
+// rest. Every search is validated and timed, and the TEPS statistics are
+// written as JSON so runs can be compared across builds.
+//
+// With --mode async (or both) every search also runs as an asynchronous
+// label-correcting BFS with no level barriers: a vertex adopts any shorter
+// distance it hears about and re-propagates it, and a counting termination
+// detector decides when the search is over. --graph grid swaps the Kronecker
+// graph for a high-diameter 2D grid, where the per-level barriers of the
+// synchronous version are most expensive.
+//
+// With --compact the per-level EXPLORE batches are sent with the codec.h
+// encoding (targets sorted and delta-encoded, parents as varints); it
+// applies to the message exchange, so it cannot be combined with
+// --exchange rma.
+//
+// With --exchange rma the EXPLORE batches are written one-sided into the
+// owners' next-frontier windows instead of going through MPI_Alltoallv;
+// --exchange both runs every search both ways and reports the exchange time
+// per level against frontier density.
+//
+// With --threads N each rank expands its frontier with N threads
+// (work-stealing pool, thread-local EXPLORE buffers merged before the
+// exchange); only the main thread calls MPI, so MPI_THREAD_FUNNELED suffices.
+// Compare e.g. -np 4 --threads 1 with -np 1 --threads 4 on the same cores.
+//
+// With --out FILE the tree of the first search is written with MPI-IO in the
+// tree_io.h format (read it back with tree_reader).
+//
+// With --batch 64/128/256 the same roots are also searched as a multi-source
+// BFS (MS-BFS), where every vertex carries one bit per search, and compared
+// with the level-synchronous searches in searches per second (so not with
+// --mode async).
+
+const int DEFAULT_SCALE = 16;
+const int DEFAULT_EDGE_FACTOR = 16;
+const int DEFAULT_NUM_ROOTS = 64;
+
+struct ExploreMessage {
+    int64_t target;     // vertex being explored
+    int64_t sender_id;  // frontier vertex proposing itself as parent
+};
+
+// UPDATE batches of the label-correcting mode
+const int UPDATE_TAG = 20;
+const size_t UPDATE_FLUSH_THRESHOLD = 4096;  // messages buffered per destination
+const int ASYNC_POLL_INTERVAL = 256;         // vertices relaxed between polls
+
+struct UpdateMessage {
+    int64_t target;
+    int64_t sender_id;
+    int64_t distance;   // distance of target through sender_id
+};
+
+struct BenchConfig {
+    string graph = "kronecker";
+    string mode = "sync";   // sync, async or both
+    int scale = DEFAULT_SCALE;
+    int edge_factor = DEFAULT_EDGE_FACTOR;
+    int num_roots = DEFAULT_NUM_ROOTS;
+    uint64_t seed = 1;
+    int batch = 0;      // searches per multi-source batch, 0 to disable
+    int threads = 1;    // worker threads per rank for run_bfs
+    bool compact = false;
+    string exchange = "p2p";    // p2p, rma or both
+    bool validate = true;
+    string json_path = "bfs_bench.json";
+    string out_path;    // tree of the first search, empty to disable
+};
+
+struct SearchResult {
+    int64_t root;
+    double time;
+    int64_t edges;
+    int levels;
+    double teps;
+};
+
+struct MultiSourceResult {
+    int batch = 0;
+    int searches = 0;
+    double time = 0;         // all batches
+    double single_time = 0;  // same roots, one search at a time
+    bool valid = true;
+};
+
+// One bit per concurrent search.
+template <int WORDS>
+struct SearchMask {
+    uint64_t word[WORDS] = {};
+
+    bool any() const {
+        for (int i = 0; i < WORDS; ++i) if (word[i]) return true;
+        return false;
+    }
+    void set(int bit) { word[bit / 64] |= 1ULL << (bit % 64); }
+    SearchMask& operator|=(const SearchMask& o) {
+        for (int i = 0; i < WORDS; ++i) word[i] |= o.word[i];
+        return *this;
+    }
+    void clear_seen(const SearchMask& seen) {
+        for (int i = 0; i < WORDS; ++i) word[i] &= ~seen.word[i];
+    }
+};
+
+template <int WORDS>
+struct MultiExploreMessage {
+    int64_t target;
+    SearchMask<WORDS> searches;  // searches whose frontier contains the sender
+};
+
+// EXPLORE exchange settings and traffic counters for run_bfs.
+bool compact_exchange = false;
+bool rma_exchange = false;
+WorkStealingPool* frontier_pool = NULL;
+const int64_t FRONTIER_GRAIN = 256;   // frontier vertices or messages per chunk
+int64_t explore_bytes_raw = 0;
+int64_t explore_bytes_wire = 0;
+
+// Exchange time per level, bucketed by frontier density (share of all
+// vertices in the frontier); index 0 is p2p, 1 is rma.
+const int NUM_DENSITY_BUCKETS = 4;
+const double DENSITY_BOUNDS[NUM_DENSITY_BUCKETS - 1] = {0.001, 0.01, 0.1};
+const char* DENSITY_NAMES[NUM_DENSITY_BUCKETS] = {"<0.1%", "0.1-1%", "1-10%", ">=10%"};
+
+struct ExchangeStats {
+    double time[NUM_DENSITY_BUCKETS] = {};
+    int64_t levels[NUM_DENSITY_BUCKETS] = {};
+};
+ExchangeStats exchange_stats[2];
+
+void record_exchange(double density, double time) {
+    int bucket = 0;
+    while (bucket < NUM_DENSITY_BUCKETS - 1 && density >= DENSITY_BOUNDS[bucket]) bucket++;
+    exchange_stats[rma_exchange].time[bucket] += time;
+    exchange_stats[rma_exchange].levels[bucket]++;
+}
+
+// Sends every outgoing[r] batch to rank r as one compact record: a count,
+// then per message the target delta (batches are sorted by target) and the
+// proposed parent.
+vector<ExploreMessage> exchange_compact(vector<vector<ExploreMessage>>& outgoing, MPI_Comm comm) {
+    vector<vector<uint8_t>> encoded(outgoing.size());
+    for (size_t r = 0; r < outgoing.size(); ++r) {
+        if (outgoing[r].empty()) continue;
+        sort(outgoing[r].begin(), outgoing[r].end(),
+             [](const ExploreMessage& a, const ExploreMessage& b) { return a.target < b.target; });
+        put_varint(encoded[r], outgoing[r].size());
+        int64_t previous = 0;
+        for (const ExploreMessage& msg : outgoing[r]) {
+            put_varint(encoded[r], msg.target - previous);
+            put_varint(encoded[r], msg.sender_id);
+            previous = msg.target;
+        }
+        explore_bytes_wire += encoded[r].size();
+    }
+
+    vector<uint8_t> incoming = exchange_messages(encoded, comm);
+    vector<ExploreMessage> messages;
+    WireReader reader(incoming);
+    while (reader.ok() && !reader.at_end()) {
+        uint64_t count = reader.get_varint();
+        int64_t target = 0;
+        for (uint64_t i = 0; i < count && reader.ok(); ++i) {
+            target += reader.get_varint();
+            messages.push_back({target, (int64_t)reader.get_varint()});
+        }
+    }
+    if (!reader.ok()) {
+        cerr << "Malformed EXPLORE batch" << endl;
+        MPI_Abort(comm, 1);
+    }
+    return messages;
+}
+
+// Window for the one-sided exchange. Each rank exposes a next-frontier bitmap
+// over the vertices it owns, followed by one parent-proposal slot per vertex
+// (displacements are in int64 units, and the layout is the same on every rank
+// since it is sized by vertices_per_rank).
+struct RmaFrontier {
+    MPI_Win win = MPI_WIN_NULL;
+    int64_t words = 0;          // bitmap words; the proposal slots start here
+    uint64_t* bitmap = NULL;
+    int64_t* proposal = NULL;
+};
+const int64_t NO_PROPOSAL = INT64_MAX;
+RmaFrontier* rma_frontier = NULL;
+
+void create_rma_frontier(const DistGraph& g, RmaFrontier& rma, MPI_Comm comm) {
+    rma.words = (g.vertices_per_rank + 63) / 64;
+    int64_t* base = NULL;
+    MPI_Win_allocate((rma.words + g.vertices_per_rank) * sizeof(int64_t), sizeof(int64_t), MPI_INFO_NULL,
+                     comm, &base, &rma.win);
+    rma.bitmap = (uint64_t*)base;
+    rma.proposal = base + rma.words;
+    fill(rma.bitmap, rma.bitmap + rma.words, 0);
+    fill(rma.proposal, rma.proposal + g.vertices_per_rank, NO_PROPOSAL);
+    MPI_Win_fence(0, rma.win);
+}
+
+// One-sided version of the EXPLORE exchange, one fence epoch per level.
+// Each batch is deduplicated by target, then written to the owner with two
+// MPI_Accumulate calls through indexed datatypes: the discovered bits are
+// ORed into its bitmap (MPI_BOR) and the proposals lower its slots (MPI_MIN,
+// so the smallest proposing vertex wins whatever the arrival order). After
+// the closing fence the owner scans the non-zero bitmap words for its new
+// discoveries and resets them; nothing is probed or matched.
+vector<ExploreMessage> exchange_rma(vector<vector<ExploreMessage>>& outgoing, const DistGraph& g) {
+    RmaFrontier& rma = *rma_frontier;
+    const int world_size = (int)outgoing.size();
+    vector<vector<uint64_t>> masks(world_size);
+    vector<vector<int64_t>> proposals(world_size);
+    vector<MPI_Datatype> types;
+
+    MPI_Win_fence(MPI_MODE_NOPRECEDE, rma.win);
+    for (int r = 0; r < world_size; ++r) {
+        vector<ExploreMessage>& out = outgoing[r];
+        if (out.empty()) continue;
+        sort(out.begin(), out.end(), [](const ExploreMessage& a, const ExploreMessage& b) {
+            return a.target < b.target || (a.target == b.target && a.sender_id < b.sender_id);
+        });
+        const int64_t first = (int64_t)r * g.vertices_per_rank;
+        vector<int> word_disp, slot_disp;
+        for (size_t i = 0; i < out.size(); ++i) {
+            if (i > 0 && out[i].target == out[i - 1].target) continue;
+            int64_t local = out[i].target - first;
+            if (word_disp.empty() || word_disp.back() != local / 64) {
+                word_disp.push_back(local / 64);
+                masks[r].push_back(0);
+            }
+            masks[r].back() |= 1ULL << (local % 64);
+            slot_disp.push_back(rma.words + local);
+            proposals[r].push_back(out[i].sender_id);
+        }
+
+        MPI_Datatype word_type, slot_type;
+        MPI_Type_create_indexed_block(word_disp.size(), 1, word_disp.data(), MPI_UINT64_T, &word_type);
+        MPI_Type_create_indexed_block(slot_disp.size(), 1, slot_disp.data(), MPI_INT64_T, &slot_type);
+        MPI_Type_commit(&word_type);
+        MPI_Type_commit(&slot_type);
+        MPI_Accumulate(masks[r].data(), masks[r].size(), MPI_UINT64_T, r, 0, 1, word_type, MPI_BOR, rma.win);
+        MPI_Accumulate(proposals[r].data(), proposals[r].size(), MPI_INT64_T, r, 0, 1, slot_type, MPI_MIN,
+                       rma.win);
+        types.push_back(word_type);
+        types.push_back(slot_type);
+    }
+    MPI_Win_fence(MPI_MODE_NOSUCCEED, rma.win);
+    for (MPI_Datatype& t : types) MPI_Type_free(&t);
+
+    vector<ExploreMessage> incoming;
+    const int64_t num_words = (g.num_local + 63) / 64;
+    for (int64_t w = 0; w < num_words; ++w) {
+        for (uint64_t bits = rma.bitmap[w]; bits; bits &= bits - 1) {
+            int64_t local = w * 64 + __builtin_ctzll(bits);
+            incoming.push_back({g.local_begin + local, rma.proposal[local]});
+            rma.proposal[local] = NO_PROPOSAL;
+        }
+        rma.bitmap[w] = 0;
+    }
+    return incoming;
+}
+
+// What one frontier_pool thread produces during a level.
+struct ThreadBuffers {
+    vector<int64_t> next_frontier;
+    vector<vector<ExploreMessage>> outgoing;
+};
+
+// Runs one BFS from root. parent/level are indexed by local vertex and are -1
+// for vertices that were never reached. Returns the elapsed time.
+//
+// Frontier expansion and the handling of incoming EXPLOREs are split across
+// frontier_pool. Threads claim a vertex by swapping its parent from -1 with a
+// compare-and-swap, so exactly one proposal wins, and keep their own
+// next-frontier and outgoing buffers, which the main thread merges before it
+// does the exchange.
+double run_bfs(const DistGraph& g, int64_t root, vector<int64_t>& parent, vector<int64_t>& level,
+               int* num_levels, MPI_Comm comm) {
+    int world_size;
+    MPI_Comm_size(comm, &world_size);
+
+    parent.assign(g.num_local, -1);
+    level.assign(g.num_local, -1);
+    vector<int64_t> frontier, next_frontier;
+    WorkStealingPool& pool = *frontier_pool;
+    vector<ThreadBuffers> buffers(pool.size());
+    for (ThreadBuffers& b : buffers) b.outgoing.resize(world_size);
+
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+
+    if (g.is_local(root)) {
+        int64_t li = g.local_index(root);
+        parent[li] = root;
+        level[li] = 0;
+        frontier.push_back(li);
+    }
+
+    int64_t current_level = 0, global_frontier = 1;
+    auto accept = [&](int64_t lv, int64_t sender, ThreadBuffers& buf) {
+        if (parent[lv] == -1 && __sync_bool_compare_and_swap(&parent[lv], (int64_t)-1, sender)) {
+            level[lv] = current_level + 1;
+            buf.next_frontier.push_back(lv);
+        }
+    };
+
+    vector<vector<ExploreMessage>> outgoing(world_size);
+    while (true) {
+        for (auto& out : outgoing) out.clear();
+
+        // EXPLORE every neighbour of the frontier; local targets are accepted
+        // in place instead of going through the exchange.
+        pool.parallel_for(frontier.size(), FRONTIER_GRAIN, [&](int64_t begin, int64_t end, int t) {
+            ThreadBuffers& buf = buffers[t];
+            for (int64_t i = begin; i < end; ++i) {
+                int64_t li = frontier[i];
+                int64_t u = g.local_begin + li;
+                for (int64_t e = g.row_offsets[li]; e < g.row_offsets[li + 1]; ++e) {
+                    int64_t v = g.columns[e];
+                    if (g.is_local(v)) accept(g.local_index(v), u, buf);
+                    else buf.outgoing[g.owner(v)].push_back({v, u});
+                }
+            }
+        });
+        for (ThreadBuffers& buf : buffers) {
+            for (int r = 0; r < world_size; ++r) {
+                if (outgoing[r].empty()) outgoing[r].swap(buf.outgoing[r]);
+                else outgoing[r].insert(outgoing[r].end(), buf.outgoing[r].begin(), buf.outgoing[r].end());
+                buf.outgoing[r].clear();
+            }
+        }
+
+        // The one-sided exchange bypasses the codec, so only the message
+        // exchanges count towards the compression ratio.
+        if (!rma_exchange) {
+            for (const auto& out : outgoing) explore_bytes_raw += out.size() * sizeof(ExploreMessage);
+        }
+        double exchange_start = MPI_Wtime();
+        vector<ExploreMessage> incoming = rma_exchange ? exchange_rma(outgoing, g)
+                                        : compact_exchange ? exchange_compact(outgoing, comm)
+                                                           : exchange_messages(outgoing, comm);
+        record_exchange((double)global_frontier / g.num_global_vertices, MPI_Wtime() - exchange_start);
+        pool.parallel_for(incoming.size(), FRONTIER_GRAIN, [&](int64_t begin, int64_t end, int t) {
+            for (int64_t i = begin; i < end; ++i) {
+                accept(g.local_index(incoming[i].target), incoming[i].sender_id, buffers[t]);
+            }
+        });
+        for (ThreadBuffers& buf : buffers) {
+            next_frontier.insert(next_frontier.end(), buf.next_frontier.begin(), buf.next_frontier.end());
+            buf.next_frontier.clear();
+        }
+
+        int64_t local_next = next_frontier.size(), global_next = 0;
+        MPI_Allreduce(&local_next, &global_next, 1, MPI_INT64_T, MPI_SUM, comm);
+        if (global_next == 0) break;
+
+        global_frontier = global_next;
+        frontier.swap(next_frontier);
+        next_frontier.clear();
+        current_level++;
+    }
+
+    double elapsed = MPI_Wtime() - start;
+    *num_levels = (int)current_level + 1;
+    return elapsed;
+}
+
+// Label-correcting counters for the JSON report.
+int64_t async_relaxations = 0;   // distance changes, including later corrections
+int64_t async_batches = 0;       // UPDATE messages sent
+
+struct PendingSend {
+    MPI_Request request;
+    vector<UpdateMessage> data;
+};
+
+// Asynchronous BFS: no rank ever waits for a level to finish. Relaxed
+// vertices push UPDATE(target, parent, distance) to the target's owner, and
+// a receiver that learns a shorter distance adopts it and relaxes the vertex
+// again. Work is taken in distance order to limit corrections.
+//
+// Termination uses the four-counter method: idle ranks join a non-blocking
+// MPI_Iallreduce of (batches sent, batches received); once two consecutive
+// waves return the same totals with sent == received, no rank did any work
+// between them and nothing was in flight, so the search is over.
+double run_async_bfs(const DistGraph& g, int64_t root, vector<int64_t>& parent, vector<int64_t>& level,
+                     int* num_levels, MPI_Comm comm) {
+    int world_size;
+    MPI_Comm_size(comm, &world_size);
+
+    parent.assign(g.num_local, -1);
+    level.assign(g.num_local, -1);
+
+    typedef pair<int64_t, int64_t> WorkItem;   // (distance, local vertex)
+    priority_queue<WorkItem, vector<WorkItem>, greater<WorkItem>> work;
+    vector<vector<UpdateMessage>> outgoing(world_size);
+    vector<unordered_map<int64_t, size_t>> slot(world_size);
+    list<PendingSend> in_flight;
+    vector<UpdateMessage> recv_buf;
+    int64_t sent = 0, received = 0;
+
+    auto adopt = [&](int64_t lv, int64_t sender, int64_t distance) {
+        if (level[lv] == -1 || distance < level[lv]) {
+            level[lv] = distance;
+            parent[lv] = sender;
+            work.push({distance, lv});
+            async_relaxations++;
+        }
+    };
+    auto flush = [&](int dest) {
+        if (outgoing[dest].empty()) return;
+        in_flight.push_back({MPI_REQUEST_NULL, move(outgoing[dest])});
+        PendingSend& p = in_flight.back();
+        MPI_Isend(p.data.data(), (int)(p.data.size() * sizeof(UpdateMessage)), MPI_BYTE, dest,
+                  UPDATE_TAG, comm, &p.request);
+        outgoing[dest].clear();
+        slot[dest].clear();
+        sent++;
+        async_batches++;
+    };
+
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+
+    if (g.is_local(root)) adopt(g.local_index(root), root, 0);
+
+    int64_t wave_counts[2], wave_totals[2], previous_totals[2] = {-1, -1};
+    MPI_Request wave = MPI_REQUEST_NULL;
+    while (true) {
+        int flag = 1;
+        MPI_Status status;
+        while (true) {
+            MPI_Iprobe(MPI_ANY_SOURCE, UPDATE_TAG, comm, &flag, &status);
+            if (!flag) break;
+            int bytes = 0;
+            MPI_Get_count(&status, MPI_BYTE, &bytes);
+            recv_buf.resize(bytes / sizeof(UpdateMessage));
+            MPI_Recv(recv_buf.data(), bytes, MPI_BYTE, status.MPI_SOURCE, UPDATE_TAG, comm, &status);
+            received++;
+            for (const UpdateMessage& msg : recv_buf) {
+                adopt(g.local_index(msg.target), msg.sender_id, msg.distance);
+            }
+        }
+
+        for (int i = 0; i < ASYNC_POLL_INTERVAL && !work.empty(); ++i) {
+            WorkItem item = work.top();
+            work.pop();
+            int64_t lu = item.second;
+            if (item.first != level[lu]) continue;   // superseded by a shorter distance
+
+            int64_t u = g.local_begin + lu;
+            int64_t distance = item.first + 1;
+            for (int64_t e = g.row_offsets[lu]; e < g.row_offsets[lu + 1]; ++e) {
+                int64_t v = g.columns[e];
+                if (g.is_local(v)) {
+                    adopt(g.local_index(v), u, distance);
+                    continue;
+                }
+                int dest = g.owner(v);
+                auto it = slot[dest].find(v);
+                if (it == slot[dest].end()) {
+                    slot[dest][v] = outgoing[dest].size();
+                    outgoing[dest].push_back({v, u, distance});
+                    if (outgoing[dest].size() >= UPDATE_FLUSH_THRESHOLD) flush(dest);
+                } else if (distance < outgoing[dest][it->second].distance) {
+                    outgoing[dest][it->second] = {v, u, distance};
+                }
+            }
+        }
+        if (work.empty()) {
+            for (int dest = 0; dest < world_size; ++dest) flush(dest);
+        }
+
+        for (auto it = in_flight.begin(); it != in_flight.end();) {
+            int done = 0;
+            MPI_Test(&it->request, &done, MPI_STATUS_IGNORE);
+            it = done ? in_flight.erase(it) : next(it);
+        }
+
+        if (wave == MPI_REQUEST_NULL && work.empty()) {
+            wave_counts[0] = sent;
+            wave_counts[1] = received;
+            MPI_Iallreduce(wave_counts, wave_totals, 2, MPI_INT64_T, MPI_SUM, comm, &wave);
+        }
+        if (wave != MPI_REQUEST_NULL) {
+            int done = 0;
+            MPI_Test(&wave, &done, MPI_STATUS_IGNORE);
+            if (done) {
+                if (wave_totals[0] == wave_totals[1] && wave_totals[0] == previous_totals[0] &&
+                    wave_totals[1] == previous_totals[1]) {
+                    break;
+                }
+                previous_totals[0] = wave_totals[0];
+                previous_totals[1] = wave_totals[1];
+            }
+        }
+    }
+
+    double elapsed = MPI_Wtime() - start;
+    for (PendingSend& p : in_flight) MPI_Wait(&p.request, MPI_STATUS_IGNORE);
+
+    int64_t local_max = -1, global_max = -1;
+    for (int64_t l : level) local_max = max(local_max, l);
+    MPI_Allreduce(&local_max, &global_max, 1, MPI_INT64_T, MPI_MAX, comm);
+    *num_levels = (int)global_max + 1;
+    return elapsed;
+}
+
+// Runs up to 64 * WORDS searches at once. A frontier vertex sends one EXPLORE
+// per neighbour carrying the mask of all searches that reached it this level,
+// and EXPLOREs to the same target are OR-combined before the exchange, so one
+// message and one adjacency scan advance every search together.
+// level is indexed [local vertex * 64 * WORDS + search] and is -1 where a
+// search never reached the vertex.
+template <int WORDS>
+double run_multi_source_bfs(const DistGraph& g, const vector<int64_t>& roots, vector<int32_t>& level,
+                            MPI_Comm comm) {
+    const int stride = 64 * WORDS;
+    int world_size;
+    MPI_Comm_size(comm, &world_size);
+
+    vector<SearchMask<WORDS>> seen(g.num_local), frontier(g.num_local), next(g.num_local);
+    level.assign(g.num_local * stride, -1);
+    vector<int64_t> active, touched;
+
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+
+    for (size_t i = 0; i < roots.size(); ++i) {
+        if (!g.is_local(roots[i])) continue;
+        int64_t li = g.local_index(roots[i]);
+        if (!frontier[li].any()) active.push_back(li);
+        frontier[li].set(i);
+        seen[li].set(i);
+        level[li * stride + i] = 0;
+    }
+
+    int32_t current_level = 0;
+    vector<vector<MultiExploreMessage<WORDS>>> outgoing(world_size);
+    vector<unordered_map<int64_t, size_t>> slot(world_size);
+    while (true) {
+        for (int r = 0; r < world_size; ++r) {
+            outgoing[r].clear();
+            slot[r].clear();
+        }
+
+        for (int64_t li : active) {
+            for (int64_t e = g.row_offsets[li]; e < g.row_offsets[li + 1]; ++e) {
+                int64_t v = g.columns[e];
+                if (g.is_local(v)) {
+                    int64_t lv = g.local_index(v);
+                    if (!next[lv].any()) touched.push_back(lv);
+                    next[lv] |= frontier[li];
+                } else {
+                    int dest = g.owner(v);
+                    auto it = slot[dest].find(v);
+                    if (it == slot[dest].end()) {
+                        slot[dest][v] = outgoing[dest].size();
+                        outgoing[dest].push_back({v, frontier[li]});
+                    } else {
+                        outgoing[dest][it->second].searches |= frontier[li];
+                    }
+                }
+            }
+        }
+
+        vector<MultiExploreMessage<WORDS>> incoming = exchange_messages(outgoing, comm);
+        for (const MultiExploreMessage<WORDS>& msg : incoming) {
+            int64_t lv = g.local_index(msg.target);
+            if (!next[lv].any()) touched.push_back(lv);
+            next[lv] |= msg.searches;
+        }
+
+        for (int64_t li : active) frontier[li] = SearchMask<WORDS>();
+        active.clear();
+        for (int64_t lv : touched) {
+            SearchMask<WORDS> fresh = next[lv];
+            next[lv] = SearchMask<WORDS>();
+            fresh.clear_seen(seen[lv]);
+            if (!fresh.any()) continue;
+            seen[lv] |= fresh;
+            frontier[lv] = fresh;
+            active.push_back(lv);
+            for (int w = 0; w < WORDS; ++w) {
+                for (uint64_t bits = fresh.word[w]; bits; bits &= bits - 1) {
+                    level[lv * stride + w * 64 + __builtin_ctzll(bits)] = current_level + 1;
+                }
+            }
+        }
+        touched.clear();
+
+        int64_t local_active = active.size(), global_active = 0;
+        MPI_Allreduce(&local_active, &global_active, 1, MPI_INT64_T, MPI_SUM, comm);
+        if (global_active == 0) break;
+        current_level++;
+    }
+
+    return MPI_Wtime() - start;
+}
+
+// Runs all roots in batches of cfg.batch and, when validating, checks every
+// search's levels against the single-source BFS from the same root.
+template <int WORDS>
+MultiSourceResult run_multi_source_batches(const BenchConfig& cfg, const DistGraph& g,
+                                           const vector<int64_t>& roots, MPI_Comm comm) {
+    const int stride = 64 * WORDS;
+    MultiSourceResult result;
+    result.batch = cfg.batch;
+
+    vector<int32_t> level;
+    vector<int64_t> single_parent, single_level;
+    for (size_t first = 0; first < roots.size(); first += cfg.batch) {
+        vector<int64_t> batch(roots.begin() + first,
+                              roots.begin() + min(roots.size(), first + cfg.batch));
+        result.time += run_multi_source_bfs<WORDS>(g, batch, level, comm);
+        result.searches += batch.size();
+
+        if (!cfg.validate) continue;
+        int local_ok = 1;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            int levels;
+            run_bfs(g, batch[i], single_parent, single_level, &levels, comm);
+            for (int64_t li = 0; li < g.num_local; ++li) {
+                if (level[li * stride + i] != single_level[li]) local_ok = 0;
+            }
+        }
+        int all_ok = 0;
+        MPI_Allreduce(&local_ok, &all_ok, 1, MPI_INT, MPI_LAND, comm);
+        result.valid = result.valid && all_ok;
+    }
+    return result;
+}
+
+// Validates the search (or just counts the edges it covered) and fills in
+// edges and TEPS. Returns false if validation failed.
+bool finish_search(const BenchConfig& cfg, const DistGraph& g, SearchResult& r,
+                   const vector<int64_t>& parent, const vector<int64_t>& level, MPI_Comm comm) {
+    int world_rank;
+    MPI_Comm_rank(comm, &world_rank);
+
+    bool valid = true;
+    r.edges = 0;
+    if (cfg.validate) {
+        string error;
+        if (!validate_bfs_tree(g, r.root, parent, level, &r.edges, &error, comm)) {
+            valid = false;
+            if (world_rank == 0) {
+                cerr << "Validation FAILED for root " << r.root << ": " << error << endl;
+            }
+        }
+    } else {
+        int64_t degree_sum = 0;
+        for (int64_t i = 0; i < g.num_local; ++i) {
+            if (level[i] >= 0) degree_sum += g.degree(i);
+        }
+        MPI_Allreduce(&degree_sum, &r.edges, 1, MPI_INT64_T, MPI_SUM, comm);
+        r.edges /= 2;
+    }
+    r.teps = r.edges / r.time;
+    return valid;
+}
+
+// Writes a search tree to cfg.out_path. Children are collected at the owner
+// of their parent and sorted; the root's parent is stored as -1.
+bool write_search_tree(const BenchConfig& cfg, const DistGraph& g, const vector<int64_t>& parent,
+                       const vector<int64_t>& level, int64_t* file_bytes, MPI_Comm comm) {
+    int world_size;
+    MPI_Comm_size(comm, &world_size);
+
+    vector<vector<Edge>> outgoing(world_size);
+    vector<int64_t> file_parent(parent);
+    for (int64_t i = 0; i < g.num_local; ++i) {
+        int64_t v = g.local_begin + i;
+        if (parent[i] == v) file_parent[i] = -1;
+        if (parent[i] >= 0 && parent[i] != v) outgoing[g.owner(parent[i])].push_back({parent[i], v});
+    }
+    vector<vector<int64_t>> children(g.num_local);
+    for (const Edge& e : exchange_messages(outgoing, comm)) children[g.local_index(e.u)].push_back(e.v);
+    for (vector<int64_t>& c : children) sort(c.begin(), c.end());
+
+    return write_tree_file(cfg.out_path.c_str(), g.num_global_vertices, g.local_begin, file_parent, level,
+                           children, comm, file_bytes);
+}
+
+void write_tree_timed(const BenchConfig& cfg, const DistGraph& g, int64_t root, const vector<int64_t>& parent,
+                      const vector<int64_t>& level, MPI_Comm comm) {
+    int world_rank;
+    MPI_Comm_rank(comm, &world_rank);
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+    int64_t bytes = 0;
+    bool written = write_search_tree(cfg, g, parent, level, &bytes, comm);
+    double elapsed = MPI_Wtime() - start;
+    if (world_rank == 0) {
+        if (!written) {
+            cerr << "Could not write " << cfg.out_path << endl;
+            return;
+        }
+        cout << "Tree of root " << root << " written to " << cfg.out_path << ": " << bytes << " bytes in "
+             << elapsed << " s (" << bytes / elapsed / 1e6 << " MB/s)" << endl;
+    }
+}
+
+void write_stats_json(ofstream& out, const char* name, const TepsStats& s) {
+    out << "  \"" << name << "\": {"
+        << "\"min\": " << s.min
+        << ", \"first_quartile\": " << s.first_quartile
+        << ", \"median\": " << s.median
+        << ", \"third_quartile\": " << s.third_quartile
+        << ", \"max\": " << s.max
+        << ", \"harmonic_mean\": " << s.harmonic_mean
+        << ", \"harmonic_stddev\": " << s.harmonic_stddev << "}";
+}
+
+void write_json(const BenchConfig& cfg, const DistGraph& g, int world_size, double generation_time,
+                double construction_time, const vector<SearchResult>& results, bool valid,
+                const MultiSourceResult& multi, int64_t bytes_raw, int64_t bytes_wire,
+                const vector<SearchResult>& async_results, int64_t relaxations, int64_t batches,
+                const vector<SearchResult>& rma_results, const ExchangeStats* exchange) {
+    ofstream out(cfg.json_path);
+    if (!out) {
+        cerr << "Could not open " << cfg.json_path << " for writing." << endl;
+        return;
+    }
+
+    vector<double> teps, times;
+    for (const SearchResult& r : results) {
+        teps.push_back(r.teps);
+        times.push_back(r.time);
+    }
+    TepsStats teps_stats = compute_teps_stats(teps);
+    sort(times.begin(), times.end());
+    const bool async_only = (cfg.mode == "async");
+
+    out.precision(9);
+    out << "{\n"
+        << "  \"benchmark\": \"bfs_bench\",\n"
+        << "  \"graph\": \"" << cfg.graph << "\",\n"
+        << "  \"mode\": \"" << (async_only ? "async" : "sync") << "\",\n"
+        << "  \"exchange\": \"" << (cfg.exchange == "rma" ? "rma" : "p2p") << "\",\n"
+        << "  \"scale\": " << cfg.scale << ",\n"
+        << "  \"edge_factor\": " << cfg.edge_factor << ",\n"
+        << "  \"num_vertices\": " << g.num_global_vertices << ",\n"
+        << "  \"num_edges\": " << g.num_input_edges << ",\n"
+        << "  \"num_ranks\": " << world_size << ",\n"
+        << "  \"threads_per_rank\": " << cfg.threads << ",\n"
+        << "  \"seed\": " << cfg.seed << ",\n"
+        << "  \"generation_time\": " << generation_time << ",\n"
+        << "  \"construction_time\": " << construction_time << ",\n"
+        << "  \"validation\": \"" << (!cfg.validate ? "skipped" : valid ? "passed" : "failed") << "\",\n"
+        << "  \"num_searches\": " << results.size() << ",\n"
+        << "  \"explore_bytes\": " << (cfg.compact ? bytes_wire : bytes_raw) << ",\n"
+        << "  \"explore_bytes_uncompressed\": " << bytes_raw << ",\n";
+    write_stats_json(out, "teps", teps_stats);
+    out << ",\n  \"time\": {"
+        << "\"min\": " << (times.empty() ? 0 : times.front())
+        << ", \"first_quartile\": " << quantile(times, 0.25)
+        << ", \"median\": " << quantile(times, 0.5)
+        << ", \"third_quartile\": " << quantile(times, 0.75)
+        << ", \"max\": " << (times.empty() ? 0 : times.back()) << "},\n";
+    out << "  \"searches\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const SearchResult& r = results[i];
+        out << "    {\"root\": " << r.root << ", \"time\": " << r.time << ", \"edges\": " << r.edges
+            << ", \"levels\": " << r.levels << ", \"teps\": " << r.teps << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]";
+    if (cfg.mode == "both" && !async_results.empty()) {
+        vector<double> async_teps;
+        for (const SearchResult& r : async_results) async_teps.push_back(r.teps);
+        TepsStats a = compute_teps_stats(async_teps);
+        out << ",\n  \"async\": {\"harmonic_mean_teps\": " << a.harmonic_mean
+            << ", \"median_teps\": " << a.median
+            << ", \"speedup_vs_sync\": " << a.harmonic_mean / teps_stats.harmonic_mean
+            << ", \"relaxations\": " << relaxations
+            << ", \"update_batches\": " << batches << "}";
+    }
+    if (cfg.exchange != "p2p" && !async_only) {
+        if (!rma_results.empty()) {
+            vector<double> rma_teps;
+            for (const SearchResult& r : rma_results) rma_teps.push_back(r.teps);
+            TepsStats a = compute_teps_stats(rma_teps);
+            out << ",\n  \"rma\": {\"harmonic_mean_teps\": " << a.harmonic_mean
+                << ", \"median_teps\": " << a.median
+                << ", \"speedup_vs_p2p\": " << a.harmonic_mean / teps_stats.harmonic_mean << "}";
+        }
+        out << ",\n  \"exchange_by_density\": [\n";
+        for (int b = 0; b < NUM_DENSITY_BUCKETS; ++b) {
+            out << "    {\"frontier\": \"" << DENSITY_NAMES[b] << "\"";
+            for (int m = 0; m < 2; ++m) {
+                const char* name = m ? "rma" : "p2p";
+                out << ", \"" << name << "_levels\": " << exchange[m].levels[b]
+                    << ", \"" << name << "_time\": " << exchange[m].time[b];
+            }
+            out << "}" << (b + 1 < NUM_DENSITY_BUCKETS ? ",\n" : "\n");
+        }
+        out << "  ]";
+    }
+    if (multi.batch > 0) {
+        out << ",\n  \"multi_source\": {"
+            << "\"batch\": " << multi.batch
+            << ", \"searches\": " << multi.searches
+            << ", \"time\": " << multi.time
+            << ", \"searches_per_sec\": " << multi.searches / multi.time
+            << ", \"single_source_searches_per_sec\": " << multi.searches / multi.single_time
+            << ", \"validation\": \"" << (!cfg.validate ? "skipped" : multi.valid ? "passed" : "failed")
+            << "\"}";
+    }
+    out << "\n}\n";
+}
+
+bool parse_args(int argc, char** argv, BenchConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--graph" && has_value) cfg.graph = argv[++i];
+        else if (arg == "--mode" && has_value) cfg.mode = argv[++i];
+        else if (arg == "--scale" && has_value) cfg.scale = atoi(argv[++i]);
+        else if (arg == "--edgefactor" && has_value) cfg.edge_factor = atoi(argv[++i]);
+        else if (arg == "--roots" && has_value) cfg.num_roots = atoi(argv[++i]);
+        else if (arg == "--seed" && has_value) cfg.seed = strtoull(argv[++i], NULL, 10);
+        else if (arg == "--batch" && has_value) cfg.batch = atoi(argv[++i]);
+        else if (arg == "--threads" && has_value) cfg.threads = atoi(argv[++i]);
+        else if (arg == "--json" && has_value) cfg.json_path = argv[++i];
+        else if (arg == "--out" && has_value) cfg.out_path = argv[++i];
+        else if (arg == "--exchange" && has_value) cfg.exchange = argv[++i];
+        else if (arg == "--compact") cfg.compact = true;
+        else if (arg == "--no-validate") cfg.validate = false;
+        else return false;
+    }
+    // The multi-source searches are compared against the level-synchronous
+    // ones, so --batch needs those to run.
+    bool batch_ok = cfg.batch == 0 ||
+                    ((cfg.batch == 64 || cfg.batch == 128 || cfg.batch == 256) && cfg.mode != "async");
+    bool graph_ok = cfg.graph == "kronecker" || cfg.graph == "grid";
+    bool mode_ok = cfg.mode == "sync" || cfg.mode == "async" || cfg.mode == "both";
+    bool exchange_ok = cfg.exchange == "p2p" || cfg.exchange == "rma" || cfg.exchange == "both";
+    // --compact only changes the message exchange; --exchange both still
+    // runs it next to rma.
+    bool compact_ok = !cfg.compact || cfg.exchange != "rma";
+    return cfg.scale > 0 && cfg.scale < 40 && cfg.edge_factor > 0 && cfg.num_roots > 0 &&
+           cfg.threads > 0 && batch_ok && graph_ok && mode_ok && exchange_ok && compact_ok;
+}
+
+int main(int argc, char** argv) {
+    // Worker threads never call MPI, so FUNNELED is all that is needed.
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    int world_rank, world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    BenchConfig cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        if (world_rank == 0) {
+            cerr << "usage: " << argv[0] << " [--graph kronecker|grid] [--mode sync|async|both]"
+                 << " [--scale S] [--edgefactor E] [--roots K]"
+                 << " [--exchange p2p|rma|both] [--threads N] [--batch 64|128|256] [--compact] [--seed N]"
+                 << " [--json FILE] [--out FILE] [--no-validate]" << endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (cfg.threads > 1 && provided < MPI_THREAD_FUNNELED) {
+        if (world_rank == 0) cerr << "MPI library does not support MPI_THREAD_FUNNELED" << endl;
+        MPI_Finalize();
+        return 1;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    // The grid gets the same number of vertices, rounded to a square.
+    const int64_t grid_side = llround(sqrt((double)(1LL << cfg.scale)));
+    const int64_t num_vertices = (cfg.graph == "grid") ? grid_side * grid_side : (1LL << cfg.scale);
+    vector<Edge> edges = (cfg.graph == "grid")
+        ? generate_grid_edges(grid_side, MPI_COMM_WORLD)
+        : generate_kronecker_edges(cfg.scale, cfg.edge_factor, cfg.seed, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double generation_time = MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    DistGraph g = build_dist_graph(num_vertices, edges, MPI_COMM_WORLD);
+    vector<Edge>().swap(edges);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double construction_time = MPI_Wtime() - start;
+
+    if (world_rank == 0) {
+        cout << "Graph: " << cfg.graph << ", scale " << cfg.scale << ", edge factor " << cfg.edge_factor << ", "
+             << g.num_global_vertices << " vertices, " << g.num_input_edges << " edges on "
+             << world_size << " ranks x " << cfg.threads << " threads" << endl;
+        cout << "Generation: " << generation_time << " s, construction: " << construction_time
+             << " s" << endl;
+    }
+
+    vector<int64_t> roots = pick_search_keys(g, cfg.num_roots, cfg.seed, MPI_COMM_WORLD);
+    compact_exchange = cfg.compact;
+    WorkStealingPool pool(cfg.threads);
+    frontier_pool = &pool;
+    RmaFrontier rma;
+    if (cfg.exchange != "p2p") {
+        create_rma_frontier(g, rma, MPI_COMM_WORLD);
+        rma_frontier = &rma;
+    }
+    rma_exchange = (cfg.exchange == "rma");
+
+    // results holds the level-synchronous searches unless only the
+    // asynchronous mode was requested; with --exchange both, rma_results
+    // holds the same searches over the one-sided exchange.
+    vector<SearchResult> results, async_results, rma_results;
+    vector<int64_t> parent, level;
+    bool all_valid = true;
+    for (int64_t root : roots) {
+        const bool write_tree = !cfg.out_path.empty() && root == roots.front();
+        if (cfg.mode != "async") {
+            SearchResult r;
+            r.root = root;
+            r.time = run_bfs(g, root, parent, level, &r.levels, MPI_COMM_WORLD);
+            all_valid = finish_search(cfg, g, r, parent, level, MPI_COMM_WORLD) && all_valid;
+            results.push_back(r);
+            if (write_tree) write_tree_timed(cfg, g, root, parent, level, MPI_COMM_WORLD);
+
+            if (world_rank == 0) {
+                cout << "Root " << root << ": " << r.levels << " levels, " << r.edges << " edges in "
+                     << r.time << " s (" << r.teps << " TEPS)" << endl;
+            }
+        }
+        if (cfg.mode != "async" && cfg.exchange == "both") {
+            SearchResult r;
+            r.root = root;
+            rma_exchange = true;
+            r.time = run_bfs(g, root, parent, level, &r.levels, MPI_COMM_WORLD);
+            rma_exchange = false;
+            all_valid = finish_search(cfg, g, r, parent, level, MPI_COMM_WORLD) && all_valid;
+            rma_results.push_back(r);
+
+            if (world_rank == 0) {
+                cout << "Root " << root << " (rma): " << r.levels << " levels, " << r.edges
+                     << " edges in " << r.time << " s (" << r.teps << " TEPS)" << endl;
+            }
+        }
+        if (cfg.mode != "sync") {
+            SearchResult r;
+            r.root = root;
+            r.time = run_async_bfs(g, root, parent, level, &r.levels, MPI_COMM_WORLD);
+            all_valid = finish_search(cfg, g, r, parent, level, MPI_COMM_WORLD) && all_valid;
+            (cfg.mode == "async" ? results : async_results).push_back(r);
+            if (write_tree && cfg.mode == "async") write_tree_timed(cfg, g, root, parent, level, MPI_COMM_WORLD);
+
+            if (world_rank == 0) {
+                cout << "Root " << root << " (async): " << r.levels << " levels, " << r.edges
+                     << " edges in " << r.time << " s (" << r.teps << " TEPS)" << endl;
+            }
+        }
+    }
+
+    int64_t async_totals[2] = {0, 0};
+    int64_t local_async[2] = {async_relaxations, async_batches};
+    MPI_Reduce(local_async, async_totals, 2, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    int64_t bytes[2] = {0, 0};
+    int64_t local_bytes[2] = {explore_bytes_raw, explore_bytes_wire};
+    MPI_Reduce(local_bytes, bytes, 2, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Every rank sees the same levels; the slowest rank sets the exchange time.
+    ExchangeStats exchange_totals[2];
+    for (int m = 0; m < 2; ++m) {
+        MPI_Reduce(exchange_stats[m].time, exchange_totals[m].time, NUM_DENSITY_BUCKETS, MPI_DOUBLE,
+                   MPI_MAX, 0, MPI_COMM_WORLD);
+        copy(exchange_stats[m].levels, exchange_stats[m].levels + NUM_DENSITY_BUCKETS,
+             exchange_totals[m].levels);
+    }
+
+    MultiSourceResult multi;
+    if (cfg.batch > 0) {
+        if (cfg.batch == 64) multi = run_multi_source_batches<1>(cfg, g, roots, MPI_COMM_WORLD);
+        else if (cfg.batch == 128) multi = run_multi_source_batches<2>(cfg, g, roots, MPI_COMM_WORLD);
+        else multi = run_multi_source_batches<4>(cfg, g, roots, MPI_COMM_WORLD);
+        for (const SearchResult& r : results) multi.single_time += r.time;
+        all_valid = all_valid && multi.valid;
+    }
+
+    if (world_rank == 0) {
+        vector<double> teps;
+        for (const SearchResult& r : results) teps.push_back(r.teps);
+        TepsStats s = compute_teps_stats(teps);
+        cout << "\n========================================" << endl;
+        cout << "BFS searches: " << results.size() << " ("
+             << (!cfg.validate ? "not validated" : all_valid ? "all valid" : "VALIDATION FAILED")
+             << ")" << endl;
+        cout << "TEPS min/q1/median/q3/max: " << s.min << " / " << s.first_quartile << " / "
+             << s.median << " / " << s.third_quartile << " / " << s.max << endl;
+        cout << "TEPS harmonic mean: " << s.harmonic_mean << " (stddev " << s.harmonic_stddev << ")" << endl;
+        if (!async_results.empty()) {
+            vector<double> async_teps;
+            for (const SearchResult& r : async_results) async_teps.push_back(r.teps);
+            TepsStats a = compute_teps_stats(async_teps);
+            cout << "Async TEPS harmonic mean: " << a.harmonic_mean << " ("
+                 << a.harmonic_mean / s.harmonic_mean << "x level-synchronous)" << endl;
+        }
+        if (cfg.mode != "sync") {
+            cout << "Async relaxations: " << async_totals[0] << " for "
+                 << (async_results.empty() ? results : async_results).size() << " searches, "
+                 << async_totals[1] << " UPDATE batches" << endl;
+        }
+        if (!rma_results.empty()) {
+            vector<double> rma_teps;
+            for (const SearchResult& r : rma_results) rma_teps.push_back(r.teps);
+            TepsStats a = compute_teps_stats(rma_teps);
+            cout << "RMA exchange TEPS harmonic mean: " << a.harmonic_mean << " ("
+                 << a.harmonic_mean / s.harmonic_mean << "x point-to-point)" << endl;
+        }
+        if (cfg.exchange != "p2p" && cfg.mode != "async") {
+            cout << "Exchange time per level by frontier density:" << endl;
+            for (int b = 0; b < NUM_DENSITY_BUCKETS; ++b) {
+                if (exchange_totals[0].levels[b] + exchange_totals[1].levels[b] == 0) continue;
+                cout << "  " << DENSITY_NAMES[b] << ":";
+                for (int m = 0; m < 2; ++m) {
+                    const ExchangeStats& e = exchange_totals[m];
+                    if (e.levels[b] == 0) continue;
+                    cout << "  " << (m ? "rma " : "p2p ") << e.time[b] / e.levels[b] * 1e3 << " ms ("
+                         << e.levels[b] << " levels)";
+                }
+                cout << endl;
+            }
+        }
+        if (cfg.compact) {
+            cout << "EXPLORE traffic: " << bytes[1] << " bytes (" << bytes[0] << " uncompressed, "
+                 << (double)bytes[0] / max<int64_t>(bytes[1], 1) << "x smaller)" << endl;
+        }
+        if (multi.batch > 0) {
+            cout << "Multi-source (batch " << multi.batch << "): " << multi.searches / multi.time
+                 << " searches/s vs " << multi.searches / multi.single_time << " single-source ("
+                 << multi.single_time / multi.time << "x)"
+                 << (!cfg.validate ? "" : multi.valid ? ", levels match" : ", LEVELS DIFFER") << endl;
+        }
+        cout << "========================================" << endl;
+
+        write_json(cfg, g, world_size, generation_time, construction_time, results, all_valid, multi,
+                   bytes[0], bytes[1], async_results, async_totals[0], async_totals[1], rma_results,
+                   exchange_totals);
+    }
+
+    if (rma.win != MPI_WIN_NULL) MPI_Win_free(&rma.win);
+    MPI_Finalize();
+    return all_valid ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <unordered_map>
+#include <algorithm>
+#include <mpi.h>
+#include "graph500.h"
+
+using namespace std;
+
+// Distributed connected components on the same block-distributed graphs as
+// bfs_bench.cpp. Unlike the traversals, which only reach the root's component
+// and leave everything else unassigned, every vertex ends up labelled with the
+// smallest vertex id of its component.
+//
+// The default algorithm is min-label propagation with Shiloach-Vishkin-style
+// hooking and pointer jumping (FastSV): besides taking the smallest label of
+// its neighbours, a vertex hooks its parent onto the smallest grandparent it
+// sees and then jumps to its own grandparent, so labels travel along the
+// forest of parent pointers rather than one edge per round. This converges in
+// O(log n) rounds instead of O(diameter). --algorithm lp runs plain
+// label propagation for comparison.
+
+struct HookMessage {
+    int64_t target;   // vertex whose parent pointer is lowered
+    int64_t label;
+};
+
+struct CcConfig {
+    string graph = "kronecker";
+    string algorithm = "sv";    // sv or lp
+    int scale = 16;
+    int edge_factor = 16;
+    uint64_t seed = 1;
+    bool verbose = true;        // print per-round changed counts
+};
+
+// Returns the number of rounds; label[i] is the component of local vertex i.
+int run_components(const CcConfig& cfg, const DistGraph& g, vector<int64_t>& label, MPI_Comm comm) {
+    int world_rank, world_size;
+    MPI_Comm_rank(comm, &world_rank);
+    MPI_Comm_size(comm, &world_size);
+
+    const bool pointer_jumping = (cfg.algorithm == "sv");
+    label.resize(g.num_local);
+    for (int64_t i = 0; i < g.num_local; ++i) label[i] = g.local_begin + i;
+
+    // grandparent[i] = label[label[i]]; without pointer jumping it is just label.
+    vector<int64_t> grandparent = pointer_jumping ? fetch_remote(g, label, label, comm) : label;
+
+    int rounds = 0;
+    vector<vector<HookMessage>> outgoing(world_size);
+    vector<unordered_map<int64_t, size_t>> slot(world_size);
+    while (true) {
+        rounds++;
+        vector<int64_t> neighbour_gp = fetch_remote(g, g.columns, grandparent, comm);
+        vector<int64_t> next = label;
+
+        for (int64_t i = 0; i < g.num_local; ++i) {
+            int64_t smallest = grandparent[i];
+            for (int64_t e = g.row_offsets[i]; e < g.row_offsets[i + 1]; ++e) {
+                smallest = min(smallest, neighbour_gp[e]);
+            }
+            // Aggressive hooking (and, with gp = label, plain propagation).
+            next[i] = min(next[i], smallest);
+
+            // Hook the parent itself onto the smallest grandparent seen.
+            if (pointer_jumping && smallest < label[i]) {
+                int64_t p = label[i];
+                if (g.is_local(p)) {
+                    next[g.local_index(p)] = min(next[g.local_index(p)], smallest);
+                } else {
+                    int dest = g.owner(p);
+                    auto it = slot[dest].find(p);
+                    if (it == slot[dest].end()) {
+                        slot[dest][p] = outgoing[dest].size();
+                        outgoing[dest].push_back({p, smallest});
+                    } else {
+                        outgoing[dest][it->second].label = min(outgoing[dest][it->second].label, smallest);
+                    }
+                }
+            }
+        }
+        if (pointer_jumping) {
+            for (const HookMessage& msg : exchange_messages(outgoing, comm)) {
+                int64_t li = g.local_index(msg.target);
+                next[li] = min(next[li], msg.label);
+            }
+            for (int r = 0; r < world_size; ++r) {
+                outgoing[r].clear();
+                slot[r].clear();
+            }
+        }
+
+        // Shortcutting: jump to the new grandparent.
+        vector<int64_t> next_gp = pointer_jumping ? fetch_remote(g, next, next, comm) : next;
+        int64_t local_changed = 0, changed = 0;
+        for (int64_t i = 0; i < g.num_local; ++i) {
+            if (pointer_jumping) next[i] = min(next[i], next_gp[i]);
+            if (next[i] != label[i]) local_changed++;
+        }
+        MPI_Allreduce(&local_changed, &changed, 1, MPI_INT64_T, MPI_SUM, comm);
+        if (world_rank == 0 && cfg.verbose) {
+            cout << "Round " << rounds << ": " << changed << " vertices changed label" << endl;
+        }
+
+        label.swap(next);
+        if (changed == 0) break;
+        grandparent = pointer_jumping ? fetch_remote(g, label, label, comm) : label;
+    }
+    return rounds;
+}
+
+// Labels must be constant along every edge and every label must be the id of
+// a vertex that labels itself, with no larger id than the vertices it labels.
+bool validate_components(const DistGraph& g, const vector<int64_t>& label, MPI_Comm comm) {
+    int ok = 1;
+    vector<int64_t> neighbour_label = fetch_remote(g, g.columns, label, comm);
+    vector<int64_t> label_of_label = fetch_remote(g, label, label, comm);
+    for (int64_t i = 0; i < g.num_local && ok; ++i) {
+        if (label[i] > g.local_begin + i || label_of_label[i] != label[i]) ok = 0;
+        for (int64_t e = g.row_offsets[i]; e < g.row_offsets[i + 1]; ++e) {
+            if (neighbour_label[e] != label[i]) ok = 0;
+        }
+    }
+    int all_ok = 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, comm);
+    return all_ok;
+}
+
+bool parse_args(int argc, char** argv, CcConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--graph" && has_value) cfg.graph = argv[++i];
+        else if (arg == "--algorithm" && has_value) cfg.algorithm = argv[++i];
+        else if (arg == "--scale" && has_value) cfg.scale = atoi(argv[++i]);
+        else if (arg == "--edgefactor" && has_value) cfg.edge_factor = atoi(argv[++i]);
+        else if (arg == "--seed" && has_value) cfg.seed = strtoull(argv[++i], NULL, 10);
+        else if (arg == "--quiet") cfg.verbose = false;
+        else return false;
+    }
+    return (cfg.graph == "kronecker" || cfg.graph == "grid") &&
+           (cfg.algorithm == "sv" || cfg.algorithm == "lp") &&
+           cfg.scale > 0 && cfg.scale < 40 && cfg.edge_factor > 0;
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+
+    int world_rank, world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    CcConfig cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        if (world_rank == 0) {
+            cerr << "usage: " << argv[0] << " [--graph kronecker|grid] [--algorithm sv|lp]"
+                 << " [--scale S] [--edgefactor E] [--seed N] [--quiet]" << endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    const int64_t grid_side = llround(sqrt((double)(1LL << cfg.scale)));
+    const int64_t num_vertices = (cfg.graph == "grid") ? grid_side * grid_side : (1LL << cfg.scale);
+    vector<Edge> edges = (cfg.graph == "grid")
+        ? generate_grid_edges(grid_side, MPI_COMM_WORLD)
+        : generate_kronecker_edges(cfg.scale, cfg.edge_factor, cfg.seed, MPI_COMM_WORLD);
+    DistGraph g = build_dist_graph(num_vertices, edges, MPI_COMM_WORLD);
+    vector<Edge>().swap(edges);
+
+    if (world_rank == 0) {
+        cout << "Graph: " << cfg.graph << ", " << g.num_global_vertices << " vertices, "
+             << g.num_input_edges << " edges on " << world_size << " ranks, algorithm "
+             << cfg.algorithm << endl;
+    }
+
+    vector<int64_t> label;
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    int rounds = run_components(cfg, g, label, MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start;
+
+    bool valid = validate_components(g, label, MPI_COMM_WORLD);
+
+    // Component sizes, counted at the owner of each label.
+    vector<vector<int64_t>> members(world_size);
+    for (int64_t l : label) members[g.owner(l)].push_back(l);
+    vector<int64_t> size_of(g.num_local, 0);
+    for (int64_t l : exchange_messages(members, MPI_COMM_WORLD)) size_of[g.local_index(l)]++;
+
+    int64_t local_stats[2] = {0, 0}, stats[2] = {0, 0};   // components, isolated vertices
+    int64_t local_largest = 0, largest = 0;
+    for (int64_t i = 0; i < g.num_local; ++i) {
+        if (size_of[i] > 0) local_stats[0]++;
+        if (size_of[i] == 1) local_stats[1]++;
+        local_largest = max(local_largest, size_of[i]);
+    }
+    MPI_Reduce(local_stats, stats, 2, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local_largest, &largest, 1, MPI_INT64_T, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (world_rank == 0) {
+        cout << "\n========================================" << endl;
+        cout << "Components: " << stats[0] << " (" << stats[1] << " isolated vertices), largest "
+             << largest << " vertices" << endl;
+        cout << "Rounds: " << rounds << ", time: " << elapsed << " s" << endl;
+        cout << "Validation: " << (valid ? "passed" : "FAILED") << endl;
+        cout << "========================================" << endl;
+    }
+
+    MPI_Finalize();
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+// Compact wire encoding shared by the traversal programs.
+//
+// Integers are LEB128 varints (signed values zigzag-encoded first) and id
+// lists are length-prefixed, sorted and delta-encoded, so a message costs a
+// few bytes per entry instead of a fixed-size struct. Receivers size their
+// buffer with MPI_Probe/MPI_Get_count and take it from a BufferPool. The
+// Comm overloads do the same over comm.h.
+
+#include <mpi.h>
+#include <stdint.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "comm.h"
+
+inline void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+class WireWriter {
+public:
+    explicit WireWriter(std::vector<uint8_t>& out) : out_(out) {}
+
+    void put_int(int64_t value) { put_varint(out_, zigzag_encode(value)); }
+
+    // Order is not preserved: the list is sent sorted.
+    template <typename T>
+    void put_id_list(std::vector<T> ids) {
+        std::sort(ids.begin(), ids.end());
+        put_varint(out_, ids.size());
+        uint64_t previous = 0;
+        for (T id : ids) {
+            put_varint(out_, (uint64_t)id - previous);
+            previous = (uint64_t)id;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+};
+
+// Decoding stops at the first malformed or truncated field; ok() reports it.
+class WireReader {
+public:
+    WireReader(const uint8_t* data, size_t size) : p_(data), end_(data + size) {}
+    explicit WireReader(const std::vector<uint8_t>& buf) : WireReader(buf.data(), buf.size()) {}
+
+    bool ok() const { return ok_; }
+    bool at_end() const { return p_ == end_; }
+
+    uint64_t get_varint() {
+        uint64_t value = 0;
+        for (int shift = 0; ok_ && shift < 64; shift += 7) {
+            if (p_ == end_) break;
+            uint8_t byte = *p_++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    int64_t get_int() { return zigzag_decode(get_varint()); }
+
+    template <typename T>
+    std::vector<T> get_id_list() {
+        std::vector<T> ids;
+        uint64_t count = get_varint();
+        if (!ok_ || count > (uint64_t)(end_ - p_)) {  // every entry takes >= 1 byte
+            ok_ = false;
+            return ids;
+        }
+        ids.reserve(count);
+        uint64_t previous = 0;
+        for (uint64_t i = 0; i < count && ok_; ++i) {
+            previous += get_varint();
+            ids.push_back((T)previous);
+        }
+        return ids;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    bool ok_ = true;
+};
+
+// Recycles receive buffers so steady-state traffic does not allocate.
+class BufferPool {
+public:
+    std::vector<uint8_t> acquire(size_t size) {
+        std::vector<uint8_t> buf;
+        if (!free_.empty()) {
+            buf = std::move(free_.back());
+            free_.pop_back();
+        }
+        buf.resize(size);
+        return buf;
+    }
+
+    void release(std::vector<uint8_t>&& buf) {
+        buf.clear();
+        free_.push_back(std::move(buf));
+    }
+
+private:
+    std::vector<std::vector<uint8_t>> free_;
+};
+
+inline void send_encoded(const std::vector<uint8_t>& buf, int dest, int tag, MPI_Comm comm) {
+    MPI_Send(buf.data(), (int)buf.size(), MPI_BYTE, dest, tag, comm);
+}
+
+// Receives a message whose length is only known once it has arrived.
+inline std::vector<uint8_t> recv_encoded(BufferPool& pool, int source, int tag, MPI_Comm comm,
+                                         MPI_Status* status) {
+    MPI_Probe(source, tag, comm, status);
+    int count = 0;
+    MPI_Get_count(status, MPI_BYTE, &count);
+    std::vector<uint8_t> buf = pool.acquire(count);
+    MPI_Recv(buf.data(), count, MPI_BYTE, status->MPI_SOURCE, status->MPI_TAG, comm, status);
+    return buf;
+}
+
+inline void send_encoded(const std::vector<uint8_t>& buf, int dest, int tag, Comm& comm) {
+    comm.send(buf.data(), (int)buf.size(), dest, tag);
+}
+
+inline std::vector<uint8_t> recv_encoded(BufferPool& pool, int source, int tag, Comm& comm, CommStatus* status) {
+    comm.probe(source, tag, status);
+    std::vector<uint8_t> buf = pool.acquire(status->bytes);
+    comm.recv(buf.data(), status->bytes, status->source, status->tag, status);
+    return buf;
+}
+
+#endif
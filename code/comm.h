@@ -0,0 +1,1443 @@
+#ifndef COMM_H
+#define COMM_H
+
+// Messaging layer under the example programs, so the same program can run as
+// real MPI ranks or as thousands of virtual ranks inside one process.
+//
+// A program is written as int run(Comm& comm, int argc, char** argv) and
+// started with comm_main(argc, argv, run). Without options it runs on
+// MPI_COMM_WORLD. With --shm N it runs N ranks as threads of one process
+// (see ShmMailbox below). With --sim N it runs N virtual ranks in a
+// deterministic discrete-event simulator instead. Neither initialises MPI.
+// --trace PREFIX records a trace of every rank in any of the three modes
+// (see TraceComm below). The simulator options are:
+//
+//   --sim N             number of virtual ranks
+//   --sim-seed S        seed for the latency jitter and Comm::seed() (default 1)
+//   --sim-latency-us L  one-way latency of every message (default 5)
+//   --sim-jitter-us J   extra latency drawn uniformly from [0, J) (default 0)
+//   --sim-gbps B        link bandwidth, 0 for infinite (default 10)
+//   --sim-stack-kb K    stack of each virtual rank (default 64)
+//   --sim-quiet         discard the output of every rank but rank 0
+//
+// Every virtual rank is a fiber (ucontext) with its own stack. One fiber
+// runs at a time, until it blocks in recv(), probe(), sleep_us() or a
+// collective; computation takes no virtual time. Messages between a pair of
+// ranks arrive in the order they were sent, and events due at the same time
+// are ordered by a sequence number, so a run depends only on its options and
+// seed. The closing summary prints a digest of the delivery schedule for
+// checking that two runs replayed the same one.
+//
+// A rank that polls has to sleep or block between polls: a fiber spinning on
+// test() or iprobe() never gives the others a chance to send to it.
+
+#include <mpi.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+const int COMM_ANY_SOURCE = -1;
+const int COMM_ANY_TAG = -1;
+
+enum CommOp { COMM_SUM, COMM_MAX, COMM_MIN };
+
+struct CommStatus {
+    int source;
+    int tag;
+    int bytes;
+};
+
+typedef int CommRequest;
+const CommRequest COMM_REQUEST_NULL = -1;
+
+class Comm {
+public:
+    virtual ~Comm() {}
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    // Buffered: returns at once and buf may be reused immediately.
+    virtual void send(const void* buf, int bytes, int dest, int tag) = 0;
+    virtual void recv(void* buf, int bytes, int source, int tag, CommStatus* status = NULL) = 0;
+    virtual CommRequest irecv(void* buf, int bytes, int source, int tag) = 0;
+    // On completion the request is released and reset to COMM_REQUEST_NULL.
+    virtual bool test(CommRequest& request, CommStatus* status = NULL) = 0;
+    // Blocks until the receive completes, then as test().
+    virtual void wait(CommRequest& request, CommStatus* status = NULL) = 0;
+    virtual void cancel(CommRequest& request) = 0;
+    virtual bool iprobe(int source, int tag, CommStatus* status) = 0;
+    virtual void probe(int source, int tag, CommStatus* status) = 0;
+
+    virtual void barrier() = 0;
+    virtual void bcast(void* buf, int bytes, int root) = 0;
+    // out is only written on root.
+    virtual void reduce(const long long* in, long long* out, int count, CommOp op, int root) = 0;
+    virtual void allreduce(const long long* in, long long* out, int count, CommOp op) = 0;
+
+    // Seconds; virtual time in the simulator.
+    virtual double now() = 0;
+    virtual void sleep_us(long long us) = 0;
+    // Per-rank seed for the program's own random choices: time-based under
+    // MPI, derived from --sim-seed in the simulator.
+    virtual unsigned seed() const = 0;
+    virtual void abort(int code) = 0;
+    // The underlying communicator, or MPI_COMM_NULL for a virtual rank, for
+    // the phases (tree_comm.h, tree_io.h) that still need real MPI.
+    virtual MPI_Comm mpi_comm() const { return MPI_COMM_NULL; }
+
+    // Point-to-point traffic this rank has sent.
+    long long messages_sent() const { return messages_sent_; }
+    long long bytes_sent() const { return bytes_sent_; }
+
+protected:
+    void count_send(int bytes) {
+        messages_sent_++;
+        bytes_sent_ += bytes;
+    }
+
+private:
+    long long messages_sent_ = 0;
+    long long bytes_sent_ = 0;
+};
+
+class MpiComm : public Comm {
+public:
+    explicit MpiComm(MPI_Comm comm) : comm_(comm) {
+        MPI_Comm_rank(comm_, &rank_);
+        MPI_Comm_size(comm_, &size_);
+    }
+
+    ~MpiComm() { flush(); }
+
+    MpiComm(const MpiComm&) = delete;
+    MpiComm& operator=(const MpiComm&) = delete;
+
+    int rank() const { return rank_; }
+    int size() const { return size_; }
+
+    void send(const void* buf, int bytes, int dest, int tag) {
+        reap_sends();
+        sends_.push_back(PendingSend());
+        PendingSend& pending = sends_.back();
+        pending.data.assign((const char*)buf, (const char*)buf + bytes);
+        MPI_Isend(pending.data.data(), bytes, MPI_BYTE, dest, tag, comm_, &pending.request);
+        count_send(bytes);
+    }
+
+    void recv(void* buf, int bytes, int source, int tag, CommStatus* status = NULL) {
+        MPI_Status mpi_status;
+        MPI_Recv(buf, bytes, MPI_BYTE, source, tag, comm_, &mpi_status);
+        convert(mpi_status, status);
+    }
+
+    CommRequest irecv(void* buf, int bytes, int source, int tag) {
+        size_t slot = 0;
+        while (slot < requests_.size() && requests_[slot] != MPI_REQUEST_NULL) slot++;
+        if (slot == requests_.size()) requests_.push_back(MPI_REQUEST_NULL);
+        MPI_Irecv(buf, bytes, MPI_BYTE, source, tag, comm_, &requests_[slot]);
+        return (CommRequest)slot;
+    }
+
+    bool test(CommRequest& request, CommStatus* status = NULL) {
+        int flag = 0;
+        MPI_Status mpi_status;
+        MPI_Test(&requests_[request], &flag, &mpi_status);
+        if (!flag) return false;
+        convert(mpi_status, status);
+        request = COMM_REQUEST_NULL;
+        return true;
+    }
+
+    void wait(CommRequest& request, CommStatus* status = NULL) {
+        MPI_Status mpi_status;
+        MPI_Wait(&requests_[request], &mpi_status);
+        convert(mpi_status, status);
+        request = COMM_REQUEST_NULL;
+    }
+
+    void cancel(CommRequest& request) {
+        MPI_Cancel(&requests_[request]);
+        MPI_Wait(&requests_[request], MPI_STATUS_IGNORE);
+        request = COMM_REQUEST_NULL;
+    }
+
+    bool iprobe(int source, int tag, CommStatus* status) {
+        int flag = 0;
+        MPI_Status mpi_status;
+        MPI_Iprobe(source, tag, comm_, &flag, &mpi_status);
+        if (flag) convert(mpi_status, status);
+        return flag;
+    }
+
+    void probe(int source, int tag, CommStatus* status) {
+        MPI_Status mpi_status;
+        MPI_Probe(source, tag, comm_, &mpi_status);
+        convert(mpi_status, status);
+    }
+
+    void barrier() { MPI_Barrier(comm_); }
+    void bcast(void* buf, int bytes, int root) { MPI_Bcast(buf, bytes, MPI_BYTE, root, comm_); }
+
+    void reduce(const long long* in, long long* out, int count, CommOp op, int root) {
+        MPI_Reduce(in, out, count, MPI_LONG_LONG, mpi_op(op), root, comm_);
+    }
+
+    void allreduce(const long long* in, long long* out, int count, CommOp op) {
+        MPI_Allreduce(in, out, count, MPI_LONG_LONG, mpi_op(op), comm_);
+    }
+
+    double now() { return MPI_Wtime(); }
+    void sleep_us(long long us) { usleep(us); }
+    unsigned seed() const { return time(NULL) + rank_; }
+    void abort(int code) { MPI_Abort(comm_, code); }
+    MPI_Comm mpi_comm() const { return comm_; }
+
+    // Waits for every buffered send; call before MPI_Finalize.
+    void flush() {
+        int finalized = 0;
+        MPI_Finalized(&finalized);
+        if (finalized) return;
+        for (PendingSend& pending : sends_) MPI_Wait(&pending.request, MPI_STATUS_IGNORE);
+        sends_.clear();
+    }
+
+private:
+    struct PendingSend {
+        MPI_Request request = MPI_REQUEST_NULL;
+        std::vector<char> data;
+    };
+
+    void reap_sends() {
+        for (size_t i = 0; i < sends_.size();) {
+            int done = 0;
+            MPI_Test(&sends_[i].request, &done, MPI_STATUS_IGNORE);
+            if (!done) {
+                ++i;
+                continue;
+            }
+            std::swap(sends_[i], sends_.back());
+            sends_.pop_back();
+        }
+    }
+
+    static void convert(const MPI_Status& mpi_status, CommStatus* status) {
+        if (status == NULL) return;
+        status->source = mpi_status.MPI_SOURCE;
+        status->tag = mpi_status.MPI_TAG;
+        MPI_Get_count(&mpi_status, MPI_BYTE, &status->bytes);
+    }
+
+    static MPI_Op mpi_op(CommOp op) {
+        return op == COMM_SUM ? MPI_SUM : op == COMM_MAX ? MPI_MAX : MPI_MIN;
+    }
+
+    MPI_Comm comm_;
+    int rank_ = 0;
+    int size_ = 1;
+    std::vector<MPI_Request> requests_;
+    std::deque<PendingSend> sends_;
+};
+
+// Receive-side matching for the in-process backends. An arriving message
+// completes the oldest posted receive it matches or else waits, in arrival
+// order, for one; the same non-overtaking rule as MPI.
+class MatchingQueue {
+public:
+    struct Message {
+        int source;
+        int tag;
+        std::vector<char> data;
+    };
+
+    // True if a posted receive took the message.
+    bool arrive(int source, int tag, const char* data, int bytes) {
+        if (take_posted(source, tag, data, bytes)) return true;
+        unexpected_.push_back(Message());
+        Message& m = unexpected_.back();
+        m.source = source;
+        m.tag = tag;
+        m.data.assign(data, data + bytes);
+        return false;
+    }
+
+    bool arrive(Message&& m) {
+        if (take_posted(m.source, m.tag, m.data.data(), (int)m.data.size())) return true;
+        unexpected_.push_back(std::move(m));
+        return false;
+    }
+
+    CommRequest irecv(void* buf, int bytes, int source, int tag) {
+        size_t slot = 0;
+        while (slot < recvs_.size() && recvs_[slot].active) slot++;
+        if (slot == recvs_.size()) recvs_.push_back(PostedRecv());
+        PostedRecv& recv = recvs_[slot];
+        recv.active = true;
+        recv.done = false;
+        recv.buf = buf;
+        recv.bytes = bytes;
+        recv.source = source;
+        recv.tag = tag;
+        for (size_t i = 0; i < unexpected_.size(); ++i) {
+            Message& m = unexpected_[i];
+            if (!matches(source, tag, m.source, m.tag)) continue;
+            complete(recv, m.source, m.tag, m.data.data(), (int)m.data.size());
+            unexpected_.erase(unexpected_.begin() + i);
+            return (CommRequest)slot;
+        }
+        posted_.push_back((int)slot);
+        return (CommRequest)slot;
+    }
+
+    bool test(CommRequest& request, CommStatus* status) {
+        PostedRecv& recv = recvs_[request];
+        if (!recv.done) return false;
+        if (status != NULL) *status = recv.status;
+        recv.active = false;
+        request = COMM_REQUEST_NULL;
+        return true;
+    }
+
+    void cancel(CommRequest& request) {
+        for (size_t i = 0; i < posted_.size(); ++i) {
+            if (posted_[i] == request) {
+                posted_.erase(posted_.begin() + i);
+                break;
+            }
+        }
+        recvs_[request].active = false;
+        request = COMM_REQUEST_NULL;
+    }
+
+    // Oldest unmatched message that a receive for (source, tag) would take.
+    bool probe(int source, int tag, CommStatus* status) const {
+        for (const Message& m : unexpected_) {
+            if (!matches(source, tag, m.source, m.tag)) continue;
+            if (status != NULL) {
+                status->source = m.source;
+                status->tag = m.tag;
+                status->bytes = (int)m.data.size();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct PostedRecv {
+        bool active = false;
+        bool done = false;
+        void* buf = NULL;
+        int bytes = 0;
+        int source = 0;
+        int tag = 0;
+        CommStatus status;
+    };
+
+    static bool matches(int want_source, int want_tag, int source, int tag) {
+        return (want_source == COMM_ANY_SOURCE || want_source == source) &&
+               (want_tag == COMM_ANY_TAG || want_tag == tag);
+    }
+
+    bool take_posted(int source, int tag, const char* data, int bytes) {
+        for (size_t i = 0; i < posted_.size(); ++i) {
+            PostedRecv& recv = recvs_[posted_[i]];
+            if (!matches(recv.source, recv.tag, source, tag)) continue;
+            complete(recv, source, tag, data, bytes);
+            posted_.erase(posted_.begin() + i);
+            return true;
+        }
+        return false;
+    }
+
+    static void complete(PostedRecv& recv, int source, int tag, const char* data, int bytes) {
+        if (bytes > recv.bytes) {
+            std::cerr << "Message of " << bytes << " bytes from rank " << source << " (tag " << tag
+                      << ") truncated to " << recv.bytes << std::endl;
+            std::exit(1);
+        }
+        if (bytes > 0) std::memcpy(recv.buf, data, bytes);
+        recv.done = true;
+        recv.status.source = source;
+        recv.status.tag = tag;
+        recv.status.bytes = bytes;
+    }
+
+    std::deque<Message> unexpected_;
+    std::vector<PostedRecv> recvs_;       // indexed by CommRequest
+    std::vector<int> posted_;             // unmatched receives, in posting order
+};
+
+struct SimOptions {
+    int ranks = 0;
+    uint64_t seed = 1;
+    double latency_us = 5;
+    double jitter_us = 0;
+    double gbps = 10;
+    size_t stack_bytes = 64 * 1024;
+    bool quiet = false;
+};
+
+// Reads the --sim options; false if --sim is absent.
+inline bool parse_sim_options(int argc, char** argv, SimOptions& options) {
+    bool sim = false;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--sim") == 0 && has_value) {
+            options.ranks = std::atoi(argv[++i]);
+            sim = true;
+        } else if (std::strcmp(argv[i], "--sim-seed") == 0 && has_value) {
+            options.seed = std::strtoull(argv[++i], NULL, 10);
+        } else if (std::strcmp(argv[i], "--sim-latency-us") == 0 && has_value) {
+            options.latency_us = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--sim-jitter-us") == 0 && has_value) {
+            options.jitter_us = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--sim-gbps") == 0 && has_value) {
+            options.gbps = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--sim-stack-kb") == 0 && has_value) {
+            options.stack_bytes = (size_t)std::atoi(argv[++i]) * 1024;
+        } else if (std::strcmp(argv[i], "--sim-quiet") == 0) {
+            options.quiet = true;
+        }
+    }
+    return sim;
+}
+
+inline uint64_t sim_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+class Simulator;
+
+class SimComm : public Comm {
+public:
+    SimComm(Simulator* sim, int rank) : sim_(sim), rank_(rank) {}
+
+    int rank() const { return rank_; }
+    int size() const;
+
+    void send(const void* buf, int bytes, int dest, int tag);
+    void recv(void* buf, int bytes, int source, int tag, CommStatus* status = NULL);
+    CommRequest irecv(void* buf, int bytes, int source, int tag);
+    bool test(CommRequest& request, CommStatus* status = NULL);
+    void wait(CommRequest& request, CommStatus* status = NULL);
+    void cancel(CommRequest& request);
+    bool iprobe(int source, int tag, CommStatus* status);
+    void probe(int source, int tag, CommStatus* status);
+
+    void barrier();
+    void bcast(void* buf, int bytes, int root);
+    void reduce(const long long* in, long long* out, int count, CommOp op, int root);
+    void allreduce(const long long* in, long long* out, int count, CommOp op);
+
+    double now();
+    void sleep_us(long long us);
+    unsigned seed() const;
+    void abort(int code);
+
+private:
+    Simulator* sim_;
+    int rank_;
+};
+
+class Simulator {
+public:
+    typedef std::function<int(Comm&)> Body;
+
+    explicit Simulator(const SimOptions& options) : options_(options), jitter_rng_(options.seed) {}
+
+    ~Simulator() {
+        if (stacks_ != NULL) munmap(stacks_, stack_region_bytes());
+    }
+
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+
+    // Runs body on every virtual rank until all have returned and gives back
+    // the largest exit code. A deadlock is reported and exits the process.
+    int run(const Body& body) {
+        const int n = options_.ranks;
+        if (n < 1) {
+            std::cerr << "--sim needs at least one rank" << std::endl;
+            return 1;
+        }
+        stacks_ = (char*)mmap(NULL, stack_region_bytes(), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (stacks_ == MAP_FAILED) {
+            stacks_ = NULL;
+            std::cerr << "Could not map " << stack_region_bytes() << " bytes of fiber stacks" << std::endl;
+            return 1;
+        }
+        body_ = &body;
+        active() = this;
+        ranks_.resize(n);
+        comms_.reserve(n);
+        for (int r = 0; r < n; ++r) {
+            comms_.emplace_back(this, r);
+            VirtualRank& vr = ranks_[r];
+            getcontext(&vr.context);
+            vr.context.uc_stack.ss_sp = stacks_ + (size_t)r * options_.stack_bytes;
+            vr.context.uc_stack.ss_size = options_.stack_bytes;
+            vr.context.uc_link = &scheduler_;
+            makecontext(&vr.context, &Simulator::fiber_entry, 0);
+            ready_.push_back(r);
+        }
+
+        std::streambuf* stdout_buf = std::cout.rdbuf();
+        auto wall_start = std::chrono::steady_clock::now();
+        while (true) {
+            while (!ready_.empty()) {
+                current_ = ready_.front();
+                ready_.pop_front();
+                ranks_[current_].state = RUNNING;
+                if (options_.quiet) std::cout.rdbuf(current_ == 0 ? stdout_buf : &discard_);
+                switches_++;
+                swapcontext(&scheduler_, &ranks_[current_].context);
+                if (ranks_[current_].state == DONE) {
+                    finished_++;
+                    madvise(ranks_[current_].context.uc_stack.ss_sp, options_.stack_bytes, MADV_DONTNEED);
+                }
+            }
+            if (events_.empty()) break;
+            Event event = events_.top();
+            events_.pop();
+            now_ = event.time;
+            events_processed_++;
+            if (event.message >= 0) deliver(event.rank, event.message);
+            else wake(event.rank, WAIT_TIMER);
+        }
+        std::cout.rdbuf(stdout_buf);
+        wall_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        active() = NULL;
+
+        if (finished_ < n) {
+            std::cout << "Simulation deadlocked at " << now_ << " s: " << n - finished_ << " of " << n
+                      << " ranks blocked";
+            int shown = 0;
+            for (int r = 0; r < n && shown < 10; ++r) {
+                if (ranks_[r].state == DONE) continue;
+                std::cout << (shown++ ? ", " : " (") << r
+                          << (ranks_[r].state == WAIT_MESSAGE ? " in receive" : " in collective or sleep");
+            }
+            std::cout << (shown ? ")" : "") << std::endl;
+            print_summary(std::cout);
+            std::exit(2);
+        }
+        int code = 0;
+        for (const VirtualRank& vr : ranks_) code = std::max(code, vr.exit_code);
+        return code;
+    }
+
+    void print_summary(std::ostream& out) const {
+        out << "Simulated " << options_.ranks << " ranks: " << messages_ << " messages, " << bytes_
+            << " bytes, " << collectives_ << " collectives, " << now_ << " s virtual, " << wall_seconds_
+            << " s wall (" << events_processed_ << " events, " << switches_ << " context switches)" << std::endl;
+        out << "Schedule digest: " << std::hex << digest_ << std::dec << " (seed " << options_.seed << ")"
+            << std::endl;
+    }
+
+    long long messages() const { return messages_; }
+    uint64_t digest() const { return digest_; }
+
+private:
+    friend class SimComm;
+
+    enum State { READY, RUNNING, WAIT_MESSAGE, WAIT_TIMER, DONE };
+
+    typedef MatchingQueue::Message Message;
+
+    struct VirtualRank {
+        ucontext_t context;
+        State state = READY;
+        int exit_code = 0;
+        MatchingQueue queue;
+    };
+
+    // A delivery (message >= 0, an index into in_flight_) or a wake-up.
+    struct Event {
+        double time;
+        uint64_t seq;
+        int rank;
+        int message;
+
+        bool operator>(const Event& other) const {
+            return time != other.time ? time > other.time : seq > other.seq;
+        }
+    };
+
+    // Swallows the output of muted ranks.
+    class DiscardBuf : public std::streambuf {
+    protected:
+        int overflow(int c) { return c; }
+        std::streamsize xsputn(const char*, std::streamsize n) { return n; }
+    };
+
+    static Simulator*& active() {
+        static Simulator* sim = NULL;
+        return sim;
+    }
+
+    static void fiber_entry() {
+        Simulator* sim = active();
+        int r = sim->current_;
+        sim->ranks_[r].exit_code = (*sim->body_)(sim->comms_[r]);
+        sim->ranks_[r].state = DONE;
+    }
+
+    size_t stack_region_bytes() const { return (size_t)options_.ranks * options_.stack_bytes; }
+
+    // Gives the processor back to the scheduler until woken.
+    void block(State state) {
+        int r = current_;
+        ranks_[r].state = state;
+        swapcontext(&ranks_[r].context, &scheduler_);
+    }
+
+    void wake(int r, State waiting_for) {
+        if (ranks_[r].state != waiting_for) return;
+        ranks_[r].state = READY;
+        ready_.push_back(r);
+    }
+
+    void schedule(double time, int rank, int message) {
+        Event event = {time, next_seq_++, rank, message};
+        events_.push(event);
+    }
+
+    void send(int source, const void* buf, int bytes, int dest, int tag) {
+        if (dest < 0 || dest >= options_.ranks) {
+            std::cerr << "Rank " << source << ": send to invalid rank " << dest << std::endl;
+            std::exit(1);
+        }
+        int slot;
+        if (!free_messages_.empty()) {
+            slot = free_messages_.back();
+            free_messages_.pop_back();
+        } else {
+            slot = (int)in_flight_.size();
+            in_flight_.push_back(Message());
+        }
+        Message& m = in_flight_[slot];
+        m.source = source;
+        m.tag = tag;
+        m.data.assign((const char*)buf, (const char*)buf + bytes);
+
+        double delay = options_.latency_us * 1e-6;
+        if (options_.gbps > 0) delay += bytes * 8 / (options_.gbps * 1e9);
+        if (options_.jitter_us > 0) {
+            delay += std::uniform_real_distribution<double>(0, options_.jitter_us * 1e-6)(jitter_rng_);
+        }
+        // No overtaking between a pair of ranks.
+        double& last = last_arrival_[(uint64_t)source * options_.ranks + dest];
+        double arrival = std::max(now_ + delay, last);
+        last = arrival;
+        schedule(arrival, dest, slot);
+        messages_++;
+        bytes_ += bytes;
+    }
+
+    void deliver(int dest, int slot) {
+        Message& m = in_flight_[slot];
+        digest_ = sim_mix(digest_ ^ (uint64_t)std::llround(now_ * 1e9));
+        digest_ = sim_mix(digest_ ^ ((uint64_t)m.source << 32 | (uint32_t)dest));
+        digest_ = sim_mix(digest_ ^ ((uint64_t)(uint32_t)m.tag << 32 | (uint32_t)m.data.size()));
+
+        ranks_[dest].queue.arrive(std::move(m));
+        m.data.clear();
+        free_messages_.push_back(slot);
+        wake(dest, WAIT_MESSAGE);
+    }
+
+    // Collectives complete once every rank has entered them, one tree
+    // round trip of latency after the last arrival.
+    void collective_arrive() {
+        if (++collective_arrived_ == options_.ranks) {
+            collective_arrived_ = 0;
+            collective_result_.swap(collective_accum_);
+            collective_accum_.clear();
+            collective_bytes_result_.swap(collective_bytes_);
+            collective_bytes_.clear();
+            collectives_++;
+            double depth = std::ceil(std::log2((double)std::max(options_.ranks, 2)));
+            double done = now_ + 2 * depth * options_.latency_us * 1e-6;
+            for (int r = 0; r < options_.ranks; ++r) schedule(done, r, -1);
+        }
+        block(WAIT_TIMER);
+    }
+
+    void combine(const long long* in, int count, CommOp op) {
+        if (collective_accum_.empty()) {
+            collective_accum_.assign(in, in + count);
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            long long& acc = collective_accum_[i];
+            if (op == COMM_SUM) acc += in[i];
+            else if (op == COMM_MAX) acc = std::max(acc, in[i]);
+            else acc = std::min(acc, in[i]);
+        }
+    }
+
+    SimOptions options_;
+    std::mt19937_64 jitter_rng_;
+    const Body* body_ = NULL;
+    char* stacks_ = NULL;
+    ucontext_t scheduler_;
+    std::vector<VirtualRank> ranks_;
+    std::vector<SimComm> comms_;
+    std::deque<int> ready_;
+    int current_ = -1;
+    int finished_ = 0;
+    double now_ = 0;
+    uint64_t next_seq_ = 0;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+    std::vector<Message> in_flight_;
+    std::vector<int> free_messages_;
+    std::unordered_map<uint64_t, double> last_arrival_;
+    int collective_arrived_ = 0;
+    std::vector<long long> collective_accum_, collective_result_;
+    std::vector<char> collective_bytes_, collective_bytes_result_;
+    DiscardBuf discard_;
+
+    long long messages_ = 0;
+    long long bytes_ = 0;
+    long long collectives_ = 0;
+    long long events_processed_ = 0;
+    long long switches_ = 0;
+    uint64_t digest_ = 0;
+    double wall_seconds_ = 0;
+};
+
+inline int SimComm::size() const { return sim_->options_.ranks; }
+
+inline void SimComm::send(const void* buf, int bytes, int dest, int tag) {
+    sim_->send(rank_, buf, bytes, dest, tag);
+    count_send(bytes);
+}
+
+inline void SimComm::recv(void* buf, int bytes, int source, int tag, CommStatus* status) {
+    CommRequest request = irecv(buf, bytes, source, tag);
+    wait(request, status);
+}
+
+inline CommRequest SimComm::irecv(void* buf, int bytes, int source, int tag) {
+    return sim_->ranks_[rank_].queue.irecv(buf, bytes, source, tag);
+}
+
+inline bool SimComm::test(CommRequest& request, CommStatus* status) {
+    return sim_->ranks_[rank_].queue.test(request, status);
+}
+
+inline void SimComm::wait(CommRequest& request, CommStatus* status) {
+    while (!test(request, status)) sim_->block(Simulator::WAIT_MESSAGE);
+}
+
+inline void SimComm::cancel(CommRequest& request) { sim_->ranks_[rank_].queue.cancel(request); }
+
+inline bool SimComm::iprobe(int source, int tag, CommStatus* status) {
+    return sim_->ranks_[rank_].queue.probe(source, tag, status);
+}
+
+inline void SimComm::probe(int source, int tag, CommStatus* status) {
+    while (!iprobe(source, tag, status)) sim_->block(Simulator::WAIT_MESSAGE);
+}
+
+inline void SimComm::barrier() { sim_->collective_arrive(); }
+
+inline void SimComm::bcast(void* buf, int bytes, int root) {
+    if (rank_ == root) sim_->collective_bytes_.assign((const char*)buf, (const char*)buf + bytes);
+    sim_->collective_arrive();
+    if (rank_ != root && bytes > 0) std::memcpy(buf, sim_->collective_bytes_result_.data(), bytes);
+}
+
+inline void SimComm::reduce(const long long* in, long long* out, int count, CommOp op, int root) {
+    sim_->combine(in, count, op);
+    sim_->collective_arrive();
+    if (rank_ == root) std::copy(sim_->collective_result_.begin(), sim_->collective_result_.begin() + count, out);
+}
+
+inline void SimComm::allreduce(const long long* in, long long* out, int count, CommOp op) {
+    sim_->combine(in, count, op);
+    sim_->collective_arrive();
+    std::copy(sim_->collective_result_.begin(), sim_->collective_result_.begin() + count, out);
+}
+
+inline double SimComm::now() { return sim_->now_; }
+
+inline void SimComm::sleep_us(long long us) {
+    if (us <= 0) return;
+    sim_->schedule(sim_->now_ + us * 1e-6, rank_, -1);
+    sim_->block(Simulator::WAIT_TIMER);
+}
+
+inline unsigned SimComm::seed() const { return (unsigned)sim_mix(sim_->options_.seed ^ sim_mix(rank_)); }
+
+inline void SimComm::abort(int code) {
+    std::cout.flush();
+    std::cerr << "Rank " << rank_ << " aborted the simulation with code " << code << std::endl;
+    std::exit(code);
+}
+
+// --shm N runs the ranks as threads, for single-node runs where the MPI
+// stack costs far more than a 4-byte message. Each rank owns a bounded
+// multi-producer single-consumer mailbox: a ring of pre-allocated slots in
+// the style of Vyukov's bounded queue. A sender claims a slot with one
+// compare-and-swap on the tail and publishes it through the slot's sequence
+// number; the owner pops without any read-modify-write. Payloads up to
+// SHM_INLINE_BYTES travel inside the slot, larger ones as a heap copy. The
+// head and tail indices sit on cache lines of their own.
+//
+// A sender that finds a ring full drains its own mailbox while it waits, and
+// so does every waiting rank, so ranks flooding each other cannot deadlock.
+// Waits spin briefly and then yield the core.
+
+const int SHM_CACHE_LINE = 64;
+const int SHM_INLINE_BYTES = 88;
+const size_t SHM_DEFAULT_SLOTS = 1024;
+
+class ShmMailbox {
+public:
+    explicit ShmMailbox(size_t slots) {
+        capacity_ = 1;
+        while (capacity_ < slots) capacity_ <<= 1;
+        mask_ = capacity_ - 1;
+        cells_.reset(new Cell[capacity_]);
+        for (size_t i = 0; i < capacity_; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~ShmMailbox() {
+        while (try_pop([](int, int, const char*, int) {})) {}
+    }
+
+    ShmMailbox(const ShmMailbox&) = delete;
+    ShmMailbox& operator=(const ShmMailbox&) = delete;
+
+    // Any thread. False if the ring is full.
+    bool try_push(int source, int tag, const void* buf, int bytes) {
+        uint64_t pos = tail_.value.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(sequence - pos);
+            if (diff == 0) {
+                if (tail_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.value.load(std::memory_order_relaxed);
+            }
+        }
+        cell->source = source;
+        cell->tag = tag;
+        cell->bytes = bytes;
+        cell->heap = NULL;
+        char* data = cell->data;
+        if (bytes > SHM_INLINE_BYTES) data = cell->heap = new char[bytes];
+        if (bytes > 0) std::memcpy(data, buf, bytes);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only. Hands the oldest message to fn(source, tag, data, bytes).
+    template <typename Fn>
+    bool try_pop(Fn&& fn) {
+        uint64_t pos = head_.value;
+        Cell& cell = cells_[pos & mask_];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1) return false;
+        fn(cell.source, cell.tag, cell.heap != NULL ? cell.heap : cell.data, cell.bytes);
+        delete[] cell.heap;
+        cell.sequence.store(pos + capacity_, std::memory_order_release);
+        head_.value = pos + 1;
+        return true;
+    }
+
+private:
+    struct alignas(SHM_CACHE_LINE) Cell {
+        std::atomic<uint64_t> sequence;
+        int source;
+        int tag;
+        int bytes;
+        char* heap;
+        char data[SHM_INLINE_BYTES];
+    };
+
+    struct alignas(SHM_CACHE_LINE) ProducerIndex {
+        std::atomic<uint64_t> value{0};
+    };
+
+    struct alignas(SHM_CACHE_LINE) ConsumerIndex {
+        uint64_t value = 0;
+    };
+
+    ProducerIndex tail_;
+    ConsumerIndex head_;
+    size_t capacity_;
+    size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+};
+
+class ThreadComm;
+
+// State shared by the threads of a --shm run.
+class ShmWorld {
+public:
+    typedef std::function<int(Comm&)> Body;
+
+    ShmWorld(int ranks, size_t slots) : ranks_(ranks), contributions_(ranks) {
+        for (int r = 0; r < ranks; ++r) mailboxes_.emplace_back(new ShmMailbox(slots));
+    }
+
+    int size() const { return ranks_; }
+    ShmMailbox& mailbox(int rank) { return *mailboxes_[rank]; }
+    double elapsed() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count(); }
+
+    // Runs body on one thread per rank and gives back the largest exit code.
+    int run(const Body& body);
+    void print_summary(std::ostream& out) const {
+        out << "Shared-memory run: " << ranks_ << " threads, " << messages_ << " messages, " << bytes_
+            << " bytes, " << wall_seconds_ << " s wall" << std::endl;
+    }
+
+private:
+    friend class ThreadComm;
+
+    int ranks_;
+    std::vector<std::unique_ptr<ShmMailbox>> mailboxes_;
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+
+    // Sense-reversing barrier; the collectives are built on it.
+    alignas(SHM_CACHE_LINE) std::atomic<int> arrived_{0};
+    alignas(SHM_CACHE_LINE) std::atomic<uint64_t> generation_{0};
+    std::vector<std::vector<long long>> contributions_;
+    std::vector<char> bcast_bytes_;
+
+    long long messages_ = 0;
+    long long bytes_ = 0;
+    double wall_seconds_ = 0;
+};
+
+class ThreadComm : public Comm {
+public:
+    ThreadComm(ShmWorld* world, int rank) : world_(world), rank_(rank) {}
+
+    int rank() const { return rank_; }
+    int size() const { return world_->size(); }
+
+    void send(const void* buf, int bytes, int dest, int tag) {
+        if (dest < 0 || dest >= size()) {
+            std::cerr << "Rank " << rank_ << ": send to invalid rank " << dest << std::endl;
+            std::exit(1);
+        }
+        ShmMailbox& box = world_->mailbox(dest);
+        if (!box.try_push(rank_, tag, buf, bytes)) {
+            wait([&] { return box.try_push(rank_, tag, buf, bytes); });
+        }
+        count_send(bytes);
+    }
+
+    void recv(void* buf, int bytes, int source, int tag, CommStatus* status = NULL) {
+        CommRequest request = irecv(buf, bytes, source, tag);
+        wait(request, status);
+    }
+
+    CommRequest irecv(void* buf, int bytes, int source, int tag) {
+        drain();
+        return queue_.irecv(buf, bytes, source, tag);
+    }
+
+    bool test(CommRequest& request, CommStatus* status = NULL) {
+        if (queue_.test(request, status)) return true;
+        drain();
+        return queue_.test(request, status);
+    }
+
+    void wait(CommRequest& request, CommStatus* status = NULL) {
+        wait([&] { return queue_.test(request, status); });
+    }
+
+    void cancel(CommRequest& request) { queue_.cancel(request); }
+
+    bool iprobe(int source, int tag, CommStatus* status) {
+        drain();
+        return queue_.probe(source, tag, status);
+    }
+
+    void probe(int source, int tag, CommStatus* status) {
+        wait([&] { return queue_.probe(source, tag, status); });
+    }
+
+    void barrier() {
+        uint64_t generation = world_->generation_.load(std::memory_order_acquire);
+        if (world_->arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == size()) {
+            world_->arrived_.store(0, std::memory_order_relaxed);
+            world_->generation_.store(generation + 1, std::memory_order_release);
+            return;
+        }
+        wait([&] { return world_->generation_.load(std::memory_order_acquire) != generation; });
+    }
+
+    // The second barrier of each collective keeps the next one from
+    // overwriting the shared buffers while a rank still reads them.
+    void bcast(void* buf, int bytes, int root) {
+        if (rank_ == root) world_->bcast_bytes_.assign((const char*)buf, (const char*)buf + bytes);
+        barrier();
+        if (rank_ != root && bytes > 0) std::memcpy(buf, world_->bcast_bytes_.data(), bytes);
+        barrier();
+    }
+
+    void reduce(const long long* in, long long* out, int count, CommOp op, int root) {
+        world_->contributions_[rank_].assign(in, in + count);
+        barrier();
+        if (rank_ == root) combine(out, count, op);
+        barrier();
+    }
+
+    void allreduce(const long long* in, long long* out, int count, CommOp op) {
+        world_->contributions_[rank_].assign(in, in + count);
+        barrier();
+        combine(out, count, op);
+        barrier();
+    }
+
+    double now() { return world_->elapsed(); }
+
+    void sleep_us(long long us) {
+        drain();
+        usleep(us);
+    }
+
+    unsigned seed() const { return time(NULL) + rank_; }
+
+    void abort(int code) {
+        std::cout.flush();
+        std::cerr << "Rank " << rank_ << " aborted with code " << code << std::endl;
+        std::_Exit(code);
+    }
+
+private:
+    // Moves everything in this rank's ring into the matching queue, straight
+    // into a posted receive's buffer where one matches.
+    void drain() {
+        ShmMailbox& box = world_->mailbox(rank_);
+        while (box.try_pop([this](int source, int tag, const char* data, int bytes) {
+            queue_.arrive(source, tag, data, bytes);
+        })) {}
+    }
+
+    template <typename Pred>
+    void wait(Pred done) {
+        for (int spins = 0;; ++spins) {
+            drain();
+            if (done()) return;
+            if (spins >= 64) std::this_thread::yield();
+        }
+    }
+
+    void combine(long long* out, int count, CommOp op) {
+        for (int i = 0; i < count; ++i) {
+            long long acc = world_->contributions_[0][i];
+            for (int r = 1; r < size(); ++r) {
+                long long v = world_->contributions_[r][i];
+                acc = op == COMM_SUM ? acc + v : op == COMM_MAX ? std::max(acc, v) : std::min(acc, v);
+            }
+            out[i] = acc;
+        }
+    }
+
+    ShmWorld* world_;
+    int rank_;
+    MatchingQueue queue_;
+};
+
+inline int ShmWorld::run(const Body& body) {
+    std::vector<std::unique_ptr<ThreadComm>> comms;
+    for (int r = 0; r < ranks_; ++r) comms.emplace_back(new ThreadComm(this, r));
+    std::vector<int> codes(ranks_, 0);
+    start_ = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int r = 0; r < ranks_; ++r) {
+        threads.emplace_back([&, r] { codes[r] = body(*comms[r]); });
+    }
+    for (std::thread& t : threads) t.join();
+    wall_seconds_ = elapsed();
+    for (const std::unique_ptr<ThreadComm>& comm : comms) {
+        messages_ += comm->messages_sent();
+        bytes_ += comm->bytes_sent();
+    }
+    return *std::max_element(codes.begin(), codes.end());
+}
+
+// Tracing (--trace PREFIX): every rank's Comm is wrapped in a TraceComm that
+// records its sends, receives, collectives and sleeps, and the time from each
+// receive to the rank's next call into the Comm as the handler of that
+// message. Every message carries a 16-byte header with the sender's Lamport
+// clock and a per-sender sequence number, so a receive names the send it
+// matches. The records stay in memory and are written to PREFIX.<rank>.trace
+// when the rank finishes; trace_export.cpp merges the files into one
+// Chrome-trace/Perfetto JSON file with a flow arrow from each send to its
+// receive.
+//
+// Under MPI the clocks of different processes disagree, so before the
+// program starts rank 0 ping-pongs with every other rank and keeps, per rank,
+// the clock offset seen on the round trip with the shortest time; the offset
+// goes into the file header and the exporter subtracts it. Threads and
+// virtual ranks share one clock and skip this.
+
+const int TRACE_CALIBRATION_TAG = 32000;
+const int TRACE_CALIBRATION_ROUNDS = 16;
+
+enum TraceKind { TRACE_SEND, TRACE_RECV, TRACE_HANDLER, TRACE_COLLECTIVE, TRACE_SLEEP };
+// TraceRecord::tag of a TRACE_COLLECTIVE record.
+enum TraceCollective { TRACE_BARRIER, TRACE_BCAST, TRACE_REDUCE, TRACE_ALLREDUCE };
+
+struct TraceRecord {
+    int64_t start_ns;
+    int64_t end_ns;
+    int32_t kind;
+    int32_t peer;     // destination of a send, source of a receive
+    int32_t tag;
+    int32_t bytes;    // payload, without the trace header
+    int64_t seq;      // the sender's sequence number of the message
+    int64_t lamport;  // clock after the event
+};
+
+const char TRACE_FILE_MAGIC[8] = {'T', 'R', 'A', 'C', 'E', 'E', 'V', '1'};
+
+struct TraceFileHeader {
+    char magic[8];
+    int32_t rank;
+    int32_t size;
+    int64_t offset_ns;   // this rank's clock minus rank 0's
+    int64_t records;
+    int64_t reserved[3];
+};
+
+class TraceComm : public Comm {
+public:
+    // Collective: calibrates the clocks under MPI.
+    TraceComm(Comm& inner, const std::string& prefix) : inner_(inner), prefix_(prefix) {
+        if (inner_.mpi_comm() != MPI_COMM_NULL && inner_.size() > 1) calibrate();
+    }
+
+    ~TraceComm() {
+        enter();
+        std::string path = prefix_ + "." + std::to_string(rank()) + ".trace";
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == NULL) {
+            std::cerr << "Could not write " << path << std::endl;
+            return;
+        }
+        TraceFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, TRACE_FILE_MAGIC, 8);
+        header.rank = rank();
+        header.size = size();
+        header.offset_ns = offset_ns_;
+        header.records = records_.size();
+        std::fwrite(&header, sizeof(header), 1, file);
+        std::fwrite(records_.data(), sizeof(TraceRecord), records_.size(), file);
+        std::fclose(file);
+    }
+
+    TraceComm(const TraceComm&) = delete;
+    TraceComm& operator=(const TraceComm&) = delete;
+
+    Comm& inner() { return inner_; }
+
+    int rank() const { return inner_.rank(); }
+    int size() const { return inner_.size(); }
+
+    void send(const void* buf, int bytes, int dest, int tag) {
+        enter();
+        int64_t start = now_ns();
+        Header header = {++lamport_, next_seq_++};
+        scratch_.resize(sizeof(Header) + bytes);
+        std::memcpy(scratch_.data(), &header, sizeof(Header));
+        if (bytes > 0) std::memcpy(scratch_.data() + sizeof(Header), buf, bytes);
+        inner_.send(scratch_.data(), scratch_.size(), dest, tag);
+        count_send(bytes);
+        add(TRACE_SEND, start, dest, tag, bytes, header.seq);
+    }
+
+    void recv(void* buf, int bytes, int source, int tag, CommStatus* status = NULL) {
+        enter();
+        int64_t start = now_ns();
+        std::vector<char> data(sizeof(Header) + bytes);
+        CommStatus s;
+        inner_.recv(data.data(), data.size(), source, tag, &s);
+        unwrap(data, buf, bytes, s, start);
+        if (status != NULL) *status = s;
+    }
+
+    CommRequest irecv(void* buf, int bytes, int source, int tag) {
+        enter();
+        PendingRecv pending;
+        pending.buf = buf;
+        pending.bytes = bytes;
+        pending.data.resize(sizeof(Header) + bytes);
+        CommRequest request = inner_.irecv(pending.data.data(), pending.data.size(), source, tag);
+        pending_[request] = std::move(pending);
+        return request;
+    }
+
+    bool test(CommRequest& request, CommStatus* status = NULL) {
+        enter();
+        int64_t start = now_ns();
+        CommRequest key = request;
+        CommStatus s;
+        if (!inner_.test(request, &s)) return false;
+        PendingRecv& pending = pending_[key];
+        unwrap(pending.data, pending.buf, pending.bytes, s, start);
+        pending_.erase(key);
+        if (status != NULL) *status = s;
+        return true;
+    }
+
+    void wait(CommRequest& request, CommStatus* status = NULL) {
+        enter();
+        int64_t start = now_ns();
+        CommRequest key = request;
+        CommStatus s;
+        inner_.wait(request, &s);
+        PendingRecv& pending = pending_[key];
+        unwrap(pending.data, pending.buf, pending.bytes, s, start);
+        pending_.erase(key);
+        if (status != NULL) *status = s;
+    }
+
+    void cancel(CommRequest& request) {
+        enter();
+        CommRequest key = request;
+        inner_.cancel(request);
+        pending_.erase(key);
+    }
+
+    bool iprobe(int source, int tag, CommStatus* status) {
+        enter();
+        CommStatus s;
+        if (!inner_.iprobe(source, tag, &s)) return false;
+        s.bytes -= sizeof(Header);
+        if (status != NULL) *status = s;
+        return true;
+    }
+
+    void probe(int source, int tag, CommStatus* status) {
+        enter();
+        CommStatus s;
+        inner_.probe(source, tag, &s);
+        s.bytes -= sizeof(Header);
+        if (status != NULL) *status = s;
+    }
+
+    void barrier() {
+        int64_t start = begin();
+        inner_.barrier();
+        add(TRACE_COLLECTIVE, start, -1, TRACE_BARRIER, 0, 0);
+    }
+
+    void bcast(void* buf, int bytes, int root) {
+        int64_t start = begin();
+        inner_.bcast(buf, bytes, root);
+        add(TRACE_COLLECTIVE, start, root, TRACE_BCAST, bytes, 0);
+    }
+
+    void reduce(const long long* in, long long* out, int count, CommOp op, int root) {
+        int64_t start = begin();
+        inner_.reduce(in, out, count, op, root);
+        add(TRACE_COLLECTIVE, start, root, TRACE_REDUCE, count * sizeof(long long), 0);
+    }
+
+    void allreduce(const long long* in, long long* out, int count, CommOp op) {
+        int64_t start = begin();
+        inner_.allreduce(in, out, count, op);
+        add(TRACE_COLLECTIVE, start, -1, TRACE_ALLREDUCE, count * sizeof(long long), 0);
+    }
+
+    double now() { return inner_.now(); }
+
+    void sleep_us(long long us) {
+        int64_t start = begin();
+        inner_.sleep_us(us);
+        add(TRACE_SLEEP, start, -1, 0, 0, 0);
+    }
+
+    unsigned seed() const { return inner_.seed(); }
+    void abort(int code) { inner_.abort(code); }
+    MPI_Comm mpi_comm() const { return inner_.mpi_comm(); }
+
+private:
+    struct Header {
+        int64_t lamport;
+        int64_t seq;
+    };
+
+    struct PendingRecv {
+        void* buf;
+        int bytes;
+        std::vector<char> data;
+    };
+
+    int64_t now_ns() { return (int64_t)(inner_.now() * 1e9); }
+
+    // Closes the handler of the last message received, if one is open.
+    void enter() {
+        if (!handling_) return;
+        handling_ = false;
+        records_.push_back({handler_start_, now_ns(), TRACE_HANDLER, handler_source_, handler_tag_, 0, 0, lamport_});
+    }
+
+    int64_t begin() {
+        enter();
+        lamport_++;
+        return now_ns();
+    }
+
+    void add(int kind, int64_t start, int peer, int tag, int bytes, int64_t seq) {
+        records_.push_back({start, now_ns(), kind, peer, tag, bytes, seq, lamport_});
+    }
+
+    void unwrap(const std::vector<char>& data, void* buf, int bytes, CommStatus& s, int64_t start) {
+        Header header;
+        std::memcpy(&header, data.data(), sizeof(Header));
+        s.bytes -= sizeof(Header);
+        if (s.bytes > 0) std::memcpy(buf, data.data() + sizeof(Header), std::min(s.bytes, bytes));
+        lamport_ = std::max(lamport_, header.lamport) + 1;
+        add(TRACE_RECV, start, s.source, s.tag, s.bytes, header.seq);
+        handling_ = true;
+        handler_start_ = records_.back().end_ns;
+        handler_source_ = s.source;
+        handler_tag_ = s.tag;
+    }
+
+    void calibrate() {
+        double offset = 0;
+        if (rank() == 0) {
+            for (int r = 1; r < size(); ++r) {
+                double best_rtt = 1e30, best_offset = 0;
+                for (int k = 0; k < TRACE_CALIBRATION_ROUNDS; ++k) {
+                    double t0 = inner_.now(), remote;
+                    inner_.send(&t0, sizeof(t0), r, TRACE_CALIBRATION_TAG);
+                    inner_.recv(&remote, sizeof(remote), r, TRACE_CALIBRATION_TAG);
+                    double t1 = inner_.now();
+                    if (t1 - t0 < best_rtt) {
+                        best_rtt = t1 - t0;
+                        best_offset = remote - (t0 + t1) / 2;
+                    }
+                }
+                inner_.send(&best_offset, sizeof(best_offset), r, TRACE_CALIBRATION_TAG);
+            }
+        } else {
+            for (int k = 0; k < TRACE_CALIBRATION_ROUNDS; ++k) {
+                double t;
+                inner_.recv(&t, sizeof(t), 0, TRACE_CALIBRATION_TAG);
+                t = inner_.now();
+                inner_.send(&t, sizeof(t), 0, TRACE_CALIBRATION_TAG);
+            }
+            inner_.recv(&offset, sizeof(offset), 0, TRACE_CALIBRATION_TAG);
+        }
+        inner_.barrier();
+        offset_ns_ = (int64_t)(offset * 1e9);
+    }
+
+    Comm& inner_;
+    std::string prefix_;
+    std::vector<TraceRecord> records_;
+    std::unordered_map<CommRequest, PendingRecv> pending_;
+    std::vector<char> scratch_;
+    int64_t lamport_ = 0;
+    int64_t next_seq_ = 0;
+    int64_t offset_ns_ = 0;
+    bool handling_ = false;
+    int64_t handler_start_ = 0;
+    int handler_source_ = -1;
+    int handler_tag_ = -1;
+};
+
+typedef int (*CommProgram)(Comm& comm, int argc, char** argv);
+
+// Reads --shm N [--shm-slots S]; false if --shm is absent.
+inline bool parse_shm_options(int argc, char** argv, int* ranks, size_t* slots) {
+    bool shm = false;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--shm") == 0) {
+            *ranks = std::atoi(argv[++i]);
+            shm = true;
+        } else if (std::strcmp(argv[i], "--shm-slots") == 0) {
+            *slots = std::strtoull(argv[++i], NULL, 10);
+        }
+    }
+    return shm;
+}
+
+// The value of --trace, or NULL.
+inline const char* parse_trace_option(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--trace") == 0) return argv[i + 1];
+    }
+    return NULL;
+}
+
+// Runs program on MPI_COMM_WORLD, on threads with --shm N or on virtual
+// ranks with --sim N; with --trace PREFIX each rank's Comm is a TraceComm.
+inline int comm_main(int argc, char** argv, CommProgram program) {
+    const char* trace_prefix = parse_trace_option(argc, argv);
+    auto start = [&](Comm& comm) {
+        if (trace_prefix == NULL) return program(comm, argc, argv);
+        TraceComm traced(comm, trace_prefix);
+        return program(traced, argc, argv);
+    };
+    int shm_ranks = 0;
+    size_t shm_slots = SHM_DEFAULT_SLOTS;
+    if (parse_shm_options(argc, argv, &shm_ranks, &shm_slots)) {
+        if (shm_ranks < 1 || shm_slots < 2) {
+            std::cerr << "--shm needs at least one rank and two mailbox slots" << std::endl;
+            return 1;
+        }
+        ShmWorld world(shm_ranks, shm_slots);
+        int code = world.run(start);
+        world.print_summary(std::cout);
+        return code;
+    }
+    SimOptions options;
+    if (parse_sim_options(argc, argv, options)) {
+        Simulator sim(options);
+        int code = sim.run(start);
+        sim.print_summary(std::cout);
+        return code;
+    }
+    MPI_Init(&argc, &argv);
+    int code;
+    {
+        MpiComm comm(MPI_COMM_WORLD);
+        code = start(comm);
+    }
+    MPI_Finalize();
+    return code;
+}
+
+#endif
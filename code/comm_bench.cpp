@@ -0,0 +1,221 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include "comm.h"
+
+using namespace std;
+
+// Small-message rate and latency through comm.h, to compare the transports
+// on one node:
+//
+//   mpirun -np 4 ./comm_bench      Open MPI (shared-memory BTL within a node)
+//   ./comm_bench --shm 4           threads with lock-free mailboxes
+//   ./comm_bench --sim 4           the simulator's latency model
+//
+// Each pattern mirrors the traffic of one of the programs:
+//
+//   pingpong  pairs of ranks bounce one message back and forth
+//   random    lamport/vector: every rank sends to random peers and takes in
+//             whatever has arrived between sends
+//   dme       Ricart-Agrawala rounds: every rank asks all others and waits for
+//             all replies, answering their requests as they come in
+//   hub       async_bfs on the hub topology: every rank reports to rank 0
+
+const int PING_TAG = 50;
+const int DATA_TAG = 51;
+const int REQUEST_TAG = 52;
+const int REPLY_TAG = 53;
+const int DONE_TAG = 54;
+
+struct CommBenchConfig {
+    string pattern = "all";
+    int messages = 20000;   // sent per rank, roughly, by each pattern
+    int bytes = 4;
+};
+
+struct PatternResult {
+    vector<double> latencies;   // seconds, per round trip or round
+};
+
+PatternResult run_pingpong(Comm& comm, const CommBenchConfig& cfg, vector<char>& buf) {
+    PatternResult result;
+    int partner = comm.rank() ^ 1;
+    if (partner >= comm.size()) return result;
+    int rounds = max(1, cfg.messages);
+    result.latencies.reserve(rounds);
+    for (int i = 0; i < rounds; ++i) {
+        double start = comm.now();
+        if (comm.rank() % 2 == 0) {
+            comm.send(buf.data(), cfg.bytes, partner, PING_TAG);
+            comm.recv(buf.data(), cfg.bytes, partner, PING_TAG);
+        } else {
+            comm.recv(buf.data(), cfg.bytes, partner, PING_TAG);
+            comm.send(buf.data(), cfg.bytes, partner, PING_TAG);
+        }
+        result.latencies.push_back(comm.now() - start);
+    }
+    return result;
+}
+
+PatternResult run_random(Comm& comm, const CommBenchConfig& cfg, vector<char>& buf) {
+    PatternResult result;
+    const int n = comm.size();
+    if (n < 2) return result;
+    // Destinations are drawn up front so every rank can learn how many
+    // messages it will receive.
+    mt19937 rng(12345 + comm.rank());
+    vector<int> dests(cfg.messages);
+    vector<long long> counts(n, 0), totals(n, 0);
+    for (int& d : dests) {
+        d = (comm.rank() + 1 + rng() % (n - 1)) % n;
+        counts[d]++;
+    }
+    comm.allreduce(counts.data(), totals.data(), n, COMM_SUM);
+    long long expected = totals[comm.rank()], received = 0;
+
+    for (int d : dests) {
+        comm.send(buf.data(), cfg.bytes, d, DATA_TAG);
+        CommStatus status;
+        while (comm.iprobe(COMM_ANY_SOURCE, DATA_TAG, &status)) {
+            comm.recv(buf.data(), cfg.bytes, status.source, DATA_TAG);
+            received++;
+        }
+    }
+    while (received < expected) {
+        comm.recv(buf.data(), cfg.bytes, COMM_ANY_SOURCE, DATA_TAG);
+        received++;
+    }
+    return result;
+}
+
+PatternResult run_dme(Comm& comm, const CommBenchConfig& cfg, vector<char>& buf) {
+    PatternResult result;
+    const int n = comm.size();
+    if (n < 2) return result;
+    int rounds = max(1, cfg.messages / (2 * (n - 1)));
+    result.latencies.reserve(rounds);
+    int done = 0;
+    CommStatus status;
+    // Answers one message; true if it was a reply.
+    auto handle = [&]() {
+        comm.recv(buf.data(), cfg.bytes, COMM_ANY_SOURCE, COMM_ANY_TAG, &status);
+        if (status.tag == REQUEST_TAG) comm.send(buf.data(), cfg.bytes, status.source, REPLY_TAG);
+        else if (status.tag == DONE_TAG) done++;
+        return status.tag == REPLY_TAG;
+    };
+    for (int round = 0; round < rounds; ++round) {
+        double start = comm.now();
+        for (int j = 0; j < n; ++j) {
+            if (j != comm.rank()) comm.send(buf.data(), cfg.bytes, j, REQUEST_TAG);
+        }
+        int replies = 0;
+        while (replies < n - 1) {
+            if (handle()) replies++;
+        }
+        result.latencies.push_back(comm.now() - start);
+    }
+    // Keep answering until every other rank has finished its rounds.
+    for (int j = 0; j < n; ++j) {
+        if (j != comm.rank()) comm.send(buf.data(), cfg.bytes, j, DONE_TAG);
+    }
+    while (done < n - 1) handle();
+    return result;
+}
+
+PatternResult run_hub(Comm& comm, const CommBenchConfig& cfg, vector<char>& buf) {
+    PatternResult result;
+    if (comm.rank() != 0) {
+        for (int i = 0; i < cfg.messages; ++i) comm.send(buf.data(), cfg.bytes, 0, DATA_TAG);
+        return result;
+    }
+    long long expected = (long long)cfg.messages * (comm.size() - 1);
+    for (long long i = 0; i < expected; ++i) comm.recv(buf.data(), cfg.bytes, COMM_ANY_SOURCE, DATA_TAG);
+    return result;
+}
+
+bool parse_args(int argc, char** argv, CommBenchConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--pattern" && has_value) cfg.pattern = argv[++i];
+        else if (arg == "--messages" && has_value) cfg.messages = atoi(argv[++i]);
+        else if (arg == "--bytes" && has_value) cfg.bytes = atoi(argv[++i]);
+        else if (arg.compare(0, 5, "--sim") == 0 || arg.compare(0, 5, "--shm") == 0 || arg == "--trace") {
+            if (arg != "--sim-quiet" && has_value) ++i;
+        } else {
+            return false;
+        }
+    }
+    return (cfg.pattern == "all" || cfg.pattern == "pingpong" || cfg.pattern == "random" || cfg.pattern == "dme" ||
+            cfg.pattern == "hub") &&
+           cfg.messages > 0 && cfg.bytes >= 0;
+}
+
+string transport_name(Comm& comm) {
+    TraceComm* traced = dynamic_cast<TraceComm*>(&comm);
+    if (traced != NULL) return transport_name(traced->inner()) + ", traced";
+    if (comm.mpi_comm() != MPI_COMM_NULL) return "MPI";
+    if (dynamic_cast<ThreadComm*>(&comm) != NULL) return "threads (--shm)";
+    return "simulator (--sim, virtual time)";
+}
+
+int run(Comm& comm, int argc, char** argv) {
+    CommBenchConfig cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        if (comm.rank() == 0) {
+            cerr << "usage: " << argv[0] << " [--pattern all|pingpong|random|dme|hub] [--messages N] [--bytes B]"
+                 << " [--shm N | --sim N]" << endl;
+        }
+        return 1;
+    }
+    if (comm.rank() == 0) {
+        cout << "Transport: " << transport_name(comm) << ", " << comm.size() << " ranks, " << cfg.bytes
+             << "-byte messages" << endl;
+        cout << "\npattern\t\tmessages\tseconds\t\tMmsg/s\t\tlatency p50\tp99 (us)" << endl;
+    }
+
+    const char* patterns[] = {"pingpong", "random", "dme", "hub"};
+    vector<char> buf(max(cfg.bytes, 1), 'x');
+    for (const char* name : patterns) {
+        if (cfg.pattern != "all" && cfg.pattern != name) continue;
+        long long sent_before = comm.messages_sent();
+        comm.barrier();
+        double start = comm.now();
+        PatternResult result;
+        if (string(name) == "pingpong") result = run_pingpong(comm, cfg, buf);
+        else if (string(name) == "random") result = run_random(comm, cfg, buf);
+        else if (string(name) == "dme") result = run_dme(comm, cfg, buf);
+        else result = run_hub(comm, cfg, buf);
+        double elapsed = comm.now() - start;
+
+        // Latencies are the slowest rank's percentiles, in nanoseconds.
+        vector<double>& lat = result.latencies;
+        sort(lat.begin(), lat.end());
+        long long sent = comm.messages_sent() - sent_before;
+        long long local[3] = {(long long)(elapsed * 1e9), 0, 0};
+        if (!lat.empty()) {
+            local[1] = (long long)(lat[lat.size() / 2] * 1e9);
+            local[2] = (long long)(lat[min(lat.size() - 1, lat.size() * 99 / 100)] * 1e9);
+        }
+        long long total_sent = 0, slowest[3] = {0, 0, 0};
+        comm.allreduce(&sent, &total_sent, 1, COMM_SUM);
+        comm.allreduce(local, slowest, 3, COMM_MAX);
+        long long* percentiles = slowest + 1;
+        if (comm.rank() == 0) {
+            double seconds = slowest[0] * 1e-9;
+            cout << name << (string(name).size() < 8 ? "\t\t" : "\t") << total_sent << "\t\t" << seconds << "\t"
+                 << (seconds > 0 ? total_sent / seconds / 1e6 : 0) << "\t\t";
+            if (percentiles[1] > 0) cout << percentiles[0] * 1e-3 << "\t\t" << percentiles[1] * 1e-3;
+            else cout << "-\t\t-";
+            cout << endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
@@ -0,0 +1,337 @@
+#ifndef CORO_H
+#define CORO_H
+
+// C++20 coroutine runtime for node programs. The logic of a node reads as
+// straight-line code,
+//
+//   NodeMessage m = co_await node.recv(MC_PROPOSE_TAG);
+//   co_await node.send(m.source, MP_ACCEPT_TAG, reply);
+//
+// and one single-threaded executor per rank runs any number of such nodes on
+// top of a Comm (comm.h). A node costs a coroutine frame and a mailbox,
+// where a virtual rank of --sim costs a fiber stack (64 KB by default), so
+// one rank can host thousands of nodes. Build with -std=c++20.
+//
+// Nodes 0..n-1 are spread over the ranks in contiguous blocks. A message
+// between two nodes of the same rank is handed over in memory. Messages to
+// other ranks are packed into one frame per destination rank, sent on
+// CORO_TAG when the frame fills or when no node can run any more, so a rank
+// pays one Comm message per peer per round instead of one per node message.
+// The executor keeps a receive for a whole frame posted (Comm::irecv, an
+// MPI_Irecv under MPI). Between rounds it takes in the frames that have
+// arrived with test(), and when every node is waiting it blocks in wait().
+//
+// A receive matches on source node and tag and takes messages in arrival
+// order, as MPI does. send() is buffered like Comm::send and never suspends;
+// it is awaitable so that node code reads the same in both directions.
+
+#include <stdint.h>
+#include <algorithm>
+#include <coroutine>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "comm.h"
+
+const int CORO_TAG = 60;
+const int CORO_FRAME_BYTES = 65536;
+
+struct NodeMessage {
+    int source;   // node
+    int tag;
+    std::vector<char> data;
+
+    // The payload, which was sent as a T.
+    template <typename T>
+    T as() const {
+        T value{};
+        std::memcpy(&value, data.data(), std::min(sizeof(T), data.size()));
+        return value;
+    }
+};
+
+// Return type of a node coroutine. The executor starts it and destroys it
+// once it has returned.
+class NodeTask {
+public:
+    struct promise_type {
+        NodeTask get_return_object() {
+            return NodeTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    NodeTask(NodeTask&& other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+
+    ~NodeTask() {
+        if (handle_) handle_.destroy();
+    }
+
+    NodeTask(const NodeTask&) = delete;
+    NodeTask& operator=(const NodeTask&) = delete;
+
+    std::coroutine_handle<> release() {
+        std::coroutine_handle<> handle = handle_;
+        handle_ = nullptr;
+        return handle;
+    }
+
+private:
+    explicit NodeTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+class CoroExecutor;
+
+class CoroNode {
+public:
+    CoroNode(CoroExecutor* executor, int id) : executor_(executor), id_(id) {}
+
+    int id() const { return id_; }
+    // Nodes in total, over all ranks.
+    int count() const;
+
+    struct RecvAwaiter {
+        CoroNode& node;
+        int source;
+        int tag;
+        NodeMessage message;
+
+        bool await_ready() { return node.take(source, tag, message); }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            node.waiter_ = handle;
+            node.want_source_ = source;
+            node.want_tag_ = tag;
+            node.slot_ = &message;
+        }
+
+        NodeMessage await_resume() { return std::move(message); }
+    };
+
+    // The next message with tag (COMM_ANY_TAG for any) from source.
+    RecvAwaiter recv(int tag, int source = COMM_ANY_SOURCE) { return RecvAwaiter{*this, source, tag, NodeMessage()}; }
+
+    std::suspend_never send(int dest, int tag, const void* buf, int bytes);
+
+    template <typename T>
+    std::suspend_never send(int dest, int tag, const T& value) {
+        return send(dest, tag, &value, sizeof(T));
+    }
+
+private:
+    friend class CoroExecutor;
+
+    static bool matches(int want_source, int want_tag, const NodeMessage& m) {
+        return (want_source == COMM_ANY_SOURCE || want_source == m.source) &&
+               (want_tag == COMM_ANY_TAG || want_tag == m.tag);
+    }
+
+    bool take(int source, int tag, NodeMessage& message) {
+        for (auto it = mailbox_.begin(); it != mailbox_.end(); ++it) {
+            if (!matches(source, tag, *it)) continue;
+            message = std::move(*it);
+            mailbox_.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+    // Hands message to the waiting receive if it matches, else queues it.
+    // Returns the coroutine to resume, if any.
+    std::coroutine_handle<> deliver(NodeMessage&& message) {
+        if (waiter_ && matches(want_source_, want_tag_, message)) {
+            *slot_ = std::move(message);
+            std::coroutine_handle<> resumed = waiter_;
+            waiter_ = nullptr;
+            return resumed;
+        }
+        mailbox_.push_back(std::move(message));
+        return nullptr;
+    }
+
+    CoroExecutor* executor_;
+    int id_;
+    std::deque<NodeMessage> mailbox_;
+    std::coroutine_handle<> waiter_;
+    int want_source_ = COMM_ANY_SOURCE;
+    int want_tag_ = COMM_ANY_TAG;
+    NodeMessage* slot_ = NULL;
+};
+
+class CoroExecutor {
+public:
+    // Nodes [0, nodes) over the ranks of comm, in blocks. Not collective.
+    CoroExecutor(Comm& comm, int nodes) : comm_(comm), nodes_(nodes) {
+        int first = first_node(comm_.rank()), last = first_node(comm_.rank() + 1);
+        local_.reserve(last - first);
+        for (int id = first; id < last; ++id) local_.emplace_back(this, id);
+    }
+
+    // Also destroys the nodes that never returned.
+    ~CoroExecutor() {
+        for (std::coroutine_handle<> task : tasks_) task.destroy();
+    }
+
+    CoroExecutor(const CoroExecutor&) = delete;
+    CoroExecutor& operator=(const CoroExecutor&) = delete;
+
+    Comm& comm() { return comm_; }
+    int nodes() const { return nodes_; }
+
+    // The rank that runs node, and the first node of rank (rank == size()
+    // gives nodes()).
+    int owner(int node) const {
+        int base = nodes_ / comm_.size(), extra = nodes_ % comm_.size();
+        int split = extra * (base + 1);
+        return node < split ? node / (base + 1) : extra + (node - split) / base;
+    }
+
+    int first_node(int rank) const {
+        int base = nodes_ / comm_.size(), extra = nodes_ % comm_.size();
+        return rank * base + std::min(rank, extra);
+    }
+
+    // This rank's nodes, in id order.
+    std::vector<CoroNode>& local_nodes() { return local_; }
+    CoroNode& node(int id) { return local_[id - local_.front().id()]; }
+
+    void spawn(NodeTask task) {
+        std::coroutine_handle<> handle = task.release();
+        tasks_.push_back(handle);
+        ready_.push_back(handle);
+        live_++;
+    }
+
+    // Runs until every spawned node has returned. Messages still arriving
+    // for nodes that have returned are dropped.
+    void run() {
+        // Not zeroed: only the bytes of frames that arrive are touched, which
+        // keeps a --sim run with one node on each of 100000 ranks small.
+        std::unique_ptr<char[]> inbox(new char[CORO_FRAME_BYTES]);
+        CommRequest request = comm_.irecv(inbox.get(), CORO_FRAME_BYTES, COMM_ANY_SOURCE, CORO_TAG);
+        CommStatus status;
+        while (true) {
+            while (!ready_.empty()) {
+                std::coroutine_handle<> handle = ready_.front();
+                ready_.pop_front();
+                handle.resume();
+                if (handle.done()) live_--;
+            }
+            flush();
+            if (live_ == 0) break;
+            rounds_++;
+            comm_.wait(request, &status);
+            do {
+                unpack(inbox.get(), status.bytes);
+                request = comm_.irecv(inbox.get(), CORO_FRAME_BYTES, COMM_ANY_SOURCE, CORO_TAG);
+            } while (comm_.test(request, &status));
+        }
+        comm_.cancel(request);
+    }
+
+    long long local_messages() const { return local_messages_; }
+    long long remote_messages() const { return remote_messages_; }
+    long long frames_sent() const { return frames_sent_; }
+    // Times every node on this rank was waiting for another rank.
+    long long rounds() const { return rounds_; }
+
+private:
+    friend class CoroNode;
+
+    struct FrameHeader {
+        int32_t dest;
+        int32_t source;
+        int32_t tag;
+        int32_t bytes;
+    };
+
+    void send(int source, int dest, int tag, const void* buf, int bytes) {
+        if (dest < 0 || dest >= nodes_ || bytes < 0 || bytes > CORO_FRAME_BYTES - (int)sizeof(FrameHeader)) {
+            std::cerr << "Node " << source << ": cannot send " << bytes << " bytes to node " << dest << std::endl;
+            comm_.abort(1);
+        }
+        int rank = owner(dest);
+        if (rank == comm_.rank()) {
+            local_messages_++;
+            NodeMessage message = {source, tag, std::vector<char>((const char*)buf, (const char*)buf + bytes)};
+            std::coroutine_handle<> resumed = node(dest).deliver(std::move(message));
+            if (resumed) ready_.push_back(resumed);
+            return;
+        }
+        remote_messages_++;
+        std::vector<char>& frame = outbox_[rank];
+        if (frame.size() + sizeof(FrameHeader) + bytes > (size_t)CORO_FRAME_BYTES) send_frame(rank, frame);
+        if (frame.empty()) pending_.push_back(rank);
+        FrameHeader header = {dest, source, tag, bytes};
+        frame.insert(frame.end(), (const char*)&header, (const char*)&header + sizeof(header));
+        frame.insert(frame.end(), (const char*)buf, (const char*)buf + bytes);
+    }
+
+    void send_frame(int rank, std::vector<char>& frame) {
+        if (frame.empty()) return;
+        comm_.send(frame.data(), frame.size(), rank, CORO_TAG);
+        frames_sent_++;
+        frame.clear();
+    }
+
+    void flush() {
+        for (int rank : pending_) send_frame(rank, outbox_[rank]);
+        pending_.clear();
+    }
+
+    void unpack(const char* data, int bytes) {
+        int offset = 0;
+        while (offset < bytes) {
+            FrameHeader header;
+            std::memcpy(&header, data + offset, sizeof(header));
+            offset += sizeof(header);
+            NodeMessage message = {header.source, header.tag,
+                                   std::vector<char>(data + offset, data + offset + header.bytes)};
+            offset += header.bytes;
+            std::coroutine_handle<> resumed = node(header.dest).deliver(std::move(message));
+            if (resumed) ready_.push_back(resumed);
+        }
+    }
+
+    Comm& comm_;
+    int nodes_;
+    std::vector<CoroNode> local_;
+    std::vector<std::coroutine_handle<>> tasks_;
+    std::deque<std::coroutine_handle<>> ready_;
+    int live_ = 0;
+    // Frames being filled, by destination rank, and the ranks that have one.
+    std::unordered_map<int, std::vector<char>> outbox_;
+    std::vector<int> pending_;
+
+    long long local_messages_ = 0;
+    long long remote_messages_ = 0;
+    long long frames_sent_ = 0;
+    long long rounds_ = 0;
+};
+
+// --nodes N, or fallback (usually one node per rank).
+inline int coro_node_count(int argc, char** argv, int fallback) {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--nodes") == 0) return std::atoi(argv[i + 1]);
+    }
+    return fallback;
+}
+
+inline int CoroNode::count() const { return executor_->nodes(); }
+
+inline std::suspend_never CoroNode::send(int dest, int tag, const void* buf, int bytes) {
+    executor_->send(id_, dest, tag, buf, bytes);
+    return {};
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef DISTRIBUTED_MUTEX_H
+#define DISTRIBUTED_MUTEX_H
+
+// MCS queue lock over MPI-3 one-sided operations.
+//
+// The lock is a queue of waiting ranks threaded through a small window on
+// every rank: {locked, next}, plus the queue tail on the home rank. To
+// acquire, a rank swaps itself into the tail with MPI_Fetch_and_op; if
+// there was a predecessor it links itself behind it and then spins on its
+// own locked flag, which only touches local memory. On release the holder
+// clears its successor's flag, or, with no successor, swings the tail back
+// to empty with MPI_Compare_and_swap. Every step is an atomic on passive
+// target memory, so no remote CPU has to run anything for a rank to get or
+// hand over the lock; a busy or sleeping peer delays only the ranks queued
+// directly behind it.
+//
+// An acquire costs two remote atomics (swap the tail, link behind the
+// predecessor) and a release at most two (clear the successor's flag, or the
+// compare-and-swap on the tail).
+//
+// lock_shared() admits any number of readers. The home rank also keeps a
+// reader count and a writer flag: a writer first gets through the MCS queue,
+// so writers stay FIFO among themselves, then raises the flag and waits for
+// the readers to drain; a reader announces itself in the count and checks
+// the flag. Readers and draining writers poll these two words on the home
+// rank, so unlike the exclusive path they do spin remotely. The policy
+// decides who backs off when both arrive:
+//
+//   PREFER_WRITERS  a waiting writer raises the flag at once and new readers
+//                   hold back until it is done, so writers cannot starve.
+//   PREFER_READERS  a writer only takes the flag while no reader is inside
+//                   and drops it again if one slipped in; a steady stream of
+//                   readers can starve writers.
+
+#include <mpi.h>
+
+class DistributedMutex {
+public:
+    enum Policy { PREFER_WRITERS, PREFER_READERS };
+
+    // Collective over comm; home holds the queue tail and the reader-writer
+    // state.
+    explicit DistributedMutex(MPI_Comm comm, int home = 0, Policy policy = PREFER_WRITERS)
+        : home_(home), policy_(policy) {
+        MPI_Comm_dup(comm, &comm_);
+        MPI_Comm_rank(comm_, &rank_);
+        MPI_Win_allocate(SLOTS * sizeof(int), sizeof(int), MPI_INFO_NULL, comm_, &base_, &win_);
+        base_[LOCKED] = 0;
+        base_[NEXT] = NONE;
+        base_[TAIL] = NONE;
+        base_[READERS] = 0;
+        base_[WRITER] = 0;
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, win_);
+        MPI_Win_sync(win_);
+        MPI_Barrier(comm_);
+    }
+
+    // Collective; the lock must be free.
+    ~DistributedMutex() {
+        int finalized = 0;
+        MPI_Finalized(&finalized);
+        if (finalized) return;
+        MPI_Win_unlock_all(win_);
+        MPI_Win_free(&win_);
+        MPI_Comm_free(&comm_);
+    }
+
+    DistributedMutex(const DistributedMutex&) = delete;
+    DistributedMutex& operator=(const DistributedMutex&) = delete;
+
+    void lock() {
+        atomic(rank_, LOCKED, 1, MPI_REPLACE);
+        atomic(rank_, NEXT, NONE, MPI_REPLACE);
+        int predecessor = atomic(home_, TAIL, rank_, MPI_REPLACE);
+        if (predecessor == NONE) return;
+        atomic(predecessor, NEXT, rank_, MPI_REPLACE);
+        while (atomic(rank_, LOCKED, 0, MPI_NO_OP) != 0) {}
+    }
+
+    void unlock() {
+        int successor = atomic(rank_, NEXT, 0, MPI_NO_OP);
+        if (successor == NONE) {
+            int empty = NONE, self = rank_, tail;
+            MPI_Compare_and_swap(&empty, &self, &tail, MPI_INT, home_, TAIL, win_);
+            MPI_Win_flush(home_, win_);
+            count(home_);
+            if (tail == rank_) return;
+            // A rank has swapped itself into the tail but not linked yet.
+            while ((successor = atomic(rank_, NEXT, 0, MPI_NO_OP)) == NONE) {}
+        }
+        atomic(successor, LOCKED, 0, MPI_REPLACE);
+    }
+
+    // lock() plus exclusion of readers; pairs with unlock_exclusive().
+    void lock_exclusive() {
+        lock();
+        if (policy_ == PREFER_WRITERS) {
+            atomic(home_, WRITER, 1, MPI_REPLACE);
+            while (atomic(home_, READERS, 0, MPI_NO_OP) != 0) {}
+            return;
+        }
+        while (true) {
+            while (atomic(home_, READERS, 0, MPI_NO_OP) != 0) {}
+            atomic(home_, WRITER, 1, MPI_REPLACE);
+            if (atomic(home_, READERS, 0, MPI_NO_OP) == 0) return;
+            atomic(home_, WRITER, 0, MPI_REPLACE);
+        }
+    }
+
+    void unlock_exclusive() {
+        atomic(home_, WRITER, 0, MPI_REPLACE);
+        unlock();
+    }
+
+    void lock_shared() {
+        if (policy_ == PREFER_READERS) {
+            atomic(home_, READERS, 1, MPI_SUM);
+            while (atomic(home_, WRITER, 0, MPI_NO_OP) != 0) {}
+            return;
+        }
+        while (true) {
+            while (atomic(home_, WRITER, 0, MPI_NO_OP) != 0) {}
+            atomic(home_, READERS, 1, MPI_SUM);
+            if (atomic(home_, WRITER, 0, MPI_NO_OP) == 0) return;
+            atomic(home_, READERS, -1, MPI_SUM);
+        }
+    }
+
+    void unlock_shared() {
+        atomic(home_, READERS, -1, MPI_SUM);
+    }
+
+    // One-sided operations this rank has issued against other ranks.
+    long long remote_ops() const { return remote_ops_; }
+
+private:
+    enum { LOCKED = 0, NEXT = 1, TAIL = 2, READERS = 3, WRITER = 4, SLOTS = 5 };
+    static const int NONE = -1;
+
+    int atomic(int target, int slot, int value, MPI_Op op) {
+        int result;
+        MPI_Fetch_and_op(&value, &result, MPI_INT, target, slot, op, win_);
+        MPI_Win_flush(target, win_);
+        count(target);
+        return result;
+    }
+
+    void count(int target) {
+        if (target != rank_) remote_ops_++;
+    }
+
+    MPI_Comm comm_ = MPI_COMM_NULL;
+    MPI_Win win_ = MPI_WIN_NULL;
+    int* base_ = NULL;
+    int rank_ = 0;
+    int home_;
+    Policy policy_;
+    long long remote_ops_ = 0;
+};
+
+#endif
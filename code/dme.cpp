@@ -1,38 +1,214 @@
 #include <iostream>
+#include <fstream>
 #include <vector>
+#include <deque>
+#include <set>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <functional>
 #include <mpi.h>
+#include "distributed_mutex.h"
+#include "snapshot.h"
 #include <unistd.h>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <sstream>
 
 using namespace std;
 
+// Distributed mutual exclusion. Every process enters the critical section
+// max_cs_executions times through EnterCS()/ExitCS(); --algo selects how the
+// permission is obtained:
+//
+//   ra       Ricart-Agrawala: REQ to every peer and wait for all replies,
+//            2(N-1) messages per entry.
+//   rc       Ricart-Agrawala with Roucairol-Carvalho permission caching: a
+//            reply is kept until its sender asks for it back, so a process
+//            only asks the peers whose permission it has given away and an
+//            uncontended re-entry costs nothing.
+//   maekawa  Maekawa with grid quorums: a process asks only the ranks in its
+//            row and column of a ceil(sqrt N)-wide grid (about 2 sqrt N), and
+//            any two quorums intersect. Each rank hands its single vote to one
+//            requester at a time; INQUIRE/RELINQUISH/FAILED take a vote back
+//            from a lower-priority holder so overlapping requests cannot
+//            deadlock.
+//   sk       Suzuki-Kasami: a single token carries LN (the request number each
+//            rank was last served at) and the queue of waiting ranks. A rank
+//            without the token broadcasts its request number, N-1 messages,
+//            and the token costs one more; entering again while still holding
+//            the token costs nothing.
+//   raymond  Raymond's tree token: requests and the token travel only along a
+//            binary tree over the ranks, each rank pointing towards the
+//            current holder, so an entry costs O(log N) messages.
+//   mcs      DistributedMutex (distributed_mutex.h): an MCS queue lock over
+//            MPI one-sided atomics. Nobody has to answer anything, so it
+//            needs no message handling at all; its "messages" are the RMA
+//            operations issued against other ranks.
+//
+// With --read-ratio F a fraction F of the entries only read. ra and rc then
+// let concurrent readers reply to each other at once and only defer when
+// one side writes; requests are still ordered by timestamp, so a waiting
+// writer is never overtaken by later readers. mcs takes its shared or
+// exclusive lock, where --rw-policy picks whether waiting writers (the
+// default) or arriving readers go first.
+//
+// Benchmarking: --cs-us, --think-us and --entries fix the workload (the
+// defaults keep the original random delays and a single entry). With
+// --arrival open, requests arrive as a Poisson process of mean gap
+// --think-us instead of one think time after each exit. Every run reports
+// acquire latency percentiles, the synchronization delay between one exit
+// and the next waiting process's entry, messages per CS and throughput;
+// --algo all runs every algorithm the options allow, each on a fresh
+// communicator, and --csv/--json save the results.
+//
+// Messages are handled while a process waits for permission or thinks
+// between entries. A process that has finished keeps answering until every
+// peer has sent DONE, so late requests are never left unanswered.
+//
+// With --progress-thread (MPI_THREAD_MULTIPLE) a second thread owns all
+// incoming messages instead, so requests are answered while the main thread
+// is inside the CS or busy with its own work. protocol_mutex guards the
+// protocol state: a decision such as "defer this request" reads the clock,
+// the outstanding request and the deferred flags together and must not
+// interleave with EnterCS()/ExitCS() changing them. It is never held across
+// a blocking receive. EnterCS() sends its requests and then sleeps on
+// protocol_cv until the progress thread has collected the permission.
+//
+// With --snapshot-every S, rank 0 takes a Chandy-Lamport snapshot of the
+// protocol state and the messages in flight every S seconds while the run
+// goes on (snapshot.h), into PREFIX.<algorithm>.snap. Every rank receives
+// all messages through the one MPI_ANY_TAG probe in handle_message(), so
+// markers stay in order with the protocol's messages on each channel.
+// DONE and STOP belong to the harness and are left out.
+
 // Message Tags
 const int REQ_TAG = 100;  // Request message
 const int REP_TAG = 101;  // Reply message
 const int DONE_TAG = 102; // Done with all CS executions
+const int STOP_TAG = 103; // Sent to ourselves to stop the progress thread
+
+// Maekawa message tags
+const int MK_REQUEST_TAG = 110;
+const int MK_LOCKED_TAG = 111;      // arbiter's vote granted
+const int MK_RELEASE_TAG = 112;     // vote returned after the CS
+const int MK_INQUIRE_TAG = 113;     // arbiter asks for its vote back
+const int MK_RELINQUISH_TAG = 114;  // vote returned before the CS
+const int MK_FAILED_TAG = 115;      // a higher-priority request is ahead
+
+// Token message tags
+const int SK_REQUEST_TAG = 120;
+const int SK_TOKEN_TAG = 121;
+const int RT_REQUEST_TAG = 130;
+const int RT_TOKEN_TAG = 131;
 
 // Message Structures
 struct RequestMessage {
-    int timestamp;      
-    int process_id;     
+    int timestamp;
+    int process_id;
+    int write = 1;               // 0 for a reader
 };
 
 struct ReplyMessage {
-    int process_id;     
+    int process_id;
+    int lease = 0;               // rc: reader to reader, the permission stays with the sender
 };
 
+// Every Maekawa message names the request it is about by its timestamp and
+// carries the sender in process_id.
+typedef RequestMessage MaekawaMessage;
+
 //  variables (per process)
 int Ts_current = 0;              // Current Lamport's clock value
+int Ts_request = 0;              // Timestamp of our outstanding request
 int Num_expected = 0;            // Expected number of REPLY messages
 bool Cs_requested = false;       // ?
+atomic<bool> Cs_write(true);     // the current entry writes, set before EnterCS()
 vector<bool> Rep_deferred;       // Deferred reply flags
+vector<bool> Rc_granted;         // rc: permission of each peer currently held
+vector<bool> Rc_lent;            // rc: held permission lent to a peer that may still be reading
+vector<bool> Rc_asked;           // rc: REQ sent to the peer and not answered yet
 bool Priority = false;           // Priority flag
 
 int world_rank;
 int world_size;
+MPI_Comm dme_comm = MPI_COMM_NULL;   // private duplicate of MPI_COMM_WORLD for one run
 int cs_executions = 0;           // Counter for CS executions
-const int MAX_CS_EXECUTIONS = 1; // Each process enters CS this many times
+int max_cs_executions = 1;       // Each process enters CS this many times
+
+string algorithm = "ra";         // ra, rc, maekawa, sk, raymond, mcs or all
+int cs_duration_us = -1;         // time inside the CS, -1 for 0.5-1 s at random
+int think_time_us = -1;          // time between entries, -1 for 0-2 s at random
+int skew = 1;                    // ranks other than 0 enter skew times less often
+string arrival = "closed";       // closed: think after each exit; open: Poisson arrivals
+string csv_path, json_path;      // benchmark results, written by rank 0
+double read_ratio = 0;           // fraction of entries that only read
+string rw_policy = "writers";    // mcs: writers or readers go first
+bool verbose = true;
+long long messages_sent = 0;     // protocol messages, excluding DONE and self-delivery
+int done_received = 0;
+vector<double> cs_records;       // request, enter and exit time and write flag of every CS
+DistributedMutex* mcs_mutex = NULL;
+SnapshotOptions snapshot_options;
+MpiComm* snapshot_comm = NULL;   // markers on dme_comm
+SnapshotService* snapshot = NULL;
+
+bool progress_thread = false;    // --progress-thread
+bool stop_progress = false;
+mutex protocol_mutex;
+condition_variable protocol_cv;  // signalled after every message the progress thread handles
+
+// Maekawa state. Every rank is both a requester and an arbiter for the
+// ranks whose quorum it belongs to. Requests are ordered by (timestamp, id).
+typedef pair<int, int> MkRequest;
+vector<int> quorum;
+deque<pair<int, MaekawaMessage>> local_messages;   // (tag, message) sent to ourselves
+// arbiter side
+bool Mk_locked = false;
+MkRequest Mk_owner;              // request holding our vote
+bool Mk_inquired = false;        // INQUIRE sent to Mk_owner
+set<MkRequest> Mk_waiting;
+set<int> Mk_failed_sent;         // waiting requesters already told FAILED
+// requester side
+set<int> Mk_votes;
+set<int> Mk_failed_from;         // arbiters that said FAILED and have not granted since
+set<int> Mk_inquiries;           // arbiters waiting for their vote back
+bool Mk_in_cs = false;
+
+// Suzuki-Kasami state. LN and the queue only mean something on the rank
+// holding the token; they travel with it.
+vector<int> Sk_rn;               // highest request number heard from each rank
+vector<int> Sk_ln;               // request number each rank was last served at
+deque<int> Sk_queue;             // ranks waiting for the token
+bool Sk_has_token = false;
+
+// Raymond state. Rt_holder is the tree neighbour in the direction of the
+// token, or this rank while it holds it.
+int Rt_holder = -1;
+deque<int> Rt_queue;             // neighbours (or this rank) waiting for the token
+bool Rt_asked = false;           // REQUEST already sent to Rt_holder
+bool Rt_using = false;
+
+ostream null_stream(NULL);
+
+// Protocol trace, silenced by --quiet.
+ostream& trace() {
+    return verbose ? cout : null_stream;
+}
+
+
+// CLOCK_MONOTONIC is shared by every process on a node, unlike MPI_Wtime,
+// which Open MPI counts from each process's own start.
+double node_time() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
 
 void update_lamport_clock(int received_timestamp) {
@@ -42,173 +218,1010 @@ void update_lamport_clock(int received_timestamp) {
 
 void execute_critical_section() {
     cs_executions++;
-    cout << "\n--------------------------------------------------------" << endl;
-    cout << " Process " << world_rank << " ENTERED Critical Section [" 
-         << cs_executions << "/" << MAX_CS_EXECUTIONS << "]" << endl;
-    cout << " Timestamp: " << Ts_current << endl;
-    cout << "----------------------------------------------------------\n" << endl;
-    
+    trace() << "\n--------------------------------------------------------" << endl;
+    trace() << " Process " << world_rank << " ENTERED Critical Section ["
+            << cs_executions << "/" << max_cs_executions << "]" << (Cs_write ? "" : " to read") << endl;
+    trace() << " Timestamp: " << Ts_request << endl;
+    trace() << "----------------------------------------------------------\n" << endl;
+
     // Simulate some work in CS
-    usleep(500000 + (rand() % 500000)); 
-    
-    cout << "Process " << world_rank << " EXITING Critical Section [" 
-         << cs_executions << "/" << MAX_CS_EXECUTIONS << "]" << endl;
+    usleep(cs_duration_us >= 0 ? cs_duration_us : 500000 + (rand() % 500000));
+
+    trace() << "Process " << world_rank << " EXITING Critical Section ["
+            << cs_executions << "/" << max_cs_executions << "]" << endl;
 }
 
 
-void EnterCS() {
-    Cs_requested = true;
-    Ts_current++;
-    Num_expected = world_size - 1;
-    
-    cout << "Process " << world_rank << " requesting CS (Timestamp: " 
-         << Ts_current << ")" << endl;
-    
+// Every protocol message sent, for the statistics and the snapshot channels.
+void protocol_sent(int dest) {
+    messages_sent++;
+    if (snapshot != NULL) snapshot->sent(dest);
+}
+
+
+// Every protocol message received, before it is acted on.
+void protocol_received(const MPI_Status& status, const void* data, int bytes) {
+    if (snapshot != NULL) snapshot->received(status.MPI_SOURCE, status.MPI_TAG, data, bytes);
+}
 
+
+void send_request(int dest) {
     RequestMessage req_msg;
-    req_msg.timestamp = Ts_current;
+    req_msg.timestamp = Ts_request;
     req_msg.process_id = world_rank;
-    
-    for (int j = 0; j < world_size; j++) {
-        if (j != world_rank) {
-            MPI_Send(&req_msg, sizeof(RequestMessage), MPI_BYTE, 
-                    j, REQ_TAG, MPI_COMM_WORLD);
-            cout << "  Process " << world_rank << " sent REQ(" 
-                 << Ts_current << ", " << world_rank << ") to Process " 
-                 << j << endl;
+    req_msg.write = Cs_write;
+    if (algorithm == "rc") Rc_asked[dest] = true;
+    MPI_Send(&req_msg, sizeof(RequestMessage), MPI_BYTE,
+            dest, REQ_TAG, dme_comm);
+    protocol_sent(dest);
+    trace() << "  Process " << world_rank << " sent REQ("
+            << Ts_request << ", " << world_rank << ") to Process "
+            << dest << endl;
+}
+
+
+void ra_handle_request(const RequestMessage& req_msg) {
+    // Calculate priority. With rc a process may be inside the CS without
+    // having asked the requester, whose timestamp can then be older. Two
+    // readers never hold each other up.
+    bool in_cs = Cs_requested && Num_expected == 0;
+    bool conflict = Cs_write || req_msg.write;
+    Priority = Cs_requested && conflict &&
+              (in_cs ||
+               (req_msg.timestamp > Ts_request) ||
+               ((req_msg.timestamp == Ts_request) &&
+                (world_rank < req_msg.process_id)));
+
+    if (Priority) {
+        // Defer the reply
+        Rep_deferred[req_msg.process_id] = true;
+        trace() << "    Process " << world_rank << " DEFERRED reply to Process "
+                << req_msg.process_id << " (Priority: mine)" << endl;
+    } else {
+        // Send immediate reply
+        Rep_deferred[req_msg.process_id] = false;
+        ReplyMessage reply_msg;
+        reply_msg.process_id = world_rank;
+        // rc: a reader that is after the CS itself only lends its
+        // permission to another reader; giving it away would let the other
+        // side later write without asking.
+        reply_msg.lease = Cs_requested && !conflict;
+        MPI_Send(&reply_msg, sizeof(ReplyMessage), MPI_BYTE,
+                req_msg.process_id, REP_TAG, dme_comm);
+        protocol_sent(req_msg.process_id);
+        trace() << "    Process " << world_rank << " sent immediate REP to Process "
+                << req_msg.process_id << endl;
+
+        // rc: the permission is gone, ask for it back if we still need it
+        // and have not asked already.
+        if (algorithm == "rc" && reply_msg.lease) Rc_lent[req_msg.process_id] = true;
+        if (algorithm == "rc" && !reply_msg.lease) {
+            Rc_granted[req_msg.process_id] = false;
+            Rc_lent[req_msg.process_id] = false;
+            if (Cs_requested && !Rc_asked[req_msg.process_id]) {
+                Num_expected++;
+                send_request(req_msg.process_id);
+            }
         }
     }
-    
-    
-    cout << "Process " << world_rank << " waiting for " << Num_expected 
-         << " replies..." << endl;
-    
-    while (Num_expected > 0) {
-        usleep(10000); 
-        
-        
-        MPI_Status status;
-        int flag;
-        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
-        
-        if (flag) {
-            if (status.MPI_TAG == REP_TAG) {
-                ReplyMessage rep_msg;
-                MPI_Recv(&rep_msg, sizeof(ReplyMessage), MPI_BYTE, 
-                        status.MPI_SOURCE, REP_TAG, MPI_COMM_WORLD, &status);
-                
-                Num_expected--;
-                cout << "  ← Process " << world_rank << " received REP from Process " 
-                     << rep_msg.process_id << " (Remaining: " << Num_expected << ")" << endl;
-            }
-            else if (status.MPI_TAG == REQ_TAG) {
-                // Handle incoming REQUEST while waiting
-                RequestMessage req_msg;
-                MPI_Recv(&req_msg, sizeof(RequestMessage), MPI_BYTE, 
-                        status.MPI_SOURCE, REQ_TAG, MPI_COMM_WORLD, &status);
-                
-                cout << "   Process " << world_rank << " received REQ(" 
-                     << req_msg.timestamp << ", " << req_msg.process_id 
-                     << ") while waiting" << endl;
-                
-                // Calculate priority
-                Priority = Cs_requested && 
-                          ((req_msg.timestamp > Ts_current) || 
-                           ((req_msg.timestamp == Ts_current) && 
-                            (world_rank < req_msg.process_id)));
-                
-                if (Priority) {
-                    // Defer the reply
-                    Rep_deferred[req_msg.process_id] = true;
-                    cout << "    Process " << world_rank << " DEFERRED reply to Process " 
-                         << req_msg.process_id << " (Priority: mine)" << endl;
-                } else {
-                    // Send immediate reply
-                    Rep_deferred[req_msg.process_id] = false;
-                    ReplyMessage reply_msg;
-                    reply_msg.process_id = world_rank;
-                    MPI_Send(&reply_msg, sizeof(ReplyMessage), MPI_BYTE, 
-                            req_msg.process_id, REP_TAG, MPI_COMM_WORLD);
-                    cout << "    Process " << world_rank << " sent immediate REP to Process " 
-                         << req_msg.process_id << endl;
-                }
-                
-                update_lamport_clock(req_msg.timestamp);
+
+    update_lamport_clock(req_msg.timestamp);
+}
+
+
+// Row and column of this rank in a ceil(sqrt N)-wide grid, itself included.
+// When the last row is partial, two ranks whose row/column crossing is
+// missing are both in the last row and meet there instead.
+vector<int> grid_quorum(int rank, int n) {
+    int k = (int)ceil(sqrt((double)n));
+    int row = rank / k, col = rank % k;
+    vector<int> members;
+    for (int c = 0; c < k; c++) {
+        if (row * k + c < n) members.push_back(row * k + c);
+    }
+    for (int r = 0; r < k; r++) {
+        if (r != row && r * k + col < n) members.push_back(r * k + col);
+    }
+    sort(members.begin(), members.end());
+    return members;
+}
+
+
+void mk_send(int dest, int tag, int timestamp) {
+    MaekawaMessage msg;
+    msg.timestamp = timestamp;
+    msg.process_id = world_rank;
+    if (dest == world_rank) {
+        local_messages.push_back(make_pair(tag, msg));
+        return;
+    }
+    MPI_Send(&msg, sizeof(MaekawaMessage), MPI_BYTE, dest, tag, dme_comm);
+    protocol_sent(dest);
+}
+
+
+void mk_grant(const MkRequest& req) {
+    Mk_locked = true;
+    Mk_owner = req;
+    Mk_inquired = false;
+    Mk_failed_sent.erase(req.second);
+    mk_send(req.second, MK_LOCKED_TAG, req.first);
+    trace() << "    Process " << world_rank << " voted for Process " << req.second << endl;
+}
+
+
+void mk_fail(const MkRequest& req) {
+    Mk_failed_sent.insert(req.second);
+    mk_send(req.second, MK_FAILED_TAG, req.first);
+}
+
+
+// Arbiter: a request is granted if the vote is free. Otherwise it waits, and
+// it is told FAILED unless it is now the best request around, in which case
+// the current holder is asked (once) to give the vote back.
+void mk_on_request(const MaekawaMessage& msg) {
+    update_lamport_clock(msg.timestamp);
+    MkRequest req(msg.timestamp, msg.process_id);
+    if (!Mk_locked) {
+        mk_grant(req);
+        return;
+    }
+    bool best = req < Mk_owner && (Mk_waiting.empty() || req < *Mk_waiting.begin());
+    if (best) {
+        if (!Mk_waiting.empty() && !Mk_failed_sent.count(Mk_waiting.begin()->second)) {
+            mk_fail(*Mk_waiting.begin());
+        }
+        if (!Mk_inquired) {
+            Mk_inquired = true;
+            mk_send(Mk_owner.second, MK_INQUIRE_TAG, Mk_owner.first);
+        }
+    } else {
+        mk_fail(req);
+    }
+    Mk_waiting.insert(req);
+}
+
+
+void mk_grant_next() {
+    Mk_locked = false;
+    if (Mk_waiting.empty()) return;
+    MkRequest next = *Mk_waiting.begin();
+    Mk_waiting.erase(Mk_waiting.begin());
+    mk_grant(next);
+}
+
+
+void mk_on_release(const MaekawaMessage& msg) {
+    if (Mk_locked && Mk_owner.second == msg.process_id) mk_grant_next();
+}
+
+
+void mk_on_relinquish(const MaekawaMessage& msg) {
+    if (!Mk_locked || Mk_owner != MkRequest(msg.timestamp, msg.process_id)) return;
+    Mk_waiting.insert(Mk_owner);
+    Mk_failed_sent.insert(Mk_owner.second);   // it knows it has to wait
+    mk_grant_next();
+}
+
+
+// Requester: give back every vote that was inquired about. Only done once
+// some arbiter has said FAILED, i.e. this request cannot win right now.
+void mk_relinquish_inquired() {
+    for (int arbiter : Mk_inquiries) {
+        if (!Mk_votes.count(arbiter)) continue;
+        Mk_votes.erase(arbiter);
+        Mk_failed_from.insert(arbiter);
+        mk_send(arbiter, MK_RELINQUISH_TAG, Ts_request);
+        trace() << "    Process " << world_rank << " relinquished the vote of Process " << arbiter << endl;
+    }
+    Mk_inquiries.clear();
+}
+
+
+bool mk_current_request(const MaekawaMessage& msg) {
+    return Cs_requested && !Mk_in_cs && msg.timestamp == Ts_request;
+}
+
+
+void mk_on_locked(const MaekawaMessage& msg) {
+    if (!mk_current_request(msg)) return;
+    Mk_votes.insert(msg.process_id);
+    Mk_failed_from.erase(msg.process_id);
+    trace() << "  ← Process " << world_rank << " got the vote of Process " << msg.process_id
+            << " (" << Mk_votes.size() << "/" << quorum.size() << ")" << endl;
+    if (Mk_votes.size() == quorum.size()) {
+        Mk_in_cs = true;
+        Mk_inquiries.clear();
+    }
+}
+
+
+void mk_on_failed(const MaekawaMessage& msg) {
+    if (!mk_current_request(msg)) return;
+    Mk_failed_from.insert(msg.process_id);
+    mk_relinquish_inquired();
+}
+
+
+void mk_on_inquire(const MaekawaMessage& msg) {
+    if (!mk_current_request(msg) || !Mk_votes.count(msg.process_id)) return;
+    Mk_inquiries.insert(msg.process_id);
+    if (!Mk_failed_from.empty()) mk_relinquish_inquired();
+}
+
+
+void mk_dispatch(int tag, const MaekawaMessage& msg) {
+    switch (tag) {
+        case MK_REQUEST_TAG: mk_on_request(msg); break;
+        case MK_LOCKED_TAG: mk_on_locked(msg); break;
+        case MK_RELEASE_TAG: mk_on_release(msg); break;
+        case MK_INQUIRE_TAG: mk_on_inquire(msg); break;
+        case MK_RELINQUISH_TAG: mk_on_relinquish(msg); break;
+        case MK_FAILED_TAG: mk_on_failed(msg); break;
+    }
+}
+
+
+void sk_send_token(int dest) {
+    // [queue length, LN[0..N), queue...]
+    vector<int> token;
+    token.push_back(Sk_queue.size());
+    token.insert(token.end(), Sk_ln.begin(), Sk_ln.end());
+    token.insert(token.end(), Sk_queue.begin(), Sk_queue.end());
+    Sk_has_token = false;
+    MPI_Send(token.data(), token.size(), MPI_INT, dest, SK_TOKEN_TAG, dme_comm);
+    protocol_sent(dest);
+    trace() << "    Process " << world_rank << " passed the token to Process " << dest << endl;
+}
+
+
+void sk_on_token(const vector<int>& token) {
+    int queued = token[0];
+    Sk_ln.assign(token.begin() + 1, token.begin() + 1 + world_size);
+    Sk_queue.assign(token.begin() + 1 + world_size, token.begin() + 1 + world_size + queued);
+    Sk_has_token = true;
+}
+
+
+// An idle token holder hands the token over at once if the request is one
+// it has not served yet; outdated requests only raise RN.
+void sk_on_request(const RequestMessage& msg) {
+    Sk_rn[msg.process_id] = max(Sk_rn[msg.process_id], msg.timestamp);
+    if (Sk_has_token && !Cs_requested && Sk_rn[msg.process_id] == Sk_ln[msg.process_id] + 1) {
+        sk_send_token(msg.process_id);
+    }
+}
+
+
+void rt_send(int dest, int tag) {
+    ReplyMessage msg;
+    msg.process_id = world_rank;
+    MPI_Send(&msg, sizeof(ReplyMessage), MPI_BYTE, dest, tag, dme_comm);
+    protocol_sent(dest);
+}
+
+
+// Binary tree over the ranks: rank r hangs below (r - 1) / 2.
+int rt_tree_height(int n) {
+    int height = 0;
+    while ((1 << (height + 1)) - 1 < n) height++;
+    return height;
+}
+
+
+void rt_assign_privilege() {
+    if (Rt_holder != world_rank || Rt_using || Rt_queue.empty()) return;
+    Rt_holder = Rt_queue.front();
+    Rt_queue.pop_front();
+    Rt_asked = false;
+    if (Rt_holder == world_rank) {
+        Rt_using = true;
+    } else {
+        rt_send(Rt_holder, RT_TOKEN_TAG);
+        trace() << "    Process " << world_rank << " passed the token to Process " << Rt_holder << endl;
+    }
+}
+
+
+void rt_make_request() {
+    if (Rt_holder == world_rank || Rt_queue.empty() || Rt_asked) return;
+    Rt_asked = true;
+    rt_send(Rt_holder, RT_REQUEST_TAG);
+}
+
+
+void rt_dispatch(int tag, const ReplyMessage& msg) {
+    if (tag == RT_REQUEST_TAG) Rt_queue.push_back(msg.process_id);
+    else Rt_holder = world_rank;
+    rt_assign_privilege();
+    rt_make_request();
+}
+
+
+// Messages Maekawa sent to ourselves. Called with protocol_mutex held.
+void drain_local_messages() {
+    while (!local_messages.empty()) {
+        pair<int, MaekawaMessage> local = local_messages.front();
+        local_messages.pop_front();
+        mk_dispatch(local.first, local.second);
+    }
+}
+
+
+// Receives and handles one message, waiting for it if block is set.
+// Returns false if there was nothing to handle.
+bool handle_message(bool block) {
+    MPI_Status status;
+    int flag = 1;
+    if (block) MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, dme_comm, &status);
+    else MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, dme_comm, &flag, &status);
+    if (!flag) return false;
+
+    lock_guard<mutex> guard(protocol_mutex);
+    if (SnapshotService::owns(status.MPI_TAG)) {
+        CommStatus marker = {status.MPI_SOURCE, status.MPI_TAG, 0};
+        MPI_Get_count(&status, MPI_BYTE, &marker.bytes);
+        snapshot->handle(marker);
+    }
+    else if (status.MPI_TAG == STOP_TAG) {
+        MPI_Recv(NULL, 0, MPI_BYTE, status.MPI_SOURCE, STOP_TAG, dme_comm, &status);
+        stop_progress = true;
+    }
+    else if (status.MPI_TAG == DONE_TAG) {
+        MPI_Recv(NULL, 0, MPI_BYTE, status.MPI_SOURCE, DONE_TAG, dme_comm, &status);
+        done_received++;
+    }
+    else if (status.MPI_TAG == REP_TAG) {
+        ReplyMessage rep_msg;
+        MPI_Recv(&rep_msg, sizeof(ReplyMessage), MPI_BYTE,
+                status.MPI_SOURCE, REP_TAG, dme_comm, &status);
+        protocol_received(status, &rep_msg, sizeof(ReplyMessage));
+
+        Num_expected--;
+        if (algorithm == "rc" && !rep_msg.lease) {
+            Rc_granted[rep_msg.process_id] = true;
+            Rc_lent[rep_msg.process_id] = false;
+        }
+        if (algorithm == "rc") Rc_asked[rep_msg.process_id] = false;
+        trace() << "  ← Process " << world_rank << " received REP from Process "
+                << rep_msg.process_id << " (Remaining: " << Num_expected << ")" << endl;
+    }
+    else if (status.MPI_TAG == REQ_TAG) {
+        RequestMessage req_msg;
+        MPI_Recv(&req_msg, sizeof(RequestMessage), MPI_BYTE,
+                status.MPI_SOURCE, REQ_TAG, dme_comm, &status);
+        protocol_received(status, &req_msg, sizeof(RequestMessage));
+
+        trace() << "   Process " << world_rank << " received REQ("
+                << req_msg.timestamp << ", " << req_msg.process_id
+                << ")" << (Cs_requested ? " while waiting" : " in background") << endl;
+        ra_handle_request(req_msg);
+    }
+    else if (status.MPI_TAG == SK_REQUEST_TAG) {
+        RequestMessage req_msg;
+        MPI_Recv(&req_msg, sizeof(RequestMessage), MPI_BYTE,
+                status.MPI_SOURCE, SK_REQUEST_TAG, dme_comm, &status);
+        protocol_received(status, &req_msg, sizeof(RequestMessage));
+        sk_on_request(req_msg);
+    }
+    else if (status.MPI_TAG == SK_TOKEN_TAG) {
+        int count;
+        MPI_Get_count(&status, MPI_INT, &count);
+        vector<int> token(count);
+        MPI_Recv(token.data(), count, MPI_INT, status.MPI_SOURCE, SK_TOKEN_TAG, dme_comm, &status);
+        protocol_received(status, token.data(), count * sizeof(int));
+        sk_on_token(token);
+    }
+    else if (status.MPI_TAG == RT_REQUEST_TAG || status.MPI_TAG == RT_TOKEN_TAG) {
+        ReplyMessage msg;
+        MPI_Recv(&msg, sizeof(ReplyMessage), MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG,
+                 dme_comm, &status);
+        protocol_received(status, &msg, sizeof(ReplyMessage));
+        rt_dispatch(status.MPI_TAG, msg);
+    }
+    else {
+        MaekawaMessage msg;
+        MPI_Recv(&msg, sizeof(MaekawaMessage), MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG,
+                 dme_comm, &status);
+        protocol_received(status, &msg, sizeof(MaekawaMessage));
+        mk_dispatch(status.MPI_TAG, msg);
+    }
+    drain_local_messages();
+    if (snapshot != NULL) snapshot->poll();
+    if (progress_thread) protocol_cv.notify_all();
+    return true;
+}
+
+
+void progress_loop() {
+    while (!stop_progress) handle_message(true);
+}
+
+
+// Waits with protocol_mutex held (through lock) until done() holds: on
+// protocol_cv if the progress thread is handling messages, otherwise by
+// handling them here with the lock released.
+template <typename Pred>
+void wait_until(unique_lock<mutex>& lock, Pred done) {
+    if (progress_thread) {
+        protocol_cv.wait(lock, done);
+        return;
+    }
+    lock.unlock();
+    while (!done()) handle_message(true);
+    lock.lock();
+}
+
+
+void handle_background_requests() {
+    if (progress_thread) return;
+    while (handle_message(false)) {}
+}
+
+
+// Lets rank 0 start a snapshot when one is due and moves a write on.
+void poll_snapshot() {
+    if (snapshot == NULL) return;
+    lock_guard<mutex> guard(protocol_mutex);
+    snapshot->poll();
+}
+
+
+// Thinks for us microseconds, answering requests meanwhile.
+void think(int us) {
+    if (progress_thread) {
+        poll_snapshot();
+        usleep(us);
+        return;
+    }
+    double deadline = MPI_Wtime() + us * 1e-6;
+    while (MPI_Wtime() < deadline) {
+        handle_background_requests();
+        poll_snapshot();
+        usleep(min(1000, max(1, (int)((deadline - MPI_Wtime()) * 1e6))));
+    }
+}
+
+
+void EnterCS() {
+    if (algorithm == "mcs") {
+        if (read_ratio == 0) mcs_mutex->lock();
+        else if (Cs_write) mcs_mutex->lock_exclusive();
+        else mcs_mutex->lock_shared();
+        return;
+    }
+
+    unique_lock<mutex> lock(protocol_mutex);
+    Cs_requested = true;
+    Ts_current++;
+    Ts_request = Ts_current;
+
+    trace() << "Process " << world_rank << " requesting CS (Timestamp: "
+            << Ts_current << ")" << endl;
+
+    if (algorithm == "maekawa") {
+        Mk_votes.clear();
+        Mk_failed_from.clear();
+        Mk_inquiries.clear();
+        Mk_in_cs = false;
+        for (int member : quorum) mk_send(member, MK_REQUEST_TAG, Ts_request);
+        drain_local_messages();
+        wait_until(lock, [] { return Mk_in_cs; });
+        trace() << "Process " << world_rank << " holds all " << quorum.size() << " votes, entering CS!" << endl;
+        return;
+    }
+
+    if (algorithm == "sk") {
+        if (!Sk_has_token) {
+            RequestMessage req_msg;
+            req_msg.timestamp = ++Sk_rn[world_rank];
+            req_msg.process_id = world_rank;
+            for (int j = 0; j < world_size; j++) {
+                if (j == world_rank) continue;
+                MPI_Send(&req_msg, sizeof(RequestMessage), MPI_BYTE, j, SK_REQUEST_TAG, dme_comm);
+                protocol_sent(j);
             }
+            wait_until(lock, [] { return Sk_has_token; });
         }
+        trace() << "Process " << world_rank << " holds the token, entering CS!" << endl;
+        return;
     }
-    
-    cout << "Process " << world_rank << " received all replies, entering CS!" << endl;
+
+    if (algorithm == "raymond") {
+        Rt_queue.push_back(world_rank);
+        rt_assign_privilege();
+        rt_make_request();
+        wait_until(lock, [] { return Rt_using; });
+        trace() << "Process " << world_rank << " holds the token, entering CS!" << endl;
+        return;
+    }
+
+    // ra asks everyone; rc only the peers whose permission it gave away,
+    // and before writing also those it lent it to, which may still be
+    // reading. Their reply says they are done.
+    vector<int> ask;
+    for (int j = 0; j < world_size; j++) {
+        if (j == world_rank) continue;
+        if (algorithm != "rc" || !Rc_granted[j] || (Cs_write && Rc_lent[j])) ask.push_back(j);
+    }
+    Num_expected = ask.size();
+    for (int j : ask) send_request(j);
+
+
+    trace() << "Process " << world_rank << " waiting for " << Num_expected
+            << " replies..." << endl;
+
+    wait_until(lock, [] { return Num_expected == 0; });
+
+    trace() << "Process " << world_rank << " received all replies, entering CS!" << endl;
 }
 
 
 void ExitCS() {
+    if (algorithm == "mcs") {
+        if (read_ratio == 0) mcs_mutex->unlock();
+        else if (Cs_write) mcs_mutex->unlock_exclusive();
+        else mcs_mutex->unlock_shared();
+        return;
+    }
+
+    lock_guard<mutex> guard(protocol_mutex);
     Cs_requested = false;
-    
-    cout << "Process " << world_rank << " sending deferred replies..." << endl;
-    
-  
+
+    if (algorithm == "maekawa") {
+        Mk_in_cs = false;
+        Mk_votes.clear();
+        for (int member : quorum) mk_send(member, MK_RELEASE_TAG, Ts_request);
+        drain_local_messages();
+        return;
+    }
+
+    if (algorithm == "sk") {
+        // Queue every rank with an outstanding request, then pass the token
+        // to the first one; with nobody waiting it stays here.
+        Sk_ln[world_rank] = Sk_rn[world_rank];
+        for (int j = 0; j < world_size; j++) {
+            if (Sk_rn[j] == Sk_ln[j] + 1 && find(Sk_queue.begin(), Sk_queue.end(), j) == Sk_queue.end()) {
+                Sk_queue.push_back(j);
+            }
+        }
+        if (!Sk_queue.empty()) {
+            int next = Sk_queue.front();
+            Sk_queue.pop_front();
+            sk_send_token(next);
+        }
+        return;
+    }
+
+    if (algorithm == "raymond") {
+        Rt_using = false;
+        rt_assign_privilege();
+        rt_make_request();
+        return;
+    }
+
+    trace() << "Process " << world_rank << " sending deferred replies..." << endl;
+
+
     for (int j = 0; j < world_size; j++) {
         if (j != world_rank && Rep_deferred[j]) {
             Rep_deferred[j] = false;
+            if (algorithm == "rc") Rc_granted[j] = Rc_lent[j] = false;
             ReplyMessage reply_msg;
             reply_msg.process_id = world_rank;
-            MPI_Send(&reply_msg, sizeof(ReplyMessage), MPI_BYTE, 
-                    j, REP_TAG, MPI_COMM_WORLD);
-            cout << "   Process " << world_rank << " sent deferred REP to Process " 
-                 << j << endl;
+            MPI_Send(&reply_msg, sizeof(ReplyMessage), MPI_BYTE,
+                    j, REP_TAG, dme_comm);
+            protocol_sent(j);
+            trace() << "   Process " << world_rank << " sent deferred REP to Process "
+                    << j << endl;
         }
     }
 }
 
 
-void handle_background_requests() {
-    MPI_Status status;
-    int flag;
-    
-    MPI_Iprobe(MPI_ANY_SOURCE, REQ_TAG, MPI_COMM_WORLD, &flag, &status);
-    
-    if (flag) {
-        RequestMessage req_msg;
-        MPI_Recv(&req_msg, sizeof(RequestMessage), MPI_BYTE, 
-                status.MPI_SOURCE, REQ_TAG, MPI_COMM_WORLD, &status);
-        
-        cout << "   Process " << world_rank << " received REQ(" 
-             << req_msg.timestamp << ", " << req_msg.process_id 
-             << ") in background" << endl;
-        
-        
-        Priority = Cs_requested && 
-                  ((req_msg.timestamp > Ts_current) || 
-                   ((req_msg.timestamp == Ts_current) && 
-                    (world_rank < req_msg.process_id)));
-        
-        if (Priority) {
-            
-            Rep_deferred[req_msg.process_id] = true;
-            cout << "    Process " << world_rank << " DEFERRED reply to Process " 
-                 << req_msg.process_id << endl;
+// Whether an algorithm can run with the chosen options.
+bool supported(const string& name) {
+    return (read_ratio == 0 || name == "ra" || name == "rc" || name == "mcs") &&
+           (rw_policy == "writers" || name == "mcs") && !(progress_thread && name == "mcs");
+}
+
+
+// The algorithms --algo selects; "all" is every one the options allow.
+vector<string> selected_algorithms() {
+    const char* all[] = {"ra", "rc", "maekawa", "sk", "raymond", "mcs"};
+    vector<string> names;
+    for (const char* name : all) {
+        if ((algorithm == "all" || algorithm == name) && supported(name)) names.push_back(name);
+    }
+    return names;
+}
+
+
+bool parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--algo" && has_value) algorithm = argv[++i];
+        else if (arg == "--entries" && has_value) max_cs_executions = atoi(argv[++i]);
+        else if (arg == "--cs-us" && has_value) cs_duration_us = atoi(argv[++i]);
+        else if (arg == "--think-us" && has_value) think_time_us = atoi(argv[++i]);
+        else if (arg == "--arrival" && has_value) arrival = argv[++i];
+        else if (arg == "--skew" && has_value) skew = atoi(argv[++i]);
+        else if (arg == "--read-ratio" && has_value) read_ratio = atof(argv[++i]);
+        else if (arg == "--rw-policy" && has_value) rw_policy = argv[++i];
+        else if (arg == "--progress-thread") progress_thread = true;
+        else if (arg == "--csv" && has_value) csv_path = argv[++i];
+        else if (arg == "--json" && has_value) json_path = argv[++i];
+        else if (arg == "--quiet") verbose = false;
+        else if ((arg == "--snapshot-every" || arg == "--snapshot-prefix") && has_value) ++i;   // snapshot.h
+        else return false;
+    }
+    bool known = algorithm == "all" || algorithm == "ra" || algorithm == "rc" || algorithm == "maekawa" ||
+                 algorithm == "sk" || algorithm == "raymond" || algorithm == "mcs";
+    return known && !selected_algorithms().empty() && max_cs_executions > 0 && skew > 0 &&
+           read_ratio >= 0 && read_ratio <= 1 && (rw_policy == "writers" || rw_policy == "readers") &&
+           (arrival == "closed" || (arrival == "open" && think_time_us >= 0));
+}
+
+
+// This rank's protocol state, one line for a snapshot. Called with
+// protocol_mutex held.
+string snapshot_state() {
+    ostringstream out;
+    out << "clock " << Ts_current << ", " << cs_executions << "/" << max_cs_executions << " entries";
+    if (Cs_requested) out << ", requesting at " << Ts_request;
+    if (algorithm == "ra" || algorithm == "rc") {
+        out << ", " << Num_expected << " replies expected, deferred [";
+        const char* sep = "";
+        for (int j = 0; j < world_size; j++) {
+            if (!Rep_deferred[j]) continue;
+            out << sep << j;
+            sep = ", ";
+        }
+        out << "]";
+    } else if (algorithm == "maekawa") {
+        out << ", vote " << (Mk_locked ? "with " + to_string(Mk_owner.second) : string("free")) << ", "
+            << Mk_waiting.size() << " waiting, " << Mk_votes.size() << "/" << quorum.size() << " votes held";
+    } else if (algorithm == "sk") {
+        out << (Sk_has_token ? ", holds the token" : "") << ", RN [";
+        for (int j = 0; j < world_size; j++) out << (j > 0 ? ", " : "") << Sk_rn[j];
+        out << "]";
+    } else if (algorithm == "raymond") {
+        out << ", holder " << Rt_holder << ", " << Rt_queue.size() << " queued" << (Rt_using ? ", in the CS" : "");
+    } else {
+        out << ", lock state is in the RMA window";
+    }
+    return out.str();
+}
+
+
+// Fresh protocol state for one run of algorithm on a new communicator.
+void init_state() {
+    MPI_Comm_dup(MPI_COMM_WORLD, &dme_comm);
+    Ts_current = Ts_request = 0;
+    Num_expected = 0;
+    Cs_requested = false;
+    Cs_write = true;
+    Rep_deferred.assign(world_size, false);
+    // rc: of every pair of ranks the lower one starts with the permission.
+    Rc_granted.assign(world_size, false);
+    Rc_lent.assign(world_size, false);
+    Rc_asked.assign(world_size, false);
+    for (int j = world_rank + 1; j < world_size; j++) Rc_granted[j] = true;
+    cs_executions = 0;
+    messages_sent = 0;
+    done_received = 0;
+    cs_records.clear();
+
+    quorum = grid_quorum(world_rank, world_size);
+    local_messages.clear();
+    Mk_locked = Mk_inquired = Mk_in_cs = false;
+    Mk_waiting.clear();
+    Mk_failed_sent.clear();
+    Mk_votes.clear();
+    Mk_failed_from.clear();
+    Mk_inquiries.clear();
+
+    // Rank 0 starts with both tokens.
+    Sk_rn.assign(world_size, 0);
+    Sk_ln.assign(world_size, 0);
+    Sk_queue.clear();
+    Sk_has_token = (world_rank == 0);
+    Rt_holder = (world_rank == 0) ? 0 : (world_rank - 1) / 2;
+    Rt_queue.clear();
+    Rt_asked = Rt_using = false;
+
+    stop_progress = false;
+    if (algorithm == "mcs") {
+        mcs_mutex = new DistributedMutex(dme_comm, 0,
+                                         rw_policy == "readers" ? DistributedMutex::PREFER_READERS
+                                                                : DistributedMutex::PREFER_WRITERS);
+    }
+    if (snapshot_options.every > 0) {
+        SnapshotOptions options = snapshot_options;
+        options.prefix += "." + algorithm;
+        snapshot_comm = new MpiComm(dme_comm);
+        snapshot = new SnapshotService(*snapshot_comm, options);
+        snapshot->set_capture(snapshot_state);
+    }
+}
+
+
+// Runs the workload and the DONE exchange; returns the elapsed time.
+double run_workload() {
+    thread progress;
+    if (progress_thread) progress = thread(progress_loop);
+
+    MPI_Barrier(dme_comm);
+    double start = MPI_Wtime();
+    double next_arrival = node_time();
+
+    for (int execution = 0; execution < max_cs_executions; execution++) {
+
+        // Closed loop: think, then ask. Open loop: requests arrive as a
+        // Poisson process whether or not the previous CS is over, and the
+        // latency counts from the arrival.
+        double requested;
+        if (arrival == "open") {
+            next_arrival += -log(1 - rand() / (RAND_MAX + 1.0)) * think_time_us * 1e-6;
+            double ahead = next_arrival - node_time();
+            if (ahead > 0) think((int)(ahead * 1e6));
+            requested = next_arrival;
         } else {
-           
-            Rep_deferred[req_msg.process_id] = false;
-            ReplyMessage reply_msg;
-            reply_msg.process_id = world_rank;
-            MPI_Send(&reply_msg, sizeof(ReplyMessage), MPI_BYTE, 
-                    req_msg.process_id, REP_TAG, MPI_COMM_WORLD);
-            cout << "    Process " << world_rank << " sent immediate REP to Process " 
-                 << req_msg.process_id << endl;
+            think(think_time_us >= 0 ? think_time_us : rand() % 2000000);
+            requested = node_time();
         }
-        
-        update_lamport_clock(req_msg.timestamp);
+
+        Cs_write = (rand() / (RAND_MAX + 1.0) >= read_ratio);
+        EnterCS();
+        double entered = node_time();
+
+
+        execute_critical_section();
+
+
+        cs_records.push_back(requested);
+        cs_records.push_back(entered);
+        cs_records.push_back(node_time());
+        cs_records.push_back(Cs_write ? 1 : 0);
+        ExitCS();
     }
+
+    trace() << "\n Process " << world_rank << " completed all "
+            << max_cs_executions << " CS executions" << endl;
+
+    // Keep answering requests until every peer is done as well.
+    for (int j = 0; j < world_size; j++) {
+        if (j != world_rank) MPI_Send(NULL, 0, MPI_BYTE, j, DONE_TAG, dme_comm);
+    }
+    {
+        unique_lock<mutex> lock(protocol_mutex);
+        wait_until(lock, [] { return done_received == world_size - 1; });
+    }
+    double elapsed = MPI_Wtime() - start;
+    if (progress_thread) {
+        MPI_Send(NULL, 0, MPI_BYTE, world_rank, STOP_TAG, dme_comm);
+        progress.join();
+    }
+    // Only this thread receives now, so the service can probe for its own
+    // markers.
+    if (snapshot != NULL) snapshot->finish();
+
+    // Wait for all processes to finish
+    MPI_Barrier(dme_comm);
+    return elapsed;
 }
 
+
+struct RunResult {
+    string algorithm;
+    long long total_cs = 0, reads = 0, messages = 0;
+    int max_quorum = 0, peak_readers = 0, overlaps = 0;
+    double elapsed = 0;
+    double acquire_mean = 0, acquire_p50 = 0, acquire_p99 = 0, acquire_p999 = 0, acquire_max = 0;
+    double sync_mean = 0, sync_p50 = 0, sync_p99 = 0;
+    long long sync_samples = 0;
+};
+
+
+// Nearest-rank percentile of sorted values.
+double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)ceil(p * sorted.size());
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+}
+
+
+// Collects every rank's records on rank 0 and computes the statistics there.
+RunResult gather_results(double elapsed) {
+    RunResult r;
+    r.algorithm = algorithm;
+    if (mcs_mutex) {
+        messages_sent += mcs_mutex->remote_ops();
+        delete mcs_mutex;
+        mcs_mutex = NULL;
+    }
+    delete snapshot;
+    delete snapshot_comm;
+    snapshot = NULL;
+    snapshot_comm = NULL;
+    MPI_Reduce(&messages_sent, &r.messages, 1, MPI_LONG_LONG, MPI_SUM, 0, dme_comm);
+    int quorum_size = quorum.size();
+    MPI_Reduce(&quorum_size, &r.max_quorum, 1, MPI_INT, MPI_MAX, 0, dme_comm);
+    MPI_Reduce(&elapsed, &r.elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, dme_comm);
+
+    // Records carry the owner's rank so that hand-overs can be told apart
+    // from a process entering again.
+    const int fields = 5;
+    vector<double> mine;
+    for (size_t i = 0; i < cs_records.size(); i += 4) {
+        mine.insert(mine.end(), cs_records.begin() + i, cs_records.begin() + i + 4);
+        mine.push_back(world_rank);
+    }
+    int record_count = mine.size();
+    vector<int> counts(world_size), displs(world_size, 0);
+    MPI_Gather(&record_count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, dme_comm);
+    for (int j = 1; j < world_size; j++) displs[j] = displs[j - 1] + counts[j - 1];
+    vector<double> all(world_rank == 0 ? displs[world_size - 1] + counts[world_size - 1] : 0);
+    MPI_Gatherv(mine.data(), record_count, MPI_DOUBLE, all.data(), counts.data(), displs.data(), MPI_DOUBLE,
+                0, dme_comm);
+    MPI_Comm_free(&dme_comm);
+    if (world_rank != 0) return r;
+
+    // (enter, exit, write, request, rank), swept in order of entry
+    vector<vector<double>> spans;
+    vector<double> acquire;
+    for (size_t i = 0; i < all.size(); i += fields) {
+        spans.push_back({all[i + 1], all[i + 2], all[i + 3], all[i], all[i + 4]});
+        acquire.push_back(all[i + 1] - all[i]);
+    }
+    r.total_cs = spans.size();
+    sort(acquire.begin(), acquire.end());
+    for (double a : acquire) r.acquire_mean += a / acquire.size();
+    r.acquire_p50 = percentile(acquire, 0.5);
+    r.acquire_p99 = percentile(acquire, 0.99);
+    r.acquire_p999 = percentile(acquire, 0.999);
+    r.acquire_max = acquire.empty() ? 0 : acquire.back();
+
+    // With all ranks on one node (node_time), a write whose [enter, exit)
+    // interval overlaps any other would mean mutual exclusion was broken.
+    // Synchronization delay: from a CS exit to the next entry by another
+    // process that was already waiting for it.
+    sort(spans.begin(), spans.end());
+    double last_exit = -1, last_write_exit = -1, last_holder = -1;
+    vector<double> reader_exits;   // min-heap of the readers still inside
+    vector<double> sync;
+    for (const vector<double>& span : spans) {
+        bool write = span[2] != 0;
+        if (span[0] < last_write_exit || (write && span[0] < last_exit)) r.overlaps++;
+        if (span[0] >= last_exit && span[3] < last_exit && span[4] != last_holder) {
+            sync.push_back(span[0] - last_exit);
+        }
+        if (span[1] > last_exit) {
+            last_exit = span[1];
+            last_holder = span[4];
+        }
+        if (write) {
+            last_write_exit = max(last_write_exit, span[1]);
+            continue;
+        }
+        r.reads++;
+        while (!reader_exits.empty() && reader_exits.front() <= span[0]) {
+            pop_heap(reader_exits.begin(), reader_exits.end(), greater<double>());
+            reader_exits.pop_back();
+        }
+        reader_exits.push_back(span[1]);
+        push_heap(reader_exits.begin(), reader_exits.end(), greater<double>());
+        r.peak_readers = max(r.peak_readers, (int)reader_exits.size());
+    }
+    sort(sync.begin(), sync.end());
+    r.sync_samples = sync.size();
+    for (double d : sync) r.sync_mean += d / sync.size();
+    r.sync_p50 = percentile(sync, 0.5);
+    r.sync_p99 = percentile(sync, 0.99);
+    return r;
+}
+
+
+void print_summary(const RunResult& r) {
+    cout << "\n--------------------------------------------------------------" << endl;
+    cout << "All processes completed mutual exclusion test  " << endl;
+    cout << " Algorithm: " << r.algorithm;
+    if (r.algorithm == "maekawa") cout << " (quorum size up to " << r.max_quorum << ")";
+    if (r.algorithm == "raymond") cout << " (binary tree of height " << rt_tree_height(world_size) << ")";
+    cout << endl;
+    cout << " Total CS executions: " << r.total_cs
+         << "                          " << endl;
+    if (read_ratio > 0) {
+        cout << " Reads: " << r.reads << ", writes: " << r.total_cs - r.reads << ", up to " << r.peak_readers
+             << " readers at once";
+        if (r.algorithm == "mcs") cout << " (" << rw_policy << " first)";
+        cout << endl;
+    }
+    cout << " Messages: " << r.messages << " (" << (double)r.messages / r.total_cs
+         << " per CS)" << (r.algorithm == "mcs" ? " one-sided operations" : "") << endl;
+    cout << " Acquire latency (us): mean " << r.acquire_mean * 1e6 << ", p50 " << r.acquire_p50 * 1e6
+         << ", p99 " << r.acquire_p99 * 1e6 << ", p999 " << r.acquire_p999 * 1e6 << ", max "
+         << r.acquire_max * 1e6 << endl;
+    cout << " Synchronization delay (us): mean " << r.sync_mean * 1e6 << ", p50 " << r.sync_p50 * 1e6
+         << ", p99 " << r.sync_p99 * 1e6 << " over " << r.sync_samples << " hand-overs" << endl;
+    cout << " Throughput: " << r.total_cs / r.elapsed << " CS/s over " << r.elapsed << " s" << endl;
+    cout << " Mutual exclusion: " << (r.overlaps == 0 ? "held" : "VIOLATED") << " ("
+         << r.overlaps << " overlapping CS intervals)" << endl;
+    cout << "-------------------------------------------------------------\n" << endl;
+}
+
+
+// One row per run, appended; the header is written when the file is new.
+void write_csv(const vector<RunResult>& results) {
+    ifstream existing(csv_path);
+    bool fresh = !existing || existing.peek() == ifstream::traits_type::eof();
+    existing.close();
+    ofstream out(csv_path, ios::app);
+    if (!out) {
+        cerr << "Could not open " << csv_path << " for writing." << endl;
+        return;
+    }
+    if (fresh) {
+        out << "algorithm,ranks,entries,cs_us,think_us,arrival,read_ratio,progress_thread,total_cs,"
+            << "messages_per_cs,throughput,acquire_mean_us,acquire_p50_us,acquire_p99_us,acquire_p999_us,"
+            << "acquire_max_us,sync_delay_mean_us,sync_delay_p50_us,sync_delay_p99_us,mutual_exclusion\n";
+    }
+    for (const RunResult& r : results) {
+        out << r.algorithm << "," << world_size << "," << max_cs_executions << "," << cs_duration_us << ","
+            << think_time_us << "," << arrival << "," << read_ratio << "," << progress_thread << ","
+            << r.total_cs << "," << (double)r.messages / r.total_cs << "," << r.total_cs / r.elapsed << ","
+            << r.acquire_mean * 1e6 << "," << r.acquire_p50 * 1e6 << "," << r.acquire_p99 * 1e6 << ","
+            << r.acquire_p999 * 1e6 << "," << r.acquire_max * 1e6 << "," << r.sync_mean * 1e6 << ","
+            << r.sync_p50 * 1e6 << "," << r.sync_p99 * 1e6 << "," << (r.overlaps == 0 ? "held" : "violated")
+            << "\n";
+    }
+}
+
+
+void write_json(const vector<RunResult>& results) {
+    ofstream out(json_path);
+    if (!out) {
+        cerr << "Could not open " << json_path << " for writing." << endl;
+        return;
+    }
+    out << "{\n";
+    out << "  \"ranks\": " << world_size << ",\n";
+    out << "  \"entries\": " << max_cs_executions << ",\n";
+    out << "  \"skew\": " << skew << ",\n";
+    out << "  \"cs_us\": " << cs_duration_us << ",\n";
+    out << "  \"think_us\": " << think_time_us << ",\n";
+    out << "  \"arrival\": \"" << arrival << "\",\n";
+    out << "  \"read_ratio\": " << read_ratio << ",\n";
+    out << "  \"progress_thread\": " << (progress_thread ? "true" : "false") << ",\n";
+    out << "  \"runs\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const RunResult& r = results[i];
+        out << "    {\"algorithm\": \"" << r.algorithm << "\", \"total_cs\": " << r.total_cs
+            << ", \"messages\": " << r.messages << ", \"messages_per_cs\": " << (double)r.messages / r.total_cs
+            << ", \"throughput\": " << r.total_cs / r.elapsed << ",\n"
+            << "     \"acquire_us\": {\"mean\": " << r.acquire_mean * 1e6 << ", \"p50\": " << r.acquire_p50 * 1e6
+            << ", \"p99\": " << r.acquire_p99 * 1e6 << ", \"p999\": " << r.acquire_p999 * 1e6
+            << ", \"max\": " << r.acquire_max * 1e6 << "},\n"
+            << "     \"sync_delay_us\": {\"mean\": " << r.sync_mean * 1e6 << ", \"p50\": " << r.sync_p50 * 1e6
+            << ", \"p99\": " << r.sync_p99 * 1e6 << ", \"samples\": " << r.sync_samples << "},\n"
+            << "     \"mutual_exclusion\": " << (r.overlaps == 0 ? "true" : "false") << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+
 int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
-    
+    // The thread level depends on --progress-thread, so parse first.
+    bool args_ok = parse_args(argc, argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, progress_thread ? MPI_THREAD_MULTIPLE : MPI_THREAD_SINGLE, &provided);
+
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
-    
+
     if (world_size < 2) {
         if (world_rank == 0) {
             cerr << "Need at least 2 processes for mutual exclusion." << endl;
@@ -216,53 +1229,45 @@ int main(int argc, char** argv) {
         MPI_Finalize();
         return 0;
     }
-    
-   
-    Rep_deferred.resize(world_size, false);
-    srand(time(NULL) + world_rank); 
-    
- 
-    
-   
-    for (int execution = 0; execution < MAX_CS_EXECUTIONS; execution++) {
-        
-        int delay = rand() % 2000000; 
-        usleep(delay);
-        
-      
-        for (int i = 0; i < 10; i++) {
-            handle_background_requests();
-            usleep(delay / 10);
+    if (!args_ok) {
+        if (world_rank == 0) {
+            cerr << "usage: " << argv[0] << " [--algo ra|rc|maekawa|sk|raymond|mcs|all] [--entries N]"
+                 << " [--cs-us US] [--think-us US] [--arrival closed|open] [--skew X] [--read-ratio F]"
+                 << " [--rw-policy writers|readers] [--progress-thread] [--csv FILE] [--json FILE]"
+                 << " [--quiet] [--snapshot-every S] [--snapshot-prefix P]" << endl;
         }
-        
-        
-        EnterCS();
-        
-       
-        execute_critical_section();
-        
-        
-        ExitCS();
-        
-        
-        usleep(200000);
-    }
-    
-    cout << "\n Process " << world_rank << " completed all " 
-         << MAX_CS_EXECUTIONS << " CS executions" << endl;
-    
-    // Wait for all processes to finish
-    MPI_Barrier(MPI_COMM_WORLD);
-    
-    // Final summary
+        MPI_Finalize();
+        return 1;
+    }
+    if (progress_thread && provided < MPI_THREAD_MULTIPLE) {
+        if (world_rank == 0) cerr << "--progress-thread needs MPI_THREAD_MULTIPLE" << endl;
+        MPI_Finalize();
+        return 1;
+    }
+
+    snapshot_options = parse_snapshot_options(argc, argv);
+
+    // Skewed access: rank 0 makes every entry, the rest 1/skew of them.
+    if (world_rank != 0) max_cs_executions = max(1, max_cs_executions / skew);
+    srand(time(NULL) + world_rank);
+
+    vector<RunResult> results;
+    bool all_held = true;
+    for (const string& name : selected_algorithms()) {
+        algorithm = name;
+        init_state();
+        RunResult r = gather_results(run_workload());
+        if (world_rank == 0) {
+            print_summary(r);
+            all_held = all_held && r.overlaps == 0;
+        }
+        results.push_back(r);
+    }
     if (world_rank == 0) {
-        cout << "\n--------------------------------------------------------------" << endl;
-        cout << "All processes completed mutual exclusion test  " << endl;
-        cout << " Total CS executions: " << (world_size * MAX_CS_EXECUTIONS) 
-             << "                          " << endl;
-        cout << "-------------------------------------------------------------\n" << endl;
+        if (!csv_path.empty()) write_csv(results);
+        if (!json_path.empty()) write_json(results);
     }
-    
+
     MPI_Finalize();
-    return 0;
-}
\ No newline at end of file
+    return all_held ? 0 : 1;
+}
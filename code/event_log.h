@@ -0,0 +1,345 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+// Per-rank binary event log, so the programs can record every protocol step
+// without paying for formatted, flushed stdout on the hot path.
+//
+// An event is a fixed-size record (time, kind, level, three integers) pushed
+// into a lock-free ring owned by the rank. One background thread per process
+// drains the rings of all ranks in it to one file per rank. What a kind
+// means is given by a table of names and format strings that the program
+// passes in and that is copied to the head of every file, so
+// event_log_reader.cpp can merge the files of a run and print them as text.
+//
+// Options, read from the program's command line:
+//
+//   --log-level L     off, error, info or debug (default off)
+//   --log-prefix P    files are P.<rank>.evlog (default "events")
+//   --log-records N   ring capacity per rank (default 8192)
+//
+// Recording never blocks: an event that finds the ring full is dropped and
+// counted, and the count is written at the end of the file. Building with
+// -DEVENT_LOG_DISABLE compiles every LOG_EVENT to nothing, without
+// evaluating its arguments, and the log never opens a file or starts the
+// thread.
+//
+// File layout (native byte order):
+//
+//   header          EventFileHeader
+//   kinds[k]        EventFileKind, k = header.num_kinds
+//   records         EventRecord until the end of the file; the last one has
+//                   kind EVENT_DROPPED and the number of dropped events in
+//                   args[0]
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "comm.h"
+
+enum LogLevel { LOG_OFF = 0, LOG_ERROR = 1, LOG_INFO = 2, LOG_DEBUG = 3 };
+
+// Kind i of a program's table. Each "{}" in format stands for the next
+// argument of the event.
+struct EventKind {
+    const char* name;
+    const char* format;
+};
+
+const int EVENT_ARGS = 3;
+const int32_t EVENT_DROPPED = -1;
+
+struct EventRecord {
+    int64_t time_ns;   // Comm::now() of the recording rank
+    int32_t kind;
+    int32_t level;
+    int64_t args[EVENT_ARGS];
+};
+
+const char EVENT_FILE_MAGIC[8] = {'E', 'V', 'E', 'N', 'T', 'L', 'G', '1'};
+
+struct EventFileHeader {
+    char magic[8];
+    int32_t rank;
+    int32_t size;
+    int32_t num_kinds;
+    int32_t reserved;
+};
+
+struct EventFileKind {
+    char name[32];
+    char format[96];
+};
+
+struct EventLogOptions {
+    int level = LOG_OFF;
+    std::string prefix = "events";
+    size_t records = 8192;
+};
+
+inline int parse_log_level(const char* name) {
+    const char* names[] = {"off", "error", "info", "debug"};
+    for (int level = LOG_OFF; level <= LOG_DEBUG; ++level) {
+        if (std::strcmp(name, names[level]) == 0) return level;
+    }
+    return -1;
+}
+
+// Reads --log-level, --log-prefix and --log-records; other arguments are
+// left to the program.
+inline EventLogOptions parse_log_options(int argc, char** argv) {
+    EventLogOptions options;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--log-level") == 0) {
+            options.level = parse_log_level(argv[++i]);
+            if (options.level < 0) {
+                std::cerr << "Unknown log level " << argv[i] << ", logging is off" << std::endl;
+                options.level = LOG_OFF;
+            }
+        } else if (std::strcmp(argv[i], "--log-prefix") == 0) {
+            options.prefix = argv[++i];
+        } else if (std::strcmp(argv[i], "--log-records") == 0) {
+            options.records = std::strtoull(argv[++i], NULL, 10);
+        }
+    }
+    return options;
+}
+
+// Bounded multi-producer single-consumer ring of records, the same scheme
+// as ShmMailbox in comm.h: producers claim a cell with a compare-and-swap on
+// the tail and publish it through the cell's sequence number.
+class EventRing {
+public:
+    explicit EventRing(size_t records) {
+        capacity_ = 2;
+        while (capacity_ < records) capacity_ <<= 1;
+        mask_ = capacity_ - 1;
+        cells_.reset(new Cell[capacity_]);
+        for (size_t i = 0; i < capacity_; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Any thread. False if the ring is full.
+    bool try_push(const EventRecord& record) {
+        uint64_t pos = tail_.value.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(sequence - pos);
+            if (diff == 0) {
+                if (tail_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.value.load(std::memory_order_relaxed);
+            }
+        }
+        cell->record = record;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.
+    bool try_pop(EventRecord& record) {
+        uint64_t pos = head_.value;
+        Cell& cell = cells_[pos & mask_];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1) return false;
+        record = cell.record;
+        cell.sequence.store(pos + capacity_, std::memory_order_release);
+        head_.value = pos + 1;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<uint64_t> sequence;
+        EventRecord record;
+    };
+
+    struct alignas(SHM_CACHE_LINE) ProducerIndex {
+        std::atomic<uint64_t> value{0};
+    };
+
+    struct alignas(SHM_CACHE_LINE) ConsumerIndex {
+        uint64_t value = 0;
+    };
+
+    ProducerIndex tail_;
+    ConsumerIndex head_;
+    size_t capacity_;
+    size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+};
+
+class EventLog;
+
+// The thread that writes out the rings of every open log in the process.
+// It runs while at least one log is open.
+class EventLogDrainer {
+public:
+    static EventLogDrainer& instance() {
+        static EventLogDrainer drainer;
+        return drainer;
+    }
+
+    void add(EventLog* log);
+    // Once this returns the thread no longer touches log.
+    void remove(EventLog* log);
+
+private:
+    void loop(std::shared_ptr<std::atomic<bool>> stop);
+
+    std::mutex mutex_;
+    std::vector<EventLog*> logs_;
+    std::thread thread_;
+    std::shared_ptr<std::atomic<bool>> stop_;
+};
+
+class EventLog {
+public:
+    // One log per rank; kinds[i] describes kind i. Not collective.
+    template <size_t N>
+    EventLog(Comm& comm, int argc, char** argv, const EventKind (&kinds)[N])
+        : comm_(&comm) {
+#ifndef EVENT_LOG_DISABLE
+        EventLogOptions options = parse_log_options(argc, argv);
+        if (options.level != LOG_OFF) open(options, kinds, N);
+#else
+        (void)argc, (void)argv, (void)kinds;
+#endif
+    }
+
+    ~EventLog() {
+        if (file_ == NULL) return;
+        EventLogDrainer::instance().remove(this);
+        drain();
+        EventRecord trailer = {now_ns(), EVENT_DROPPED, LOG_OFF, {dropped_.load(), 0, 0}};
+        std::fwrite(&trailer, sizeof(trailer), 1, file_);
+        std::fclose(file_);
+    }
+
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+
+    bool enabled(int level) const { return level <= level_; }
+
+    void record(int level, int kind, long long a = 0, long long b = 0, long long c = 0) {
+        EventRecord r = {now_ns(), kind, level, {a, b, c}};
+        if (!ring_->try_push(r)) dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    long long dropped() const { return dropped_.load(); }
+
+private:
+    friend class EventLogDrainer;
+
+    void open(const EventLogOptions& options, const EventKind* kinds, size_t count) {
+        std::string path = options.prefix + "." + std::to_string(comm_->rank()) + ".evlog";
+        file_ = std::fopen(path.c_str(), "wb");
+        if (file_ == NULL) {
+            std::cerr << "Could not open " << path << ", logging is off" << std::endl;
+            return;
+        }
+        EventFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, EVENT_FILE_MAGIC, 8);
+        header.rank = comm_->rank();
+        header.size = comm_->size();
+        header.num_kinds = (int32_t)count;
+        std::fwrite(&header, sizeof(header), 1, file_);
+        for (size_t i = 0; i < count; ++i) {
+            EventFileKind kind;
+            std::memset(&kind, 0, sizeof(kind));
+            std::strncpy(kind.name, kinds[i].name, sizeof(kind.name) - 1);
+            std::strncpy(kind.format, kinds[i].format, sizeof(kind.format) - 1);
+            std::fwrite(&kind, sizeof(kind), 1, file_);
+        }
+        ring_.reset(new EventRing(options.records));
+        batch_.resize(256);
+        level_ = options.level;
+        EventLogDrainer::instance().add(this);
+    }
+
+    // Consumer side; true if anything was written.
+    bool drain() {
+        size_t n = 0, total = 0;
+        while (ring_->try_pop(batch_[n])) {
+            if (++n == batch_.size()) {
+                std::fwrite(batch_.data(), sizeof(EventRecord), n, file_);
+                total += n;
+                n = 0;
+            }
+        }
+        if (n > 0) std::fwrite(batch_.data(), sizeof(EventRecord), n, file_);
+        return total + n > 0;
+    }
+
+    int64_t now_ns() { return (int64_t)(comm_->now() * 1e9); }
+
+    Comm* comm_;
+    int level_ = LOG_OFF;
+    std::FILE* file_ = NULL;
+    std::unique_ptr<EventRing> ring_;
+    std::vector<EventRecord> batch_;
+    std::atomic<long long> dropped_{0};
+};
+
+inline void EventLogDrainer::add(EventLog* log) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    logs_.push_back(log);
+    if (!thread_.joinable()) {
+        stop_ = std::make_shared<std::atomic<bool>>(false);
+        thread_ = std::thread(&EventLogDrainer::loop, this, stop_);
+    }
+}
+
+inline void EventLogDrainer::remove(EventLog* log) {
+    std::thread last;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < logs_.size(); ++i) {
+            if (logs_[i] == log) {
+                logs_.erase(logs_.begin() + i);
+                break;
+            }
+        }
+        if (!logs_.empty()) return;
+        stop_->store(true);
+        last.swap(thread_);
+    }
+    last.join();
+}
+
+inline void EventLogDrainer::loop(std::shared_ptr<std::atomic<bool>> stop) {
+    while (!stop->load()) {
+        bool wrote = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (EventLog* log : logs_) wrote |= log->drain();
+        }
+        if (!wrote) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+#ifdef EVENT_LOG_DISABLE
+// The arguments only appear in an unevaluated operand, so variables kept for
+// logging do not turn into unused-variable warnings.
+#define LOG_EVENT(log, level, ...) ((void)sizeof((log).record(level, __VA_ARGS__), 0))
+#else
+// LOG_EVENT(log, level, kind, args...): up to three integer arguments, which
+// are only evaluated if level is enabled.
+#define LOG_EVENT(log, level, ...)                                  \
+    do {                                                            \
+        if ((log).enabled(level)) (log).record(level, __VA_ARGS__); \
+    } while (0)
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include "event_log.h"
+
+using namespace std;
+
+// Prints the per-rank event logs of a run (event_log.h, written with
+// --log-level) as one text stream in time order:
+//
+//   ./event_log_reader events.*.evlog
+//
+// Records of ranks in one process share a clock; across MPI processes the
+// order is only as good as the agreement of their MPI_Wtime clocks.
+
+struct RankLog {
+    string path;
+    EventFileHeader header;
+    vector<EventFileKind> kinds;
+    vector<EventRecord> records;
+    long long dropped = -1;   // -1 if the trailer is missing
+};
+
+bool read_log(const char* path, RankLog& log) {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        cerr << "Could not open " << path << endl;
+        return false;
+    }
+    log.path = path;
+    if (!in.read((char*)&log.header, sizeof(log.header)) || memcmp(log.header.magic, EVENT_FILE_MAGIC, 8) != 0 ||
+        log.header.num_kinds < 0) {
+        cerr << path << " is not an event log" << endl;
+        return false;
+    }
+    log.kinds.resize(log.header.num_kinds);
+    if (!in.read((char*)log.kinds.data(), log.kinds.size() * sizeof(EventFileKind))) {
+        cerr << path << ": truncated kind table" << endl;
+        return false;
+    }
+    for (EventFileKind& kind : log.kinds) {
+        kind.name[sizeof(kind.name) - 1] = '\0';
+        kind.format[sizeof(kind.format) - 1] = '\0';
+    }
+    EventRecord record;
+    while (in.read((char*)&record, sizeof(record))) {
+        if (record.kind == EVENT_DROPPED) log.dropped = record.args[0];
+        else log.records.push_back(record);
+    }
+    return true;
+}
+
+string format_event(const RankLog& log, const EventRecord& record) {
+    if (record.kind < 0 || record.kind >= (int)log.kinds.size()) {
+        return "unknown event " + to_string(record.kind) + " (" + to_string(record.args[0]) + ", " +
+               to_string(record.args[1]) + ", " + to_string(record.args[2]) + ")";
+    }
+    string text;
+    int next = 0;
+    for (const char* p = log.kinds[record.kind].format; *p != '\0'; ++p) {
+        if (p[0] == '{' && p[1] == '}' && next < EVENT_ARGS) {
+            text += to_string(record.args[next++]);
+            ++p;
+        } else {
+            text += *p;
+        }
+    }
+    return text;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " FILE..." << endl;
+        return 1;
+    }
+    vector<RankLog> logs(argc - 1);
+    for (int i = 1; i < argc; ++i) {
+        if (!read_log(argv[i], logs[i - 1])) return 1;
+    }
+
+    // (time, rank, index in that rank's log); ties keep each rank's order.
+    struct Entry {
+        int64_t time;
+        int log;
+        size_t index;
+    };
+    vector<Entry> entries;
+    int64_t start = INT64_MAX;
+    for (size_t l = 0; l < logs.size(); ++l) {
+        for (size_t i = 0; i < logs[l].records.size(); ++i) {
+            entries.push_back({logs[l].records[i].time_ns, (int)l, i});
+            start = min(start, logs[l].records[i].time_ns);
+        }
+    }
+    stable_sort(entries.begin(), entries.end(), [&](const Entry& a, const Entry& b) {
+        if (a.time != b.time) return a.time < b.time;
+        return logs[a.log].header.rank < logs[b.log].header.rank;
+    });
+
+    map<string, long long> per_kind;
+    for (const Entry& e : entries) {
+        const RankLog& log = logs[e.log];
+        const EventRecord& record = log.records[e.index];
+        cout << "[" << (record.time_ns - start) / 1000 << " us] rank " << log.header.rank << ": "
+             << format_event(log, record) << endl;
+        if (record.kind >= 0 && record.kind < (int)log.kinds.size()) per_kind[log.kinds[record.kind].name]++;
+    }
+
+    long long dropped = 0;
+    int truncated = 0;
+    for (const RankLog& log : logs) {
+        if (log.dropped < 0) truncated++;
+        else dropped += log.dropped;
+    }
+    cout << "\nEvents: " << entries.size() << " from " << logs.size() << " ranks, " << dropped << " dropped";
+    if (truncated > 0) cout << ", " << truncated << " logs without trailer (rank did not finish)";
+    cout << endl;
+    for (const auto& kind : per_kind) cout << "  " << kind.first << ": " << kind.second << endl;
+    return 0;
+}
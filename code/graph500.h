@@ -0,0 +1,398 @@
+#ifndef GRAPH500_H
+#define GRAPH500_H
+
+// Graph500-style graph generation, distribution and BFS validation.
+//
+// Unlike the one-vertex-per-rank programs, every rank here owns a contiguous
+// block of vertices of a large graph (1D partitioning), so a handful of
+// processes can traverse millions of vertices.
+
+#include <mpi.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+// R-MAT quadrant probabilities used by the Graph500 reference generator.
+const double KRONECKER_A = 0.57;
+const double KRONECKER_B = 0.19;
+const double KRONECKER_C = 0.19;
+
+struct Edge {
+    int64_t u;
+    int64_t v;
+};
+
+struct DistGraph {
+    int64_t num_global_vertices = 0;
+    int64_t num_input_edges = 0;     // edges produced by the generator
+    int64_t vertices_per_rank = 0;
+    int64_t local_begin = 0;         // first global id owned by this rank
+    int64_t num_local = 0;
+    std::vector<int64_t> row_offsets; // num_local + 1 entries
+    std::vector<int64_t> columns;     // global neighbour ids
+
+    int owner(int64_t v) const { return (int)(v / vertices_per_rank); }
+    bool is_local(int64_t v) const { return v >= local_begin && v < local_begin + num_local; }
+    int64_t local_index(int64_t v) const { return v - local_begin; }
+    int64_t degree(int64_t local) const { return row_offsets[local + 1] - row_offsets[local]; }
+};
+
+// Counter-based generator so that edge i is identical for every process
+// count and the graph only depends on (scale, edge_factor, seed).
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline double uniform01(uint64_t& state) {
+    state = splitmix64(state);
+    return (state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Bijective label scramble on [0, 2^scale) so that high-degree vertices are
+// not all clustered on rank 0.
+inline int64_t scramble_vertex(int64_t v, int scale, uint64_t seed) {
+    const uint64_t mask = (scale >= 64) ? ~0ULL : ((1ULL << scale) - 1);
+    uint64_t x = (uint64_t)v;
+    x = (x * ((splitmix64(seed) | 1ULL))) & mask;
+    x ^= x >> ((scale + 1) / 2);
+    x = (x * ((splitmix64(seed + 1) | 1ULL))) & mask;
+    x ^= x >> ((scale + 1) / 2);
+    return (int64_t)x;
+}
+
+// Generates this rank's share of the edge_factor * 2^scale Kronecker edges.
+inline std::vector<Edge> generate_kronecker_edges(int scale, int edge_factor, uint64_t seed,
+                                                  MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    const int64_t num_edges = (int64_t)edge_factor << scale;
+    const int64_t begin = num_edges * rank / size;
+    const int64_t end = num_edges * (rank + 1) / size;
+
+    std::vector<Edge> edges;
+    edges.reserve(end - begin);
+    for (int64_t i = begin; i < end; ++i) {
+        uint64_t state = splitmix64(seed ^ splitmix64((uint64_t)i));
+        int64_t u = 0, v = 0;
+        for (int bit = 0; bit < scale; ++bit) {
+            double r = uniform01(state);
+            int row = (r >= KRONECKER_A + KRONECKER_B);
+            int col = row ? (r >= KRONECKER_A + KRONECKER_B + KRONECKER_C)
+                          : (r >= KRONECKER_A);
+            u = (u << 1) | row;
+            v = (v << 1) | col;
+        }
+        edges.push_back({scramble_vertex(u, scale, seed), scramble_vertex(v, scale, seed)});
+    }
+    return edges;
+}
+
+// Weight in [0, 1) of the undirected edge {u, v}; both directions (and any
+// parallel copies) get the same value, so weights need not be stored.
+inline double edge_weight(int64_t u, int64_t v, uint64_t seed) {
+    uint64_t state = splitmix64(seed ^ splitmix64((uint64_t)std::min(u, v)) ^
+                                (splitmix64((uint64_t)std::max(u, v)) << 1));
+    return uniform01(state);
+}
+
+// 2D grid with side x side vertices: a high-diameter, road-network-like
+// counterpart to the low-diameter Kronecker graphs. Vertex ids are row-major,
+// so the block distribution keeps neighbouring rows on the same rank.
+inline std::vector<Edge> generate_grid_edges(int64_t side, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    const int64_t n = side * side;
+    std::vector<Edge> edges;
+    for (int64_t v = n * rank / size; v < n * (rank + 1) / size; ++v) {
+        if ((v % side) + 1 < side) edges.push_back({v, v + 1});
+        if (v + side < n) edges.push_back({v, v + side});
+    }
+    return edges;
+}
+
+// Personalised all-to-all of plain structs: outgoing[r] is delivered to rank r
+// and everything addressed to this rank is returned concatenated.
+// MPI_Alltoallv takes int counts and displacements, so they are given in
+// elements of a sizeof(T)-byte type, and an exchange too large for them
+// runs in rounds of at most max_chunk elements per rank pair.
+template <typename T>
+std::vector<T> exchange_messages(const std::vector<std::vector<T>>& outgoing, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    std::vector<int64_t> send_counts(size), recv_counts(size);
+    for (int r = 0; r < size; ++r) send_counts[r] = outgoing[r].size();
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT64_T, recv_counts.data(), 1, MPI_INT64_T, comm);
+
+    std::vector<size_t> recv_base(size + 1, 0);
+    int64_t largest = 0;
+    for (int r = 0; r < size; ++r) {
+        recv_base[r + 1] = recv_base[r] + recv_counts[r];
+        largest = std::max(largest, std::max(send_counts[r], recv_counts[r]));
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &largest, 1, MPI_INT64_T, MPI_MAX, comm);
+    const int64_t max_chunk = std::max<int64_t>(1, std::numeric_limits<int>::max() / size);
+    const int64_t rounds = std::max<int64_t>(1, (largest + max_chunk - 1) / max_chunk);
+
+    MPI_Datatype type;
+    MPI_Type_contiguous(sizeof(T), MPI_BYTE, &type);
+    MPI_Type_commit(&type);
+
+    std::vector<T> recv_buf(recv_base[size]), send_buf, chunk;
+    std::vector<int> send_chunk(size), recv_chunk(size), send_displs(size), recv_displs(size);
+    for (int64_t round = 0; round < rounds; ++round) {
+        const int64_t offset = round * max_chunk;
+        int send_total = 0, recv_total = 0;
+        for (int r = 0; r < size; ++r) {
+            send_chunk[r] = (int)std::min(std::max<int64_t>(send_counts[r] - offset, 0), max_chunk);
+            recv_chunk[r] = (int)std::min(std::max<int64_t>(recv_counts[r] - offset, 0), max_chunk);
+            send_displs[r] = send_total;
+            recv_displs[r] = recv_total;
+            send_total += send_chunk[r];
+            recv_total += recv_chunk[r];
+        }
+
+        send_buf.resize(send_total);
+        for (int r = 0; r < size; ++r) {
+            if (send_chunk[r] == 0) continue;
+            std::copy(outgoing[r].begin() + offset, outgoing[r].begin() + offset + send_chunk[r],
+                      send_buf.begin() + send_displs[r]);
+        }
+        // In a single round the data lands in place, as recv_displs match
+        // recv_base.
+        if (rounds > 1) chunk.resize(recv_total);
+        T* recv_data = (rounds > 1) ? chunk.data() : recv_buf.data();
+        MPI_Alltoallv(send_buf.data(), send_chunk.data(), send_displs.data(), type,
+                      recv_data, recv_chunk.data(), recv_displs.data(), type, comm);
+        if (rounds == 1) continue;
+        for (int r = 0; r < size; ++r) {
+            std::copy(chunk.begin() + recv_displs[r], chunk.begin() + recv_displs[r] + recv_chunk[r],
+                      recv_buf.begin() + recv_base[r] + offset);
+        }
+    }
+    MPI_Type_free(&type);
+    return recv_buf;
+}
+
+// Ships both directions of every edge to the owner of its source and builds
+// the local CSR. Self loops are dropped; parallel edges are kept.
+inline DistGraph build_dist_graph(int64_t num_vertices, const std::vector<Edge>& local_edges,
+                                  MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    DistGraph g;
+    g.num_global_vertices = num_vertices;
+    g.vertices_per_rank = (num_vertices + size - 1) / size;
+    g.local_begin = std::min(num_vertices, g.vertices_per_rank * rank);
+    g.num_local = std::min(num_vertices, g.local_begin + g.vertices_per_rank) - g.local_begin;
+
+    int64_t local_count = (int64_t)local_edges.size();
+    MPI_Allreduce(&local_count, &g.num_input_edges, 1, MPI_INT64_T, MPI_SUM, comm);
+
+    std::vector<std::vector<Edge>> outgoing(size);
+    for (const Edge& e : local_edges) {
+        if (e.u == e.v) continue;
+        outgoing[g.owner(e.u)].push_back({e.u, e.v});
+        outgoing[g.owner(e.v)].push_back({e.v, e.u});
+    }
+    std::vector<Edge> mine = exchange_messages(outgoing, comm);
+
+    g.row_offsets.assign(g.num_local + 1, 0);
+    for (const Edge& e : mine) g.row_offsets[g.local_index(e.u) + 1]++;
+    for (int64_t i = 0; i < g.num_local; ++i) g.row_offsets[i + 1] += g.row_offsets[i];
+    g.columns.resize(mine.size());
+    std::vector<int64_t> fill(g.row_offsets.begin(), g.row_offsets.end() - 1);
+    for (const Edge& e : mine) g.columns[fill[g.local_index(e.u)]++] = e.v;
+    return g;
+}
+
+// Picks distinct search keys with at least one edge, identically on all ranks.
+inline std::vector<int64_t> pick_search_keys(const DistGraph& g, int count, uint64_t seed,
+                                             MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    std::vector<int64_t> keys;
+    uint64_t state = splitmix64(seed ^ 0x5EA2C4ULL);
+    int64_t attempts = 0;
+    while ((int)keys.size() < count && attempts < 64 * (int64_t)count + g.num_global_vertices) {
+        ++attempts;
+        state = splitmix64(state);
+        int64_t candidate = (int64_t)(state % (uint64_t)g.num_global_vertices);
+        int64_t degree = 0;
+        if (g.owner(candidate) == rank) degree = g.degree(g.local_index(candidate));
+        MPI_Bcast(&degree, 1, MPI_INT64_T, g.owner(candidate), comm);
+        if (degree > 0 && find(keys.begin(), keys.end(), candidate) == keys.end()) {
+            keys.push_back(candidate);
+        }
+    }
+    return keys;
+}
+
+// Fetches value[v] for every requested global vertex from its owner.
+template <typename T>
+std::vector<T> fetch_remote(const DistGraph& g, const std::vector<int64_t>& wanted,
+                            const std::vector<T>& value, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    std::vector<std::vector<int64_t>> requests(size);
+    for (int64_t v : wanted) requests[g.owner(v)].push_back(v);
+
+    // Answer in the order the requests arrived, grouped per source rank.
+    std::vector<int64_t> recv_counts(size), send_counts(size);
+    for (int r = 0; r < size; ++r) send_counts[r] = requests[r].size();
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT64_T, recv_counts.data(), 1, MPI_INT64_T, comm);
+    std::vector<int64_t> incoming = exchange_messages(requests, comm);
+
+    std::vector<std::vector<T>> replies(size);
+    size_t pos = 0;
+    for (int r = 0; r < size; ++r) {
+        for (int64_t i = 0; i < recv_counts[r]; ++i, ++pos) {
+            replies[r].push_back(value[g.local_index(incoming[pos])]);
+        }
+    }
+    std::vector<T> answers = exchange_messages(replies, comm);
+
+    std::vector<size_t> next(size, 0), base(size, 0);
+    for (int r = 1; r < size; ++r) base[r] = base[r - 1] + send_counts[r - 1];
+    std::vector<T> result(wanted.size());
+    for (size_t i = 0; i < wanted.size(); ++i) {
+        int r = g.owner(wanted[i]);
+        result[i] = answers[base[r] + next[r]++];
+    }
+    return result;
+}
+
+// Checks a BFS result the way the Graph500 reference validator does:
+//  - the root is its own parent at level 0,
+//  - every tree edge (v, parent[v]) is an edge of the graph,
+//  - level[v] == level[parent[v]] + 1 for every non-root tree vertex,
+//  - no graph edge joins levels more than one apart,
+//  - no graph edge joins a visited and an unvisited vertex.
+// parent/level are -1 for unvisited vertices. On success edges_traversed holds
+// the number of undirected edges inside the root's component.
+inline bool validate_bfs_tree(const DistGraph& g, int64_t root, const std::vector<int64_t>& parent,
+                              const std::vector<int64_t>& level, int64_t* edges_traversed,
+                              std::string* error, MPI_Comm comm) {
+    std::string local_error;
+    int64_t degree_sum = 0;
+
+    if (g.is_local(root)) {
+        int64_t li = g.local_index(root);
+        if (parent[li] != root || level[li] != 0) local_error = "root is not its own parent at level 0";
+    }
+
+    std::vector<int64_t> parents_wanted;
+    for (int64_t i = 0; i < g.num_local; ++i) {
+        int64_t v = g.local_begin + i;
+        if (parent[i] < 0 || v == root) continue;
+        bool found = false;
+        for (int64_t e = g.row_offsets[i]; e < g.row_offsets[i + 1] && !found; ++e) {
+            found = (g.columns[e] == parent[i]);
+        }
+        if (!found && local_error.empty()) {
+            local_error = "tree edge " + std::to_string(v) + "-" + std::to_string(parent[i]) +
+                          " is not a graph edge";
+        }
+        parents_wanted.push_back(parent[i]);
+    }
+
+    std::vector<int64_t> parent_levels = fetch_remote(g, parents_wanted, level, comm);
+    size_t pos = 0;
+    for (int64_t i = 0; i < g.num_local; ++i) {
+        int64_t v = g.local_begin + i;
+        if (parent[i] < 0 || v == root) continue;
+        if (parent_levels[pos++] + 1 != level[i] && local_error.empty()) {
+            local_error = "vertex " + std::to_string(v) + " is not one level below its parent";
+        }
+    }
+
+    std::vector<int64_t> neighbour_levels = fetch_remote(g, g.columns, level, comm);
+    for (int64_t i = 0; i < g.num_local; ++i) {
+        for (int64_t e = g.row_offsets[i]; e < g.row_offsets[i + 1]; ++e) {
+            int64_t lu = level[i], lv = neighbour_levels[e];
+            if ((lu < 0) != (lv < 0)) {
+                if (local_error.empty()) {
+                    local_error = "edge " + std::to_string(g.local_begin + i) + "-" +
+                                  std::to_string(g.columns[e]) + " leaves the reached component";
+                }
+            } else if (lu >= 0 && std::llabs(lu - lv) > 1 && local_error.empty()) {
+                local_error = "edge " + std::to_string(g.local_begin + i) + "-" +
+                              std::to_string(g.columns[e]) + " spans more than one level";
+            }
+        }
+        if (level[i] >= 0) degree_sum += g.degree(i);
+    }
+
+    int local_ok = local_error.empty(), all_ok = 0;
+    MPI_Allreduce(&local_ok, &all_ok, 1, MPI_INT, MPI_LAND, comm);
+    int64_t total_degree = 0;
+    MPI_Allreduce(&degree_sum, &total_degree, 1, MPI_INT64_T, MPI_SUM, comm);
+    *edges_traversed = total_degree / 2;
+
+    if (!all_ok) {
+        // Report the first failing rank's message.
+        int rank, size;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+        int first_bad = local_ok ? size : rank, reporter = 0;
+        MPI_Allreduce(&first_bad, &reporter, 1, MPI_INT, MPI_MIN, comm);
+        int len = (int)local_error.size();
+        MPI_Bcast(&len, 1, MPI_INT, reporter, comm);
+        local_error.resize(len);
+        MPI_Bcast(&local_error[0], len, MPI_CHAR, reporter, comm);
+        *error = local_error;
+    }
+    return all_ok;
+}
+
+struct TepsStats {
+    double min = 0, first_quartile = 0, median = 0, third_quartile = 0, max = 0;
+    double harmonic_mean = 0, harmonic_stddev = 0;
+};
+
+inline double quantile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    double pos = q * (sorted.size() - 1);
+    size_t lo = (size_t)pos;
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+}
+
+// TEPS are rates, so they are averaged harmonically (Graph500 spec, sec. 9).
+inline TepsStats compute_teps_stats(std::vector<double> teps) {
+    TepsStats s;
+    if (teps.empty()) return s;
+    std::sort(teps.begin(), teps.end());
+    s.min = teps.front();
+    s.first_quartile = quantile(teps, 0.25);
+    s.median = quantile(teps, 0.5);
+    s.third_quartile = quantile(teps, 0.75);
+    s.max = teps.back();
+
+    double inverse_sum = 0;
+    for (double t : teps) inverse_sum += 1.0 / t;
+    s.harmonic_mean = teps.size() / inverse_sum;
+    if (teps.size() > 1) {
+        double var = 0;
+        for (double t : teps) var += (1.0 / t - 1.0 / s.harmonic_mean) * (1.0 / t - 1.0 / s.harmonic_mean);
+        var /= (teps.size() - 1);
+        s.harmonic_stddev = std::sqrt(var) * s.harmonic_mean * s.harmonic_mean / std::sqrt((double)teps.size());
+    }
+    return s;
+}
+
+#endif
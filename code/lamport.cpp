@@ -3,36 +3,45 @@
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
-#include <mpi.h>
-#include <unistd.h> 
+#include <random>
+#include "comm.h"
+#include "event_log.h"
+#include "snapshot.h"
 
 using namespace std;
 
 const int MSG_TAG = 0;
 const int TERM_TAG = 1;
 
+enum { EV_INTERNAL, EV_SEND, EV_RECEIVE };
+const EventKind LAMPORT_EVENTS[] = {
+    {"internal", "internal event. new clock = {}"},
+    {"send", "sent message with timestamp {} to rank {}"},
+    {"receive", "received message from rank {} with timestamp {}. new clock = {}"},
+};
+
 struct MessageData {
     int logical_timestamp;
 };
 
-int getRandomDestination(int my_rank, int world_size) {
+int getRandomDestination(int my_rank, int world_size, mt19937& rng) {
     if (world_size == 1) return my_rank;
     int dest_rank;
     do {
-        dest_rank = rand() % world_size;
+        dest_rank = rng() % world_size;
     } while (dest_rank == my_rank); 
     return dest_rank;
 }
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
-
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+// With --snapshot-every S the clocks and the messages in flight are saved
+// every S seconds (snapshot.h).
+int run(Comm& world, int argc, char** argv) {
+    SnapshotComm comm(world, argc, argv);
+    int world_rank = comm.rank();
+    int world_size = comm.size();
 
-    srand(time(NULL) + world_rank);
+    mt19937 rng(comm.seed());
+    EventLog events(comm, argc, argv, LAMPORT_EVENTS);
 
     int local_clock = 0;
     int messages_sent = 0;
@@ -40,59 +49,55 @@ int main(int argc, char** argv) {
     bool terminated = false;
     
     MessageData received_msg;
-    MPI_Request recv_request;
-    MPI_Status recv_status;
+    CommRequest recv_request = COMM_REQUEST_NULL;
+    CommStatus recv_status;
     bool recv_posted = false;
 
+    comm.capture([&] {
+        return "clock " + to_string(local_clock) + ", " + to_string(messages_sent) + " messages sent";
+    });
+
     if (world_size > 1) {
-        MPI_Irecv(&received_msg, sizeof(MessageData), MPI_BYTE, MPI_ANY_SOURCE, MSG_TAG, MPI_COMM_WORLD, &recv_request);
+        recv_request = comm.irecv(&received_msg, sizeof(MessageData), COMM_ANY_SOURCE, MSG_TAG);
         recv_posted = true;
     }
 
     while (!terminated) {
         
-        usleep(500000);
+        comm.sleep_us(500000);
 
         local_clock++;
-        cout << "rank " << world_rank << ": internal event. new clock = " << local_clock << endl;
+        LOG_EVENT(events, LOG_INFO, EV_INTERNAL, local_clock);
         
     
         if (messages_sent < MAX_MESSAGES_PER_PROCESS && world_size > 1) {
             
             local_clock++; 
             
-            int dest_rank = getRandomDestination(world_rank, world_size);
+            int dest_rank = getRandomDestination(world_rank, world_size, rng);
             MessageData send_msg;
             send_msg.logical_timestamp = local_clock;
 
-            MPI_Request send_request;
-            MPI_Isend(&send_msg, sizeof(MessageData), MPI_BYTE, dest_rank, MSG_TAG, MPI_COMM_WORLD, &send_request);
-            
-            MPI_Request_free(&send_request); 
+            comm.send(&send_msg, sizeof(MessageData), dest_rank, MSG_TAG);
 
-            cout << "rank " << world_rank << ": sent message with timestamp " << local_clock 
-             << " to rank " << dest_rank << endl;
+            LOG_EVENT(events, LOG_INFO, EV_SEND, local_clock, dest_rank);
             messages_sent++;
         }
         
         if (recv_posted) {
-            int flag = 0;
-            MPI_Test(&recv_request, &flag, &recv_status);
-
-            if (flag) { 
+            if (comm.test(recv_request, &recv_status)) {
                 
                 local_clock = max(local_clock, received_msg.logical_timestamp) + 1;
                 
-                cout << "rank " << world_rank << ": received message from rank " << recv_status.MPI_SOURCE
-                          << " with timestamp " << received_msg.logical_timestamp
-                          << ". new clock = " << local_clock << endl;
+                LOG_EVENT(events, LOG_INFO, EV_RECEIVE, recv_status.source, received_msg.logical_timestamp,
+                          local_clock);
 
-                MPI_Irecv(&received_msg, sizeof(MessageData), MPI_BYTE, MPI_ANY_SOURCE, MSG_TAG, MPI_COMM_WORLD, &recv_request);
+                recv_request = comm.irecv(&received_msg, sizeof(MessageData), COMM_ANY_SOURCE, MSG_TAG);
             }
         }
 
-        int global_messages_sent;
-        MPI_Reduce(&messages_sent, &global_messages_sent, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+        long long local_messages_sent = messages_sent, global_messages_sent;
+        comm.reduce(&local_messages_sent, &global_messages_sent, 1, COMM_SUM, 0);
 
         if (world_rank == 0) {
             if (global_messages_sent >= MAX_MESSAGES_PER_PROCESS * world_size) {
@@ -101,17 +106,18 @@ int main(int argc, char** argv) {
             }
         }
     
-        MPI_Bcast(&terminated, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+        comm.bcast(&terminated, sizeof(bool), 0);
     } 
 
      
-    // if (recv_posted) {
-    //     MPI_Cancel(&recv_request);
-    //     MPI_Status status;
-    //     MPI_Wait(&recv_request, &status);
-    //     MPI_Request_free(&recv_request);
-    // }
+    if (recv_posted && recv_request != COMM_REQUEST_NULL) {
+        comm.cancel(recv_request);
+    }
+    comm.finish();
     
-    MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
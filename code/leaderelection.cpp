@@ -1,8 +1,8 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
-#include <mpi.h>
-#include <unistd.h> 
+#include "comm.h"
+#include "event_log.h"
 
 using namespace std;
 
@@ -11,6 +11,15 @@ const int ELECTION_TAG = 20;
 const int ELECTED_TAG = 21;
 
 
+enum { EV_INITIATED, EV_LEADER, EV_SENT_ELECTED, EV_FORWARD, EV_FORWARD_ELECTED };
+const EventKind ELECTION_EVENTS[] = {
+    {"initiated", "Initiated election with ID {}. Sent to {}"},
+    {"leader", "Received own ID. I AM THE NEW LEADER."},
+    {"sent_elected", "Sent ELECTED message to {}"},
+    {"forward", "Forwarding ID {} to {}"},
+    {"forward_elected", "Received and forwarded ELECTED message. Leader is {}."},
+};
+
 struct ElectionMessage {
     int candidate_id;
 };
@@ -20,19 +29,15 @@ struct ElectedMessage {
     int leader_id;
 };
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
-
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+int run(Comm& comm, int argc, char** argv) {
+    int world_rank = comm.rank();
+    int world_size = comm.size();
 
     if (world_size < 2) {
         cerr << "Need at least 2 processes for ring election." << endl;
-        MPI_Finalize();
         return 0;
     }
+    EventLog events(comm, argc, argv, ELECTION_EVENTS);
 
    
     const int next_rank = (world_rank + 1) % world_size; 
@@ -41,42 +46,23 @@ int main(int argc, char** argv) {
     int leader_id = -1;
     bool has_forwarded_own_id = false; 
 
-
-    ElectionMessage recv_election_msg;
-    MPI_Request election_recv_request;
-    
-   
-    MPI_Irecv(&recv_election_msg, sizeof(ElectionMessage), MPI_BYTE, prev_rank, ELECTION_TAG, MPI_COMM_WORLD, &election_recv_request);
-
-    ElectedMessage recv_elected_msg;
-    MPI_Request elected_recv_request;
-    
-  
-    MPI_Irecv(&recv_elected_msg, sizeof(ElectedMessage), MPI_BYTE, prev_rank, ELECTED_TAG, MPI_COMM_WORLD, &elected_recv_request);
-
-    MPI_Status status;
-
     ElectionMessage init_msg = {world_rank};
-    MPI_Request init_send_request;
-    MPI_Isend(&init_msg, sizeof(ElectionMessage), MPI_BYTE, next_rank, ELECTION_TAG, MPI_COMM_WORLD, &init_send_request);
-    MPI_Request_free(&init_send_request);
+    comm.send(&init_msg, sizeof(ElectionMessage), next_rank, ELECTION_TAG);
     
     has_forwarded_own_id = true;
-    cout << "Rank " << world_rank << ": Initiated election with ID " << world_rank << ". Sent to " << next_rank << endl;
+    LOG_EVENT(events, LOG_INFO, EV_INITIATED, world_rank, next_rank);
     
 
+    // Both message kinds come from prev_rank, so block on it instead of
+    // polling: a ring of N ranks then costs N hops of latency, not N polls.
     while (leader_id == -1) {
-        usleep(100000); 
+        CommStatus status;
+        comm.probe(prev_rank, COMM_ANY_TAG, &status);
 
-
-        int election_flag = 0;
-        MPI_Test(&election_recv_request, &election_flag, &status);
-
-        if (election_flag) {
+        if (status.tag == ELECTION_TAG) {
+            ElectionMessage recv_election_msg;
+            comm.recv(&recv_election_msg, sizeof(ElectionMessage), prev_rank, ELECTION_TAG);
             int arrived_id = recv_election_msg.candidate_id;
-            
-
-            MPI_Irecv(&recv_election_msg, sizeof(ElectionMessage), MPI_BYTE, prev_rank, ELECTION_TAG, MPI_COMM_WORLD, &election_recv_request);
 
   
             ElectionMessage outgoing_msg;
@@ -91,29 +77,23 @@ int main(int argc, char** argv) {
                 has_forwarded_own_id = true;
             } else if (arrived_id == world_rank) {
                 leader_id = world_rank;
-                cout << "\nRank " << world_rank << ": Received own ID. **I AM THE NEW LEADER.**" << endl;
+                LOG_EVENT(events, LOG_INFO, EV_LEADER);
                 
                 ElectedMessage elected_msg = {leader_id};
-                MPI_Request send_request;
-                MPI_Isend(&elected_msg, sizeof(ElectedMessage), MPI_BYTE, next_rank, ELECTED_TAG, MPI_COMM_WORLD, &send_request);
-                MPI_Request_free(&send_request);
+                comm.send(&elected_msg, sizeof(ElectedMessage), next_rank, ELECTED_TAG);
                 
-                cout << "Rank " << world_rank << ": Sent ELECTED message to " << next_rank << endl;
+                LOG_EVENT(events, LOG_INFO, EV_SENT_ELECTED, next_rank);
             }
             
             if (should_forward) {
-                MPI_Request send_request;
-                MPI_Isend(&outgoing_msg, sizeof(ElectionMessage), MPI_BYTE, next_rank, ELECTION_TAG, MPI_COMM_WORLD, &send_request);
-                MPI_Request_free(&send_request);
-                cout << "Rank " << world_rank << ": Forwarding ID " << outgoing_msg.candidate_id << " to " << next_rank << endl;
+                comm.send(&outgoing_msg, sizeof(ElectionMessage), next_rank, ELECTION_TAG);
+                LOG_EVENT(events, LOG_INFO, EV_FORWARD, outgoing_msg.candidate_id, next_rank);
             }
         } 
 
-        
-        int elected_flag = 0;
-        MPI_Test(&elected_recv_request, &elected_flag, &status);
-
-        if (elected_flag) {
+        else if (status.tag == ELECTED_TAG) {
+            ElectedMessage recv_elected_msg;
+            comm.recv(&recv_elected_msg, sizeof(ElectedMessage), prev_rank, ELECTED_TAG);
             int announced_leader = recv_elected_msg.leader_id;
             
             if (announced_leader != world_rank) {
@@ -121,28 +101,31 @@ int main(int argc, char** argv) {
                 leader_id = announced_leader;
                 
     
-                MPI_Request send_request;
-                MPI_Isend(&recv_elected_msg, sizeof(ElectedMessage), MPI_BYTE, next_rank, ELECTED_TAG, MPI_COMM_WORLD, &send_request);
-                MPI_Request_free(&send_request);
+                comm.send(&recv_elected_msg, sizeof(ElectedMessage), next_rank, ELECTED_TAG);
                 
-                cout << "Rank " << world_rank << ": Received and forwarded ELECTED message. Leader is **" << leader_id << "**." << endl;
+                LOG_EVENT(events, LOG_INFO, EV_FORWARD_ELECTED, leader_id);
             }
          
         }
     } 
 
-    MPI_Cancel(&election_recv_request);
-    MPI_Cancel(&elected_recv_request);
-    
-    MPI_Wait(&election_recv_request, &status);
-    MPI_Wait(&elected_recv_request, &status); 
+    // The leader's own ELECTED comes back around the ring; drain it.
+    if (leader_id == world_rank) {
+        ElectedMessage returned_msg;
+        comm.recv(&returned_msg, sizeof(ElectedMessage), prev_rank, ELECTED_TAG);
+    }
 
-    MPI_Request_free(&election_recv_request);
-    MPI_Request_free(&elected_recv_request);
-    
-    MPI_Barrier(MPI_COMM_WORLD);
+    long long sent = comm.messages_sent(), total_sent = 0;
+    comm.reduce(&sent, &total_sent, 1, COMM_SUM, 0);
+    comm.barrier();
     cout << "\nRank " << world_rank << " terminated. Final Leader: " << leader_id << endl;
+    if (world_rank == 0) {
+        cout << "Election messages: " << total_sent << " (" << (double)total_sent / world_size << " per rank)" << endl;
+    }
     
-    MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
@@ -3,23 +3,45 @@
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
-#include <mpi.h>
-#include <unistd.h> 
+#include <random>
+#include "comm.h"
+#include "event_log.h"
+#include "snapshot.h"
 #include <sstream>
 
 using namespace std;
 
 const int MSG_TAG = 0;
 
-int getRandomDestination(int my_rank, int world_size) {
+int getRandomDestination(int my_rank, int world_size, mt19937& rng) {
     if (world_size == 1) return my_rank;
     int dest_rank;
     do {
-        dest_rank = rand() % world_size;
+        dest_rank = rng() % world_size;
     } while (dest_rank == my_rank); 
     return dest_rank;
 }
 
+enum { EV_INTERNAL, EV_SEND, EV_RECEIVE, EV_CLOCK_ENTRY };
+// r is the recording rank, which event_log_reader prints with every event.
+const EventKind MATRIX_EVENTS[] = {
+    {"internal", "internal event. new clock M[r][r] = {}"},
+    {"send", "sent message with clock to rank {}. M[r][r] = {}"},
+    {"receive", "received message from rank {}. Merged clock. New M[r][r] = {}"},
+    {"clock", "    M[{}][{}] = {}"},
+};
+
+// The whole clock, one record per entry, at debug level; this replaces
+// printing the P x P matrix on every event.
+void log_matrix(EventLog& events, const vector<int>& matrix, int world_size) {
+    if (!events.enabled(LOG_DEBUG)) return;
+    for (int i = 0; i < world_size; ++i) {
+        for (int j = 0; j < world_size; ++j) {
+            LOG_EVENT(events, LOG_DEBUG, EV_CLOCK_ENTRY, i, j, matrix[i * world_size + j]);
+        }
+    }
+}
+
 void print_matrix(const vector<int>& matrix, int world_size) {
     cout << "{\n";
     for (int i = 0; i < world_size; ++i) {
@@ -39,15 +61,15 @@ void print_matrix(const vector<int>& matrix, int world_size) {
     cout << "\n}\n";
 }
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
-
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+// With --snapshot-every S the clocks and the messages in flight are saved
+// every S seconds (snapshot.h).
+int run(Comm& world, int argc, char** argv) {
+    SnapshotComm comm(world, argc, argv);
+    int world_rank = comm.rank();
+    int world_size = comm.size();
 
-    srand(time(NULL) + world_rank);
+    mt19937 rng(comm.seed());
+    EventLog events(comm, argc, argv, MATRIX_EVENTS);
     
     int matrix_size = world_size * world_size;
     
@@ -58,44 +80,46 @@ int main(int argc, char** argv) {
     bool terminated = false;
     
     vector<int> received_matrix(matrix_size); 
-    MPI_Request recv_request;
-    MPI_Status recv_status;
+    CommRequest recv_request = COMM_REQUEST_NULL;
+    CommStatus recv_status;
     bool recv_posted = false;
 
+    // Row by row, rows separated by semicolons.
+    comm.capture([&] {
+        string state = "M = [";
+        for (int i = 0; i < matrix_size; ++i) {
+            if (i > 0) state += (i % world_size == 0 ? "; " : ", ");
+            state += to_string(matrix_clock[i]);
+        }
+        return state + "], " + to_string(messages_sent) + " messages sent";
+    });
+
     if (world_size > 1) {
-        MPI_Irecv(received_matrix.data(), matrix_size, MPI_INT, MPI_ANY_SOURCE, MSG_TAG, MPI_COMM_WORLD, &recv_request);
+        recv_request = comm.irecv(received_matrix.data(), matrix_size * sizeof(int), COMM_ANY_SOURCE, MSG_TAG);
         recv_posted = true;
     }
 
     while (!terminated) {
-        usleep(500000); 
+        comm.sleep_us(500000); 
 
         matrix_clock[world_rank * world_size + world_rank]++;
-        cout << "rank " << world_rank << ": internal event. new clock M[" << world_rank << "][" << world_rank << "] = " 
-             << matrix_clock[world_rank * world_size + world_rank] << endl;
+        LOG_EVENT(events, LOG_INFO, EV_INTERNAL, matrix_clock[world_rank * world_size + world_rank]);
         
         if (messages_sent < MAX_MESSAGES_PER_PROCESS && world_size > 1) {
             matrix_clock[world_rank * world_size + world_rank]++; 
             
-            int dest_rank = getRandomDestination(world_rank, world_size);
+            int dest_rank = getRandomDestination(world_rank, world_size, rng);
             
-            MPI_Request send_request;
-    
-            MPI_Isend(matrix_clock.data(), matrix_size, MPI_INT, dest_rank, MSG_TAG, MPI_COMM_WORLD, &send_request);
+            comm.send(matrix_clock.data(), matrix_size * sizeof(int), dest_rank, MSG_TAG);
             
-            cout << "rank " << world_rank << ": sent message with clock to rank " << dest_rank << ". M[" 
-                 << world_rank << "][" << world_rank << "] = " 
-                 << matrix_clock[world_rank * world_size + world_rank] << endl;
-                  print_matrix(matrix_clock, world_size);
+            LOG_EVENT(events, LOG_INFO, EV_SEND, dest_rank, matrix_clock[world_rank * world_size + world_rank]);
+            log_matrix(events, matrix_clock, world_size);
             messages_sent++;
         }
         
         if (recv_posted) {
-            int flag = 0;
-            MPI_Test(&recv_request, &flag, &recv_status);
-
-            if (flag) { 
-                int sender_rank = recv_status.MPI_SOURCE;
+            if (comm.test(recv_request, &recv_status)) {
+                int sender_rank = recv_status.source;
                 
                 matrix_clock[world_rank * world_size + world_rank]++; 
                 
@@ -106,18 +130,16 @@ int main(int argc, char** argv) {
                     }
                 }
                 
-                cout << "rank " << world_rank << ": received message from rank " << sender_rank
-                          << ". Merged clock. New M[" << world_rank << "][" << world_rank << "] = " 
-                          << matrix_clock[world_rank * world_size + world_rank] << endl;
-
-                           print_matrix(matrix_clock, world_size);
+                LOG_EVENT(events, LOG_INFO, EV_RECEIVE, sender_rank,
+                          matrix_clock[world_rank * world_size + world_rank]);
+                log_matrix(events, matrix_clock, world_size);
               
-                MPI_Irecv(received_matrix.data(), matrix_size, MPI_INT, MPI_ANY_SOURCE, MSG_TAG, MPI_COMM_WORLD, &recv_request);
+                recv_request = comm.irecv(received_matrix.data(), matrix_size * sizeof(int), COMM_ANY_SOURCE, MSG_TAG);
             }
         }
 
-        int global_messages_sent;
-        MPI_Reduce(&messages_sent, &global_messages_sent, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+        long long local_messages_sent = messages_sent, global_messages_sent;
+        comm.reduce(&local_messages_sent, &global_messages_sent, 1, COMM_SUM, 0);
 
         if (world_rank == 0) {
             if (global_messages_sent >= MAX_MESSAGES_PER_PROCESS * world_size) {
@@ -126,16 +148,23 @@ int main(int argc, char** argv) {
             }
         }
     
-        MPI_Bcast(&terminated, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+        comm.bcast(&terminated, sizeof(bool), 0);
     } 
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    if (recv_posted) {
+        comm.cancel(recv_request);
+    }
+    comm.finish();
+    comm.barrier();
 
     if (world_rank == 0) {
         cout << "\nFinal Matrix Clock State:\n";
         print_matrix(matrix_clock, world_size);
     }
     
-    MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
@@ -0,0 +1,539 @@
+// PMPI profiling library: per-tag, per-peer message statistics for any of
+// the programs without changing them. Build it as a shared library and
+// either preload it or link it in front of MPI:
+//
+//   mpic++ -O2 -shared -fPIC mpi_profile.cpp -o libmpiprofile.so
+//   mpirun -np 4 -x LD_PRELOAD=$PWD/libmpiprofile.so ./dme
+//   mpic++ -O2 dme.cpp -o dme -L. -lmpiprofile -Wl,-rpath,$PWD
+//
+// Every wrapper records and then calls the PMPI_ entry point. At
+// MPI_Finalize each rank writes PREFIX.<rank>.txt (MPI_PROFILE_PREFIX,
+// default "mpi_profile") with:
+//
+//   - messages and bytes sent and received per tag and peer, with tag
+//     numbers named through tag_names.h;
+//   - a log2 histogram of message sizes per tag;
+//   - calls and time blocked in MPI_Recv, MPI_Probe and the MPI_Wait family;
+//   - MPI_Iprobe hits and misses per requested tag, and MPI_Test and
+//     MPI_Testall calls;
+//   - calls, time and bytes of every collective.
+//
+// Rank 0 also prints a one-line summary of the whole job. Sends count when
+// they are posted, receives when they complete; cancelled receives and
+// MPI_PROC_NULL are left out. One-sided operations (dme's MCS lock) are not
+// counted. Updates take a mutex, so MPI_THREAD_MULTIPLE programs (dme with
+// --progress-thread) are safe.
+
+#include <mpi.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "tag_names.h"
+
+namespace {
+
+const int HISTOGRAM_BUCKETS = 33;   // 0 bytes, then [2^(b-1), 2^b)
+
+struct PeerStats {
+    long long sent = 0;
+    long long sent_bytes = 0;
+    long long received = 0;
+    long long received_bytes = 0;
+};
+
+struct TagStats {
+    std::map<int, PeerStats> peers;
+    long long histogram[HISTOGRAM_BUCKETS] = {};
+};
+
+struct CallStats {
+    long long calls = 0;
+    double seconds = 0;
+    long long bytes = 0;
+};
+
+struct ProbeStats {
+    long long hits = 0;
+    long long misses = 0;
+};
+
+struct Profile {
+    std::mutex mutex;
+    std::string program = "unknown";
+    double init_time = 0;
+    std::map<int, TagStats> tags;
+    std::map<std::string, CallStats> blocking;
+    std::map<std::string, CallStats> collectives;
+    std::map<int, ProbeStats> iprobe;   // by requested tag
+    long long test_calls = 0;
+    long long test_completions = 0;
+    std::unordered_set<MPI_Request> receives;   // posted by MPI_Irecv
+    std::map<int, std::string> extra_names;     // from MPI_PROFILE_TAGS
+};
+
+Profile& profile() {
+    static Profile p;
+    return p;
+}
+
+int bucket(long long bytes) {
+    int b = 0;
+    while (bytes > 0 && b < HISTOGRAM_BUCKETS - 1) {
+        bytes >>= 1;
+        b++;
+    }
+    return b;
+}
+
+long long type_bytes(int count, MPI_Datatype type) {
+    int size = 0;
+    PMPI_Type_size(type, &size);
+    return (long long)count * size;
+}
+
+void record_send(int dest, int tag, long long bytes) {
+    if (dest == MPI_PROC_NULL) return;
+    Profile& p = profile();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    TagStats& t = p.tags[tag];
+    PeerStats& peer = t.peers[dest];
+    peer.sent++;
+    peer.sent_bytes += bytes;
+    t.histogram[bucket(bytes)]++;
+}
+
+void record_receive(const MPI_Status& status) {
+    if (status.MPI_SOURCE == MPI_PROC_NULL || status.MPI_SOURCE == MPI_ANY_SOURCE) return;
+    int cancelled = 0;
+    PMPI_Test_cancelled(&status, &cancelled);
+    if (cancelled) return;
+    int bytes = 0;
+    PMPI_Get_count(&status, MPI_BYTE, &bytes);
+    if (bytes == MPI_UNDEFINED) bytes = 0;
+    Profile& p = profile();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    TagStats& t = p.tags[status.MPI_TAG];
+    PeerStats& peer = t.peers[status.MPI_SOURCE];
+    peer.received++;
+    peer.received_bytes += bytes;
+    t.histogram[bucket(bytes)]++;
+}
+
+void record_call(std::map<std::string, CallStats> Profile::*table, const char* name, double start,
+                 long long bytes = 0) {
+    double seconds = PMPI_Wtime() - start;
+    Profile& p = profile();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    CallStats& c = (p.*table)[name];
+    c.calls++;
+    c.seconds += seconds;
+    c.bytes += bytes;
+}
+
+// Takes the request out of the receive set; true if it was a receive.
+bool take_receive(MPI_Request request) {
+    if (request == MPI_REQUEST_NULL) return false;
+    Profile& p = profile();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    return p.receives.erase(request) > 0;
+}
+
+void load_tag_names(Profile& p) {
+    const char* path = std::getenv("MPI_PROFILE_TAGS");
+    if (path == NULL) return;
+    std::ifstream in(path);
+    std::string program, name;
+    int tag;
+    while (in >> program >> tag >> name) {
+        if (program == p.program || program == "*") p.extra_names[tag] = name;
+    }
+}
+
+void start(char** argv) {
+    Profile& p = profile();
+    std::string name;
+    if (argv != NULL && argv[0] != NULL) {
+        name = argv[0];
+    } else {
+        std::ifstream comm("/proc/self/comm");
+        std::getline(comm, name);
+    }
+    size_t slash = name.rfind('/');
+    if (slash != std::string::npos) name = name.substr(slash + 1);
+    if (!name.empty()) p.program = name;
+    load_tag_names(p);
+    p.init_time = PMPI_Wtime();
+}
+
+std::string tag_label(Profile& p, int tag) {
+    if (tag == MPI_ANY_TAG) return "any tag";
+    std::map<int, std::string>::iterator extra = p.extra_names.find(tag);
+    const char* name = extra != p.extra_names.end() ? extra->second.c_str() : find_tag_name(p.program.c_str(), tag);
+    std::ostringstream label;
+    if (name != NULL) label << name << " (" << tag << ")";
+    else label << "tag " << tag;
+    return label.str();
+}
+
+void write_summary(int rank, int size, double elapsed) {
+    Profile& p = profile();
+    const char* prefix = std::getenv("MPI_PROFILE_PREFIX");
+    std::string path = std::string(prefix != NULL ? prefix : "mpi_profile") + "." + std::to_string(rank) + ".txt";
+    std::FILE* out = std::fopen(path.c_str(), "w");
+    if (out == NULL) {
+        std::fprintf(stderr, "mpi_profile: could not write %s\n", path.c_str());
+        return;
+    }
+    std::fprintf(out, "Rank %d of %d (%s), %.6f s from MPI_Init to MPI_Finalize\n", rank, size, p.program.c_str(),
+                 elapsed);
+
+    std::fprintf(out, "\nPoint-to-point by tag and peer:\n");
+    std::fprintf(out, "  %-32s %6s %10s %14s %10s %14s\n", "tag", "peer", "sent", "bytes", "received", "bytes");
+    for (auto& t : p.tags) {
+        std::string label = tag_label(p, t.first);
+        for (auto& peer : t.second.peers) {
+            const PeerStats& s = peer.second;
+            std::fprintf(out, "  %-32s %6d %10lld %14lld %10lld %14lld\n", label.c_str(), peer.first, s.sent,
+                         s.sent_bytes, s.received, s.received_bytes);
+        }
+    }
+
+    std::fprintf(out, "\nMessage sizes by tag (sent and received):\n");
+    for (auto& t : p.tags) {
+        std::fprintf(out, "  %s:", tag_label(p, t.first).c_str());
+        for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+            long long n = t.second.histogram[b];
+            if (n == 0) continue;
+            if (b == 0) std::fprintf(out, "  0 B: %lld", n);
+            else std::fprintf(out, "  %lld-%lld B: %lld", 1LL << (b - 1), (1LL << b) - 1, n);
+        }
+        std::fprintf(out, "\n");
+    }
+
+    std::fprintf(out, "\nBlocked in:\n");
+    for (auto& c : p.blocking) {
+        std::fprintf(out, "  %-20s %10lld calls %12.6f s\n", c.first.c_str(), c.second.calls, c.second.seconds);
+    }
+    std::fprintf(out, "  %-20s %10lld calls %12lld completed\n", "MPI_Test(all)", p.test_calls, p.test_completions);
+
+    std::fprintf(out, "\nMPI_Iprobe by requested tag:\n");
+    for (auto& probe : p.iprobe) {
+        long long calls = probe.second.hits + probe.second.misses;
+        std::fprintf(out, "  %-32s %10lld hits %10lld misses  %5.1f%% hit\n", tag_label(p, probe.first).c_str(),
+                     probe.second.hits, probe.second.misses, calls > 0 ? 100.0 * probe.second.hits / calls : 0.0);
+    }
+
+    std::fprintf(out, "\nCollectives:\n");
+    for (auto& c : p.collectives) {
+        std::fprintf(out, "  %-22s %10lld calls %12.6f s %14lld bytes\n", c.first.c_str(), c.second.calls,
+                     c.second.seconds, c.second.bytes);
+    }
+    std::fclose(out);
+}
+
+}  // namespace
+
+extern "C" {
+
+int MPI_Init(int* argc, char*** argv) {
+    int code = PMPI_Init(argc, argv);
+    start(argv != NULL ? *argv : NULL);
+    return code;
+}
+
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided) {
+    int code = PMPI_Init_thread(argc, argv, required, provided);
+    start(argv != NULL ? *argv : NULL);
+    return code;
+}
+
+int MPI_Finalize() {
+    Profile& p = profile();
+    int rank = 0, size = 1;
+    PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    PMPI_Comm_size(MPI_COMM_WORLD, &size);
+    double elapsed = PMPI_Wtime() - p.init_time;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        write_summary(rank, size, elapsed);
+    }
+
+    // messages, bytes sent; blocked and collective time in microseconds
+    long long local[4] = {0, 0, 0, 0}, total[4];
+    for (auto& t : p.tags) {
+        for (auto& peer : t.second.peers) {
+            local[0] += peer.second.sent;
+            local[1] += peer.second.sent_bytes;
+        }
+    }
+    for (auto& c : p.blocking) local[2] += (long long)(c.second.seconds * 1e6);
+    for (auto& c : p.collectives) local[3] += (long long)(c.second.seconds * 1e6);
+    PMPI_Reduce(local, total, 4, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        const char* prefix = std::getenv("MPI_PROFILE_PREFIX");
+        std::printf("mpi_profile: %d ranks, %lld messages, %lld bytes, %.6f s blocked, %.6f s in collectives; "
+                    "per-rank summaries in %s.*.txt\n",
+                    size, total[0], total[1], total[2] * 1e-6, total[3] * 1e-6,
+                    prefix != NULL ? prefix : "mpi_profile");
+        std::fflush(stdout);
+    }
+    return PMPI_Finalize();
+}
+
+int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+    record_send(dest, tag, type_bytes(count, type));
+    return PMPI_Send(buf, count, type, dest, tag, comm);
+}
+
+int MPI_Ssend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+    record_send(dest, tag, type_bytes(count, type));
+    return PMPI_Ssend(buf, count, type, dest, tag, comm);
+}
+
+int MPI_Isend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm,
+              MPI_Request* request) {
+    record_send(dest, tag, type_bytes(count, type));
+    return PMPI_Isend(buf, count, type, dest, tag, comm, request);
+}
+
+int MPI_Recv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status* status) {
+    MPI_Status local;
+    if (status == MPI_STATUS_IGNORE) status = &local;
+    double start = PMPI_Wtime();
+    int code = PMPI_Recv(buf, count, type, source, tag, comm, status);
+    record_call(&Profile::blocking, "MPI_Recv", start);
+    record_receive(*status);
+    return code;
+}
+
+int MPI_Irecv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request* request) {
+    int code = PMPI_Irecv(buf, count, type, source, tag, comm, request);
+    Profile& p = profile();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    p.receives.insert(*request);
+    return code;
+}
+
+int MPI_Wait(MPI_Request* request, MPI_Status* status) {
+    MPI_Status local;
+    if (status == MPI_STATUS_IGNORE) status = &local;
+    MPI_Request handle = *request;
+    double start = PMPI_Wtime();
+    int code = PMPI_Wait(request, status);
+    record_call(&Profile::blocking, "MPI_Wait", start);
+    if (take_receive(handle)) record_receive(*status);
+    return code;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]) {
+    std::vector<MPI_Status> local;
+    if (statuses == MPI_STATUSES_IGNORE) {
+        local.resize(count);
+        statuses = local.data();
+    }
+    std::vector<MPI_Request> handles(requests, requests + count);
+    double start = PMPI_Wtime();
+    int code = PMPI_Waitall(count, requests, statuses);
+    record_call(&Profile::blocking, "MPI_Waitall", start);
+    for (int i = 0; i < count; ++i) {
+        if (take_receive(handles[i])) record_receive(statuses[i]);
+    }
+    return code;
+}
+
+int MPI_Waitany(int count, MPI_Request requests[], int* index, MPI_Status* status) {
+    MPI_Status local;
+    if (status == MPI_STATUS_IGNORE) status = &local;
+    std::vector<MPI_Request> handles(requests, requests + count);
+    double start = PMPI_Wtime();
+    int code = PMPI_Waitany(count, requests, index, status);
+    record_call(&Profile::blocking, "MPI_Waitany", start);
+    if (*index != MPI_UNDEFINED && take_receive(handles[*index])) record_receive(*status);
+    return code;
+}
+
+int MPI_Test(MPI_Request* request, int* flag, MPI_Status* status) {
+    MPI_Status local;
+    if (status == MPI_STATUS_IGNORE) status = &local;
+    MPI_Request handle = *request;
+    int code = PMPI_Test(request, flag, status);
+    {
+        Profile& p = profile();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.test_calls++;
+        if (*flag) p.test_completions++;
+    }
+    if (*flag && take_receive(handle)) record_receive(*status);
+    return code;
+}
+
+int MPI_Testall(int count, MPI_Request requests[], int* flag, MPI_Status statuses[]) {
+    std::vector<MPI_Status> local;
+    if (statuses == MPI_STATUSES_IGNORE) {
+        local.resize(count);
+        statuses = local.data();
+    }
+    std::vector<MPI_Request> handles(requests, requests + count);
+    int code = PMPI_Testall(count, requests, flag, statuses);
+    {
+        Profile& p = profile();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.test_calls++;
+        if (*flag) p.test_completions++;
+    }
+    if (!*flag) return code;
+    for (int i = 0; i < count; ++i) {
+        if (take_receive(handles[i])) record_receive(statuses[i]);
+    }
+    return code;
+}
+
+int MPI_Cancel(MPI_Request* request) {
+    // The request still completes through MPI_Wait or MPI_Test, where the
+    // cancelled status keeps it out of the counts.
+    return PMPI_Cancel(request);
+}
+
+int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status* status) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Probe(source, tag, comm, status);
+    record_call(&Profile::blocking, "MPI_Probe", start);
+    return code;
+}
+
+int MPI_Iprobe(int source, int tag, MPI_Comm comm, int* flag, MPI_Status* status) {
+    int code = PMPI_Iprobe(source, tag, comm, flag, status);
+    Profile& p = profile();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    ProbeStats& s = p.iprobe[tag];
+    if (*flag) s.hits++;
+    else s.misses++;
+    return code;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Barrier(comm);
+    record_call(&Profile::collectives, "MPI_Barrier", start);
+    return code;
+}
+
+int MPI_Bcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Bcast(buf, count, type, root, comm);
+    record_call(&Profile::collectives, "MPI_Bcast", start, type_bytes(count, type));
+    return code;
+}
+
+int MPI_Reduce(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Reduce(in, out, count, type, op, root, comm);
+    record_call(&Profile::collectives, "MPI_Reduce", start, type_bytes(count, type));
+    return code;
+}
+
+int MPI_Allreduce(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Allreduce(in, out, count, type, op, comm);
+    record_call(&Profile::collectives, "MPI_Allreduce", start, type_bytes(count, type));
+    return code;
+}
+
+int MPI_Iallreduce(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm,
+                   MPI_Request* request) {
+    // Only the time to start it; completion shows up under MPI_Test and the
+    // MPI_Wait family.
+    double start = PMPI_Wtime();
+    int code = PMPI_Iallreduce(in, out, count, type, op, comm, request);
+    record_call(&Profile::collectives, "MPI_Iallreduce", start, type_bytes(count, type));
+    return code;
+}
+
+int MPI_Exscan(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Exscan(in, out, count, type, op, comm);
+    record_call(&Profile::collectives, "MPI_Exscan", start, type_bytes(count, type));
+    return code;
+}
+
+int MPI_Iexscan(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm,
+                MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Iexscan(in, out, count, type, op, comm, request);
+    record_call(&Profile::collectives, "MPI_Iexscan", start, type_bytes(count, type));
+    return code;
+}
+
+int MPI_Gather(const void* in, int in_count, MPI_Datatype in_type, void* out, int out_count, MPI_Datatype out_type,
+               int root, MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Gather(in, in_count, in_type, out, out_count, out_type, root, comm);
+    record_call(&Profile::collectives, "MPI_Gather", start, type_bytes(in_count, in_type));
+    return code;
+}
+
+int MPI_Gatherv(const void* in, int in_count, MPI_Datatype in_type, void* out, const int out_counts[],
+                const int displs[], MPI_Datatype out_type, int root, MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Gatherv(in, in_count, in_type, out, out_counts, displs, out_type, root, comm);
+    record_call(&Profile::collectives, "MPI_Gatherv", start, type_bytes(in_count, in_type));
+    return code;
+}
+
+int MPI_Allgather(const void* in, int in_count, MPI_Datatype in_type, void* out, int out_count,
+                  MPI_Datatype out_type, MPI_Comm comm) {
+    double start = PMPI_Wtime();
+    int code = PMPI_Allgather(in, in_count, in_type, out, out_count, out_type, comm);
+    record_call(&Profile::collectives, "MPI_Allgather", start, type_bytes(in_count, in_type));
+    return code;
+}
+
+int MPI_Alltoall(const void* in, int in_count, MPI_Datatype in_type, void* out, int out_count, MPI_Datatype out_type,
+                 MPI_Comm comm) {
+    int size = 1;
+    PMPI_Comm_size(comm, &size);
+    double start = PMPI_Wtime();
+    int code = PMPI_Alltoall(in, in_count, in_type, out, out_count, out_type, comm);
+    record_call(&Profile::collectives, "MPI_Alltoall", start, type_bytes(in_count, in_type) * size);
+    return code;
+}
+
+int MPI_Alltoallv(const void* in, const int in_counts[], const int in_displs[], MPI_Datatype in_type, void* out,
+                  const int out_counts[], const int out_displs[], MPI_Datatype out_type, MPI_Comm comm) {
+    int size = 1;
+    PMPI_Comm_size(comm, &size);
+    long long bytes = 0;
+    for (int r = 0; r < size; ++r) bytes += type_bytes(in_counts[r], in_type);
+    double start = PMPI_Wtime();
+    int code = PMPI_Alltoallv(in, in_counts, in_displs, in_type, out, out_counts, out_displs, out_type, comm);
+    record_call(&Profile::collectives, "MPI_Alltoallv", start, bytes);
+    return code;
+}
+
+int MPI_File_write_at_all(MPI_File file, MPI_Offset offset, const void* buf, int count, MPI_Datatype type,
+                          MPI_Status* status) {
+    double start = PMPI_Wtime();
+    int code = PMPI_File_write_at_all(file, offset, buf, count, type, status);
+    record_call(&Profile::collectives, "MPI_File_write_at_all", start, type_bytes(count, type));
+    return code;
+}
+
+int MPI_File_iwrite_at_all(MPI_File file, MPI_Offset offset, const void* buf, int count, MPI_Datatype type,
+                           MPI_Request* request) {
+    // As MPI_Iallreduce: the time to start it, with completion under MPI_Test
+    // and the MPI_Wait family.
+    double start = PMPI_Wtime();
+    int code = PMPI_File_iwrite_at_all(file, offset, buf, count, type, request);
+    record_call(&Profile::collectives, "MPI_File_iwrite_at_all", start, type_bytes(count, type));
+    return code;
+}
+
+}  // extern "C"
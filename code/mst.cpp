@@ -1,8 +1,10 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
-#include <mpi.h>
-#include <unistd.h> 
+#include "comm.h"
+#include "coro.h"
+#include "tree_io.h"
+#include "event_log.h"
 
 using namespace std;
 
@@ -10,174 +12,196 @@ using namespace std;
 const int MC_PROPOSE_TAG = 10;
 const int MP_ACCEPT_TAG = 11;
 const int MR_REJECT_TAG = 12;
-const int ROOT_RANK = 0; 
-
+const int ROOT_NODE = 0;
+
+
+enum { EV_ROOT_START, EV_WAIT_PARENT, EV_PARENT, EV_PROPOSE, EV_ACCEPTED, EV_REJECTED, EV_REJECT_PROPOSAL };
+const EventKind MST_EVENTS[] = {
+    {"root_start", "Node {}: initiating RST construction with {} proposals."},
+    {"wait_parent", "Node {}: waiting for first MC message to select parent."},
+    {"parent", "Node {}: first MC received from {}. Parent set to {}."},
+    {"propose", "Node {}: sent MC to neighbor {}"},
+    {"accepted", "Node {}: accepted as parent by {} (MP). Remaining: {}"},
+    {"rejected", "Node {}: rejected by {} (MR). Remaining: {}"},
+    {"reject_proposal", "Node {}: rejected MC proposal from {} (sent MR)."},
+};
 
 struct RSTMessage {
-    int sender_rank;
+    int sender;
+    int level;   // of the sender
+};
+
+// Where one node ended up in the tree; parent -1 for the root, -2 while
+// unreached.
+struct NodeResult {
+    int parent = -2;
+    int level = 0;
+    vector<int> children;
 };
 
 
-vector<vector<int>> get_graph_topology(int world_size) {
-    if (world_size == 4) {
-        return {
-            {1, 3},       
-            {0, 2},       
-            {1, 3},       
-            {0, 2}        
+// Neighbours of node: fixed graphs for 2 and 4 nodes, otherwise a line.
+// Only this node's list is built, so a run stays linear in memory however
+// many nodes it has.
+vector<int> get_neighbors(int num_nodes, int node) {
+    if (num_nodes == 4) {
+        const vector<vector<int>> square = {
+            {1, 3},
+            {0, 2},
+            {1, 3},
+            {0, 2}
         };
-    } 
-     if (world_size == 2) {
-       return {
-        {1},
-        {0}
-       };
+        return square[node];
     }
-    if (world_size > 1) {
-        vector<vector<int>> adj(world_size);
-        for (int i = 0; i < world_size; ++i) {
-            if (i > 0) adj[i].push_back(i - 1); 
-            if (i < world_size - 1) adj[i].push_back(i + 1); 
-        }
-        return adj;
+    if (num_nodes == 2) {
+        return {1 - node};
     }
-    return vector<vector<int>>(world_size); 
+    vector<int> neighbors;
+    if (node > 0) neighbors.push_back(node - 1);
+    if (node < num_nodes - 1) neighbors.push_back(node + 1);
+    return neighbors;
 }
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+// One node of the tree (coro.h): it joins under the first proposal (MC) it
+// gets, accepts it (MP), proposes to its other neighbours and returns once
+// each has answered MP or MR, rejecting proposals in the meantime. A
+// neighbour that rejects us has proposed to us before, and messages between
+// two nodes arrive in order, so no proposal reaches a node that has
+// returned.
+NodeTask mst_node(CoroNode& node, EventLog& events, NodeResult& result) {
+    const int self = node.id();
+    const vector<int> neighbors = get_neighbors(node.count(), self);
+    RSTMessage mine = {self, 0};
+    NodeMessage msg;
+
+    if (self == ROOT_NODE) {
+        LOG_EVENT(events, LOG_INFO, EV_ROOT_START, self, neighbors.size());
+        result.parent = -1;
+    } else {
+        LOG_EVENT(events, LOG_INFO, EV_WAIT_PARENT, self);
+        msg = co_await node.recv(MC_PROPOSE_TAG);
+        result.parent = msg.source;
+        result.level = msg.as<RSTMessage>().level + 1;
+        mine.level = result.level;
+        LOG_EVENT(events, LOG_INFO, EV_PARENT, self, result.parent, result.parent);
+        co_await node.send(result.parent, MP_ACCEPT_TAG, mine);
+    }
 
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    size_t no_response_remaining = 0;
+    for (int dest : neighbors) {
+        if (dest == result.parent) continue;
+        co_await node.send(dest, MC_PROPOSE_TAG, mine);
+        LOG_EVENT(events, LOG_INFO, EV_PROPOSE, self, dest);
+        no_response_remaining++;
+    }
 
-    if (world_size < 2) {
-        cerr << "at least 2 processes required" << endl;
-        MPI_Finalize();
-        return 0;
+    while (no_response_remaining > 0) {
+        msg = co_await node.recv(COMM_ANY_TAG);
+        if (msg.tag == MP_ACCEPT_TAG) {
+            result.children.push_back(msg.source);
+            no_response_remaining--;
+            LOG_EVENT(events, LOG_INFO, EV_ACCEPTED, self, msg.source, no_response_remaining);
+        } else if (msg.tag == MR_REJECT_TAG) {
+            no_response_remaining--;
+            LOG_EVENT(events, LOG_INFO, EV_REJECTED, self, msg.source, no_response_remaining);
+        } else if (msg.tag == MC_PROPOSE_TAG) {
+            co_await node.send(msg.source, MR_REJECT_TAG, mine);
+            LOG_EVENT(events, LOG_INFO, EV_REJECT_PROPOSAL, self, msg.source);
+        }
     }
+}
 
-    
-    const vector<vector<int>> adjacency_list = get_graph_topology(world_size);
-    const vector<int>& neighbors = adjacency_list[world_rank];
-    const size_t num_neighbors = neighbors.size();
+// --nodes N spreads N tree nodes over the ranks (default one per rank).
+int run(Comm& comm, int argc, char** argv) {
+    int world_rank = comm.rank();
+    int num_nodes = coro_node_count(argc, argv, comm.size());
 
-    int parent_rank = (world_rank == ROOT_RANK) ? -1 : -2; 
-    vector<int> children;
-    
-    
-    size_t no_response_remaining = 0; 
-
-    RSTMessage received_msg;
-    MPI_Request recv_request;
-    MPI_Status recv_status;
-
-    if (world_rank == ROOT_RANK) {
-        cout << "\nRank " << world_rank << " initiating RST construction with " << num_neighbors << " proposals." << endl;
-        RSTMessage send_mc_msg = {world_rank};
-        
-        for (int dest_rank : neighbors) {
-            MPI_Request send_request;
-            MPI_Isend(&send_mc_msg, sizeof(RSTMessage), MPI_BYTE, dest_rank, MC_PROPOSE_TAG, MPI_COMM_WORLD, &send_request);
-            MPI_Request_free(&send_request); 
-        }
-        no_response_remaining = num_neighbors;
-    } 
-    
-    else {
-
-        cout << "Rank " << world_rank << ": Waiting for first MC message to select parent." << endl;
-        
-        
-        MPI_Recv(&received_msg, sizeof(RSTMessage), MPI_BYTE, MPI_ANY_SOURCE, MC_PROPOSE_TAG, MPI_COMM_WORLD, &recv_status);
-        
-        parent_rank = received_msg.sender_rank;
-        cout << "Rank " << world_rank << ": First MC received from " << parent_rank << ". **Parent set to " << parent_rank << "**." << endl;
-
-        RSTMessage send_mp_msg = {world_rank};
-        MPI_Request send_request_mp;
-        MPI_Isend(&send_mp_msg, sizeof(RSTMessage), MPI_BYTE, parent_rank, MP_ACCEPT_TAG, MPI_COMM_WORLD, &send_request_mp);
-        MPI_Request_free(&send_request_mp);
-
-        RSTMessage send_mc_msg = {world_rank};
-        for (int dest_rank : neighbors) {
-            if (dest_rank != parent_rank) {
-                MPI_Request send_request;
-                MPI_Isend(&send_mc_msg, sizeof(RSTMessage), MPI_BYTE, dest_rank, MC_PROPOSE_TAG, MPI_COMM_WORLD, &send_request);
-                MPI_Request_free(&send_request); 
-                cout << "Rank " << world_rank << ": Sent MC to neighbor " << dest_rank << endl;
+    if (num_nodes < 2) {
+        cerr << "at least 2 nodes required" << endl;
+        return 0;
+    }
+    EventLog events(comm, argc, argv, MST_EVENTS);
+
+    CoroExecutor executor(comm, num_nodes);
+    vector<CoroNode>& nodes = executor.local_nodes();
+    vector<NodeResult> results(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) executor.spawn(mst_node(nodes[i], events, results[i]));
+    double start = comm.now();
+    executor.run();
+    double elapsed = comm.now() - start;
+
+    comm.barrier();
+
+    // With --out the tree goes to a binary file (tree_io.h) instead of stdout.
+    const char* out_path = tree_output_path(argc, argv);
+    if (out_path == NULL) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const NodeResult& r = results[i];
+            cout << "\n--- Node " << nodes[i].id() << " Final Result ---" << endl;
+            cout << "Parent: " << ((r.parent == -1) ? "ROOT" : to_string(r.parent)) << endl;
+            cout << "Children (" << r.children.size() << "): ";
+            if (r.children.empty()) {
+                cout << "None" << endl;
+            } else {
+                for (int c : r.children) cout << c << " ";
+                cout << endl;
             }
+            cout << "--------------------------------" << endl;
         }
-        no_response_remaining = num_neighbors - 1; 
     }
 
+    long long sums[5] = {0, executor.local_messages(), executor.remote_messages(), executor.frames_sent(),
+                         executor.rounds()};
+    long long height = 0, totals[5], max_height;
+    for (const NodeResult& r : results) {
+        if (r.parent == -2) continue;
+        sums[0]++;
+        height = max(height, (long long)r.level);
+    }
+    comm.allreduce(sums, totals, 5, COMM_SUM);
+    comm.allreduce(&height, &max_height, 1, COMM_MAX);
+    if (world_rank == 0) {
+        cout << "Spanning tree: " << totals[0] << " of " << num_nodes << " nodes on " << comm.size()
+             << " ranks, height " << max_height << ", " << elapsed << " s" << endl;
+        cout << "Messages: " << totals[1] << " in memory, " << totals[2] << " between ranks in " << totals[3]
+             << " frames, " << totals[4] << " waits" << endl;
+    }
 
-    MPI_Irecv(&received_msg, sizeof(RSTMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &recv_request);
-
-    while (no_response_remaining > 0) {
-        usleep(100000); 
-
-        int flag = 0;
-        MPI_Test(&recv_request, &flag, &recv_status);
-
-        if (flag) { 
-            
-            int sender_rank = received_msg.sender_rank;
-            int received_tag = recv_status.MPI_TAG;
-        
-            MPI_Irecv(&received_msg, sizeof(RSTMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &recv_request);
-            
-      
-
-            if (received_tag == MP_ACCEPT_TAG) {
-             
-                children.push_back(sender_rank);
-                no_response_remaining--;
-                cout << "Rank " << world_rank << ": Accepted as parent by " << sender_rank << " (MP). Remaining: " << no_response_remaining << endl;
-            } 
-            else if (received_tag == MR_REJECT_TAG) {
-
-                no_response_remaining--;
-                cout << "Rank " << world_rank << ": Rejected by " << sender_rank << " (MR). Remaining: " << no_response_remaining << endl;
+    // TreeComm and the MPI-IO writer need real MPI ranks.
+    if (comm.mpi_comm() != MPI_COMM_NULL) {
+        // With one node per rank, reuse the spanning tree for collectives
+        // (tree_comm.h): count the ranks it covers and its height.
+        if (num_nodes == comm.size()) {
+            TreeComm tree(comm.mpi_comm(), results[0].parent, results[0].children);
+            int counts[2] = {1, tree.depth()}, tree_totals[2];
+            tree.reduce(&counts[0], &tree_totals[0], 1, MPI_INT, MPI_SUM);
+            tree.reduce(&counts[1], &tree_totals[1], 1, MPI_INT, MPI_MAX);
+            if (world_rank == 0) {
+                cout << "Tree communicator: " << tree_totals[0] << " ranks, height " << tree_totals[1] << endl;
+            }
+        }
+        if (out_path != NULL) {
+            vector<int64_t> parents, levels;
+            vector<vector<int64_t>> children;
+            for (const NodeResult& r : results) {
+                bool reached = r.parent != -2;
+                parents.push_back(reached ? r.parent : -1);
+                levels.push_back(reached ? r.level : -1);
+                children.emplace_back(r.children.begin(), r.children.end());
             }
-            else if (received_tag == MC_PROPOSE_TAG) {
-
-                RSTMessage send_mr_msg = {world_rank};
-                
-                
-                if (world_rank == ROOT_RANK || parent_rank != received_msg.sender_rank) { 
-                    MPI_Request send_request;
-                    MPI_Isend(&send_mr_msg, sizeof(RSTMessage), MPI_BYTE, sender_rank, MR_REJECT_TAG, MPI_COMM_WORLD, &send_request);
-                    MPI_Request_free(&send_request);
-                    cout << "Rank " << world_rank << ": Rejected MC proposal from " << sender_rank << " (sent MR)." << endl;
-                } 
-               
-                
+            double write_start = comm.now();
+            bool written = write_tree_file(out_path, num_nodes, executor.first_node(world_rank), parents, levels,
+                                           children, comm.mpi_comm());
+            if (world_rank == 0) {
+                cout << (written ? "Tree written to " : "Could not write ") << out_path << " in "
+                     << comm.now() - write_start << " s" << endl;
             }
         }
     }
-    
-    
-    MPI_Cancel(&recv_request);
-    MPI_Status status;
-    MPI_Wait(&recv_request, &status);
-    MPI_Request_free(&recv_request);
-
-    
-    MPI_Barrier(MPI_COMM_WORLD); 
-
-    cout << "\n--- Rank " << world_rank << " Final Result ---" << endl;
-    cout << "Parent: " << ((world_rank == ROOT_RANK) ? "ROOT" : to_string(parent_rank)) << endl;
-    cout << "Children (" << children.size() << "): ";
-    if (children.empty()) {
-        cout << "None" << endl;
-    } else {
-        for (int c : children) cout << c << " ";
-        cout << endl;
-    }
-    cout << "--------------------------------" << endl;
-    
-    MPI_Finalize();
+
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
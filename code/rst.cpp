@@ -3,63 +3,65 @@
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
-#include <mpi.h>
-#include <unistd.h> 
+#include "comm.h"
+#include "tree_io.h"
+#include "event_log.h"
 
 using namespace std;
 
 const int RST_MSG_TAG = 10;
 const int ROOT_RANK = 0;
 
+enum { EV_STARTED, EV_NEIGHBOR, EV_ROOT_START, EV_ROOT_SEND, EV_PARENT, EV_SEND_CHILD, EV_IGNORE };
+const EventKind RST_EVENTS[] = {
+    {"started", "started with {} neighbors"},
+    {"neighbor", "    neighbor {}"},
+    {"root_start", "Root: initiating RST construction."},
+    {"root_send", "Root: sent RST message to neighbor {}"},
+    {"parent", "received RST message from {}. parent is set to {}."},
+    {"send_child", "sent RST message to child neighbor {}"},
+    {"ignore", "Ignoring message from {} (Already terminated its role)."},
+};
+
 struct RSTMessage {
     int sender_rank;
 };
 
-vector<vector<int>> get_graph_topology(int world_size) {
+// Neighbours of rank; only the 2- and 4-rank graphs are wired up. Only this
+// rank's list is built, so a virtual run (comm.h) stays linear in memory.
+vector<int> get_neighbors(int world_size, int rank) {
 
 
     if (world_size == 2) {
-        return {
-            {1},       
-            {0}  
-                  
-        };
+        return {1 - rank};
     } 
     if (world_size == 4) {
-        return {
+        const vector<vector<int>> square = {
             {1, 3},       
             {0, 2},       
             {1, 3},       
             {0, 2}        
         };
+        return square[rank];
     } 
-    // if (world_size > 1) {
-    //     vector<vector<int>> adj(world_size);
-    //     for (int i = 0; i < world_size; ++i) {
-    //         if (i > 0) adj[i].push_back(i - 1); 
-    //         if (i < world_size - 1) adj[i].push_back(i + 1); 
-    //     }
-    //     return adj;
-    // }
-    return vector<vector<int>>(world_size); 
+    // vector<int> neighbors;
+    // if (rank > 0) neighbors.push_back(rank - 1); 
+    // if (rank < world_size - 1) neighbors.push_back(rank + 1); 
+    // return neighbors;
+    return vector<int>(); 
 }
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
-
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+int run(Comm& comm, int argc, char** argv) {
+    int world_rank = comm.rank();
+    int world_size = comm.size();
 
     if (world_size < 2) {
         cerr << "Need at least 2 processes for this simulation." << endl;
-        MPI_Finalize();
         return 0;
     }
+    EventLog events(comm, argc, argv, RST_EVENTS);
 
-    vector<vector<int>> adjacency_list = get_graph_topology(world_size);
-    const vector<int>& neighbors = adjacency_list[world_rank];
+    const vector<int> neighbors = get_neighbors(world_size, world_rank);
 
     int parent_rank = -1; 
     vector<int> children; 
@@ -68,27 +70,19 @@ int main(int argc, char** argv) {
     bool terminated = false;
     
     RSTMessage received_msg;
-    MPI_Request recv_request = MPI_REQUEST_NULL;
-    MPI_Status recv_status;
-    
-    if (world_rank != ROOT_RANK) {
-        MPI_Irecv(&received_msg, sizeof(RSTMessage), MPI_BYTE, MPI_ANY_SOURCE, RST_MSG_TAG, MPI_COMM_WORLD, &recv_request);
-    }
 
-    cout << "Rank " << world_rank << " started with neighbors: ";
-    for(int n : neighbors) cout << n << " ";
-    cout << endl;
+    LOG_EVENT(events, LOG_INFO, EV_STARTED, neighbors.size());
+    for (int n : neighbors) LOG_EVENT(events, LOG_DEBUG, EV_NEIGHBOR, n);
 
     if (world_rank == ROOT_RANK) {
-        cout << "\nRank " << world_rank << " Root: initiating RST construction." << endl;
+        LOG_EVENT(events, LOG_INFO, EV_ROOT_START);
         RSTMessage send_msg;
         send_msg.sender_rank = world_rank;
         
         for (int dest_rank : neighbors) {
-            MPI_Request send_request;
-            MPI_Isend(&send_msg, sizeof(RSTMessage), MPI_BYTE, dest_rank, RST_MSG_TAG, MPI_COMM_WORLD, &send_request);
+            comm.send(&send_msg, sizeof(RSTMessage), dest_rank, RST_MSG_TAG);
             
-            cout << "Rank " << world_rank << " Root: sent RST message to neighbor " << dest_rank << endl;
+            LOG_EVENT(events, LOG_INFO, EV_ROOT_SEND, dest_rank);
         }
         terminated = true; 
     } 
@@ -97,55 +91,67 @@ int main(int argc, char** argv) {
         
         while (!terminated) {
             
-            usleep(100000); 
-
-            int flag = 0;
-            if (recv_request != MPI_REQUEST_NULL) {
-                MPI_Test(&recv_request, &flag, &recv_status);
-            }
-
-            if (flag) { 
-                if (!message_received) {
-                    parent_rank = received_msg.sender_rank;
-                    message_received = true;
-
-                    cout << "\nrank " << world_rank << ": received RST message from " << parent_rank 
-                         << ". parent is set to " << parent_rank << "**." << endl;
-                    
-                    RSTMessage send_msg;
-                    send_msg.sender_rank = world_rank;
-
-                    for (int dest_rank : neighbors) {
-                        if (dest_rank != parent_rank) {
-                            MPI_Request send_request;
-                            MPI_Isend(&send_msg, sizeof(RSTMessage), MPI_BYTE, dest_rank, RST_MSG_TAG, MPI_COMM_WORLD, &send_request);
-                            MPI_Request_free(&send_request); 
-                            cout << "rank " << world_rank << ": sent RST message to child neighbor " << dest_rank << endl;
-                            children.push_back(dest_rank);
-                        }
+            comm.recv(&received_msg, sizeof(RSTMessage), COMM_ANY_SOURCE, RST_MSG_TAG);
+
+            if (!message_received) {
+                parent_rank = received_msg.sender_rank;
+                message_received = true;
+
+                LOG_EVENT(events, LOG_INFO, EV_PARENT, parent_rank, parent_rank);
+                
+                RSTMessage send_msg;
+                send_msg.sender_rank = world_rank;
+
+                for (int dest_rank : neighbors) {
+                    if (dest_rank != parent_rank) {
+                        comm.send(&send_msg, sizeof(RSTMessage), dest_rank, RST_MSG_TAG);
+                        LOG_EVENT(events, LOG_INFO, EV_SEND_CHILD, dest_rank);
+                        children.push_back(dest_rank);
                     }
-                    
-                    terminated = true; 
-                    
-                    MPI_Cancel(&recv_request);
-                    MPI_Status status_cancel;
-                    MPI_Wait(&recv_request, &status_cancel); 
-                } else {
-                    cout << "Rank " << world_rank << ": Ignoring message from " << received_msg.sender_rank 
-                         << " (Already terminated its role)." << endl;
                 }
+                
+                terminated = true; 
+            } else {
+                LOG_EVENT(events, LOG_INFO, EV_IGNORE, received_msg.sender_rank);
             }
         } 
     }
 
-    MPI_Barrier(MPI_COMM_WORLD); 
+    comm.barrier();
 
-    if (world_rank != ROOT_RANK) {
-        cout << "Rank " << world_rank << ": Final RST result: Parent=" << parent_rank << endl;
-    } else {
-        cout << "Rank " << world_rank << ": Final RST result: Root (Parent=-1)" << endl;
+    const char* out_path = tree_output_path(argc, argv);
+    if (out_path == NULL) {
+        if (world_rank != ROOT_RANK) {
+            cout << "Rank " << world_rank << ": Final RST result: Parent=" << parent_rank << endl;
+        } else {
+            cout << "Rank " << world_rank << ": Final RST result: Root (Parent=-1)" << endl;
+        }
+    }
+
+    // children above holds every non-parent neighbour rather than the real
+    // tree children, so TreeComm derives them from the parents instead.
+    // TreeComm and the MPI-IO writer need real MPI ranks.
+    if (comm.mpi_comm() != MPI_COMM_NULL) {
+        TreeComm tree(comm.mpi_comm(), parent_rank);
+        int counts[2] = {1, tree.depth()}, totals[2];
+        tree.reduce(&counts[0], &totals[0], 1, MPI_INT, MPI_SUM);
+        tree.reduce(&counts[1], &totals[1], 1, MPI_INT, MPI_MAX);
+        if (world_rank == ROOT_RANK) {
+            cout << "Tree communicator: " << totals[0] << " ranks, height " << totals[1] << endl;
+        }
+        if (out_path != NULL) {
+            double start = comm.now();
+            bool written = write_rank_tree_file(out_path, tree, comm.mpi_comm());
+            if (world_rank == ROOT_RANK) {
+                cout << (written ? "Tree written to " : "Could not write ") << out_path << " in "
+                     << comm.now() - start << " s" << endl;
+            }
+        }
     }
     
-    MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
@@ -0,0 +1,651 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// Chandy-Lamport consistent global snapshots taken while the program keeps
+// running, so a long run can be checkpointed or inspected without stopping
+// every rank at a barrier.
+//
+// Rank 0 starts a snapshot every --snapshot-every seconds. A rank records its
+// local state (a string from the program's capture function) when it starts
+// one or first hears of it, and then sends a marker to every other rank. The
+// state of the channel from s is every application message that was sent by
+// s before s recorded and received here after this rank recorded. Markers use
+// their own tag, so MPI does not keep them in order with the application's
+// messages; each marker therefore carries how many application messages its
+// sender had sent on that channel when it recorded (Mattern's counters), and
+// the channel is closed once that many have been received. Messages that
+// have to be told apart carry the sender's snapshot number (its epoch), and a
+// message from a later epoch makes the receiver record before taking it in.
+// SnapshotComm adds that epoch to every message of a Comm program; dme.cpp
+// receives everything through one MPI_ANY_TAG probe, which keeps each channel
+// in order, and uses SnapshotService directly without epochs.
+//
+// When a rank has closed all its channels it writes its part (state and
+// channel contents, as text) at its offset in one file, PREFIX.snap, through
+// nonblocking MPI-IO collectives on a private communicator: an exscan of
+// the part sizes, then MPI_File_iwrite_at_all. Nobody waits for them; poll()
+// moves them on. Threads (--shm) and virtual ranks (--sim) have no MPI-IO and
+// send their parts to rank 0, which appends them in rank order. Rank 0 starts
+// the next snapshot once the last one is written.
+//
+// Options, read from the program's command line:
+//
+//   --snapshot-every S    seconds between snapshots (default 0, off)
+//   --snapshot-prefix P   snapshots go to P.snap (default "snapshot")
+//
+// finish() is collective: it waits for the snapshot in progress, closes the
+// file and has rank 0 print what the snapshots cost (markers, epochs, time
+// spent in snapshot code) next to the application's own traffic.
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "comm.h"
+
+const int SNAPSHOT_MARKER_TAG = 32001;
+const int SNAPSHOT_PART_TAG = 32002;
+// SnapshotComm sleeps in slices this long so markers are answered meanwhile.
+const long long SNAPSHOT_POLL_US = 10000;
+// Never a real epoch: marks a SnapshotComm receive buffer nothing has
+// arrived in.
+const int32_t SNAPSHOT_NO_EPOCH = -1;
+
+struct SnapshotOptions {
+    double every = 0;
+    std::string prefix = "snapshot";
+};
+
+// Reads --snapshot-every and --snapshot-prefix; other arguments are left to
+// the program.
+inline SnapshotOptions parse_snapshot_options(int argc, char** argv) {
+    SnapshotOptions options;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--snapshot-every") == 0) options.every = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--snapshot-prefix") == 0) options.prefix = argv[++i];
+    }
+    return options;
+}
+
+struct SnapshotMarker {
+    int64_t id;
+    int64_t count;   // application messages the sender had sent on the channel
+};
+
+class SnapshotService {
+public:
+    // Collective. Markers and parts travel through comm; under MPI the file
+    // is opened on a duplicate of its communicator. header_bytes is what the
+    // caller adds to each application message, for the report.
+    SnapshotService(Comm& comm, const SnapshotOptions& options, int header_bytes = 0)
+        : comm_(comm), options_(options), header_bytes_(header_bytes), n_(comm.size()), me_(comm.rank()) {
+        if (!enabled()) return;
+        sent_.assign(n_, 0);
+        received_.assign(n_, 0);
+        post_.assign(n_, 0);
+        marker_seen_.assign(n_, true);
+        marker_count_.assign(n_, 0);
+        path_ = options_.prefix + ".snap";
+        if (comm_.mpi_comm() != MPI_COMM_NULL) open_mpi_file();
+        else if (me_ == 0) open_stdio_file();
+        next_due_ = comm_.now() + options_.every;
+    }
+
+    ~SnapshotService() {
+        if (file_ != NULL) std::fclose(file_);
+    }
+
+    SnapshotService(const SnapshotService&) = delete;
+    SnapshotService& operator=(const SnapshotService&) = delete;
+
+    bool enabled() const { return options_.every > 0; }
+
+    // Returns this rank's local state; called when the rank records.
+    void set_capture(std::function<std::string()> capture) { capture_ = capture; }
+
+    // The latest snapshot this rank has recorded, 0 before the first.
+    int epoch() const { return recorded_; }
+
+    static bool owns(int tag) { return tag == SNAPSHOT_MARKER_TAG || tag == SNAPSHOT_PART_TAG; }
+
+    // After each application message sent to dest.
+    void sent(int dest) {
+        if (!enabled()) return;
+        sent_[dest]++;
+        app_messages_++;
+    }
+
+    // After each application message received, before the program acts on
+    // it. epoch is the sender's, or -1 on channels that are kept in order.
+    void received(int source, int tag, const void* data, int bytes, int epoch = -1) {
+        if (!enabled()) return;
+        WorkTimer timer(*this);
+        if (epoch > recorded_) record(epoch);
+        received_[source]++;
+        if (!active_) return;
+        bool post = epoch >= 0 ? epoch >= recorded_ : marker_seen_[source];
+        if (post) {
+            post_[source]++;
+            return;
+        }
+        channels_ << "  in flight from rank " << source << ": tag " << tag << ", " << format_payload(data, bytes)
+                  << "\n";
+        in_flight_++;
+        check_complete();
+    }
+
+    // Receives and acts on a marker or part that a probe has found.
+    void handle(const CommStatus& status) {
+        WorkTimer timer(*this);
+        if (status.tag == SNAPSHOT_MARKER_TAG) {
+            SnapshotMarker marker;
+            comm_.recv(&marker, sizeof(marker), status.source, SNAPSHOT_MARKER_TAG);
+            if (marker.id > recorded_) record((int)marker.id);
+            marker_seen_[status.source] = true;
+            marker_count_[status.source] = marker.count;
+            check_complete();
+            return;
+        }
+        std::string part(status.bytes, '\0');
+        comm_.recv(&part[0], status.bytes, status.source, SNAPSHOT_PART_TAG);
+        gathered_[status.source] = part;
+        if (++gathered_count_ == n_) write_gathered();
+    }
+
+    // Handles every marker and part that has arrived.
+    void receive() {
+        if (!enabled()) return;
+        CommStatus status;
+        while (comm_.iprobe(COMM_ANY_SOURCE, SNAPSHOT_MARKER_TAG, &status)) handle(status);
+        if (me_ == 0 && comm_.mpi_comm() == MPI_COMM_NULL) {
+            while (comm_.iprobe(COMM_ANY_SOURCE, SNAPSHOT_PART_TAG, &status)) handle(status);
+        }
+    }
+
+    // Starts a snapshot on rank 0 when one is due and moves the write on.
+    void poll() {
+        if (!enabled()) return;
+        WorkTimer timer(*this);
+        if (me_ == 0 && !finishing_ && completed_ == recorded_ && comm_.now() >= next_due_) {
+            record(recorded_ + 1);
+            next_due_ = comm_.now() + options_.every;
+        }
+        if (io_comm_ != MPI_COMM_NULL) advance_mpi_write();
+    }
+
+    // True while some channel still waits for messages that were in flight.
+    bool active() const { return active_; }
+
+    // Collective. Waits until the snapshot in progress is written (pump, if
+    // given, receives whatever is still arriving; otherwise receive() does),
+    // closes the file and prints the report on rank 0.
+    void finish(const std::function<void()>& pump = std::function<void()>()) {
+        if (!enabled()) return;
+        finishing_ = true;
+        long long last = recorded_;
+        comm_.bcast(&last, sizeof(last), 0);
+        while (completed_ < last) {
+            if (pump) pump();
+            else receive();
+            poll();
+            if (completed_ < last) comm_.sleep_us(200);
+        }
+        if (io_comm_ != MPI_COMM_NULL) {
+            MPI_File_close(&mpi_file_);
+            MPI_Comm_free(&io_comm_);
+        }
+        report();
+    }
+
+private:
+    enum WriteStage { WRITE_IDLE, WRITE_OFFSETS, WRITE_DATA };
+
+    // Adds the wall-clock time of a call into snapshot code to work_ns_.
+    struct WorkTimer {
+        explicit WorkTimer(SnapshotService& s) : s_(s), start_(std::chrono::steady_clock::now()) {}
+        ~WorkTimer() {
+            s_.work_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start_).count();
+        }
+        SnapshotService& s_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    void open_mpi_file() {
+        MPI_Comm_dup(comm_.mpi_comm(), &io_comm_);
+        int err = MPI_File_open(io_comm_, path_.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                                &mpi_file_);
+        if (err != MPI_SUCCESS) {
+            if (me_ == 0) std::cerr << "Could not open " << path_ << ", snapshots are off" << std::endl;
+            MPI_Comm_free(&io_comm_);
+            options_.every = 0;
+            return;
+        }
+        MPI_File_set_size(mpi_file_, 0);
+    }
+
+    void open_stdio_file() {
+        file_ = std::fopen(path_.c_str(), "wb");
+        if (file_ == NULL) std::cerr << "Could not open " << path_ << ", snapshots are written nowhere" << std::endl;
+        gathered_.assign(n_, std::string());
+    }
+
+    void record(int id) {
+        recorded_ = id;
+        active_ = true;
+        if (me_ == 0) started_ = comm_.now();
+        state_ = capture_ ? capture_() : std::string();
+        channels_.str("");
+        for (int s = 0; s < n_; ++s) {
+            post_[s] = 0;
+            marker_seen_[s] = (s == me_);
+        }
+        for (int d = 0; d < n_; ++d) {
+            if (d == me_) continue;
+            SnapshotMarker marker = {id, sent_[d]};
+            comm_.send(&marker, sizeof(marker), d, SNAPSHOT_MARKER_TAG);
+            markers_++;
+        }
+        check_complete();
+    }
+
+    void check_complete() {
+        if (!active_) return;
+        for (int s = 0; s < n_; ++s) {
+            if (!marker_seen_[s] || received_[s] - post_[s] < marker_count_[s]) return;
+        }
+        active_ = false;
+        std::ostringstream part;
+        if (me_ == 0) part << "snapshot " << recorded_ << " of " << n_ << " ranks, started at " << started_ << " s\n";
+        part << "rank " << me_ << ": " << state_ << "\n" << channels_.str();
+        if (io_comm_ != MPI_COMM_NULL) {
+            parts_.push_back(part.str());
+            advance_mpi_write();
+        } else if (me_ == 0) {
+            gathered_[0] = part.str();
+            if (++gathered_count_ == n_) write_gathered();
+        } else {
+            std::string text = part.str();
+            comm_.send(text.data(), text.size(), 0, SNAPSHOT_PART_TAG);
+            completed_ = recorded_;
+        }
+    }
+
+    // Runs the exscan/allreduce of the part sizes and then the collective
+    // write, one snapshot at a time, without blocking.
+    void advance_mpi_write() {
+        while (true) {
+            if (stage_ == WRITE_IDLE) {
+                if (parts_.empty()) return;
+                writing_ = parts_.front();
+                parts_.pop_front();
+                write_size_ = writing_.size();
+                write_offset_ = 0;
+                MPI_Iexscan(&write_size_, &write_offset_, 1, MPI_LONG_LONG, MPI_SUM, io_comm_, &requests_[0]);
+                MPI_Iallreduce(&write_size_, &write_total_, 1, MPI_LONG_LONG, MPI_SUM, io_comm_, &requests_[1]);
+                stage_ = WRITE_OFFSETS;
+            }
+            int done = 0;
+            if (stage_ == WRITE_OFFSETS) {
+                MPI_Testall(2, requests_, &done, MPI_STATUSES_IGNORE);
+                if (!done) return;
+                if (me_ == 0) write_offset_ = 0;   // MPI_Exscan leaves rank 0's result undefined
+                MPI_File_iwrite_at_all(mpi_file_, file_end_ + write_offset_, writing_.data(), (int)writing_.size(),
+                                       MPI_CHAR, &requests_[0]);
+                stage_ = WRITE_DATA;
+            }
+            MPI_Test(&requests_[0], &done, MPI_STATUS_IGNORE);
+            if (!done) return;
+            file_end_ += write_total_;
+            stage_ = WRITE_IDLE;
+            written(write_total_);
+        }
+    }
+
+    void write_gathered() {
+        long long total = 0;
+        for (const std::string& part : gathered_) {
+            if (file_ != NULL) std::fwrite(part.data(), 1, part.size(), file_);
+            total += part.size();
+        }
+        if (file_ != NULL) std::fflush(file_);
+        gathered_.assign(n_, std::string());
+        gathered_count_ = 0;
+        written(total);
+    }
+
+    // Snapshot recorded_ is on disk, as far as this rank is concerned; on
+    // rank 0 that means every rank has contributed.
+    void written(long long total) {
+        completed_++;
+        if (me_ != 0) return;
+        double latency = comm_.now() - started_;
+        latency_sum_ += latency;
+        latency_max_ = std::max(latency_max_, latency);
+        file_bytes_ += total;
+    }
+
+    // The payload as 32-bit integers, which is what every program here sends.
+    static std::string format_payload(const void* data, int bytes) {
+        std::ostringstream out;
+        if (bytes % sizeof(int32_t) != 0) {
+            out << bytes << " bytes";
+            return out.str();
+        }
+        const char* p = (const char*)data;
+        out << "[";
+        for (int i = 0; i < bytes; i += sizeof(int32_t)) {
+            int32_t value;
+            std::memcpy(&value, p + i, sizeof(value));
+            out << (i > 0 ? ", " : "") << value;
+        }
+        out << "]";
+        return out.str();
+    }
+
+    void report() {
+        long long local[5] = {markers_, app_messages_, in_flight_, work_ns_, work_ns_};
+        long long sums[5] = {0, 0, 0, 0, 0}, peak[5] = {0, 0, 0, 0, 0};
+        comm_.reduce(local, sums, 5, COMM_SUM, 0);
+        comm_.reduce(local, peak, 5, COMM_MAX, 0);
+        if (me_ != 0) return;
+        std::cout << "Snapshots: " << completed_ << " written to " << path_ << " (" << file_bytes_ << " bytes)";
+        if (completed_ > 0) {
+            std::cout << ", start to written " << latency_sum_ / completed_ * 1e3 << " ms on average (max "
+                      << latency_max_ * 1e3 << " ms)";
+        }
+        std::cout << std::endl;
+        std::cout << "Snapshot overhead: " << sums[0] << " markers (" << sums[0] * sizeof(SnapshotMarker)
+                  << " bytes) against " << sums[1] << " application messages";
+        if (header_bytes_ > 0) std::cout << " carrying " << sums[1] * header_bytes_ << " bytes of epochs";
+        std::cout << ", " << sums[2] << " in-flight messages recorded, " << sums[3] / n_ * 1e-6
+                  << " ms of snapshot work per rank (max " << peak[4] * 1e-6 << " ms)" << std::endl;
+    }
+
+    Comm& comm_;
+    SnapshotOptions options_;
+    int header_bytes_;
+    int n_;
+    int me_;
+    std::string path_;
+    std::function<std::string()> capture_;
+
+    // Channels: cumulative counts, and during a snapshot the messages from
+    // its later epoch and what the markers said.
+    std::vector<long long> sent_;
+    std::vector<long long> received_;
+    std::vector<long long> post_;
+    std::vector<bool> marker_seen_;
+    std::vector<long long> marker_count_;
+
+    int recorded_ = 0;
+    int completed_ = 0;
+    bool active_ = false;
+    bool finishing_ = false;
+    double next_due_ = 0;
+    double started_ = 0;
+    std::string state_;
+    std::ostringstream channels_;
+
+    // MPI-IO
+    MPI_Comm io_comm_ = MPI_COMM_NULL;
+    MPI_File mpi_file_ = MPI_FILE_NULL;
+    std::deque<std::string> parts_;
+    std::string writing_;
+    WriteStage stage_ = WRITE_IDLE;
+    MPI_Request requests_[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+    long long write_size_ = 0, write_offset_ = 0, write_total_ = 0;
+    long long file_end_ = 0;
+
+    // Rank 0 without MPI-IO
+    std::FILE* file_ = NULL;
+    std::vector<std::string> gathered_;
+    int gathered_count_ = 0;
+
+    // Report
+    long long markers_ = 0;
+    long long app_messages_ = 0;
+    long long in_flight_ = 0;
+    long long work_ns_ = 0;
+    long long file_bytes_ = 0;
+    double latency_sum_ = 0;
+    double latency_max_ = 0;
+};
+
+// Comm decorator that takes snapshots of a Comm program. Every message gets a
+// 4-byte epoch in front; markers are answered in every call and, in slices,
+// during sleep_us. Receives with COMM_ANY_TAG skip the snapshot tags, except
+// irecv, which programs using this must post for a specific tag.
+//
+//   SnapshotComm comm(world, argc, argv);
+//   comm.capture([&] { return "clock " + std::to_string(clock); });
+//   ... the program, on comm ...
+//   comm.finish();   // after the program's last receive
+class SnapshotComm : public Comm {
+public:
+    // Collective.
+    SnapshotComm(Comm& inner, int argc, char** argv)
+        : inner_(inner), service_(inner, parse_snapshot_options(argc, argv), sizeof(int32_t)) {}
+
+    SnapshotComm(const SnapshotComm&) = delete;
+    SnapshotComm& operator=(const SnapshotComm&) = delete;
+
+    void capture(std::function<std::string()> capture) { service_.set_capture(capture); }
+
+    // Collective. In-flight messages nobody will receive any more are taken
+    // off the wire into the snapshot in progress.
+    void finish() {
+        service_.finish([this]() {
+            CommStatus s;
+            while (service_.active() && inner_.iprobe(COMM_ANY_SOURCE, COMM_ANY_TAG, &s)) {
+                if (SnapshotService::owns(s.tag)) {
+                    service_.handle(s);
+                    continue;
+                }
+                std::vector<char> data(s.bytes);
+                inner_.recv(data.data(), s.bytes, s.source, s.tag, &s);
+                unwrap(data, NULL, 0, s);
+            }
+            service_.receive();
+        });
+    }
+
+    Comm& inner() { return inner_; }
+
+    int rank() const { return inner_.rank(); }
+    int size() const { return inner_.size(); }
+
+    void send(const void* buf, int bytes, int dest, int tag) {
+        if (!service_.enabled()) {
+            inner_.send(buf, bytes, dest, tag);
+            count_send(bytes);
+            return;
+        }
+        pump();
+        int32_t epoch = service_.epoch();
+        scratch_.resize(sizeof(epoch) + bytes);
+        std::memcpy(scratch_.data(), &epoch, sizeof(epoch));
+        if (bytes > 0) std::memcpy(scratch_.data() + sizeof(epoch), buf, bytes);
+        inner_.send(scratch_.data(), scratch_.size(), dest, tag);
+        count_send(bytes);
+        service_.sent(dest);
+    }
+
+    void recv(void* buf, int bytes, int source, int tag, CommStatus* status = NULL) {
+        if (!service_.enabled()) return inner_.recv(buf, bytes, source, tag, status);
+        pump();
+        CommStatus s;
+        if (tag == COMM_ANY_TAG) {
+            probe(source, tag, &s);
+            source = s.source;
+            tag = s.tag;
+        }
+        std::vector<char> data(sizeof(int32_t) + bytes);
+        inner_.recv(data.data(), data.size(), source, tag, &s);
+        unwrap(data, buf, bytes, s);
+        if (status != NULL) *status = s;
+    }
+
+    CommRequest irecv(void* buf, int bytes, int source, int tag) {
+        if (!service_.enabled()) return inner_.irecv(buf, bytes, source, tag);
+        pump();
+        PendingRecv pending;
+        pending.buf = buf;
+        pending.bytes = bytes;
+        pending.data.resize(sizeof(int32_t) + bytes);
+        std::memcpy(pending.data.data(), &SNAPSHOT_NO_EPOCH, sizeof(SNAPSHOT_NO_EPOCH));
+        CommRequest request = inner_.irecv(pending.data.data(), pending.data.size(), source, tag);
+        pending_[request] = std::move(pending);
+        return request;
+    }
+
+    bool test(CommRequest& request, CommStatus* status = NULL) {
+        if (!service_.enabled()) return inner_.test(request, status);
+        pump();
+        CommRequest key = request;
+        CommStatus s;
+        if (!inner_.test(request, &s)) return false;
+        PendingRecv& pending = pending_[key];
+        unwrap(pending.data, pending.buf, pending.bytes, s);
+        pending_.erase(key);
+        if (status != NULL) *status = s;
+        return true;
+    }
+
+    void wait(CommRequest& request, CommStatus* status = NULL) {
+        if (!service_.enabled()) return inner_.wait(request, status);
+        pump();
+        CommRequest key = request;
+        CommStatus s;
+        inner_.wait(request, &s);
+        PendingRecv& pending = pending_[key];
+        unwrap(pending.data, pending.buf, pending.bytes, s);
+        pending_.erase(key);
+        if (status != NULL) *status = s;
+    }
+
+    // A message that completed the receive before the cancel took effect
+    // still counts as received, or its channel would never close.
+    void cancel(CommRequest& request) {
+        if (!service_.enabled()) return inner_.cancel(request);
+        CommRequest key = request;
+        CommStatus s;
+        if (inner_.test(request, &s)) {
+            unwrap(pending_[key].data, NULL, 0, s);
+        } else {
+            inner_.cancel(request);
+            int32_t epoch;
+            std::memcpy(&epoch, pending_[key].data.data(), sizeof(epoch));
+            if (epoch != SNAPSHOT_NO_EPOCH) {
+                std::cerr << "Rank " << rank() << ": a message arrived while its receive was cancelled and is"
+                          << " missing from the snapshot channels" << std::endl;
+            }
+        }
+        pending_.erase(key);
+    }
+
+    bool iprobe(int source, int tag, CommStatus* status) {
+        if (!service_.enabled()) return inner_.iprobe(source, tag, status);
+        pump();
+        CommStatus s;
+        while (inner_.iprobe(source, tag, &s)) {
+            if (SnapshotService::owns(s.tag)) {
+                service_.handle(s);
+                continue;
+            }
+            s.bytes -= sizeof(int32_t);
+            if (status != NULL) *status = s;
+            return true;
+        }
+        return false;
+    }
+
+    void probe(int source, int tag, CommStatus* status) {
+        if (!service_.enabled()) return inner_.probe(source, tag, status);
+        pump();
+        CommStatus s;
+        while (true) {
+            inner_.probe(source, tag, &s);
+            if (!SnapshotService::owns(s.tag)) break;
+            service_.handle(s);
+        }
+        s.bytes -= sizeof(int32_t);
+        if (status != NULL) *status = s;
+    }
+
+    void barrier() {
+        pump();
+        inner_.barrier();
+    }
+
+    void bcast(void* buf, int bytes, int root) {
+        pump();
+        inner_.bcast(buf, bytes, root);
+    }
+
+    void reduce(const long long* in, long long* out, int count, CommOp op, int root) {
+        pump();
+        inner_.reduce(in, out, count, op, root);
+    }
+
+    void allreduce(const long long* in, long long* out, int count, CommOp op) {
+        pump();
+        inner_.allreduce(in, out, count, op);
+    }
+
+    double now() { return inner_.now(); }
+
+    void sleep_us(long long us) {
+        if (!service_.enabled()) return inner_.sleep_us(us);
+        while (us > 0) {
+            pump();
+            long long slice = std::min(us, SNAPSHOT_POLL_US);
+            inner_.sleep_us(slice);
+            us -= slice;
+        }
+        pump();
+    }
+
+    unsigned seed() const { return inner_.seed(); }
+    void abort(int code) { inner_.abort(code); }
+    MPI_Comm mpi_comm() const { return inner_.mpi_comm(); }
+
+private:
+    struct PendingRecv {
+        void* buf;
+        int bytes;
+        std::vector<char> data;
+    };
+
+    void pump() {
+        if (!service_.enabled()) return;
+        service_.receive();
+        service_.poll();
+    }
+
+    // Strips the epoch, lets the service see the message (recording first if
+    // it comes from a later snapshot) and copies the payload to buf.
+    void unwrap(const std::vector<char>& data, void* buf, int bytes, CommStatus& s) {
+        int32_t epoch;
+        std::memcpy(&epoch, data.data(), sizeof(epoch));
+        s.bytes -= sizeof(epoch);
+        service_.received(s.source, s.tag, data.data() + sizeof(epoch), s.bytes, epoch);
+        if (buf != NULL && s.bytes > 0) std::memcpy(buf, data.data() + sizeof(epoch), std::min(s.bytes, bytes));
+    }
+
+    Comm& inner_;
+    SnapshotService service_;
+    std::unordered_map<CommRequest, PendingRecv> pending_;
+    std::vector<char> scratch_;
+};
+
+#endif
@@ -0,0 +1,419 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <mpi.h>
+#include "graph500.h"
+
+using namespace std;
+
+// Distributed single-source shortest paths on weighted Kronecker or grid
+// graphs, on the same block-distributed engine as bfs_bench.cpp.
+//
+// The BFS EXPLORE becomes a RELAX(target, parent, distance) request. Requests
+// are batched per destination rank, duplicates to the same target keep the
+// shortest distance, and the owner accepts a request only if it improves the
+// tentative distance (otherwise it is rejected, i.e. dropped).
+//
+// Delta-stepping (Meyer & Sanders) keeps vertices in buckets of width delta.
+// The lowest non-empty bucket is settled by repeated light-edge phases
+// (weight <= delta) until it stays empty, then the heavy edges of every
+// vertex removed from it are relaxed once. Bellman-Ford runs on the same
+// request exchange and relaxes every edge of every changed vertex per round.
+
+const double INF_DISTANCE = numeric_limits<double>::infinity();
+const double DISTANCE_EPSILON = 1e-9;
+
+struct RelaxMessage {
+    int64_t target;
+    int64_t sender_id;
+    double distance;   // distance of target through sender_id
+};
+
+struct SsspConfig {
+    string graph = "kronecker";
+    int scale = 16;
+    int edge_factor = 16;
+    int num_roots = 8;
+    double delta = 0.1;
+    uint64_t seed = 1;
+    bool validate = true;
+    string dist_path;       // distance array of the first root, if set
+};
+
+struct SsspResult {
+    double time = 0;
+    int64_t relaxations = 0;   // edge relaxations issued, all ranks
+    int64_t rounds = 0;        // request exchanges
+};
+
+// Local state of one search plus the batched request exchange.
+struct SsspState {
+    const DistGraph& g;
+    const vector<double>& weights;   // parallel to g.columns
+    vector<double> dist;
+    vector<int64_t> parent;
+    vector<vector<RelaxMessage>> outgoing;
+    vector<unordered_map<int64_t, size_t>> slot;
+    int64_t relaxations = 0;
+    int64_t rounds = 0;
+
+    SsspState(const DistGraph& graph, const vector<double>& w, int world_size)
+        : g(graph), weights(w), dist(graph.num_local, INF_DISTANCE), parent(graph.num_local, -1),
+          outgoing(world_size), slot(world_size) {}
+
+    // Queues a RELAX for v, keeping only the shortest request per target.
+    void request(int64_t v, int64_t sender, double distance) {
+        relaxations++;
+        int dest = g.owner(v);
+        auto it = slot[dest].find(v);
+        if (it == slot[dest].end()) {
+            slot[dest][v] = outgoing[dest].size();
+            outgoing[dest].push_back({v, sender, distance});
+        } else if (distance < outgoing[dest][it->second].distance) {
+            outgoing[dest][it->second] = {v, sender, distance};
+        }
+    }
+
+    // Ships all queued requests and returns the ones addressed to this rank.
+    vector<RelaxMessage> exchange(MPI_Comm comm) {
+        vector<RelaxMessage> incoming = exchange_messages(outgoing, comm);
+        for (size_t r = 0; r < outgoing.size(); ++r) {
+            outgoing[r].clear();
+            slot[r].clear();
+        }
+        rounds++;
+        return incoming;
+    }
+};
+
+int64_t bucket_of(double distance, double delta) {
+    return (int64_t)(distance / delta);
+}
+
+double run_delta_stepping(SsspState& s, int64_t root, double delta, MPI_Comm comm) {
+    const DistGraph& g = s.g;
+    map<int64_t, vector<int64_t>> buckets;   // bucket -> local vertices (may be stale)
+    vector<char> in_settled(g.num_local, 0);
+
+    auto accept = [&](const RelaxMessage& msg) {
+        int64_t lv = g.local_index(msg.target);
+        if (msg.distance < s.dist[lv]) {
+            s.dist[lv] = msg.distance;
+            s.parent[lv] = msg.sender_id;
+            buckets[bucket_of(msg.distance, delta)].push_back(lv);
+        }
+    };
+
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+
+    if (g.is_local(root)) accept({root, root, 0.0});
+
+    while (true) {
+        // Lowest non-empty bucket over all ranks; stale entries are dropped.
+        int64_t local_min = numeric_limits<int64_t>::max(), current = 0;
+        while (!buckets.empty()) {
+            auto it = buckets.begin();
+            auto& members = it->second;
+            members.erase(remove_if(members.begin(), members.end(),
+                                    [&](int64_t lv) { return bucket_of(s.dist[lv], delta) != it->first; }),
+                          members.end());
+            if (!members.empty()) {
+                local_min = it->first;
+                break;
+            }
+            buckets.erase(it);
+        }
+        MPI_Allreduce(&local_min, &current, 1, MPI_INT64_T, MPI_MIN, comm);
+        if (current == numeric_limits<int64_t>::max()) break;
+
+        // Light phases: settle the bucket, re-running while it refills.
+        vector<int64_t> settled;
+        while (true) {
+            vector<int64_t> frontier;
+            auto it = buckets.find(current);
+            if (it != buckets.end()) {
+                for (int64_t lv : it->second) {
+                    if (bucket_of(s.dist[lv], delta) == current) frontier.push_back(lv);
+                }
+                buckets.erase(it);
+            }
+            sort(frontier.begin(), frontier.end());
+            frontier.erase(unique(frontier.begin(), frontier.end()), frontier.end());
+
+            int64_t local_active = frontier.size(), global_active = 0;
+            MPI_Allreduce(&local_active, &global_active, 1, MPI_INT64_T, MPI_SUM, comm);
+            if (global_active == 0) break;
+
+            for (int64_t lu : frontier) {
+                if (!in_settled[lu]) {
+                    in_settled[lu] = 1;
+                    settled.push_back(lu);
+                }
+                int64_t u = g.local_begin + lu;
+                for (int64_t e = g.row_offsets[lu]; e < g.row_offsets[lu + 1]; ++e) {
+                    if (s.weights[e] <= delta) s.request(g.columns[e], u, s.dist[lu] + s.weights[e]);
+                }
+            }
+            for (const RelaxMessage& msg : s.exchange(comm)) accept(msg);
+        }
+
+        // Heavy edges of everything settled in this bucket, once.
+        for (int64_t lu : settled) {
+            in_settled[lu] = 0;
+            int64_t u = g.local_begin + lu;
+            for (int64_t e = g.row_offsets[lu]; e < g.row_offsets[lu + 1]; ++e) {
+                if (s.weights[e] > delta) s.request(g.columns[e], u, s.dist[lu] + s.weights[e]);
+            }
+        }
+        for (const RelaxMessage& msg : s.exchange(comm)) accept(msg);
+    }
+
+    return MPI_Wtime() - start;
+}
+
+double run_bellman_ford(SsspState& s, int64_t root, MPI_Comm comm) {
+    const DistGraph& g = s.g;
+    vector<int64_t> active, next_active;
+    vector<char> queued(g.num_local, 0);
+
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+
+    if (g.is_local(root)) {
+        int64_t li = g.local_index(root);
+        s.dist[li] = 0;
+        s.parent[li] = root;
+        active.push_back(li);
+    }
+
+    while (true) {
+        int64_t local_active = active.size(), global_active = 0;
+        MPI_Allreduce(&local_active, &global_active, 1, MPI_INT64_T, MPI_SUM, comm);
+        if (global_active == 0) break;
+
+        for (int64_t lu : active) {
+            queued[lu] = 0;
+            int64_t u = g.local_begin + lu;
+            for (int64_t e = g.row_offsets[lu]; e < g.row_offsets[lu + 1]; ++e) {
+                s.request(g.columns[e], u, s.dist[lu] + s.weights[e]);
+            }
+        }
+        for (const RelaxMessage& msg : s.exchange(comm)) {
+            int64_t lv = g.local_index(msg.target);
+            if (msg.distance < s.dist[lv]) {
+                s.dist[lv] = msg.distance;
+                s.parent[lv] = msg.sender_id;
+                if (!queued[lv]) {
+                    queued[lv] = 1;
+                    next_active.push_back(lv);
+                }
+            }
+        }
+        active.swap(next_active);
+        next_active.clear();
+    }
+
+    return MPI_Wtime() - start;
+}
+
+// Every reached vertex other than the root sits exactly one edge weight
+// behind its parent, and no edge can still be relaxed.
+bool validate_sssp(const DistGraph& g, const vector<double>& weights, int64_t root,
+                   const vector<double>& dist, const vector<int64_t>& parent, string* error,
+                   MPI_Comm comm) {
+    string local_error;
+    vector<int64_t> parents_wanted;
+    for (int64_t i = 0; i < g.num_local; ++i) {
+        if (parent[i] >= 0 && g.local_begin + i != root) parents_wanted.push_back(parent[i]);
+    }
+    vector<double> parent_dist = fetch_remote(g, parents_wanted, dist, comm);
+    vector<double> neighbour_dist = fetch_remote(g, g.columns, dist, comm);
+
+    size_t pos = 0;
+    for (int64_t i = 0; i < g.num_local && local_error.empty(); ++i) {
+        int64_t v = g.local_begin + i;
+        if (v == root && dist[i] != 0) local_error = "root distance is not 0";
+        if (parent[i] >= 0 && v != root) {
+            double best = INF_DISTANCE;
+            for (int64_t e = g.row_offsets[i]; e < g.row_offsets[i + 1]; ++e) {
+                if (g.columns[e] == parent[i]) best = min(best, weights[e]);
+            }
+            if (fabs(parent_dist[pos++] + best - dist[i]) > DISTANCE_EPSILON) {
+                local_error = "vertex " + to_string(v) + " is not one edge behind its parent";
+            }
+        }
+        for (int64_t e = g.row_offsets[i]; e < g.row_offsets[i + 1]; ++e) {
+            if (neighbour_dist[e] + weights[e] < dist[i] - DISTANCE_EPSILON) {
+                local_error = "edge " + to_string(g.columns[e]) + "-" + to_string(v) + " can still be relaxed";
+            }
+        }
+    }
+
+    int local_ok = local_error.empty(), all_ok = 0;
+    MPI_Allreduce(&local_ok, &all_ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!local_ok) *error = local_error;
+    return all_ok;
+}
+
+// Rank 0 writes "vertex distance parent" lines; unreachable vertices get inf.
+void write_distances(const string& path, const DistGraph& g, const vector<double>& dist,
+                     const vector<int64_t>& parent, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int local_count = (int)g.num_local;
+    vector<int> counts(size), displs(size);
+    MPI_Gather(&local_count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+    for (int r = 1; r < size; ++r) displs[r] = displs[r - 1] + counts[r - 1];
+
+    vector<double> all_dist(rank == 0 ? g.num_global_vertices : 0);
+    vector<int64_t> all_parent(rank == 0 ? g.num_global_vertices : 0);
+    MPI_Gatherv(dist.data(), local_count, MPI_DOUBLE, all_dist.data(), counts.data(), displs.data(),
+                MPI_DOUBLE, 0, comm);
+    MPI_Gatherv(parent.data(), local_count, MPI_INT64_T, all_parent.data(), counts.data(),
+                displs.data(), MPI_INT64_T, 0, comm);
+
+    if (rank == 0) {
+        ofstream out(path);
+        out.precision(9);
+        for (int64_t v = 0; v < g.num_global_vertices; ++v) {
+            out << v << " " << all_dist[v] << " " << all_parent[v] << "\n";
+        }
+    }
+}
+
+bool parse_args(int argc, char** argv, SsspConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--graph" && has_value) cfg.graph = argv[++i];
+        else if (arg == "--scale" && has_value) cfg.scale = atoi(argv[++i]);
+        else if (arg == "--edgefactor" && has_value) cfg.edge_factor = atoi(argv[++i]);
+        else if (arg == "--roots" && has_value) cfg.num_roots = atoi(argv[++i]);
+        else if (arg == "--delta" && has_value) cfg.delta = atof(argv[++i]);
+        else if (arg == "--seed" && has_value) cfg.seed = strtoull(argv[++i], NULL, 10);
+        else if (arg == "--dist" && has_value) cfg.dist_path = argv[++i];
+        else if (arg == "--no-validate") cfg.validate = false;
+        else return false;
+    }
+    return (cfg.graph == "kronecker" || cfg.graph == "grid") && cfg.scale > 0 && cfg.scale < 40 &&
+           cfg.edge_factor > 0 && cfg.num_roots > 0 && cfg.delta > 0;
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+
+    int world_rank, world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    SsspConfig cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        if (world_rank == 0) {
+            cerr << "usage: " << argv[0] << " [--graph kronecker|grid] [--scale S] [--edgefactor E]"
+                 << " [--roots K] [--delta D] [--seed N] [--dist FILE] [--no-validate]" << endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    const int64_t grid_side = llround(sqrt((double)(1LL << cfg.scale)));
+    const int64_t num_vertices = (cfg.graph == "grid") ? grid_side * grid_side : (1LL << cfg.scale);
+    vector<Edge> edges = (cfg.graph == "grid")
+        ? generate_grid_edges(grid_side, MPI_COMM_WORLD)
+        : generate_kronecker_edges(cfg.scale, cfg.edge_factor, cfg.seed, MPI_COMM_WORLD);
+    DistGraph g = build_dist_graph(num_vertices, edges, MPI_COMM_WORLD);
+    vector<Edge>().swap(edges);
+
+    vector<double> weights(g.columns.size());
+    for (int64_t i = 0; i < g.num_local; ++i) {
+        for (int64_t e = g.row_offsets[i]; e < g.row_offsets[i + 1]; ++e) {
+            weights[e] = edge_weight(g.local_begin + i, g.columns[e], cfg.seed);
+        }
+    }
+
+    if (world_rank == 0) {
+        cout << "Graph: " << cfg.graph << ", " << g.num_global_vertices << " vertices, "
+             << g.num_input_edges << " edges, weights in [0, 1), delta " << cfg.delta
+             << ", " << world_size << " ranks" << endl;
+    }
+
+    vector<int64_t> roots = pick_search_keys(g, cfg.num_roots, cfg.seed, MPI_COMM_WORLD);
+    SsspResult delta_total, bf_total;
+    bool all_valid = true;
+    double max_difference = 0;
+
+    for (size_t k = 0; k < roots.size(); ++k) {
+        int64_t root = roots[k];
+        SsspState ds(g, weights, world_size);
+        double ds_time = run_delta_stepping(ds, root, cfg.delta, MPI_COMM_WORLD);
+        SsspState bf(g, weights, world_size);
+        double bf_time = run_bellman_ford(bf, root, MPI_COMM_WORLD);
+
+        int64_t counts[4] = {ds.relaxations, ds.rounds, bf.relaxations, bf.rounds}, totals[4];
+        MPI_Allreduce(counts, totals, 4, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+        // rounds are identical on every rank
+        totals[1] /= world_size;
+        totals[3] /= world_size;
+        delta_total.time += ds_time;
+        delta_total.relaxations += totals[0];
+        delta_total.rounds += totals[1];
+        bf_total.time += bf_time;
+        bf_total.relaxations += totals[2];
+        bf_total.rounds += totals[3];
+
+        double local_diff = 0;
+        for (int64_t i = 0; i < g.num_local; ++i) {
+            if (ds.dist[i] != bf.dist[i]) local_diff = max(local_diff, fabs(ds.dist[i] - bf.dist[i]));
+        }
+        double diff = 0;
+        MPI_Allreduce(&local_diff, &diff, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        max_difference = max(max_difference, diff);
+
+        if (cfg.validate) {
+            string error;
+            if (!validate_sssp(g, weights, root, ds.dist, ds.parent, &error, MPI_COMM_WORLD)) {
+                all_valid = false;
+                cerr << "Rank " << world_rank << ": Validation FAILED for root " << root << ": "
+                     << error << endl;
+            }
+        }
+        if (k == 0 && !cfg.dist_path.empty()) {
+            write_distances(cfg.dist_path, g, ds.dist, ds.parent, MPI_COMM_WORLD);
+        }
+
+        if (world_rank == 0) {
+            cout << "Root " << root << ": delta-stepping " << ds_time << " s (" << totals[0]
+                 << " relaxations, " << totals[1] << " rounds), Bellman-Ford " << bf_time << " s ("
+                 << totals[2] << " relaxations, " << totals[3] << " rounds)" << endl;
+        }
+    }
+
+    if (world_rank == 0) {
+        cout << "\n========================================" << endl;
+        cout << "SSSP searches: " << roots.size() << " ("
+             << (!cfg.validate ? "not validated" : all_valid ? "all valid" : "VALIDATION FAILED")
+             << ", max delta-stepping/Bellman-Ford difference " << max_difference << ")" << endl;
+        cout << "Delta-stepping: " << delta_total.time << " s, " << delta_total.relaxations
+             << " relaxations, " << delta_total.relaxations / delta_total.time << " relaxations/s" << endl;
+        cout << "Bellman-Ford:   " << bf_total.time << " s, " << bf_total.relaxations
+             << " relaxations, " << bf_total.relaxations / bf_total.time << " relaxations/s" << endl;
+        cout << "Speedup: " << bf_total.time / delta_total.time << "x" << endl;
+        if (!cfg.dist_path.empty()) {
+            cout << "Distances from root " << roots[0] << " written to " << cfg.dist_path << endl;
+        }
+        cout << "========================================" << endl;
+    }
+
+    MPI_Finalize();
+    return (all_valid && max_difference <= DISTANCE_EPSILON) ? 0 : 1;
+}
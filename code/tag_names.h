@@ -0,0 +1,89 @@
+#ifndef TAG_NAMES_H
+#define TAG_NAMES_H
+
+// Names of the message tags the programs use, for tools that only see tag
+// numbers (mpi_profile.cpp). The same number means different things in
+// different programs, so entries are keyed by the program's name as it
+// appears in argv[0]; "*" entries are the tags of the shared headers and
+// apply to every program. Add a line here when a program gains a tag, or,
+// without rebuilding, list "program tag NAME" lines in a file named by
+// MPI_PROFILE_TAGS.
+
+#include <cstring>
+
+struct TagName {
+    const char* program;
+    int tag;
+    const char* name;
+};
+
+const TagName TAG_NAMES[] = {
+    {"*", 32000, "TRACE_CALIBRATION_TAG"},
+    {"*", 32001, "SNAPSHOT_MARKER_TAG"},
+    {"*", 32002, "SNAPSHOT_PART_TAG"},
+    {"*", 40, "TREE_BCAST_TAG"},
+    {"*", 41, "TREE_REDUCE_TAG"},
+    {"*", 60, "CORO_TAG"},
+
+    {"async_bfs", 10, "EXPLORE_TAG"},
+    {"async_bfs", 11, "ACCEPT_TAG"},
+    {"async_bfs", 12, "REJECT_TAG"},
+    {"async_bfs", 13, "LEVEL_COMPLETE_TAG"},
+    {"async_bfs", 14, "PROCEED_TAG"},
+    {"async_bfs", 15, "TERMINATE_TAG"},
+
+    {"bfs", 10, "MC_PROPOSE_TAG"},
+    {"bfs", 11, "MP_ACCEPT_TAG"},
+    {"bfs", 12, "MR_REJECT_TAG"},
+    {"bfs", 13, "MS_SYNC_TAG"},
+
+    {"mst", 10, "MC_PROPOSE_TAG"},
+    {"mst", 11, "MP_ACCEPT_TAG"},
+    {"mst", 12, "MR_REJECT_TAG"},
+
+    {"rst", 10, "RST_MSG_TAG"},
+
+    {"bfs_bench", 20, "UPDATE_TAG"},
+
+    {"comm_bench", 50, "PING_TAG"},
+    {"comm_bench", 51, "DATA_TAG"},
+    {"comm_bench", 52, "REQUEST_TAG"},
+    {"comm_bench", 53, "REPLY_TAG"},
+    {"comm_bench", 54, "DONE_TAG"},
+
+    {"dme", 100, "REQ_TAG"},
+    {"dme", 101, "REP_TAG"},
+    {"dme", 102, "DONE_TAG"},
+    {"dme", 103, "STOP_TAG"},
+    {"dme", 110, "MK_REQUEST_TAG"},
+    {"dme", 111, "MK_LOCKED_TAG"},
+    {"dme", 112, "MK_RELEASE_TAG"},
+    {"dme", 113, "MK_INQUIRE_TAG"},
+    {"dme", 114, "MK_RELINQUISH_TAG"},
+    {"dme", 115, "MK_FAILED_TAG"},
+    {"dme", 120, "SK_REQUEST_TAG"},
+    {"dme", 121, "SK_TOKEN_TAG"},
+    {"dme", 130, "RT_REQUEST_TAG"},
+    {"dme", 131, "RT_TOKEN_TAG"},
+
+    {"lamport", 0, "MSG_TAG"},
+    {"lamport", 1, "TERM_TAG"},
+    {"vector", 0, "MSG_TAG"},
+    {"matrix", 0, "MSG_TAG"},
+
+    {"leaderelection", 20, "ELECTION_TAG"},
+    {"leaderelection", 21, "ELECTED_TAG"},
+};
+
+// NULL if the tag has no name for program; the program's own entries win.
+inline const char* find_tag_name(const char* program, int tag) {
+    const char* shared = NULL;
+    for (const TagName& entry : TAG_NAMES) {
+        if (entry.tag != tag) continue;
+        if (std::strcmp(entry.program, program) == 0) return entry.name;
+        if (std::strcmp(entry.program, "*") == 0) shared = entry.name;
+    }
+    return shared;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include "comm.h"
+
+using namespace std;
+
+// Merges the per-rank traces of a run (comm.h, written with --trace PREFIX)
+// into one Chrome-trace JSON file for chrome://tracing or ui.perfetto.dev:
+//
+//   ./trace_export -o trace.json PREFIX.*.trace
+//
+// Each rank is a track; sends, receives, handlers, collectives and sleeps
+// are slices, and a flow arrow runs from every send to the receive that
+// matched it. Timestamps are moved onto rank 0's clock with the offsets
+// measured at startup. A receive that still ends before its send started
+// violates happens-before; those are counted, since they show the offset
+// correction was off by at least that much.
+
+struct RankTrace {
+    TraceFileHeader header;
+    vector<TraceRecord> records;
+};
+
+bool read_trace(const char* path, RankTrace& trace) {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        cerr << "Could not open " << path << endl;
+        return false;
+    }
+    if (!in.read((char*)&trace.header, sizeof(trace.header)) || memcmp(trace.header.magic, TRACE_FILE_MAGIC, 8) != 0 ||
+        trace.header.records < 0) {
+        cerr << path << " is not a trace file" << endl;
+        return false;
+    }
+    trace.records.resize(trace.header.records);
+    if (!in.read((char*)trace.records.data(), trace.records.size() * sizeof(TraceRecord))) {
+        cerr << path << ": truncated" << endl;
+        return false;
+    }
+    return true;
+}
+
+string slice_name(const TraceRecord& r) {
+    const char* collectives[] = {"barrier", "bcast", "reduce", "allreduce"};
+    switch (r.kind) {
+    case TRACE_SEND:
+        return "send to " + to_string(r.peer) + " (tag " + to_string(r.tag) + ")";
+    case TRACE_RECV:
+        return "recv from " + to_string(r.peer) + " (tag " + to_string(r.tag) + ")";
+    case TRACE_HANDLER:
+        return "handle tag " + to_string(r.tag) + " from " + to_string(r.peer);
+    case TRACE_COLLECTIVE:
+        return r.tag >= 0 && r.tag < 4 ? collectives[r.tag] : "collective";
+    default:
+        return "sleep";
+    }
+}
+
+// Microseconds with nanosecond digits, as the format expects.
+string micros(int64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld.%03lld", (long long)(ns / 1000), (long long)(ns % 1000));
+    return buf;
+}
+
+int main(int argc, char** argv) {
+    string out_path = "trace.json";
+    vector<const char*> inputs;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_path = argv[++i];
+        else inputs.push_back(argv[i]);
+    }
+    if (inputs.empty()) {
+        cerr << "usage: " << argv[0] << " [-o FILE] TRACE..." << endl;
+        return 1;
+    }
+    vector<RankTrace> traces(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (!read_trace(inputs[i], traces[i])) return 1;
+    }
+
+    // Onto rank 0's clock, relative to the earliest event.
+    int64_t start = INT64_MAX, max_offset = 0;
+    for (RankTrace& t : traces) {
+        for (TraceRecord& r : t.records) {
+            r.start_ns -= t.header.offset_ns;
+            r.end_ns -= t.header.offset_ns;
+            start = min(start, r.start_ns);
+        }
+        max_offset = max(max_offset, (int64_t)llabs(t.header.offset_ns));
+    }
+
+    // (source, seq) -> send record.
+    unordered_map<uint64_t, const TraceRecord*> sends;
+    auto flow_id = [](int64_t source, int64_t seq) { return ((uint64_t)source << 40) | (uint64_t)seq; };
+    for (const RankTrace& t : traces) {
+        for (const TraceRecord& r : t.records) {
+            if (r.kind == TRACE_SEND) sends[flow_id(t.header.rank, r.seq)] = &r;
+        }
+    }
+
+    ofstream out(out_path);
+    if (!out) {
+        cerr << "Could not write " << out_path << endl;
+        return 1;
+    }
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    auto event = [&](const string& json) {
+        out << (first ? "" : ",\n") << json;
+        first = false;
+    };
+
+    long long events = 0, matched = 0, violations = 0;
+    int64_t worst = 0;
+    for (const RankTrace& t : traces) {
+        const string tid = to_string(t.header.rank);
+        event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" + tid + ",\"args\":{\"name\":\"rank " + tid +
+              "\"}}");
+        event("{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":0,\"tid\":" + tid + ",\"args\":{\"sort_index\":" +
+              tid + "}}");
+        for (const TraceRecord& r : t.records) {
+            string common = ",\"pid\":0,\"tid\":" + tid + ",\"ts\":" + micros(r.start_ns - start);
+            event("{\"name\":\"" + slice_name(r) + "\",\"cat\":\"comm\",\"ph\":\"X\"" + common +
+                  ",\"dur\":" + micros(r.end_ns - r.start_ns) + ",\"args\":{\"peer\":" + to_string(r.peer) +
+                  ",\"tag\":" + to_string(r.tag) + ",\"bytes\":" + to_string(r.bytes) + ",\"lamport\":" +
+                  to_string(r.lamport) + ",\"seq\":" + to_string(r.seq) + "}}");
+            events++;
+            if (r.kind != TRACE_RECV) continue;
+            auto it = sends.find(flow_id(r.peer, r.seq));
+            if (it == sends.end()) continue;
+            const TraceRecord& s = *it->second;
+            matched++;
+            if (r.end_ns < s.start_ns) {
+                violations++;
+                worst = max(worst, s.start_ns - r.end_ns);
+            }
+            string id = to_string(flow_id(r.peer, r.seq));
+            event("{\"name\":\"message\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":" + id + ",\"pid\":0,\"tid\":" +
+                  to_string(r.peer) + ",\"ts\":" + micros(s.start_ns - start) + "}");
+            event("{\"name\":\"message\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":" + id + common + "}");
+        }
+    }
+    out << "\n]}\n";
+    out.close();
+
+    cout << "Trace: " << events << " slices from " << traces.size() << " ranks, " << matched << " of " << sends.size()
+         << " messages matched to their receive, written to " << out_path << endl;
+    cout << "Clock offsets: up to " << max_offset / 1000.0 << " us" << endl;
+    cout << "Happens-before violations after correction: " << violations;
+    if (violations > 0) cout << " (worst " << worst / 1000.0 << " us)";
+    cout << endl;
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <queue>
+#include <mpi.h>
+#include "tree_comm.h"
+
+using namespace std;
+
+// Compares the spanning-tree collectives of tree_comm.h with MPI_Bcast,
+// MPI_Allreduce and MPI_Barrier. The tree is the BFS tree from rank 0 of a
+// sparse rank topology (a line, a ring or a 2D mesh), the same tree bfs.cpp
+// builds on those layouts, so it mirrors the network when ranks are placed
+// along the physical links. Every size is checked against the MPI result.
+
+struct TreeBenchConfig {
+    string topology = "mesh";   // line, ring or mesh
+    int iterations = 20;
+    int max_bytes = 1 << 20;
+    int segment_bytes = (int)TREE_DEFAULT_SEGMENT_BYTES;
+};
+
+vector<vector<int>> get_topology(const string& name, int world_size) {
+    vector<vector<int>> adj(world_size);
+    if (name == "mesh") {
+        int cols = (int)sqrt((double)world_size);
+        while (world_size % cols != 0) cols--;
+        for (int i = 0; i < world_size; ++i) {
+            if (i % cols > 0) adj[i].push_back(i - 1);
+            if (i % cols < cols - 1) adj[i].push_back(i + 1);
+            if (i >= cols) adj[i].push_back(i - cols);
+            if (i + cols < world_size) adj[i].push_back(i + cols);
+        }
+        return adj;
+    }
+    for (int i = 0; i < world_size; ++i) {
+        if (i > 0) adj[i].push_back(i - 1);
+        if (i < world_size - 1) adj[i].push_back(i + 1);
+    }
+    if (name == "ring" && world_size > 2) {
+        adj[0].push_back(world_size - 1);
+        adj[world_size - 1].push_back(0);
+    }
+    return adj;
+}
+
+// Every rank knows the topology, so each computes the BFS tree locally.
+void bfs_tree(const vector<vector<int>>& adj, int rank, int* parent, vector<int>& children) {
+    vector<int> parents(adj.size(), -2);
+    queue<int> frontier;
+    parents[0] = -1;
+    frontier.push(0);
+    while (!frontier.empty()) {
+        int u = frontier.front();
+        frontier.pop();
+        for (int v : adj[u]) {
+            if (parents[v] != -2) continue;
+            parents[v] = u;
+            if (u == rank) children.push_back(v);
+            frontier.push(v);
+        }
+    }
+    *parent = parents[rank];
+}
+
+// Average time per call of op, taken on the slowest rank.
+template <typename Op>
+double time_op(int iterations, MPI_Comm comm, Op op) {
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+    for (int i = 0; i < iterations; ++i) op();
+    double local = (MPI_Wtime() - start) / iterations, slowest = 0;
+    MPI_Allreduce(&local, &slowest, 1, MPI_DOUBLE, MPI_MAX, comm);
+    return slowest;
+}
+
+bool parse_args(int argc, char** argv, TreeBenchConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--topology" && has_value) cfg.topology = argv[++i];
+        else if (arg == "--iterations" && has_value) cfg.iterations = atoi(argv[++i]);
+        else if (arg == "--max-bytes" && has_value) cfg.max_bytes = atoi(argv[++i]);
+        else if (arg == "--segment" && has_value) cfg.segment_bytes = atoi(argv[++i]);
+        else return false;
+    }
+    return (cfg.topology == "line" || cfg.topology == "ring" || cfg.topology == "mesh") &&
+           cfg.iterations > 0 && cfg.max_bytes >= 8 && cfg.segment_bytes > 0;
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+
+    int world_rank, world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    TreeBenchConfig cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        if (world_rank == 0) {
+            cerr << "usage: " << argv[0] << " [--topology line|ring|mesh] [--iterations N]"
+                 << " [--max-bytes B] [--segment B]" << endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    int parent;
+    vector<int> children;
+    bfs_tree(get_topology(cfg.topology, world_size), world_rank, &parent, children);
+    TreeComm tree(MPI_COMM_WORLD, parent, children);
+    tree.set_segment_bytes(cfg.segment_bytes);
+
+    int local_depth = tree.depth(), max_depth = 0;
+    MPI_Reduce(&local_depth, &max_depth, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (world_rank == 0) {
+        cout << "Topology: " << cfg.topology << ", " << world_size << " ranks, tree depth " << max_depth
+             << ", segment " << cfg.segment_bytes << " bytes" << endl;
+        cout << "\n" << "bytes" << "\ttree bcast\tMPI_Bcast\ttree allreduce\tMPI_Allreduce  (us)" << endl;
+    }
+
+    bool all_ok = true;
+    for (int bytes = 8; bytes <= cfg.max_bytes; bytes *= 4) {
+        int count = bytes / sizeof(double);
+        vector<double> data(count), tree_sum(count), mpi_sum(count);
+        for (int i = 0; i < count; ++i) data[i] = world_rank + i;
+
+        vector<double> buf(count);
+        double tree_bcast = time_op(cfg.iterations, MPI_COMM_WORLD, [&] {
+            if (world_rank == tree.root()) buf = data;
+            tree.bcast(buf.data(), count, MPI_DOUBLE);
+        });
+        int ok = (count == 0 || buf[count - 1] == tree.root() + count - 1);
+        double mpi_bcast = time_op(cfg.iterations, MPI_COMM_WORLD, [&] {
+            MPI_Bcast(buf.data(), count, MPI_DOUBLE, tree.root(), MPI_COMM_WORLD);
+        });
+        double tree_allreduce = time_op(cfg.iterations, MPI_COMM_WORLD, [&] {
+            tree.allreduce(data.data(), tree_sum.data(), count, MPI_DOUBLE, MPI_SUM);
+        });
+        double mpi_allreduce = time_op(cfg.iterations, MPI_COMM_WORLD, [&] {
+            MPI_Allreduce(data.data(), mpi_sum.data(), count, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        });
+        if (tree_sum != mpi_sum) ok = 0;
+
+        int all = 0;
+        MPI_Allreduce(&ok, &all, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+        all_ok = all_ok && all;
+        if (world_rank == 0) {
+            cout << bytes << "\t" << tree_bcast * 1e6 << "\t\t" << mpi_bcast * 1e6 << "\t\t"
+                 << tree_allreduce * 1e6 << "\t\t" << mpi_allreduce * 1e6 << (all ? "" : "  MISMATCH") << endl;
+        }
+    }
+
+    double tree_barrier = time_op(cfg.iterations, MPI_COMM_WORLD, [&] { tree.barrier(); });
+    double mpi_barrier = time_op(cfg.iterations, MPI_COMM_WORLD, [&] { MPI_Barrier(MPI_COMM_WORLD); });
+    if (world_rank == 0) {
+        cout << "\nBarrier: tree " << tree_barrier * 1e6 << " us, MPI_Barrier " << mpi_barrier * 1e6 << " us"
+             << endl;
+        cout << "Results: " << (all_ok ? "match MPI" : "DIFFER FROM MPI") << endl;
+    }
+
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
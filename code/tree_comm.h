@@ -0,0 +1,192 @@
+#ifndef TREE_COMM_H
+#define TREE_COMM_H
+
+// Collectives over a spanning tree built by one of the traversal programs
+// (bfs.cpp, mst.cpp, rst.cpp, async_bfs.cpp).
+//
+// Messages only travel along tree edges, so on a sparse or physically
+// constrained layout whose links the tree mirrors, every hop is a real
+// neighbour link. Large payloads are cut into segments and pipelined: a rank
+// forwards segment k to its children while segment k + 1 is still arriving
+// from its parent, so a broadcast costs roughly depth + segments hops rather
+// than depth * segments.
+//
+// The tree works on its own duplicate of the communicator, so leftover
+// messages from the construction phase cannot be matched by mistake.
+// Reductions combine children in arbitrary order: the op must be commutative.
+
+#include <mpi.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+const int TREE_BCAST_TAG = 40;
+const int TREE_REDUCE_TAG = 41;
+const size_t TREE_DEFAULT_SEGMENT_BYTES = 64 * 1024;
+
+class TreeComm {
+public:
+    // parent is -1 on the root. Collective over comm.
+    TreeComm(MPI_Comm comm, int parent, const std::vector<int>& children)
+        : parent_(parent), children_(children) {
+        init(comm);
+    }
+
+    // Derives every rank's children from the parents alone, for programs
+    // whose own children lists are not reliable. Collective over comm.
+    TreeComm(MPI_Comm comm, int parent) : parent_(parent) {
+        int size;
+        MPI_Comm_size(comm, &size);
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        std::vector<int> parents(size);
+        MPI_Allgather(&parent_, 1, MPI_INT, parents.data(), 1, MPI_INT, comm);
+        for (int r = 0; r < size; ++r) {
+            if (parents[r] == rank) children_.push_back(r);
+        }
+        init(comm);
+    }
+
+    ~TreeComm() {
+        int finalized = 0;
+        MPI_Finalized(&finalized);
+        if (!finalized) MPI_Comm_free(&comm_);
+    }
+
+    TreeComm(const TreeComm&) = delete;
+    TreeComm& operator=(const TreeComm&) = delete;
+
+    int parent() const { return parent_; }
+    const std::vector<int>& children() const { return children_; }
+    int root() const { return root_; }
+    int depth() const { return depth_; }   // edges between this rank and the root
+    void set_segment_bytes(size_t bytes) { segment_bytes_ = std::max<size_t>(bytes, 1); }
+
+    // Broadcasts count elements from the root of the tree.
+    void bcast(void* buf, int count, MPI_Datatype type) {
+        int segment, num_segments;
+        MPI_Aint extent = segments(count, type, &segment, &num_segments);
+        char* data = (char*)buf;
+
+        std::vector<MPI_Request> recvs;
+        if (parent_ >= 0) {
+            recvs.resize(num_segments);
+            for (int s = 0; s < num_segments; ++s) {
+                MPI_Irecv(data + (MPI_Aint)s * segment * extent, segment_length(s, segment, count), type,
+                          parent_, TREE_BCAST_TAG, comm_, &recvs[s]);
+            }
+        }
+        std::vector<MPI_Request> sends;
+        sends.reserve((size_t)num_segments * children_.size());
+        for (int s = 0; s < num_segments; ++s) {
+            if (parent_ >= 0) MPI_Wait(&recvs[s], MPI_STATUS_IGNORE);
+            for (int child : children_) {
+                sends.push_back(MPI_REQUEST_NULL);
+                MPI_Isend(data + (MPI_Aint)s * segment * extent, segment_length(s, segment, count), type,
+                          child, TREE_BCAST_TAG, comm_, &sends.back());
+            }
+        }
+        MPI_Waitall((int)sends.size(), sends.data(), MPI_STATUSES_IGNORE);
+    }
+
+    // Reduces count elements onto the root of the tree; recvbuf is only
+    // written there. Each segment is passed up as soon as all children have
+    // delivered theirs.
+    void reduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op) {
+        int segment, num_segments;
+        MPI_Aint extent = segments(count, type, &segment, &num_segments);
+
+        std::vector<char> scratch;
+        char* acc = (char*)recvbuf;
+        if (parent_ >= 0) {
+            scratch.resize((size_t)count * extent);
+            acc = scratch.data();
+        }
+        if (count > 0) std::memcpy(acc, sendbuf, (size_t)count * extent);
+
+        const size_t num_children = children_.size();
+        std::vector<char> incoming(num_children * count * extent);
+        std::vector<MPI_Request> recvs(num_children * num_segments);
+        for (size_t c = 0; c < num_children; ++c) {
+            for (int s = 0; s < num_segments; ++s) {
+                MPI_Irecv(incoming.data() + (c * count + (size_t)s * segment) * extent,
+                          segment_length(s, segment, count), type, children_[c], TREE_REDUCE_TAG, comm_,
+                          &recvs[c * num_segments + s]);
+            }
+        }
+        std::vector<MPI_Request> sends(num_segments, MPI_REQUEST_NULL);
+        for (int s = 0; s < num_segments; ++s) {
+            char* acc_segment = acc + (MPI_Aint)s * segment * extent;
+            int length = segment_length(s, segment, count);
+            for (size_t c = 0; c < num_children; ++c) {
+                MPI_Wait(&recvs[c * num_segments + s], MPI_STATUS_IGNORE);
+                MPI_Reduce_local(incoming.data() + (c * count + (size_t)s * segment) * extent, acc_segment,
+                                 length, type, op);
+            }
+            if (parent_ >= 0) {
+                MPI_Isend(acc_segment, length, type, parent_, TREE_REDUCE_TAG, comm_, &sends[s]);
+            }
+        }
+        MPI_Waitall(num_segments, sends.data(), MPI_STATUSES_IGNORE);
+    }
+
+    void allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op) {
+        reduce(sendbuf, recvbuf, count, type, op);
+        bcast(recvbuf, count, type);
+    }
+
+    // Empty convergecast to the root followed by an empty broadcast.
+    void barrier() {
+        std::vector<MPI_Request> recvs(children_.size());
+        for (size_t c = 0; c < children_.size(); ++c) {
+            MPI_Irecv(NULL, 0, MPI_BYTE, children_[c], TREE_REDUCE_TAG, comm_, &recvs[c]);
+        }
+        MPI_Waitall((int)recvs.size(), recvs.data(), MPI_STATUSES_IGNORE);
+        if (parent_ >= 0) {
+            MPI_Send(NULL, 0, MPI_BYTE, parent_, TREE_REDUCE_TAG, comm_);
+            MPI_Recv(NULL, 0, MPI_BYTE, parent_, TREE_BCAST_TAG, comm_, MPI_STATUS_IGNORE);
+        }
+        std::vector<MPI_Request> sends(children_.size());
+        for (size_t c = 0; c < children_.size(); ++c) {
+            MPI_Isend(NULL, 0, MPI_BYTE, children_[c], TREE_BCAST_TAG, comm_, &sends[c]);
+        }
+        MPI_Waitall((int)sends.size(), sends.data(), MPI_STATUSES_IGNORE);
+    }
+
+private:
+    void init(MPI_Comm comm) {
+        MPI_Comm_dup(comm, &comm_);
+        int rank;
+        MPI_Comm_rank(comm_, &rank);
+        int candidate = (parent_ < 0) ? rank : -1;
+        MPI_Allreduce(&candidate, &root_, 1, MPI_INT, MPI_MAX, comm_);
+        // Depth travels down the tree.
+        depth_ = 0;
+        if (parent_ >= 0) MPI_Recv(&depth_, 1, MPI_INT, parent_, TREE_BCAST_TAG, comm_, MPI_STATUS_IGNORE);
+        int child_depth = depth_ + 1;
+        for (int child : children_) MPI_Send(&child_depth, 1, MPI_INT, child, TREE_BCAST_TAG, comm_);
+    }
+
+    // Splits count elements into segments of about segment_bytes_.
+    MPI_Aint segments(int count, MPI_Datatype type, int* segment, int* num_segments) const {
+        MPI_Aint lower_bound, extent;
+        MPI_Type_get_extent(type, &lower_bound, &extent);
+        *segment = (int)std::max<MPI_Aint>(1, (MPI_Aint)segment_bytes_ / std::max<MPI_Aint>(extent, 1));
+        *num_segments = (count + *segment - 1) / *segment;
+        return extent;
+    }
+
+    static int segment_length(int s, int segment, int count) {
+        return std::min(segment, count - s * segment);
+    }
+
+    MPI_Comm comm_ = MPI_COMM_NULL;
+    int parent_;
+    std::vector<int> children_;
+    int root_ = -1;
+    int depth_ = 0;
+    size_t segment_bytes_ = TREE_DEFAULT_SEGMENT_BYTES;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef TREE_IO_H
+#define TREE_IO_H
+
+// Binary columnar output of a traversal result, written collectively with
+// MPI-IO so that every rank writes its own slice of each column in one
+// MPI_File_write_at_all call instead of printing it through stdout.
+//
+// Layout (little-endian, all fields 64-bit):
+//
+//   header          TreeFileHeader, TREE_FILE_HEADER_BYTES
+//   parent[n]       -1 for the root and for unreached vertices
+//   level[n]        -1 for unreached vertices
+//   child_offset[n + 1]
+//   children[child_offset[n]]   children of v are
+//                               children[child_offset[v] .. child_offset[v + 1])
+//
+// tree_reader.cpp validates and summarises these files.
+
+#include <mpi.h>
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+#include "tree_comm.h"
+
+const char TREE_FILE_MAGIC[8] = {'T', 'R', 'E', 'E', 'C', 'O', 'L', '1'};
+const int64_t TREE_FILE_HEADER_BYTES = 64;
+
+struct TreeFileHeader {
+    char magic[8];
+    int64_t num_vertices;
+    int64_t num_children;   // entries in the children column
+    int64_t root;
+    int64_t reserved[4];
+};
+
+// Column offsets in bytes, derived from the header.
+struct TreeFileLayout {
+    int64_t parent, level, child_offset, children, end;
+
+    TreeFileLayout(int64_t n, int64_t num_children) {
+        parent = TREE_FILE_HEADER_BYTES;
+        level = parent + n * 8;
+        child_offset = level + n * 8;
+        children = child_offset + (n + 1) * 8;
+        end = children + num_children * 8;
+    }
+};
+
+// Writes vertices [first, first + parent.size()) of an n-vertex tree; the
+// ranks' slices must be in rank order and together cover [0, n).
+// children[i] lists the children of vertex first + i. Collective over comm.
+// Returns false if the file could not be opened or written; file_bytes, if
+// given, receives the file size.
+inline bool write_tree_file(const char* path, int64_t n, int64_t first, const std::vector<int64_t>& parent,
+                            const std::vector<int64_t>& level,
+                            const std::vector<std::vector<int64_t>>& children, MPI_Comm comm,
+                            int64_t* file_bytes = NULL) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    const int64_t count = parent.size();
+
+    // Flatten the local children and find where they start globally.
+    std::vector<int64_t> offsets, flat;
+    offsets.reserve(count + 1);
+    for (const std::vector<int64_t>& c : children) {
+        offsets.push_back(flat.size());
+        flat.insert(flat.end(), c.begin(), c.end());
+    }
+    int64_t local_children = flat.size(), base = 0, total_children = 0;
+    MPI_Exscan(&local_children, &base, 1, MPI_INT64_T, MPI_SUM, comm);
+    if (rank == 0) base = 0;
+    MPI_Allreduce(&local_children, &total_children, 1, MPI_INT64_T, MPI_SUM, comm);
+    for (int64_t& o : offsets) o += base;
+    if (rank == size - 1) offsets.push_back(total_children);   // closing offset
+
+    int64_t local_root = -1, root = -1;
+    for (int64_t i = 0; i < count; ++i) {
+        if (parent[i] == -1 && level[i] == 0) local_root = first + i;
+    }
+    MPI_Allreduce(&local_root, &root, 1, MPI_INT64_T, MPI_MAX, comm);
+
+    MPI_File file;
+    if (MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        return false;
+    }
+    TreeFileLayout layout(n, total_children);
+    if (file_bytes) *file_bytes = layout.end;
+    MPI_File_set_size(file, layout.end);
+
+    TreeFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, TREE_FILE_MAGIC, sizeof(header.magic));
+    header.num_vertices = n;
+    header.num_children = total_children;
+    header.root = root;
+
+    int ok = 1;
+    MPI_Status status;
+    ok &= MPI_File_write_at_all(file, 0, &header, rank == 0 ? (int)sizeof(header) : 0, MPI_BYTE,
+                                &status) == MPI_SUCCESS;
+    ok &= MPI_File_write_at_all(file, layout.parent + first * 8, parent.data(), (int)count, MPI_INT64_T,
+                                &status) == MPI_SUCCESS;
+    ok &= MPI_File_write_at_all(file, layout.level + first * 8, level.data(), (int)count, MPI_INT64_T,
+                                &status) == MPI_SUCCESS;
+    ok &= MPI_File_write_at_all(file, layout.child_offset + first * 8, offsets.data(), (int)offsets.size(),
+                                MPI_INT64_T, &status) == MPI_SUCCESS;
+    ok &= MPI_File_write_at_all(file, layout.children + base * 8, flat.data(), (int)flat.size(), MPI_INT64_T,
+                                &status) == MPI_SUCCESS;
+    MPI_File_close(&file);
+
+    int all_ok = 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, comm);
+    return all_ok;
+}
+
+// Value of a "--out FILE" argument, or NULL.
+inline const char* tree_output_path(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--out") == 0) return argv[i + 1];
+    }
+    return NULL;
+}
+
+// One tree vertex per rank, as in bfs.cpp, mst.cpp, rst.cpp and
+// async_bfs.cpp; the level of a rank is its depth in the tree.
+inline bool write_rank_tree_file(const char* path, const TreeComm& tree, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    const std::vector<int>& children = tree.children();
+    std::vector<std::vector<int64_t>> kids(1, std::vector<int64_t>(children.begin(), children.end()));
+    return write_tree_file(path, size, rank, std::vector<int64_t>(1, tree.parent()),
+                           std::vector<int64_t>(1, tree.depth()), kids, comm);
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#include "tree_io.h"
+
+using namespace std;
+
+// Validates and summarises a tree file written by tree_io.h (bfs, mst, rst,
+// async_bfs and bfs_bench with --out FILE). Runs on one process; it only
+// links MPI because the format header comes from tree_io.h.
+//
+// Checks: the header and file size agree, there is exactly one root, every
+// reached vertex sits one level below its parent, the child offsets are
+// monotone, and the children lists are exactly the inverse of the parents.
+
+bool read_column(ifstream& in, int64_t offset, vector<int64_t>& column, size_t count) {
+    column.resize(count);
+    in.seekg(offset);
+    in.read((char*)column.data(), count * sizeof(int64_t));
+    return (bool)in;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " FILE" << endl;
+        return 1;
+    }
+    ifstream in(argv[1], ios::binary | ios::ate);
+    if (!in) {
+        cerr << "Could not open " << argv[1] << endl;
+        return 1;
+    }
+    const int64_t file_size = in.tellg();
+
+    TreeFileHeader header;
+    in.seekg(0);
+    if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, TREE_FILE_MAGIC, 8) != 0) {
+        cerr << argv[1] << " is not a tree file" << endl;
+        return 1;
+    }
+    const int64_t n = header.num_vertices;
+    TreeFileLayout layout(n, header.num_children);
+    if (n < 0 || header.num_children < 0 || layout.end != file_size) {
+        cerr << "Header does not match the file size (" << layout.end << " vs " << file_size << " bytes)" << endl;
+        return 1;
+    }
+
+    vector<int64_t> parent, level, offset, children;
+    if (!read_column(in, layout.parent, parent, n) || !read_column(in, layout.level, level, n) ||
+        !read_column(in, layout.child_offset, offset, n + 1) ||
+        !read_column(in, layout.children, children, header.num_children)) {
+        cerr << "Truncated file" << endl;
+        return 1;
+    }
+
+    vector<string> errors;
+    auto error = [&](const string& what) {
+        if (errors.size() < 10) errors.push_back(what);
+        else if (errors.size() == 10) errors.push_back("...");
+    };
+
+    int64_t roots = 0, reached = 0, height = 0, leaves = 0, max_fanout = 0, max_fanout_vertex = -1;
+    for (int64_t v = 0; v < n; ++v) {
+        if (level[v] < -1) error("vertex " + to_string(v) + " has level " + to_string(level[v]));
+        if (level[v] < 0) {
+            if (parent[v] != -1) error("unreached vertex " + to_string(v) + " has a parent");
+            continue;
+        }
+        reached++;
+        height = max(height, level[v]);
+        if (parent[v] == -1) {
+            roots++;
+            if (level[v] != 0 || v != header.root) error("root " + to_string(v) + " does not match the header");
+        } else if (parent[v] < 0 || parent[v] >= n || level[parent[v]] != level[v] - 1) {
+            error("vertex " + to_string(v) + " is not one level below its parent " + to_string(parent[v]));
+        }
+    }
+    if (roots != 1) error(to_string(roots) + " roots");
+
+    if (offset[0] != 0 || offset[n] != header.num_children) error("child offsets do not span the children column");
+    vector<char> seen(n, 0);
+    for (int64_t v = 0; v < n && errors.empty(); ++v) {
+        if (offset[v + 1] < offset[v]) {
+            error("child offsets decrease at vertex " + to_string(v));
+            break;
+        }
+        int64_t fanout = offset[v + 1] - offset[v];
+        if (level[v] >= 0 && fanout == 0) leaves++;
+        if (fanout > max_fanout) {
+            max_fanout = fanout;
+            max_fanout_vertex = v;
+        }
+        for (int64_t e = offset[v]; e < offset[v + 1]; ++e) {
+            int64_t c = children[e];
+            if (c < 0 || c >= n || parent[c] != v || seen[c]) {
+                error("bad child " + to_string(c) + " of vertex " + to_string(v));
+            } else {
+                seen[c] = 1;
+            }
+        }
+    }
+    if (errors.empty() && header.num_children != reached - roots) {
+        error(to_string(header.num_children) + " children for " + to_string(reached) + " reached vertices");
+    }
+
+    vector<int64_t> per_level(height + 1, 0);
+    for (int64_t v = 0; v < n; ++v) {
+        if (level[v] >= 0) per_level[level[v]]++;
+    }
+
+    cout << "File: " << argv[1] << " (" << file_size << " bytes)" << endl;
+    cout << "Vertices: " << n << ", reached: " << reached << ", root: " << header.root << endl;
+    cout << "Height: " << height << ", leaves: " << leaves << ", max fan-out: " << max_fanout
+         << " (vertex " << max_fanout_vertex << ")" << endl;
+    cout << "Vertices per level:";
+    for (size_t l = 0; l < per_level.size() && l < 32; ++l) cout << " " << per_level[l];
+    if (per_level.size() > 32) cout << " ...";
+    cout << endl;
+    if (errors.empty()) {
+        cout << "Validation: passed" << endl;
+        return 0;
+    }
+    cout << "Validation: FAILED" << endl;
+    for (const string& e : errors) cout << "  " << e << endl;
+    return 1;
+}
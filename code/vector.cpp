@@ -3,43 +3,47 @@
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
-#include <mpi.h>
-#include <unistd.h> 
+#include <random>
+#include "comm.h"
+#include "event_log.h"
+#include "snapshot.h"
 
 using namespace std;
 
 const int MSG_TAG = 0;
 
-int getRandomDestination(int my_rank, int world_size) {
+int getRandomDestination(int my_rank, int world_size, mt19937& rng) {
     if (world_size == 1) return my_rank;
     int dest_rank;
     do {
-        dest_rank = rand() % world_size;
+        dest_rank = rng() % world_size;
     } while (dest_rank == my_rank); 
     return dest_rank;
 }
 
-
-void print_vector(const vector<int>& clock) {
-    cout << "[";
-    for (size_t i = 0; i < clock.size(); ++i) {
-        cout << clock[i];
-        if (i < clock.size() - 1) {
-            cout << ", ";
-        }
-    }
-    cout << "]";
+enum { EV_INTERNAL, EV_SEND, EV_RECEIVE, EV_CLOCK_ENTRY };
+const EventKind VECTOR_EVENTS[] = {
+    {"internal", "internal event. new clock V[{}] = {}"},
+    {"send", "sent message with clock V[{}] = {} to rank {}"},
+    {"receive", "received message from rank {} with V[{}] = {}"},
+    {"clock", "    V[{}] = {}"},
+};
+
+// The whole clock, one record per entry, at debug level.
+void log_vector(EventLog& events, const vector<int>& clock) {
+    if (!events.enabled(LOG_DEBUG)) return;
+    for (size_t i = 0; i < clock.size(); ++i) LOG_EVENT(events, LOG_DEBUG, EV_CLOCK_ENTRY, i, clock[i]);
 }
 
-int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+// With --snapshot-every S the clocks and the messages in flight are saved
+// every S seconds (snapshot.h).
+int run(Comm& world, int argc, char** argv) {
+    SnapshotComm comm(world, argc, argv);
+    int world_rank = comm.rank();
+    int world_size = comm.size();
 
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
-
-    srand(time(NULL) + world_rank);
+    mt19937 rng(comm.seed());
+    EventLog events(comm, argc, argv, VECTOR_EVENTS);
 
     vector<int> vector_clock(world_size, 0);
     
@@ -48,45 +52,42 @@ int main(int argc, char** argv) {
     bool terminated = false;
     
     vector<int> received_vector(world_size); 
-    MPI_Request recv_request;
-    MPI_Status recv_status;
+    CommRequest recv_request = COMM_REQUEST_NULL;
+    CommStatus recv_status;
     bool recv_posted = false;
 
+    comm.capture([&] {
+        string state = "V = [";
+        for (int i = 0; i < world_size; ++i) state += (i > 0 ? ", " : "") + to_string(vector_clock[i]);
+        return state + "], " + to_string(messages_sent) + " messages sent";
+    });
+
     if (world_size > 1) {
-        MPI_Irecv(received_vector.data(), world_size, MPI_INT, MPI_ANY_SOURCE, MSG_TAG, MPI_COMM_WORLD, &recv_request);
+        recv_request = comm.irecv(received_vector.data(), world_size * sizeof(int), COMM_ANY_SOURCE, MSG_TAG);
         recv_posted = true;
     }
 
     while (!terminated) {
-        usleep(500000);
+        comm.sleep_us(500000);
 
         vector_clock[world_rank]++;
-        cout << "rank " << world_rank << ": internal event. new clock = ";
-        print_vector(vector_clock);
-        cout << endl;
+        LOG_EVENT(events, LOG_INFO, EV_INTERNAL, world_rank, vector_clock[world_rank]);
         
         if (messages_sent < MAX_MESSAGES_PER_PROCESS && world_size > 1) {
             
             vector_clock[world_rank]++; 
             
-            int dest_rank = getRandomDestination(world_rank, world_size);
-            
-            MPI_Request send_request;
-            MPI_Isend(vector_clock.data(), world_size, MPI_INT, dest_rank, MSG_TAG, MPI_COMM_WORLD, &send_request);
+            int dest_rank = getRandomDestination(world_rank, world_size, rng);
             
-            MPI_Request_free(&send_request); 
+            comm.send(vector_clock.data(), world_size * sizeof(int), dest_rank, MSG_TAG);
 
-            cout << "rank " << world_rank << ": sent message with clock ";
-            print_vector(vector_clock);
-            cout << " to rank " << dest_rank << endl;
+            LOG_EVENT(events, LOG_INFO, EV_SEND, world_rank, vector_clock[world_rank], dest_rank);
+            log_vector(events, vector_clock);
             messages_sent++;
         }
         
         if (recv_posted) {
-            int flag = 0;
-            MPI_Test(&recv_request, &flag, &recv_status);
-
-            if (flag) { 
+            if (comm.test(recv_request, &recv_status)) {
                 
                 vector_clock[world_rank]++; 
                 
@@ -94,19 +95,16 @@ int main(int argc, char** argv) {
                     vector_clock[i] = max(vector_clock[i], received_vector[i]);
                 }
                 
-                cout << "rank " << world_rank << ": received message from rank " << recv_status.MPI_SOURCE
-                          << " with clock ";
-                print_vector(received_vector);
-                cout << ". new clock = ";
-                print_vector(vector_clock);
-                cout << endl;
-
-                MPI_Irecv(received_vector.data(), world_size, MPI_INT, MPI_ANY_SOURCE, MSG_TAG, MPI_COMM_WORLD, &recv_request);
+                LOG_EVENT(events, LOG_INFO, EV_RECEIVE, recv_status.source, recv_status.source,
+                          received_vector[recv_status.source]);
+                log_vector(events, vector_clock);
+
+                recv_request = comm.irecv(received_vector.data(), world_size * sizeof(int), COMM_ANY_SOURCE, MSG_TAG);
             }
         }
 
-        int global_messages_sent;
-        MPI_Reduce(&messages_sent, &global_messages_sent, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+        long long local_messages_sent = messages_sent, global_messages_sent;
+        comm.reduce(&local_messages_sent, &global_messages_sent, 1, COMM_SUM, 0);
 
         if (world_rank == 0) {
             if (global_messages_sent >= MAX_MESSAGES_PER_PROCESS * world_size) {
@@ -115,16 +113,17 @@ int main(int argc, char** argv) {
             }
         }
     
-        MPI_Bcast(&terminated, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+        comm.bcast(&terminated, sizeof(bool), 0);
     }
 
     if (recv_posted) {
-        MPI_Cancel(&recv_request);
-        MPI_Status status;
-        MPI_Wait(&recv_request, &status); 
-        MPI_Request_free(&recv_request);
+        comm.cancel(recv_request);
     }
+    comm.finish();
     
-    MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    return comm_main(argc, argv, run);
+}
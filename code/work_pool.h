@@ -0,0 +1,137 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+// Work-stealing thread pool for data-parallel loops inside one MPI rank.
+//
+// parallel_for() cuts [0, n) into chunks and deals them round-robin onto one
+// deque per thread. Each thread pops chunks from the front of its own deque
+// and, once that is empty, steals from the back of the others, so skewed
+// frontiers (a few huge-degree vertices) still keep every core busy. The
+// calling thread takes part as thread 0 and is the only one that should make
+// MPI calls, which is what MPI_THREAD_FUNNELED allows.
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    typedef std::function<void(int64_t begin, int64_t end, int thread_id)> Body;
+
+    explicit WorkStealingPool(int num_threads) : queues_(std::max(1, num_threads)) {
+        for (int t = 1; t < (int)queues_.size(); ++t) {
+            workers_.emplace_back(&WorkStealingPool::worker_loop, this, t);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& t : workers_) t.join();
+    }
+
+    int size() const { return (int)queues_.size(); }
+
+    // Runs body over [0, n) in chunks of at most grain items and returns once
+    // every chunk is done.
+    void parallel_for(int64_t n, int64_t grain, const Body& body) {
+        if (n <= 0) return;
+        if (queues_.size() == 1 || n <= grain) {
+            body(0, n, 0);
+            return;
+        }
+
+        // Publish the body before any chunk becomes visible: a worker still
+        // leaving the previous loop may grab a new chunk straight away.
+        const int64_t chunks = (n + grain - 1) / grain;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            body_ = &body;
+            remaining_.store(chunks);
+            generation_++;
+        }
+        for (int64_t c = 0; c < chunks; ++c) {
+            Queue& q = queues_[c % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.chunks.push_back({c * grain, std::min(n, (c + 1) * grain)});
+        }
+        wake_.notify_all();
+
+        run_chunks(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return remaining_.load() == 0; });
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::pair<int64_t, int64_t>> chunks;
+    };
+
+    bool take(int thread_id, std::pair<int64_t, int64_t>& chunk) {
+        {
+            Queue& own = queues_[thread_id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.chunks.empty()) {
+                chunk = own.chunks.front();
+                own.chunks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues_.size(); ++i) {
+            Queue& victim = queues_[(thread_id + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.chunks.empty()) {
+                chunk = victim.chunks.back();
+                victim.chunks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_chunks(int thread_id) {
+        std::pair<int64_t, int64_t> chunk;
+        while (take(thread_id, chunk)) {
+            (*body_)(chunk.first, chunk.second, thread_id);
+            if (remaining_.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_.notify_all();
+            }
+        }
+    }
+
+    void worker_loop(int thread_id) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+                if (stopping_) return;
+                seen = generation_;
+            }
+            run_chunks(thread_id);
+        }
+    }
+
+    std::vector<Queue> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_, done_;
+    const Body* body_ = nullptr;
+    std::atomic<int64_t> remaining_{0};
+    uint64_t generation_ = 0;
+    bool stopping_ = false;
+};
+
+#endif